@@ -19,6 +19,12 @@ docker_image=${12}
 docker_registry=${13}
 outbound_ipv6=${14}
 outbound_net_interface=${15}
+username=${16} # Optional, the agent assigns the username up front so it can track the user across restarts.
+# Optional install mode. "full" installs a user for an instance. "base" only installs the instance independent parts of a user
+# so the agent can keep it in the warm pool. "bind" completes a previously base installed user for an instance.
+mode=${17:-full}
+# Optional comma separated provisioning steps the agent has done natively. "user", "quota", "cgroup" and "firewall" steps are skipped here.
+native_steps=${18:--}
 
 
 if [ -z "$cpu" ] || [ -z "$memory" ] || [ -z "$swapmem" ] || [ -z "$disk" ] || [ -z "$contract_dir" ] ||
@@ -26,10 +32,16 @@ if [ -z "$cpu" ] || [ -z "$memory" ] || [ -z "$swapmem" ] || [ -z "$disk" ] || [
     [ -z "$docker_image" ] || [ -z "$docker_registry" ] || [ -z "$outbound_ipv6" ] || [ -z "$outbound_net_interface" ]; then
     echo "INVALID_PARAMS,INST_ERR" && exit 1
 fi
+[ "$mode" != "full" ] && [ "$mode" != "base" ] && [ "$mode" != "bind" ] && echo "INVALID_MODE,INST_ERR" && exit 1
+[ "$mode" == "bind" ] && [ -z "$username" ] && echo "INVALID_PARAMS,INST_ERR" && exit 1
 
 prefix="sashi"
 suffix=$(date +%s%N) # Epoch nanoseconds
 user="$prefix$suffix"
+if [ -n "$username" ]; then
+    [[ ! "$username" =~ ^$prefix[0-9]+$ ]] && echo "INVALID_USERNAME,INST_ERR" && exit 1
+    user="$username"
+fi
 contract_user="$user-secuser"
 group="sashiuser"
 cgroupsuffix="-cg"
@@ -56,8 +68,17 @@ DOCKER_REGISTRY_URL="https://registry-1.docker.io/v2/"
 ACME_SH_URL="https://raw.githubusercontent.com/acmesh-official/acme.sh/master/acme.sh"
 ACME_DNS_PLUGIN_URL="https://raw.githubusercontent.com/gadget78/sashimono/main/dependencies/dns_evernode.sh"
 
-# Check if users already exists.
-[ "$(id -u "$user" 2>/dev/null || echo -1)" -ge 0 ] && echo "HAS_USER,INST_ERR" && exit 1
+# Checks whether the given provisioning step was done by the agent.
+function is_native() {
+    [[ ",$native_steps," == *",$1,"* ]]
+}
+
+# Check if users already exists. A user being bound must have been base installed already. So must be a user created by the agent.
+if [ "$mode" == "bind" ] || is_native user; then
+    [ "$(id -u "$user" 2>/dev/null || echo -1)" -lt 0 ] && echo "NO_USER,INST_ERR" && exit 1
+else
+    [ "$(id -u "$user" 2>/dev/null || echo -1)" -ge 0 ] && echo "HAS_USER,INST_ERR" && exit 1
+fi
 
 function rollback() {
     echo "Rolling back user installation. $1"
@@ -92,118 +113,154 @@ function wait_for_dockerd() {
     done
 }
 
-nofile_soft_limit=$(ulimit -n -S)
-if [ $nofile_soft_limit -lt 250000 ]; then 
-    ulimit -n 250000
-    nofile_soft_limit=250000    
-fi
-max_instance_count=$(jq -r ".system.max_instance_count | select( . != null )" "$SA_CONFIG")
-if [ -n "$max_instance_count" ] && [ "$max_instance_count" -gt 0 ]; then
-    nofile_soft_limit=$((nofile_soft_limit / ( max_instance_count + 1 )))
-    echo "setting ulimit -n to $nofile_soft_limit"
-else
-    echo "Error: max_instance_count is not valid or not found in $SA_CONFIG, defaulting ulimit to 55000"
-    nofile_soft_limit=55000
-fi
-nproc_soft_limit=$(ulimit -u -S)
-
-# Adding process and file descriptor limitations for the user before user creation
-echo "$user hard nofile $nofile_soft_limit" | tee -a /etc/security/limits.conf
-echo "$user soft nofile $nofile_soft_limit" | tee -a /etc/security/limits.conf
-echo "$user hard nproc $nproc_soft_limit" | tee -a /etc/security/limits.conf
-
-# Setup user and dockerd service.
-useradd --shell /usr/sbin/nologin -m $user
-usermod --lock $user
-usermod -a -G $group $user
-loginctl enable-linger $user # Enable lingering to support rootless dockerd service installation.
-chmod o-rwx "$user_dir"
-echo "Created '$user' user."
-
-# Creating a secondary user for the contract.
-# This is the respective host user for the child user of the sashimono user inside docker container.
-# Taking the uid and gid offsets.
-uoffset=$(grep "^$user:[0-9]\+:[0-9]\+$" /etc/subuid | cut -d: -f2)
-[ -z $uoffset ] && rollback "SUBUID_ERR"
-contract_host_uid=$(expr $uoffset + $contract_uid - 1)
-
-# If contract gid is not 0, get the calculated host gid and create the contract user group
-# and create user inside both contract user group and sashimono user group.
-# Otherwise get sashimono user's gid and create contract user inside that group.
-# Even though there's this "if not 0" condition, contract_gid will always be 0 since we are setting hp config's gid to 0 in instance creation.
-if [ ! $contract_gid -eq 0 ]; then
-    goffset=$(grep "^$user:[0-9]\+:[0-9]\+$" /etc/subgid | cut -d: -f2)
-    [ -z $goffset ] && rollback "SUBGID_ERR"
-    contract_host_gid=$(expr $goffset + $contract_gid - 1)
-    groupadd -g "$contract_host_gid" "$contract_user"
-    useradd --shell /usr/sbin/nologin -M -g "$contract_host_gid" -G "$user" -u "$contract_host_uid" "$contract_user"
+# Applies the instance resource limits to the user slice and persists the nftables rules.
+function setup_user_slice() {
+    # In the Sashimono configuration, CPU time is 1000000us Sashimono is given max_cpu_us out of it.
+    # Instance allocation is multiplied by number of cores to determined the number of cores per instance and devided by 10 since cfs_period_us is set to 100000us
+
+    echo "Setting up user slice resources."
+
+    cores=$(grep -c ^processor /proc/cpuinfo)
+    cpu_period=1000000
+    cpu_quota=$(expr $(expr $cores \* $cpu \* 100 \/ $cpu_period))
+
+    # Resource limiting for the unpriviledged user
+    if ! is_native cgroup; then
+        mkdir /etc/systemd/system/user-$user_id.slice.d
+        touch /etc/systemd/system/user-$user_id.slice.d/override.conf
+        echo "[Slice]
+MemoryAccounting=true
+CPUAccounting=true
+MemoryMax=${memory}K
+CPUQuota=${cpu_quota}% 
+MemorySwapMax=${swapmem}K" | sudo tee /etc/systemd/system/user-$user_id.slice.d/override.conf
+    fi
+
+    # save and make sure nft tables service persist after a restart
+    nft list ruleset > /etc/nftables.conf
+    systemctl enable nftables
+    systemctl daemon-reload
+}
+
+if [ "$mode" != "bind" ] && ! is_native user; then
+    nofile_soft_limit=$(ulimit -n -S)
+    if [ $nofile_soft_limit -lt 250000 ]; then 
+        ulimit -n 250000
+        nofile_soft_limit=250000    
+    fi
+    max_instance_count=$(jq -r ".system.max_instance_count | select( . != null )" "$SA_CONFIG")
+    if [ -n "$max_instance_count" ] && [ "$max_instance_count" -gt 0 ]; then
+        nofile_soft_limit=$((nofile_soft_limit / ( max_instance_count + 1 )))
+        echo "setting ulimit -n to $nofile_soft_limit"
+    else
+        echo "Error: max_instance_count is not valid or not found in $SA_CONFIG, defaulting ulimit to 55000"
+        nofile_soft_limit=55000
+    fi
+    nproc_soft_limit=$(ulimit -u -S)
+
+    # Adding process and file descriptor limitations for the user before user creation
+    echo "$user hard nofile $nofile_soft_limit" | tee -a /etc/security/limits.conf
+    echo "$user soft nofile $nofile_soft_limit" | tee -a /etc/security/limits.conf
+    echo "$user hard nproc $nproc_soft_limit" | tee -a /etc/security/limits.conf
+
+    # Setup user and dockerd service.
+    useradd --shell /usr/sbin/nologin -m $user
+    usermod --lock $user
+    usermod -a -G $group $user
+    loginctl enable-linger $user # Enable lingering to support rootless dockerd service installation.
+    chmod o-rwx "$user_dir"
+    echo "Created '$user' user."
+
+    # Creating a secondary user for the contract.
+    # This is the respective host user for the child user of the sashimono user inside docker container.
+    # Taking the uid and gid offsets.
+    uoffset=$(grep "^$user:[0-9]\+:[0-9]\+$" /etc/subuid | cut -d: -f2)
+    [ -z $uoffset ] && rollback "SUBUID_ERR"
+    contract_host_uid=$(expr $uoffset + $contract_uid - 1)
+
+    # If contract gid is not 0, get the calculated host gid and create the contract user group
+    # and create user inside both contract user group and sashimono user group.
+    # Otherwise get sashimono user's gid and create contract user inside that group.
+    # Even though there's this "if not 0" condition, contract_gid will always be 0 since we are setting hp config's gid to 0 in instance creation.
+    if [ ! $contract_gid -eq 0 ]; then
+        goffset=$(grep "^$user:[0-9]\+:[0-9]\+$" /etc/subgid | cut -d: -f2)
+        [ -z $goffset ] && rollback "SUBGID_ERR"
+        contract_host_gid=$(expr $goffset + $contract_gid - 1)
+        groupadd -g "$contract_host_gid" "$contract_user"
+        useradd --shell /usr/sbin/nologin -M -g "$contract_host_gid" -G "$user" -u "$contract_host_uid" "$contract_user"
+    else
+        contract_host_gid=$(id -g "$user")
+        useradd --shell /usr/sbin/nologin -M -g "$contract_host_gid" -u "$contract_host_uid" "$contract_user"
+    fi
+
+    usermod --lock "$contract_user"
+    echo "Created '$contract_user' contract user."
 else
-    contract_host_gid=$(id -g "$user")
-    useradd --shell /usr/sbin/nologin -M -g "$contract_host_gid" -u "$contract_host_uid" "$contract_user"
+    contract_host_uid=$(id -u "$contract_user")
+    contract_host_gid=$(id -g "$contract_user")
 fi
 
-usermod --lock "$contract_user"
-echo "Created '$contract_user' contract user."
-
 user_id=$(id -u "$user")
 user_runtime_dir="/run/user/$user_id"
 dockerd_socket="unix://$user_runtime_dir/docker.sock"
 
-echo "checking quota system, and adding disk quota of $disk to the user $user"
-if [[ "$(quotaon -p / | grep user | awk '{print $7}')" == "off" ]]; then
-    echo "User quota found not enabled, enabling user quota system..."
+if [ "$mode" != "bind" ] && ! is_native quota; then
+    echo "checking quota system, and adding disk quota of $disk to the user $user"
+    if [[ "$(quotaon -p / | grep user | awk '{print $7}')" == "off" ]]; then
+        echo "User quota found not enabled, enabling user quota system..."
             
-    # Check if we are in a VM, and if linux-image-extra-virtual is installed
-    if [ "$(systemd-detect-virt)" != "none" ]; then
-        echo "Running in a VM: $(systemd-detect-virt)"
-        if ! dpkg -l linux-image-extra-virtual | grep -q '^ii'; then
-            echo "linux-image-extra-virtual not installed. Installing now..."
-            apt-get update && apt-get -y install linux-image-extra-virtual
+        # Check if we are in a VM, and if linux-image-extra-virtual is installed
+        if [ "$(systemd-detect-virt)" != "none" ]; then
+            echo "Running in a VM: $(systemd-detect-virt)"
+            if ! dpkg -l linux-image-extra-virtual | grep -q '^ii'; then
+                echo "linux-image-extra-virtual not installed. Installing now..."
+                apt-get update && apt-get -y install linux-image-extra-virtual
+            else
+                echo "linux-image-extra-virtual is already installed."
+                echo; echo "do we need to reboot ?"; echo
+            fi
         else
-            echo "linux-image-extra-virtual is already installed."
-            echo; echo "do we need to reboot ?"; echo
+            echo "Not running in a VM. Skipping linux-image-extra-virtual installation."
         fi
-    else
-        echo "Not running in a VM. Skipping linux-image-extra-virtual installation."
-    fi
 
-    {
-        if ! grep -q ",usrquota" /etc/fstab; then
-            # Backup fstab 1st
-            BACKUP="/etc/fstab.backup.$(date +%Y%m%d_%H%M%S)"
-            cp /etc/fstab "$BACKUP"
-            # First remove any existing quota options
-            sed -i -E '/^[^#]*\s+\/\s+/ {
-                s/,?grpjquota=[^,[:space:]]*//g
-                s/,?usrjquota=[^,[:space:]]*//g
-                s/,?jqfmt=[^,[:space:]]*//g
-                s/,?usrquota[^,[:space:]]*//g
-                s/,?grpquota[^,[:space:]]*//g
-                s/,?quota[^,[:space:]]*//g
-                s/remount-ro[^,[:space:]]*/remount-ro/g
-                s/,,+/,/g
-                s/(\s+)([^,\s]+),/\1\2/
-            }' /etc/fstab
-            # then add just usrquota entry
-            sed -i -E '/^[^#]*\s+\/\s+/ {s/(\s+\S+)(\s+[0-9]+\s+[0-9]+\s*)$/\1,usrquota\2/}' /etc/fstab
-        fi
-    } || {
-        echo "Failed - rolling back..."
-        cp "$BACKUP" /etc/fstab
-        mount -o remount / 2>/dev/null || true
-    }
-    {
-        ROOT_MOUNT=$(findmnt -n -o TARGET /)
-        quotaoff "$ROOT_MOUNT" 2>/dev/null || true
-        rm -f "$ROOT_MOUNT"/quota.* "$ROOT_MOUNT"/aquota.* 2>/dev/null || true
-        sync && systemctl daemon-reload && mount -o remount "$ROOT_MOUNT"
-        quotacheck -cum "$ROOT_MOUNT" && quotaon -u "$ROOT_MOUNT"
-        quotaon -p "$ROOT_MOUNT" | grep user
-    } || {
-        echo "something failed when setting up user quota system..."
-    }
+        {
+            if ! grep -q ",usrquota" /etc/fstab; then
+                # Backup fstab 1st
+                BACKUP="/etc/fstab.backup.$(date +%Y%m%d_%H%M%S)"
+                cp /etc/fstab "$BACKUP"
+                # First remove any existing quota options
+                sed -i -E '/^[^#]*\s+\/\s+/ {
+                    s/,?grpjquota=[^,[:space:]]*//g
+                    s/,?usrjquota=[^,[:space:]]*//g
+                    s/,?jqfmt=[^,[:space:]]*//g
+                    s/,?usrquota[^,[:space:]]*//g
+                    s/,?grpquota[^,[:space:]]*//g
+                    s/,?quota[^,[:space:]]*//g
+                    s/remount-ro[^,[:space:]]*/remount-ro/g
+                    s/,,+/,/g
+                    s/(\s+)([^,\s]+),/\1\2/
+                }' /etc/fstab
+                # then add just usrquota entry
+                sed -i -E '/^[^#]*\s+\/\s+/ {s/(\s+\S+)(\s+[0-9]+\s+[0-9]+\s*)$/\1,usrquota\2/}' /etc/fstab
+            fi
+        } || {
+            echo "Failed - rolling back..."
+            cp "$BACKUP" /etc/fstab
+            mount -o remount / 2>/dev/null || true
+        }
+        {
+            ROOT_MOUNT=$(findmnt -n -o TARGET /)
+            quotaoff "$ROOT_MOUNT" 2>/dev/null || true
+            rm -f "$ROOT_MOUNT"/quota.* "$ROOT_MOUNT"/aquota.* 2>/dev/null || true
+            sync && systemctl daemon-reload && mount -o remount "$ROOT_MOUNT"
+            quotacheck -cum "$ROOT_MOUNT" && quotaon -u "$ROOT_MOUNT"
+            quotaon -p "$ROOT_MOUNT" | grep user
+        } || {
+            echo "something failed when setting up user quota system..."
+        }
+    fi
+    setquota -u "$user" "$disk" "$disk" 0 0 / && echo "Configured disk quota of $disk for the user $user" || echo "Configuring disk quota failed"
 fi
-setquota -u "$user" "$disk" "$disk" 0 0 / && echo "Configured disk quota of $disk for the user $user" || echo "Configuring disk quota failed"
 
 # Extract additional port settings if present, 1st it splits everything after :, then replaces all -- with  |, and uses that to create an array
 echo
@@ -331,12 +388,16 @@ else
 fi
 
 # Setup env variables for the user.
-echo "
+if [ "$mode" != "bind" ]; then
+    echo "
 export XDG_RUNTIME_DIR=$user_runtime_dir
 export PATH=$docker_bin:\$PATH
 export DOCKER_HOST=$dockerd_socket
-[ -f \"/contract/env.vars\" ] && source /contract/env.vars
-[ -f \"$user_dir/$contract_dir/env.vars\" ] && source $user_dir/$contract_dir/env.vars"  >>"$user_dir"/.bashrc
+[ -f \"/contract/env.vars\" ] && source /contract/env.vars" >>"$user_dir"/.bashrc
+fi
+if [ "$mode" != "base" ]; then
+    echo "[ -f \"$user_dir/$contract_dir/env.vars\" ] && source $user_dir/$contract_dir/env.vars" >>"$user_dir"/.bashrc
+fi
 echo "Updated user .bashrc."
 
 # Wait until user systemd is functioning.
@@ -348,64 +409,70 @@ for ((i = 0; i < 30; i++)); do
 done
 [ "$user_systemd" != "running" ] && rollback "NO_SYSTEMD"
 
-echo "Allowing user and peer ports in firewall"
-rule_list=$(sudo ufw status)
-comment=$prefix-$contract_dir
-
-# Add rules for user port.
-sed -n -r -e "/${user_port}\/tcp\s*ALLOW\s*Anywhere/{q100}" <<<"$rule_list"
-res=$?
-if [ ! $res -eq 100 ]; then
-    user_port_comment=$comment-user
-    echo "Adding new rule to allow user port for new instance from firewall."
-    sudo ufw allow "$user_port"/tcp comment "$user_port_comment"
-else
-    echo "User port rule already exists. Skipping."
-fi
-
-# Add rules for peer port.
-sed -n -r -e "/${peer_port}\s*ALLOW\s*Anywhere/{q100}" <<<"$rule_list"
-res=$?
-if [ ! $res -eq 100 ]; then
-    peer_port_comment=$comment-peer
-    echo "Adding new rule to allow peer port for new instance from firewall."
-    sudo ufw allow "$peer_port" comment "$peer_port_comment"
-else
-    echo "Peer port rule already exists. Skipping."
-fi
+if [ "$mode" != "base" ] && ! is_native firewall; then
+    echo "Allowing user and peer ports in firewall"
+    rule_list=$(sudo ufw status)
+    comment=$prefix-$contract_dir
 
-# Add rules for general purpose udp ports.
-for ((i = 0; i < $gp_udp_port_count; i++)); do
-    gp_udp_port=$(expr $gp_udp_port_start + $i)
-    sed -n -r -e "/${gp_udp_port}\s*ALLOW\s*Anywhere/{q100}" <<<"$rule_list"
+    # Add rules for user port.
+    sed -n -r -e "/${user_port}\/tcp\s*ALLOW\s*Anywhere/{q100}" <<<"$rule_list"
     res=$?
     if [ ! $res -eq 100 ]; then
-        gp_udp_port_comment=$comment-gp-udp-$i
-        echo "Adding new rule to allow general purpose udp port for new instance from firewall."
-        sudo ufw allow "$gp_udp_port" comment "$gp_udp_port_comment"
+        user_port_comment=$comment-user
+        echo "Adding new rule to allow user port for new instance from firewall."
+        sudo ufw allow "$user_port"/tcp comment "$user_port_comment"
     else
-        echo "General purpose udp port rule already exists. Skipping."
+        echo "User port rule already exists. Skipping."
     fi
-done
 
-# Add rules for general purpose tcp ports.
-for ((i = 0; i < $gp_tcp_port_count; i++)); do
-    gp_tcp_port=$(expr $gp_tcp_port_start + $i)
-    sed -n -r -e "/${gp_tcp_port}\s*ALLOW\s*Anywhere/{q100}" <<<"$rule_list"
+    # Add rules for peer port.
+    sed -n -r -e "/${peer_port}\s*ALLOW\s*Anywhere/{q100}" <<<"$rule_list"
     res=$?
     if [ ! $res -eq 100 ]; then
-        gp_tcp_port_comment=$comment-gp-tcp-$i
-        echo "Adding new rule to allow general purpose tcp port for new instance from firewall."
-        sudo ufw allow "$gp_tcp_port" comment "$gp_tcp_port_comment"
+        peer_port_comment=$comment-peer
+        echo "Adding new rule to allow peer port for new instance from firewall."
+        sudo ufw allow "$peer_port" comment "$peer_port_comment"
     else
-        echo "General purpose tcp rule already exists. Skipping."
+        echo "Peer port rule already exists. Skipping."
     fi
-done
 
-# Creating AppArmor Profile for unpriviledged user on Ubuntu 24.04
-if [ "$osversion" == "24.04" ]; then
-    filename=$(echo /home/$user/bin/rootlesskit | sed -e s@^/@@ -e s@/@.@g)
-    cat <<EOF > /etc/apparmor.d/$filename
+    # Add rules for general purpose udp ports.
+    for ((i = 0; i < $gp_udp_port_count; i++)); do
+        gp_udp_port=$(expr $gp_udp_port_start + $i)
+        sed -n -r -e "/${gp_udp_port}\s*ALLOW\s*Anywhere/{q100}" <<<"$rule_list"
+        res=$?
+        if [ ! $res -eq 100 ]; then
+            gp_udp_port_comment=$comment-gp-udp-$i
+            echo "Adding new rule to allow general purpose udp port for new instance from firewall."
+            sudo ufw allow "$gp_udp_port" comment "$gp_udp_port_comment"
+        else
+            echo "General purpose udp port rule already exists. Skipping."
+        fi
+    done
+
+    # Add rules for general purpose tcp ports.
+    for ((i = 0; i < $gp_tcp_port_count; i++)); do
+        gp_tcp_port=$(expr $gp_tcp_port_start + $i)
+        sed -n -r -e "/${gp_tcp_port}\s*ALLOW\s*Anywhere/{q100}" <<<"$rule_list"
+        res=$?
+        if [ ! $res -eq 100 ]; then
+            gp_tcp_port_comment=$comment-gp-tcp-$i
+            echo "Adding new rule to allow general purpose tcp port for new instance from firewall."
+            sudo ufw allow "$gp_tcp_port" comment "$gp_tcp_port_comment"
+        else
+            echo "General purpose tcp rule already exists. Skipping."
+        fi
+    done
+fi
+
+local_ip=$(hostname -I | awk '{print $1}' | xargs) 
+public_hostname_ip=$(dig +short "$EVERNODE_HOSTNAME" | head -n 1 | xargs)
+
+if [ "$mode" != "bind" ]; then
+    # Creating AppArmor Profile for unpriviledged user on Ubuntu 24.04
+    if [ "$osversion" == "24.04" ]; then
+        filename=$(echo /home/$user/bin/rootlesskit | sed -e s@^/@@ -e s@/@.@g)
+        cat <<EOF > /etc/apparmor.d/$filename
 abi <abi/4.0>,
 include <tunables/global>
 
@@ -415,81 +482,81 @@ include <tunables/global>
   include if exists <local/$filename>
 }
 EOF
-    chown $user:$user /etc/apparmor.d/$filename
-    systemctl restart apparmor.service
-fi
+        chown $user:$user /etc/apparmor.d/$filename
+        systemctl restart apparmor.service
+    fi
 
-echo "Installing rootless dockerd for user."
-sudo -H -u "$user" PATH="$docker_bin":"$PATH" XDG_RUNTIME_DIR="$user_runtime_dir" "$docker_bin"/dockerd-rootless-setuptool.sh install
+    echo "Installing rootless dockerd for user."
+    sudo -H -u "$user" PATH="$docker_bin":"$PATH" XDG_RUNTIME_DIR="$user_runtime_dir" "$docker_bin"/dockerd-rootless-setuptool.sh install
 
-# Add environment variables as an override to docker service unit file.
-echo "Applying $docker_service env overrides."
-docker_service_override_conf="$user_dir/.config/systemd/user/$docker_service.d/override.conf"
-sudo -H -u "$user" mkdir $user_dir/.config/systemd/user/$docker_service.d
-sudo -H -u "$user" touch $docker_service_override_conf
-echo "[Service]
+    # Add environment variables as an override to docker service unit file.
+    echo "Applying $docker_service env overrides."
+    docker_service_override_conf="$user_dir/.config/systemd/user/$docker_service.d/override.conf"
+    sudo -H -u "$user" mkdir $user_dir/.config/systemd/user/$docker_service.d
+    sudo -H -u "$user" touch $docker_service_override_conf
+    echo "[Service]
 Environment=DOCKERD_ROOTLESS_ROOTLESSKIT_PORT_DRIVER=slirp4netns
 " >"$docker_service_override_conf"
 
-# check nftables is installed (TODO, add this check to the main evernode installer)
-if ! command -v nft &> /dev/null; then
-    echo "nftables not installed. Installing now..."
-    apt-get update && apt-get -y install nftables
-fi
-
-# Create nftables (aka iptables), to block traffic to the local LAN subnet (for IPv4 and IPv6)
-local_ip=$(hostname -I | awk '{print $1}' | xargs) 
-public_hostname_ip=$(dig +short "$EVERNODE_HOSTNAME" | head -n 1 | xargs)
-if [[ "$local_ip" != "$public_hostname_ip" ]]; then
-    nft flush table ip docker_filter_$user_id 2>/dev/null
-    nft delete table ip docker_filter_$user_id 2>/dev/null
-    nft add table ip docker_filter_$user_id
-    nft add chain ip docker_filter_$user_id OUTPUT '{ type filter hook output priority 0 ; policy accept ; }'
-
-    echo "detected local ip to $local_ip, allowing."
-    nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $local_ip accept
-
-    gateway=$(ip route show | grep default | awk '{print $3}')
-    if [ -z "$gateway" ]; then
-        echo "Warning: Could not detect gateway IP."
-    else
-        echo "detected gateway as $gateway, allowing."
-        nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $gateway accept
+    # check nftables is installed (TODO, add this check to the main evernode installer)
+    if ! command -v nft &> /dev/null; then
+        echo "nftables not installed. Installing now..."
+        apt-get update && apt-get -y install nftables
     fi
 
-    proxy_ip=$(jq -r ".proxy.ip | select( . != null )" "$MBXRPL_CONFIG" )
-    if [ -z "$proxy_ip" ]; then proxy_ip=$(jq -r ".proxy.npm_url | select( . != null )" "$MBXRPL_CONFIG" | awk -F[/:] '{print $4}'); fi
-    if [ -z "$proxy_ip" ]; then
-        echo "Warning: Could not detect proxy IP."
-    else
-        echo "detected proxy ip to $proxy_ip, allowing."
-        nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $proxy_ip accept
-    fi
+    # Create nftables (aka iptables), to block traffic to the local LAN subnet (for IPv4 and IPv6)
+    if [[ "$local_ip" != "$public_hostname_ip" ]]; then
+        nft flush table ip docker_filter_$user_id 2>/dev/null
+        nft delete table ip docker_filter_$user_id 2>/dev/null
+        nft add table ip docker_filter_$user_id
+        nft add chain ip docker_filter_$user_id OUTPUT '{ type filter hook output priority 0 ; policy accept ; }'
 
-    lan_subnet=$(ip route | grep -oP '(\d+\.\d+\.\d+\.\d+/\d+)' | head -n 1)
-    if [ -z "$lan_subnet" ]; then
-        echo "Error: Could not detect LAN subnet."
-    else
-        local_dns=$(grep '^nameserver' /etc/resolv.conf | awk 'NR==1 {print $2}')
-        if [ -z "$local_dns" ]; then
-            echo "Warning: Could not detect local DNS IP."
+        echo "detected local ip to $local_ip, allowing."
+        nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $local_ip accept
+
+        gateway=$(ip route show | grep default | awk '{print $3}')
+        if [ -z "$gateway" ]; then
+            echo "Warning: Could not detect gateway IP."
+        else
+            echo "detected gateway as $gateway, allowing."
+            nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $gateway accept
+        fi
+
+        proxy_ip=$(jq -r ".proxy.ip | select( . != null )" "$MBXRPL_CONFIG" )
+        if [ -z "$proxy_ip" ]; then proxy_ip=$(jq -r ".proxy.npm_url | select( . != null )" "$MBXRPL_CONFIG" | awk -F[/:] '{print $4}'); fi
+        if [ -z "$proxy_ip" ]; then
+            echo "Warning: Could not detect proxy IP."
+        else
+            echo "detected proxy ip to $proxy_ip, allowing."
+            nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $proxy_ip accept
+        fi
+
+        lan_subnet=$(ip route | grep -oP '(\d+\.\d+\.\d+\.\d+/\d+)' | head -n 1)
+        if [ -z "$lan_subnet" ]; then
+            echo "Error: Could not detect LAN subnet."
         else
-            if [ "$(echo "$local_dns" | cut -d'.' -f1-2)" = "$(echo "$lan_subnet" | cut -d'.' -f1-2)" ]; then
-                echo "detected local DNS IP as $local_dns, allowing. (as within the lan subnet of $lan_subnet)"
-                nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $local_dns accept
+            local_dns=$(grep '^nameserver' /etc/resolv.conf | awk 'NR==1 {print $2}')
+            if [ -z "$local_dns" ]; then
+                echo "Warning: Could not detect local DNS IP."
             else
-                echo "detected local DNS IP as $local_dns, not part of lan subnet of $lan_subnet"
+                if [ "$(echo "$local_dns" | cut -d'.' -f1-2)" = "$(echo "$lan_subnet" | cut -d'.' -f1-2)" ]; then
+                    echo "detected local DNS IP as $local_dns, allowing. (as within the lan subnet of $lan_subnet)"
+                    nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $local_dns accept
+                else
+                    echo "detected local DNS IP as $local_dns, not part of lan subnet of $lan_subnet"
+                fi
             fi
+            echo "detected lan subnet ip to $lan_subnet, blocking/dropping"
+            nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $lan_subnet drop
         fi
-        echo "detected lan subnet ip to $lan_subnet, blocking/dropping"
-        nft add rule ip docker_filter_$user_id OUTPUT meta skuid $user_id ip daddr $lan_subnet drop
+    else
+        echo "a stand alone evernode with no subnet detected, no extra ip table rules needed"
     fi
-else
-    echo "a stand alone evernode with no subnet detected, no extra ip table rules needed"
 fi
 
 # We need to enable ipv6 configurations if outbound ipv6 address is specified.
-if [ "$outbound_ipv6" != "-" ] && [ "$outbound_net_interface" != "-" ]; then
+if [ "$mode" != "base" ] && [ "$outbound_ipv6" != "-" ] && [ "$outbound_net_interface" != "-" ]; then
+    docker_service_override_conf="$user_dir/.config/systemd/user/$docker_service.d/override.conf"
 
     # Pass the relevant ipv6 parameters to rootlesskit flags. rootlesskit will in turn pass these to slirp4nets.
     # Also apply ipv6 route configuration patch in the dockerd process namespace (credits: https://github.com/containers/podman/issues/15850#issuecomment-1320028298)
@@ -523,21 +590,32 @@ if [ "$outbound_ipv6" != "-" ] && [ "$outbound_net_interface" != "-" ]; then
     echo "ip addr del $outbound_ipv6 dev $outbound_net_interface" >>$cleanup_script
 fi
 
-# Overwrite docker-rootless cli args on the docker service unit file (ExecStart is not supported by override.conf).
-echo "Applying $docker_service extra args."
-exec_original="ExecStart=$docker_bin/dockerd-rootless.sh"
-exec_replace="$exec_original --max-concurrent-downloads 1"
-# Add private docker registry information.
-[ "$docker_registry" != "-" ] && exec_replace="$exec_replace --registry-mirror http://$docker_registry --insecure-registry $docker_registry"
-sed -i "s%$exec_original%$exec_replace%" $user_dir/.config/systemd/user/$docker_service
+if [ "$mode" != "bind" ]; then
+    # Overwrite docker-rootless cli args on the docker service unit file (ExecStart is not supported by override.conf).
+    echo "Applying $docker_service extra args."
+    exec_original="ExecStart=$docker_bin/dockerd-rootless.sh"
+    exec_replace="$exec_original --max-concurrent-downloads 1"
+    # Add private docker registry information.
+    [ "$docker_registry" != "-" ] && exec_replace="$exec_replace --registry-mirror http://$docker_registry --insecure-registry $docker_registry"
+    sed -i "s%$exec_original%$exec_replace%" $user_dir/.config/systemd/user/$docker_service
+fi
 
-# Reload the docker service.
-sudo -u "$user" XDG_RUNTIME_DIR="$user_runtime_dir" systemctl --user daemon-reload
-sudo -u "$user" XDG_RUNTIME_DIR="$user_runtime_dir" systemctl --user restart $docker_service
-service_ready $docker_service || rollback "NO_DOCKERSVC"
-# Wait until docker daemon ready, If failed rollback.
-! wait_for_dockerd && rollback "NO_DOCKERD"
-echo "finished Installing rootless dockerd."
+# Reload the docker service. A base installed user being bound only needs a restart if the ipv6 overrides were added.
+if [ "$mode" != "bind" ] || { [ "$outbound_ipv6" != "-" ] && [ "$outbound_net_interface" != "-" ]; }; then
+    sudo -u "$user" XDG_RUNTIME_DIR="$user_runtime_dir" systemctl --user daemon-reload
+    sudo -u "$user" XDG_RUNTIME_DIR="$user_runtime_dir" systemctl --user restart $docker_service
+    service_ready $docker_service || rollback "NO_DOCKERSVC"
+    # Wait until docker daemon ready, If failed rollback.
+    ! wait_for_dockerd && rollback "NO_DOCKERD"
+    echo "finished Installing rootless dockerd."
+fi
+
+# A base installed user is left here until it gets bound to an instance.
+if [ "$mode" == "base" ]; then
+    setup_user_slice
+    echo "$user_id,$user,$dockerd_socket,INST_SUC"
+    exit 0
+fi
 
 
 img_local_path=$docker_img_dir/$(echo "$docker_pull_image" | tr : -)
@@ -1096,29 +1174,7 @@ EOF
 
 fi
 
-# In the Sashimono configuration, CPU time is 1000000us Sashimono is given max_cpu_us out of it.
-# Instance allocation is multiplied by number of cores to determined the number of cores per instance and devided by 10 since cfs_period_us is set to 100000us
-
-echo "Setting up user slice resources."
-
-cores=$(grep -c ^processor /proc/cpuinfo)
-cpu_period=1000000
-cpu_quota=$(expr $(expr $cores \* $cpu \* 100 \/ $cpu_period))
-
-# Resource limiting for the unpriviledged user
-mkdir /etc/systemd/system/user-$user_id.slice.d
-touch /etc/systemd/system/user-$user_id.slice.d/override.conf
-echo "[Slice]
-MemoryAccounting=true
-CPUAccounting=true
-MemoryMax=${memory}K
-CPUQuota=${cpu_quota}% 
-MemorySwapMax=${swapmem}K" | sudo tee /etc/systemd/system/user-$user_id.slice.d/override.conf
-
-# save and make sure nft tables service persist after a restart
-nft list ruleset > /etc/nftables.conf
-systemctl enable nftables
-systemctl daemon-reload
+[ "$mode" != "bind" ] && setup_user_slice
 
 echo "$user_id,$user,$dockerd_socket,INST_SUC"
 exit 0
\ No newline at end of file
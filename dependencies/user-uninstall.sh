@@ -8,6 +8,8 @@ user_port=$3
 gp_tcp_port_start=$4
 gp_udp_port_start=$5
 instance_name=$6
+# Optional comma separated provisioning steps the agent removes natively. "user" (limits), "quota", "cgroup" and "firewall" steps are skipped here.
+native_steps=${7:--}
 prefix="sashi"
 max_kill_attempts=5
 
@@ -33,6 +35,11 @@ cleanup_script=$user_dir/uninstall_cleanup.sh
 gp_udp_port_count=2
 gp_tcp_port_count=2
 
+# Checks whether the given provisioning step is removed by the agent.
+function is_native() {
+    [[ ",$native_steps," == *",$1,"* ]]
+}
+
 function cgrulesengd_servicename() {
     # Find the cgroups rules engine service.
     local cgrulesengd_filepath=$(grep "ExecStart.*=.*/cgrulesengd$" /etc/systemd/system/*.service | head -1 | awk -F : ' { print $1 } ')
@@ -80,67 +87,71 @@ while true; do
     pkill -SIGKILL -u "$user"
 done
 
-echo "Removing cgroups"
-# Delete config values.
-cgdelete -g cpu:$user$cgroupsuffix
-cgdelete -g memory:$user$cgroupsuffix
+if ! is_native cgroup; then
+    echo "Removing cgroups"
+    # Delete config values.
+    cgdelete -g cpu:$user$cgroupsuffix
+    cgdelete -g memory:$user$cgroupsuffix
+fi
 
 # Removing applied disk quota of the user before deleting.
-setquota -g -F vfsv0 "$user" 0 0 0 0 /
-
-echo "Removing firewall rule allowing hp ports"
-rule_list=$(sudo ufw status)
-comment=$prefix-$instance_name
-
-# Remove rules for user port.
-user_port_comment=$comment-user
-sed -n -r -e "/${user_port_comment}/{q100}" <<<"$rule_list"
-res=$?
-if [ $res -eq 100 ]; then
-    echo "Deleting user port rule for instance from firewall."
-    sudo ufw delete allow "$user_port"/tcp
-else
-    echo "User port rule not added by Sashimono. Skipping.."
-fi
+! is_native quota && setquota -g -F vfsv0 "$user" 0 0 0 0 /
 
-# Remove rules for peer port.
-peer_port_comment=$comment-peer
-sed -n -r -e "/${peer_port_comment}/{q100}" <<<"$rule_list"
-res=$?
-if [ $res -eq 100 ]; then
-    echo "Deleting peer port rule for instance from firewall."
-    sudo ufw delete allow "$peer_port"
-else
-    echo "Peer port rule not added by Sashimono. Skipping.."
-fi
+if ! is_native firewall; then
+    echo "Removing firewall rule allowing hp ports"
+    rule_list=$(sudo ufw status)
+    comment=$prefix-$instance_name
 
-# Remove rules for general purpose udp port.
-for ((i = 0; i < $gp_udp_port_count; i++)); do
-    gp_udp_port=$(expr $gp_udp_port_start + $i)
-    gp_udp_port_comment=$comment-gp-udp-$i
-    sed -n -r -e "/${gp_udp_port_comment}/{q100}" <<<"$rule_list"
+    # Remove rules for user port.
+    user_port_comment=$comment-user
+    sed -n -r -e "/${user_port_comment}/{q100}" <<<"$rule_list"
     res=$?
     if [ $res -eq 100 ]; then
-        echo "Deleting general purpose udp port rule for instance from firewall."
-        sudo ufw delete allow "$gp_udp_port"
+        echo "Deleting user port rule for instance from firewall."
+        sudo ufw delete allow "$user_port"/tcp
     else
-        echo "General purpose tcp port rule not added by Sashimono. Skipping.."
+        echo "User port rule not added by Sashimono. Skipping.."
     fi
-done
 
-# Remove rules for general purpose tcp port.
-for ((i = 0; i < $gp_tcp_port_count; i++)); do
-    gp_tcp_port=$(expr $gp_tcp_port_start + $i)
-    gp_tcp_port_comment=$comment-gp-tcp-$i
-    sed -n -r -e "/${gp_tcp_port_comment}/{q100}" <<<"$rule_list"
+    # Remove rules for peer port.
+    peer_port_comment=$comment-peer
+    sed -n -r -e "/${peer_port_comment}/{q100}" <<<"$rule_list"
     res=$?
     if [ $res -eq 100 ]; then
-        echo "Deleting general purpose tcp port rule for instance from firewall."
-        sudo ufw delete allow "$gp_tcp_port"
+        echo "Deleting peer port rule for instance from firewall."
+        sudo ufw delete allow "$peer_port"
     else
-        echo "General purpose tcp port rule not added by Sashimono. Skipping.."
+        echo "Peer port rule not added by Sashimono. Skipping.."
     fi
-done
+
+    # Remove rules for general purpose udp port.
+    for ((i = 0; i < $gp_udp_port_count; i++)); do
+        gp_udp_port=$(expr $gp_udp_port_start + $i)
+        gp_udp_port_comment=$comment-gp-udp-$i
+        sed -n -r -e "/${gp_udp_port_comment}/{q100}" <<<"$rule_list"
+        res=$?
+        if [ $res -eq 100 ]; then
+            echo "Deleting general purpose udp port rule for instance from firewall."
+            sudo ufw delete allow "$gp_udp_port"
+        else
+            echo "General purpose tcp port rule not added by Sashimono. Skipping.."
+        fi
+    done
+
+    # Remove rules for general purpose tcp port.
+    for ((i = 0; i < $gp_tcp_port_count; i++)); do
+        gp_tcp_port=$(expr $gp_tcp_port_start + $i)
+        gp_tcp_port_comment=$comment-gp-tcp-$i
+        sed -n -r -e "/${gp_tcp_port_comment}/{q100}" <<<"$rule_list"
+        res=$?
+        if [ $res -eq 100 ]; then
+            echo "Deleting general purpose tcp port rule for instance from firewall."
+            sudo ufw delete allow "$gp_tcp_port"
+        else
+            echo "General purpose tcp port rule not added by Sashimono. Skipping.."
+        fi
+    done
+fi
 
 echo "Deleting contract user '$contract_user'"
 userdel "$contract_user"
@@ -164,7 +175,7 @@ if [ ! -z "$cgrulesengd_service" ]; then
 fi
 
 # Removing process and file desctiptor limitations for the user after user deletion.
-sudo sed -i "/^$user/d" /etc/security/limits.conf
+! is_native user && sudo sed -i "/^$user/d" /etc/security/limits.conf
 
 [ -d /home/"$user" ] && echo "NOT_CLEAN,UNINST_ERR" && exit 1
 
@@ -652,6 +652,7 @@ Group=root
 Type=simple
 WorkingDirectory=$SASHIMONO_BIN
 ExecStart=$SASHIMONO_BIN/sagent run $SASHIMONO_DATA
+ExecReload=/bin/kill -HUP \$MAINPID
 Restart=on-failure
 RestartSec=5
 [Install]
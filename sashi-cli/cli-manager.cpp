@@ -8,7 +8,13 @@ namespace cli
     constexpr const char *DATA_DIR = "/etc/sashimono";    // Sashimono data directory.
     constexpr const char *BIN_DIR = "/usr/bin/sashimono"; // Sashimono bin directory.
     constexpr const int BUFFER_SIZE = 4096;               // Max read buffer size.
+    constexpr const size_t HEADER_SIZE = 8;               // Length prefix sent ahead of a message.
+    constexpr const size_t MAX_PACKET_SIZE = 65536;       // Large messages are sent as several packets of this size.
+    constexpr const size_t MAX_ID_LENGTH = 64;            // Max length of a request id accepted by the agent.
     constexpr const char *MSG_LIST = "{\"type\": \"list\"}";
+    constexpr const char *MSG_METRICS = "{\"type\": \"metrics\"}";
+    constexpr const char *MSG_METRICS_PROMETHEUS = "{\"type\": \"metrics\", \"format\": \"prometheus\"}";
+    constexpr const char *MSG_RELOAD = "{\"type\": \"reload\"}";
     constexpr const char *MSG_BASIC = "{\"type\":\"%s\",\"container_name\":\"%s\"}";
     constexpr const char *MSG_CREATE = "{\"type\":\"create\",\"container_name\":\"%s\",\"owner_pubkey\":\"%s\",\"contract_id\":\"%s\",\"image\":\"%s\",\"outbound_ipv6\":\"%s\",\"outbound_net_interface\":\"%s\",\"config\":{}}";
 
@@ -140,12 +146,24 @@ namespace cli
             return -1;
         }
 
-        if (write(ctx.socket_fd, message.data(), message.size()) == -1)
+        // Send the length prefix followed by the message split into packets.
+        uint8_t length_buffer[HEADER_SIZE] = {};
+        uint32_to_bytes(length_buffer, message.size());
+        if (write(ctx.socket_fd, length_buffer, HEADER_SIZE) == -1)
         {
             std::cerr << errno << " :Error while wrting to the sashimono socket.\n";
             return -1;
         }
 
+        for (size_t offset = 0; offset < message.size(); offset += MAX_PACKET_SIZE)
+        {
+            if (write(ctx.socket_fd, message.data() + offset, std::min(MAX_PACKET_SIZE, message.size() - offset)) == -1)
+            {
+                std::cerr << errno << " :Error while wrting to the sashimono socket.\n";
+                return -1;
+            }
+        }
+
         return 0;
     }
 
@@ -163,26 +181,50 @@ namespace cli
         }
 
         // Read the length of the message to a buffer
-        uint8_t length_buffer[8];
-        int res = read(ctx.socket_fd, length_buffer, 8);
+        uint8_t length_buffer[HEADER_SIZE];
+        int res = read(ctx.socket_fd, length_buffer, HEADER_SIZE);
         if (res == -1)
         {
             std::cerr << errno << " :Error while reading message length from the sashimono socket.\n";
             return -1;
         }
+        else if (res != HEADER_SIZE)
+        {
+            std::cerr << "Invalid message length received from the sashimono socket.\n";
+            return -1;
+        }
 
         const uint32_t message_length = uint32_from_bytes(length_buffer);
 
-        // Resize the message buffer to fit to the message length
+        // Resize the message buffer to fit to the message length and read until all the packets are received.
         message.resize(message_length);
-        res = read(ctx.socket_fd, message.data(), message_length);
-        if (res == -1)
+        size_t received = 0;
+        while (received < message_length)
         {
-            std::cerr << errno << " :Error while reading the message from the sashimono socket.\n";
-            return -1;
+            res = read(ctx.socket_fd, message.data() + received, message_length - received);
+            if (res == -1)
+            {
+                std::cerr << errno << " :Error while reading the message from the sashimono socket.\n";
+                return -1;
+            }
+            else if (res == 0)
+            {
+                std::cerr << "Sashimono socket closed before the message is fully received.\n";
+                return -1;
+            }
+            received += res;
         }
 
-        return res;
+        return received;
+    }
+
+    // Convert uint32_t to big endian byte buffer
+    void uint32_to_bytes(uint8_t *dest, const uint32_t x)
+    {
+        dest[0] = (uint8_t)((x >> 24) & 0xff);
+        dest[1] = (uint8_t)((x >> 16) & 0xff);
+        dest[2] = (uint8_t)((x >> 8) & 0xff);
+        dest[3] = (uint8_t)((x >> 0) & 0xff);
     }
 
     // Convert byte buffer to uint32_t
@@ -260,6 +302,256 @@ namespace cli
         return 0;
     }
 
+    /**
+     * Prints the operation latencies and event counts recorded by the agent.
+     * @param prometheus Whether to print the Prometheus text exposition instead of the tables.
+     * @return 0 on success, -1 on error.
+     */
+    int metrics(const bool prometheus)
+    {
+        std::string output;
+        if (get_json_output(prometheus ? MSG_METRICS_PROMETHEUS : MSG_METRICS, output) == -1)
+            return -1;
+
+        try
+        {
+            jsoncons::json d = jsoncons::json::parse(output, jsoncons::strict_json_parsing());
+            if (!d.contains("type") ||
+                d["type"].as<std::string>() != "metrics_res" ||
+                !d.contains("content") ||
+                !(prometheus ? d["content"].is_string() : d["content"].is_object()))
+            {
+                std::cerr << "Invalid response. " << jsoncons::pretty_print(d) << std::endl;
+                return -1;
+            }
+
+            const jsoncons::json &content = d["content"];
+            if (prometheus)
+            {
+                std::cout << content.as<std::string>();
+                return 0;
+            }
+
+            print_to_table(content["histograms"], {{"name", "Operation"}, {"count", "Count"}, {"p50_us", "P50 (us)"}, {"p90_us", "P90 (us)"}, {"p99_us", "P99 (us)"}, {"max_us", "Max (us)"}});
+            std::cout << std::endl;
+            print_to_table(content["counters"], {{"name", "Event"}, {"value", "Count"}});
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "JSON message parsing failed. " << e.what() << std::endl;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Makes the agent reload its config file and prints the changed fields which still need a restart.
+     * @return 0 on success, -1 on error.
+     */
+    int reload()
+    {
+        std::string output;
+        if (get_json_output(MSG_RELOAD, output) == -1)
+            return -1;
+
+        try
+        {
+            jsoncons::json d = jsoncons::json::parse(output, jsoncons::strict_json_parsing());
+            if (!d.contains("type") ||
+                d["type"].as<std::string>() != "reload_res" ||
+                !d.contains("content") ||
+                !d["content"].is_object())
+            {
+                std::cerr << "Invalid response. " << jsoncons::pretty_print(d) << std::endl;
+                return -1;
+            }
+
+            std::cout << "Config reloaded." << std::endl;
+            for (const auto &field : d["content"]["restart_required"].array_range())
+                std::cout << "Restart required to apply " << field.as<std::string>() << std::endl;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "JSON message parsing failed. " << e.what() << std::endl;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Sends newline delimited json commands over a single session and prints the responses as newline delimited json
+     * in the order they arrive. The agent keeps the session open for requests carrying an "id" and echoes it in the
+     * response, so a command without an "id" is given its line number. Blank lines are skipped. A response without an
+     * "id" is counted as the answer to the oldest command awaiting one.
+     * @param input Stream to read the commands from.
+     * @param concurrency Max commands awaiting a response at a time.
+     * @param allow_create Whether create commands are allowed.
+     * @return 0 if every command was sent and answered, -1 otherwise.
+     */
+    int batch(std::istream &input, const size_t concurrency, const bool allow_create)
+    {
+        std::deque<std::string> in_flight; // Ids of the commands awaiting a response, oldest first.
+        std::string line, message, id, error, output;
+        size_t line_no = 0;
+        bool is_input_over = false;
+        int ret = 0;
+
+        while (!is_input_over || !in_flight.empty())
+        {
+            // Keep the window of in flight commands full.
+            while (!is_input_over && in_flight.size() < concurrency)
+            {
+                if (!std::getline(input, line))
+                {
+                    is_input_over = true;
+                    break;
+                }
+
+                line_no++;
+                if (line.find_first_not_of(" \t\r") == std::string::npos)
+                    continue;
+
+                if (prepare_batch_command(message, id, error, line, line_no, allow_create) == -1)
+                {
+                    print_batch_error(id, error);
+                    ret = -1;
+                    continue;
+                }
+
+                // Responses are matched by id, so ids must be unique among the in flight commands.
+                if (std::find(in_flight.begin(), in_flight.end(), id) != in_flight.end())
+                {
+                    print_batch_error(id, "duplicate_id");
+                    ret = -1;
+                    continue;
+                }
+
+                if (write_to_socket(message) == -1)
+                    return -1;
+                in_flight.push_back(id);
+            }
+
+            if (in_flight.empty())
+                continue;
+
+            if (read_from_socket(output) == -1)
+            {
+                for (const std::string &pending_id : in_flight)
+                    print_batch_error(pending_id, "no_response");
+                return -1;
+            }
+
+            try
+            {
+                const jsoncons::json d = jsoncons::json::parse(output, jsoncons::strict_json_parsing());
+                if (d.contains("id"))
+                {
+                    const auto itr = std::find(in_flight.begin(), in_flight.end(), d["id"].as<std::string>());
+                    if (itr != in_flight.end())
+                        in_flight.erase(itr);
+                }
+                else
+                {
+                    // An error the agent could not tie to a command. It is taken as the answer to the oldest command,
+                    // so the batch does not wait for a response which never comes.
+                    in_flight.pop_front();
+                    ret = -1;
+                }
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "JSON message parsing failed. " << e.what() << std::endl;
+                return -1;
+            }
+            std::cout << output << std::endl;
+        }
+
+        return ret;
+    }
+
+    /**
+     * Validates a batch command and tags it with its id.
+     * @param message Command to be sent.
+     * @param id Id of the command. The line number if the command has no id.
+     * @param error Error code if the command is not valid.
+     * @param line Input line holding the command.
+     * @param line_no Line number of the command.
+     * @param allow_create Whether create commands are allowed.
+     * @return 0 on success, -1 if the command is not valid.
+     */
+    int prepare_batch_command(std::string &message, std::string &id, std::string &error, std::string_view line, const size_t line_no, const bool allow_create)
+    {
+        id = std::to_string(line_no);
+        try
+        {
+            jsoncons::ojson d = jsoncons::ojson::parse(line, jsoncons::strict_json_parsing());
+            if (!d.is_object() || !d.contains("type") || !d["type"].is_string())
+            {
+                error = "format_error";
+                return -1;
+            }
+
+            if (d.contains("id"))
+            {
+                // The agent drops the session on an id it can't echo back, so such a command is rejected here.
+                if (!d["id"].is_string() || !is_valid_id(d["id"].as<std::string>()))
+                {
+                    error = "format_error";
+                    return -1;
+                }
+                id = d["id"].as<std::string>();
+            }
+            else
+            {
+                d.insert_or_assign("id", id);
+            }
+
+            // An encoding switch would change the format of the following responses on the shared connection.
+            const std::string type = d["type"].as<std::string>();
+            if ((!allow_create && type == "create") || type == "encoding")
+            {
+                error = "not_supported";
+                return -1;
+            }
+
+            message = d.to_string();
+        }
+        catch (const std::exception &e)
+        {
+            error = "format_error";
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Checks whether a request id is accepted by the agent, which only echoes back a safe character set.
+     * @param id Request id.
+     * @return true if the id is valid.
+     */
+    bool is_valid_id(std::string_view id)
+    {
+        return !id.empty() && id.length() <= MAX_ID_LENGTH &&
+               std::all_of(id.begin(), id.end(), [](const char c)
+                           { return isalnum(c) || c == '-' || c == '_' || c == '.'; });
+    }
+
+    /**
+     * Prints the result of a batch command which was not answered by the agent, in the agent's error response format.
+     * @param id Id of the command.
+     * @param error Error code.
+     */
+    void print_batch_error(std::string_view id, std::string_view error)
+    {
+        jsoncons::ojson d;
+        d.insert_or_assign("type", "error");
+        d.insert_or_assign("id", id);
+        d.insert_or_assign("content", error);
+        std::cout << d.to_string() << std::endl;
+    }
+
     /**
      * Execute and docker command in a givent container.
      * @param type Type of the command.
@@ -31,6 +31,18 @@ namespace cli
 
     int list();
 
+    int metrics(const bool prometheus);
+
+    int reload();
+
+    int batch(std::istream &input, const size_t concurrency, const bool allow_create);
+
+    int prepare_batch_command(std::string &message, std::string &id, std::string &error, std::string_view line, const size_t line_no, const bool allow_create);
+
+    bool is_valid_id(std::string_view id);
+
+    void print_batch_error(std::string_view id, std::string_view error);
+
     int docker_exec(std::string_view type, std::string_view container_name);
 
     void print_to_table(const jsoncons::json &list, const std::vector<std::pair<std::string, std::string>> &columns);
@@ -39,6 +51,8 @@ namespace cli
 
     void deinit();
 
+    void uint32_to_bytes(uint8_t *dest, const uint32_t x);
+
     uint32_t uint32_from_bytes(const uint8_t *data);
 }
 
@@ -88,11 +88,22 @@ int parse_cmd(int argc, char **argv)
     CLI::App *stop = app.add_subcommand("stop", "Stops an instance.");
     CLI::App *destroy = app.add_subcommand("destroy", "Destroys an instance.");
     CLI::App *attach = app.add_subcommand("attach", "Attachs to the bash of a instance.");
+    CLI::App *metrics = app.add_subcommand("metrics", "Displays operation latencies and event counts.");
+    CLI::App *reload = app.add_subcommand("reload", "Reloads the agent config without a restart.");
+    CLI::App *batch = app.add_subcommand("batch", "Sends newline delimited JSON payloads over one connection and prints the responses as they arrive.");
 
     // Initialize options.
     std::string json_message;
     json->add_option("-m,--message", json_message, "JSON message");
 
+    bool prometheus = false;
+    metrics->add_flag("-p,--prometheus", prometheus, "Print in Prometheus text format");
+
+    std::string batch_file;
+    size_t concurrency = 4;
+    batch->add_option("-f,--file", batch_file, "File to read the payloads from instead of stdin");
+    batch->add_option("-c,--concurrency", concurrency, "Max payloads awaiting a response");
+
     create->group(""); // Hides 'create' command from help-all
     std::string owner, contract_id, image, outbound_ipv6, outbound_net_interface;
     create->add_option("-o,--owner", owner, "Hex (ed-prefixed) public key of the instance owner");
@@ -215,6 +226,50 @@ int parse_cmd(int argc, char **argv)
         return execute_cli([&]()
                            { return cli::docker_exec("attach", container_name); });
     }
+    else if (metrics->parsed())
+    {
+        return execute_cli([&]()
+                           {
+                               if (cli::metrics(prometheus) == -1)
+                               {
+                                   std::cerr << "Failed to get metrics." << std::endl;
+                                   return -1;
+                               }
+                               return 0; });
+    }
+    else if (batch->parsed())
+    {
+        if (concurrency == 0)
+        {
+            std::cerr << "Concurrency should be greater than 0." << std::endl;
+            return -1;
+        }
+
+        std::ifstream file;
+        if (!batch_file.empty())
+        {
+            file.open(batch_file);
+            if (!file.is_open())
+            {
+                std::cerr << "Failed to open " << batch_file << std::endl;
+                return -1;
+            }
+        }
+
+        return execute_cli([&]()
+                           { return cli::batch(batch_file.empty() ? std::cin : file, concurrency, is_dev_mode); });
+    }
+    else if (reload->parsed())
+    {
+        return execute_cli([&]()
+                           {
+                               if (cli::reload() == -1)
+                               {
+                                   std::cerr << "Failed to reload the config." << std::endl;
+                                   return -1;
+                               }
+                               return 0; });
+    }
 
     std::cout << app.help();
     return -1;
@@ -1,8 +1,11 @@
 #ifndef _CLI_PCHHEADER_
 #define _CLI_PCHHEADER_
 
+#include <algorithm>
 #include <boost/stacktrace.hpp>
 #include <csignal>
+#include <deque>
+#include <fstream>
 #include <iostream>
 #include <libgen.h>
 #include <string>
@@ -1,30 +1,41 @@
 #include "comm_handler.hpp"
 #include "../util/util.hpp"
+#include "../util/thread_pool.hpp"
 #include "../conf.hpp"
-
-#define __HANDLE_RESPONSE(type, content, ret)                                                                                                                                                                                                                                       \
-    {                                                                                                                                                                                                                                                                               \
-        std::string res;                                                                                                                                                                                                                                                            \
-        msg_parser.build_response(res, type, content, (((void *)type == (void *)msg::MSGTYPE_CREATE_RES || (void *)type == (void *)msg::MSGTYPE_LIST_RES || (void *)type == (void *)msg::MSGTYPE_INSPECT_RES) && ret == 0) || (void *)type == (void *)msg::MSGTYPE_INITIATE_ERROR); \
-        send(res);                                                                                                                                                                                                                                                                  \
-        return ret;                                                                                                                                                                                                                                                                 \
-    }
+#include "../metrics.hpp"
 
 namespace comm
 {
-    constexpr uint32_t DEFAULT_MAX_MSG_SIZE = 1 * 1024 * 1024; // 1MB;
     bool init_success;
-    constexpr const int POLL_TIMEOUT = 10;
     constexpr const int BUFFER_SIZE = 4096;
-    constexpr const int EMPTY_READ_TRESHOLD = 5;
-    msg::msg_parser msg_parser;
-    std::vector<uint8_t> read_buffer(BUFFER_SIZE, 0); // Global buffer storing the current message.
+    constexpr const size_t HEADER_SIZE = 8;         // Length prefix sent ahead of a framed message.
+    constexpr const size_t MAX_PACKET_SIZE = 65536; // Large messages are sent as several packets of this size.
+    constexpr const int LISTEN_BACKLOG = 128;
+    constexpr const char *ADMIN_GROUP = "sashiadmin"; // Group allowed to use the socket.
+    constexpr const int MAX_EPOLL_EVENTS = 32;
+    constexpr const size_t MAX_QUEUED_BYTES = 16 * 1024 * 1024; // Clients not reading their responses are dropped beyond this.
+    constexpr const size_t WORKER_COUNT = 4;       // Number of threads executing mutating requests.
+    constexpr const size_t MAX_PENDING_TASKS = 64; // Mutating requests allowed to wait for a free worker.
+    constexpr const size_t MAX_LANE_TASKS = 8;     // Requests allowed to wait behind a running request of the same container.
+    constexpr const char *RELOAD_LANE = "";        // Reloads are serialized in a lane no created container uses.
+    constexpr const size_t MAX_BATCH_SIZE = 256;              // Max containers a batch request can target.
+    constexpr const size_t BATCH_CONCURRENCY = WORKER_COUNT; // Operations of a batch executed in parallel.
+    constexpr const size_t MAX_RETAINED_BUFFER_SIZE = 4 * 1024 * 1024; // Larger response buffers are freed after use.
+    msg::msg_parser json_parser(msg::ENCODING_JSON);
+    msg::msg_parser binary_parser(msg::ENCODING_BINARY);
+
+    // Response buffers reused by each thread so responses are built without allocating.
+    thread_local std::string response_buffer;
+    thread_local std::string content_buffer;
 
     constexpr const char *FORMAT_ERROR = "format_error";
     constexpr const char *TYPE_ERROR = "type_error";
     constexpr const char *INIT_ERROR = "init_error";
     constexpr const char *START_ERROR = "start_error";
     constexpr const char *STOP_ERROR = "stop_error";
+    constexpr const char *BUSY_ERROR = "busy_error";
+    constexpr const char *DESTROY_ERROR = "destroy_error";
+    constexpr const char *BATCH_SIZE_ERROR = "batch_size_error";
 
     struct Callback
     {
@@ -34,9 +45,15 @@ namespace comm
 
     comm_ctx ctx;
 
+    util::thread_pool workers;
+    std::mutex lanes_mutex;
+    // Queued mutating requests per container. A lane exists while a request of that container is running,
+    // so requests targeting the same container are executed one after the other.
+    std::unordered_map<std::string, std::queue<std::function<void()>>> lanes;
+
     int init()
     {
-        ctx.connection_socket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        ctx.connection_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         if (ctx.connection_socket == -1)
         {
             LOG_ERROR << errno << ": Error creating the socket.";
@@ -51,21 +68,51 @@ namespace comm
         // Remove the socket if it already exists.
         unlink(conf::ctx.socket_path.c_str());
 
-        const std::string command = "chown :sashiadmin " + conf::ctx.socket_path;
-
         const mode_t permission_mode = 0660; // rw-rw----
 
+        // Socket is accessible to the admin group.
+        const group *admin_group = getgrnam(ADMIN_GROUP);
+        if (admin_group == NULL)
+        {
+            LOG_ERROR << "Group " << ADMIN_GROUP << " not found.";
+            close(ctx.connection_socket);
+            return -1;
+        }
+
         if (bind(ctx.connection_socket, (const struct sockaddr *)&sock_name, sizeof(struct sockaddr_un)) == -1 ||
             chmod(conf::ctx.socket_path.c_str(), permission_mode) == -1 ||
-            system(command.data()) == -1 ||
-            listen(ctx.connection_socket, 20) == -1)
+            chown(conf::ctx.socket_path.c_str(), -1, admin_group->gr_gid) == -1 ||
+            listen(ctx.connection_socket, LISTEN_BACKLOG) == -1)
         {
             LOG_ERROR << errno << ": Error binding the socket for " << conf::ctx.socket_path;
             close(ctx.connection_socket);
             return -1;
         }
 
-        msg_parser = msg::msg_parser();
+        ctx.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        ctx.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ctx.epoll_fd == -1 || ctx.event_fd == -1 ||
+            watch_fd(ctx.connection_socket) == -1 || watch_fd(ctx.event_fd) == -1)
+        {
+            LOG_ERROR << errno << ": Error initializing the socket event loop.";
+            if (ctx.epoll_fd != -1)
+                close(ctx.epoll_fd);
+            if (ctx.event_fd != -1)
+                close(ctx.event_fd);
+            close(ctx.connection_socket);
+            unlink(conf::ctx.socket_path.c_str());
+            return -1;
+        }
+
+        if (workers.init(WORKER_COUNT, MAX_PENDING_TASKS) == -1)
+        {
+            close(ctx.epoll_fd);
+            close(ctx.event_fd);
+            close(ctx.connection_socket);
+            unlink(conf::ctx.socket_path.c_str());
+            return -1;
+        }
+
         ctx.comm_handler_thread = std::thread(comm_handler_loop);
         init_success = true;
 
@@ -78,38 +125,92 @@ namespace comm
         {
             ctx.is_shutting_down = true;
 
+            // Wake up the event loop so it notices the shutdown.
+            const uint64_t signal = 1;
+            if (write(ctx.event_fd, &signal, sizeof(signal)) == -1)
+                LOG_ERROR << errno << ": Error signaling the comm handler thread.";
+
             if (ctx.comm_handler_thread.joinable())
                 ctx.comm_handler_thread.join();
 
+            // Wait for the requests which are already being executed.
+            workers.deinit();
+
+            close(ctx.epoll_fd);
+            close(ctx.event_fd);
             close(ctx.connection_socket);
             unlink(conf::ctx.socket_path.c_str());
         }
     }
 
     /**
-     * This accepts connections to the socket.
-     * This only gets called whithin the comm handler thread.
+     * Registers the given fd in the epoll instance for read readiness.
+     * @param fd File descriptor to watch.
      * @return 0 on success -1 on error.
      */
-    int connect()
+    int watch_fd(const int fd)
     {
-        ctx.data_socket = accept(ctx.connection_socket, NULL, NULL);
-        if (ctx.data_socket == -1)
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        if (epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
         {
-            LOG_ERROR << errno << ": Error accepting the new connection.";
+            LOG_ERROR << errno << ": Error adding fd " << fd << " to epoll.";
             return -1;
         }
         return 0;
     }
 
     /**
-     * Disconnect the session.
+     * Accepts all the pending connections on the listening socket and registers them as sessions.
      * This only gets called whithin the comm handler thread.
      */
-    void disconnect()
+    void accept_connections()
     {
-        close(ctx.data_socket);
-        ctx.data_socket = -1;
+        while (true)
+        {
+            const int fd = accept4(ctx.connection_socket, NULL, NULL, SOCK_CLOEXEC);
+            if (fd == -1)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    LOG_ERROR << errno << ": Error accepting the new connection.";
+                if (errno != EINTR)
+                    return;
+                continue;
+            }
+
+            // Client sockets are blocking for reads. Responses are sent without blocking and queued while the client is slow.
+            if (watch_fd(fd) == -1)
+            {
+                LOG_ERROR << errno << ": Error preparing the new connection.";
+                close(fd);
+                continue;
+            }
+
+            std::shared_ptr<comm_session> session = std::make_shared<comm_session>();
+            session->fd = fd;
+            session->buffer.resize(BUFFER_SIZE);
+            ctx.sessions.emplace(fd, std::move(session));
+        }
+    }
+
+    /**
+     * Disconnect the session.
+     * This only gets called whithin the comm handler thread, so it doesn't wait for an ongoing send. The shutdown
+     * breaks a blocked send and the socket is closed once the workers release the session.
+     * @param fd Socket fd of the session.
+     */
+    void disconnect(const int fd)
+    {
+        const auto itr = ctx.sessions.find(fd);
+        if (itr == ctx.sessions.end())
+            return;
+
+        epoll_ctl(ctx.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        itr->second->is_closed = true;
+        shutdown(fd, SHUT_RDWR);
+        ctx.sessions.erase(itr);
     }
 
     void comm_handler_loop()
@@ -117,54 +218,102 @@ namespace comm
         LOG_INFO << "Message processor started.";
 
         util::mask_signal();
-        struct pollfd pfd;
-        int empty_read_count = 0; // Helps to detect when the client is disconnected.
+        struct epoll_event events[MAX_EPOLL_EVENTS];
 
         while (!ctx.is_shutting_down)
         {
-            // Process queued messaged only if there's a socket connection.
-            if (ctx.data_socket != -1)
+            const int count = epoll_wait(ctx.epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+            if (count == -1)
             {
-                const int message_size = read_socket();
-                if (message_size == -1)
-                    disconnect();
-                else if (message_size > 0)
-                    handle_message(message_size);
-                else
-                {
-                    empty_read_count++;
-                    // Empty reads happens when client closed the connection.
-                    // Disconnect connection after 5 consecutive empty reads.
-                    if (empty_read_count == EMPTY_READ_TRESHOLD)
-                    {
-                        disconnect();
-                        empty_read_count = 0;
-                    }
-                    util::sleep(1000);
-                }
+                if (errno == EINTR)
+                    continue;
+                LOG_ERROR << errno << ": Error waiting for socket events.";
+                break;
             }
-            else
-            {
-                pfd.fd = ctx.connection_socket;
-                pfd.events = POLLIN;
 
-                // Wait for some time if no connections are available.
-                if (poll(&pfd, 1, POLL_TIMEOUT) > 0)
-                {
-                    connect();
-                    empty_read_count = 0;
-                }
+            for (int i = 0; i < count && !ctx.is_shutting_down; i++)
+            {
+                const int fd = events[i].data.fd;
+                if (fd == ctx.event_fd)
+                    continue;
+                else if (fd == ctx.connection_socket)
+                    accept_connections();
                 else
-                    util::sleep(1000);
+                    handle_session_event(fd, events[i].events);
             }
         }
 
-        // Disconnect the host at the termination.
-        disconnect();
+        // Disconnect all the sessions at the termination.
+        while (!ctx.sessions.empty())
+            disconnect(ctx.sessions.begin()->first);
 
         LOG_INFO << "Message processor stopped.";
     }
 
+    /**
+     * Processes a readiness event of a connected session.
+     * This only gets called whithin the comm handler thread.
+     * @param fd Socket fd of the session.
+     * @param events Epoll events reported for the fd.
+     */
+    void handle_session_event(const int fd, const uint32_t events)
+    {
+        const auto itr = ctx.sessions.find(fd);
+        if (itr == ctx.sessions.end())
+            return;
+
+        const std::shared_ptr<comm_session> session = itr->second;
+
+        if (events & EPOLLOUT)
+        {
+            if (flush_session(*session) == -1 || is_drained(*session))
+                disconnect(fd);
+            return;
+        }
+
+        if (events & EPOLLIN)
+        {
+            const int message_size = read_socket(*session);
+            if (message_size > 0)
+                handle_message(session, message_size);
+            else if (message_size == -1 || (message_size == -2 && start_draining(*session)))
+                disconnect(fd);
+            return;
+        }
+
+        if (events & (EPOLLHUP | EPOLLERR))
+            disconnect(fd);
+        else if ((events & EPOLLRDHUP) && start_draining(*session))
+            disconnect(fd);
+    }
+
+    /**
+     * Stops reading from a session whose client shut down its sending side, so the responses of the requests it
+     * already sent can still be written. This only gets called whithin the comm handler thread.
+     * @param session Session to drain.
+     * @return Whether there's nothing left to write, so the session can be disconnected right away.
+     */
+    bool start_draining(comm_session &session)
+    {
+        {
+            std::scoped_lock lock(session.write_mutex);
+            session.is_draining = true;
+            update_events(session);
+        }
+        return is_drained(session);
+    }
+
+    /**
+     * Checks whether a draining session has written all its responses.
+     * @param session Session to check.
+     * @return Whether the session is draining and has nothing left to write.
+     */
+    bool is_drained(comm_session &session)
+    {
+        std::scoped_lock lock(session.write_mutex);
+        return session.is_draining && session.pending_requests == 0 && session.out_packets.empty();
+    }
+
     /**
      * Wait for the comm handler thread.
      */
@@ -174,32 +323,56 @@ namespace comm
     }
 
     /**
-     * Handles the received message.
+     * Handles the received message. If the message carries an "id", the response echoes it and the session
+     * is kept open, so a client can pipeline many requests over one connection and match the responses,
+     * which may arrive out of order, by their ids. Otherwise the session is closed after the response.
+     * Messages and responses use the encoding of the session, which is json until the client asks for another.
+     * @param session Session the message was received from.
      * @param message_size Message size.
      * @return 0 on success -1 on error.
      */
-    int handle_message(const int message_size)
+    int handle_message(const std::shared_ptr<comm_session> &session, const int message_size)
     {
-        std::string_view msg((char *)read_buffer.data(), message_size);
+        metrics::scoped_timer timer("comm.handle_message");
+        const msg::MSG_ENCODING encoding = session->encoding;
+        msg::msg_parser &msg_parser = get_parser(encoding);
+        std::string_view msg((char *)session->buffer.data(), message_size);
         std::string type;
-        if (msg_parser.parse(msg) == -1 || msg_parser.extract_type(type) == -1)
+        std::string request_id; // Requests with an id are answered without closing the connection.
+        if (msg_parser.parse(msg) == -1 || msg_parser.extract_type(type) == -1 || msg_parser.extract_id(request_id) == -1)
         {
-            read_buffer.clear();
-            __HANDLE_RESPONSE(msg::MSGTYPE_ERROR, FORMAT_ERROR, -1);
+            send_response(session, msg_parser, request_id, msg::MSGTYPE_ERROR, FORMAT_ERROR);
+            return -1;
         }
 
-        // Clear the buffer after the message is parsed.
-        read_buffer.clear();
-
         if (type == msg::MSGTYPE_LIST)
         {
-            std::vector<hp::instance_info> instances;
+            msg::list_msg msg;
+            if (msg_parser.extract_list_message(msg) == -1)
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_LIST_ERROR, FORMAT_ERROR);
+                return -1;
+            }
+
             std::vector<hp::lease_info> leases;
-            hp::get_instance_list(instances);
-            hp::get_lease_list(leases);
-            std::string list_res;
-            msg_parser.build_list_response(list_res, instances, leases);
-            __HANDLE_RESPONSE(msg::MSGTYPE_LIST_RES, list_res, 0);
+            std::string &list_res = reset_buffer(content_buffer);
+            msg::CONTENT_KIND content_kind;
+            if (!msg.is_query)
+            {
+                std::vector<hp::instance_info> instances;
+                hp::get_instance_list(instances);
+                hp::get_lease_list(leases);
+                content_kind = msg_parser.build_list_response(list_res, instances, leases);
+            }
+            else
+            {
+                hp::instance_page page;
+                hp::query_instances(page, msg);
+                if (!page.instances.empty())
+                    hp::get_lease_list(leases);
+                content_kind = msg_parser.build_list_page_response(list_res, page, leases);
+            }
+            return send_response(session, msg_parser, request_id, msg::MSGTYPE_LIST_RES, list_res, content_kind);
         }
         else if (type == msg::MSGTYPE_CREATE)
         {
@@ -207,116 +380,640 @@ namespace comm
             msg::initiate_msg init_msg;
             if (msg_parser.extract_create_message(msg) == -1 ||
                 msg_parser.extract_initiate_message(init_msg) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_CREATE_ERROR, FORMAT_ERROR, -1);
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_CREATE_ERROR, FORMAT_ERROR);
+                return -1;
+            }
 
-            hp::instance_info info;
-            std::string error_msg;
-            if (hp::create_new_instance(error_msg, info, msg.container_name, msg.pubkey, msg.contract_id, msg.image, msg.outbound_ipv6, msg.outbound_net_interface) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_CREATE_ERROR, error_msg, -1);
+            if (dispatch_request(session, msg.container_name, [session, request_id, encoding, msg, init_msg]()
+                         {
+                             const msg::msg_parser &msg_parser = get_parser(encoding);
+                             hp::instance_info info;
+                             std::string error_msg;
+                             if (hp::create_new_instance(error_msg, info, msg.container_name, msg.pubkey, msg.contract_id, msg.image, msg.outbound_ipv6, msg.outbound_net_interface) == -1)
+                             {
+                                 send_response(session, msg_parser, request_id, msg::MSGTYPE_CREATE_ERROR, error_msg);
+                                 return;
+                             }
+
+                             if (hp::initiate_instance(error_msg, info.container_name, init_msg) == -1)
+                             {
+                                 std::string content;
+                                 const msg::CONTENT_KIND content_kind = msg_parser.build_error_response(content, info.container_name, error_msg);
+                                 send_response(session, msg_parser, request_id, msg::MSGTYPE_INITIATE_ERROR, content, content_kind);
+                                 return;
+                             }
 
-            if (hp::initiate_instance(error_msg, info.container_name, init_msg) == -1)
+                             std::string create_res;
+                             const msg::CONTENT_KIND content_kind = msg_parser.build_create_response(create_res, info);
+                             send_response(session, msg_parser, request_id, msg::MSGTYPE_CREATE_RES, create_res, content_kind);
+                         }) == -1)
             {
-                std::string content;
-                msg_parser.build_error_response(content, info.container_name, error_msg);
-                __HANDLE_RESPONSE(msg::MSGTYPE_INITIATE_ERROR, content, -1);
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_CREATE_ERROR, BUSY_ERROR);
+                return -1;
             }
-
-            std::string create_res;
-            msg_parser.build_create_response(create_res, info);
-            __HANDLE_RESPONSE(msg::MSGTYPE_CREATE_RES, create_res, 0);
         }
         // else if (type == msg::MSGTYPE_INITIATE)
         // {
         //     msg::initiate_msg msg;
         //     if (msg_parser.extract_initiate_message(msg) == -1)
-        //         __HANDLE_RESPONSE(msg::MSGTYPE_INITIATE_RES, FORMAT_ERROR, -1);
+        //     {
+        //         send_response(session, msg_parser, request_id, msg::MSGTYPE_INITIATE_RES, FORMAT_ERROR);
+        //         return -1;
+        //     }
 
         //     if (hp::initiate_instance(msg.container_name, msg) == -1)
-        //         __HANDLE_RESPONSE(msg::MSGTYPE_INITIATE_RES, INIT_ERROR, -1);
+        //     {
+        //         send_response(session, msg_parser, request_id, msg::MSGTYPE_INITIATE_RES, INIT_ERROR);
+        //         return -1;
+        //     }
 
-        //     __HANDLE_RESPONSE(msg::MSGTYPE_INITIATE_RES, "initiated", 0);
+        //     return send_response(session, msg_parser, request_id, msg::MSGTYPE_INITIATE_RES, "initiated");
         // }
         else if (type == msg::MSGTYPE_DESTROY)
         {
             msg::destroy_msg msg;
             if (msg_parser.extract_destroy_message(msg))
-                __HANDLE_RESPONSE(msg::MSGTYPE_DESTROY_ERROR, FORMAT_ERROR, -1);
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_DESTROY_ERROR, FORMAT_ERROR);
+                return -1;
+            }
 
-            std::string error_msg;
-            if (hp::destroy_container(error_msg, msg.container_name) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_DESTROY_ERROR, error_msg, -1);
+            if (dispatch_request(session, msg.container_name, [session, request_id, encoding, msg]()
+                         {
+                             const msg::msg_parser &msg_parser = get_parser(encoding);
+                             std::string error_msg;
+                             if (hp::destroy_container(error_msg, msg.container_name) == -1)
+                             {
+                                 send_response(session, msg_parser, request_id, msg::MSGTYPE_DESTROY_ERROR, error_msg);
+                                 return;
+                             }
 
-            __HANDLE_RESPONSE(msg::MSGTYPE_DESTROY_RES, "destroyed", 0);
+                             send_response(session, msg_parser, request_id, msg::MSGTYPE_DESTROY_RES, "destroyed");
+                         }) == -1)
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_DESTROY_ERROR, BUSY_ERROR);
+                return -1;
+            }
         }
         else if (type == msg::MSGTYPE_START)
         {
             msg::start_msg msg;
             if (msg_parser.extract_start_message(msg))
-                __HANDLE_RESPONSE(msg::MSGTYPE_START_ERROR, FORMAT_ERROR, -1);
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_START_ERROR, FORMAT_ERROR);
+                return -1;
+            }
 
-            if (hp::start_container(msg.container_name) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_START_ERROR, START_ERROR, -1);
+            if (dispatch_request(session, msg.container_name, [session, request_id, encoding, msg]()
+                         {
+                             const msg::msg_parser &msg_parser = get_parser(encoding);
+                             if (hp::start_container(msg.container_name) == -1)
+                             {
+                                 send_response(session, msg_parser, request_id, msg::MSGTYPE_START_ERROR, START_ERROR);
+                                 return;
+                             }
 
-            __HANDLE_RESPONSE(msg::MSGTYPE_START_RES, "started", 0);
+                             send_response(session, msg_parser, request_id, msg::MSGTYPE_START_RES, "started");
+                         }) == -1)
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_START_ERROR, BUSY_ERROR);
+                return -1;
+            }
         }
         else if (type == msg::MSGTYPE_STOP)
         {
             msg::stop_msg msg;
             if (msg_parser.extract_stop_message(msg))
-                __HANDLE_RESPONSE(msg::MSGTYPE_STOP_ERROR, FORMAT_ERROR, -1);
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_STOP_ERROR, FORMAT_ERROR);
+                return -1;
+            }
 
-            if (hp::stop_container(msg.container_name) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_STOP_ERROR, STOP_ERROR, -1);
+            if (dispatch_request(session, msg.container_name, [session, request_id, encoding, msg]()
+                         {
+                             const msg::msg_parser &msg_parser = get_parser(encoding);
+                             if (hp::stop_container(msg.container_name) == -1)
+                             {
+                                 send_response(session, msg_parser, request_id, msg::MSGTYPE_STOP_ERROR, STOP_ERROR);
+                                 return;
+                             }
 
-            __HANDLE_RESPONSE(msg::MSGTYPE_STOP_RES, "stopped", 0);
+                             send_response(session, msg_parser, request_id, msg::MSGTYPE_STOP_RES, "stopped");
+                         }) == -1)
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_STOP_ERROR, BUSY_ERROR);
+                return -1;
+            }
         }
         else if (type == msg::MSGTYPE_INSPECT)
         {
             msg::inspect_msg msg;
             if (msg_parser.extract_inspect_message(msg))
-                __HANDLE_RESPONSE(msg::MSGTYPE_INSPECT_ERROR, FORMAT_ERROR, -1);
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_INSPECT_ERROR, FORMAT_ERROR);
+                return -1;
+            }
 
             hp::instance_info instance;
             std::string error_msg;
             if (hp::get_instance(error_msg, msg.container_name, instance) == -1)
-                __HANDLE_RESPONSE(msg::MSGTYPE_INSPECT_ERROR, error_msg, -1);
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_INSPECT_ERROR, error_msg);
+                return -1;
+            }
 
             std::string inspect_res;
-            msg_parser.build_inspect_response(inspect_res, instance);
-            __HANDLE_RESPONSE(msg::MSGTYPE_INSPECT_RES, inspect_res, 0);
+            const msg::CONTENT_KIND content_kind = msg_parser.build_inspect_response(inspect_res, instance);
+            return send_response(session, msg_parser, request_id, msg::MSGTYPE_INSPECT_RES, inspect_res, content_kind);
+        }
+        else if (type == msg::MSGTYPE_BATCH_START || type == msg::MSGTYPE_BATCH_STOP || type == msg::MSGTYPE_BATCH_DESTROY || type == msg::MSGTYPE_BATCH_INSPECT)
+        {
+            msg::batch_msg msg;
+            if (msg_parser.extract_batch_message(msg) == -1)
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_BATCH_ERROR, FORMAT_ERROR);
+                return -1;
+            }
+
+            std::shared_ptr<batch_ctx> batch = std::make_shared<batch_ctx>();
+            hp::select_instances(batch->container_names, msg.container_names, msg.owner_pubkey, msg.status);
+            if (batch->container_names.size() > MAX_BATCH_SIZE)
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_BATCH_ERROR, BATCH_SIZE_ERROR);
+                return -1;
+            }
+
+            batch->session = session;
+            batch->request_id = request_id;
+            batch->type = type;
+            batch->encoding = encoding;
+            batch->results.resize(batch->container_names.size());
+            batch->remaining = batch->container_names.size();
+            session->pending_requests++; // Answered by send_batch_response.
+
+            // Inspection only reads the instance state, so the whole batch is answered right away.
+            if (type == msg::MSGTYPE_BATCH_INSPECT || batch->container_names.empty())
+            {
+                for (size_t i = 0; i < batch->container_names.size(); i++)
+                {
+                    msg::batch_result &result = batch->results[i];
+                    result.container_name = batch->container_names[i];
+
+                    hp::instance_info instance;
+                    result.is_success = hp::get_instance(result.content, result.container_name, instance) == 0;
+                    if (result.is_success)
+                        result.content_kind = msg_parser.build_inspect_response(result.content, instance);
+                }
+                send_batch_response(batch);
+                return 0;
+            }
+
+            dispatch_batch_items(batch, BATCH_CONCURRENCY);
+        }
+        else if (type == msg::MSGTYPE_METRICS)
+        {
+            msg::metrics_msg msg;
+            if (msg_parser.extract_metrics_message(msg) == -1)
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_METRICS_ERROR, FORMAT_ERROR);
+                return -1;
+            }
+
+            std::string &metrics_res = reset_buffer(content_buffer);
+            msg::CONTENT_KIND content_kind;
+            if (msg.format == msg::METRICS_FORMAT_PROMETHEUS)
+            {
+                std::string text;
+                metrics::build_prometheus_text(text);
+                content_kind = msg_parser.build_text_content(metrics_res, text);
+            }
+            else
+            {
+                std::vector<metrics::histogram_snapshot> histograms;
+                std::vector<metrics::counter_snapshot> counters;
+                metrics::get_snapshot(histograms, counters);
+                content_kind = msg_parser.build_metrics_response(metrics_res, histograms, counters);
+            }
+            return send_response(session, msg_parser, request_id, msg::MSGTYPE_METRICS_RES, metrics_res, content_kind);
+        }
+        else if (type == msg::MSGTYPE_ENCODING)
+        {
+            msg::encoding_msg msg;
+            if (msg_parser.extract_encoding_message(msg) == -1)
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_ENCODING_ERROR, FORMAT_ERROR);
+                return -1;
+            }
+
+            // This response is still in the current encoding. The next messages of the session are in the new one.
+            session->encoding = msg.encoding;
+            return send_response(session, msg_parser, request_id, msg::MSGTYPE_ENCODING_RES, msg::MSG_ENCODINGS[msg.encoding]);
+        }
+        else if (type == msg::MSGTYPE_RELOAD)
+        {
+            // Applying the config waits for the allocations, so it's done by the workers.
+            if (dispatch_request(session, RELOAD_LANE, [session, request_id, encoding]()
+                         {
+                             const msg::msg_parser &msg_parser = get_parser(encoding);
+                             std::string error_msg;
+                             std::vector<std::string> restart_fields;
+                             if (hp::reload_config(error_msg, restart_fields) == -1)
+                             {
+                                 send_response(session, msg_parser, request_id, msg::MSGTYPE_RELOAD_ERROR, error_msg);
+                                 return;
+                             }
+
+                             std::string &reload_res = reset_buffer(content_buffer);
+                             const msg::CONTENT_KIND content_kind = msg_parser.build_reload_response(reload_res, restart_fields);
+                             send_response(session, msg_parser, request_id, msg::MSGTYPE_RELOAD_RES, reload_res, content_kind);
+                         }) == -1)
+            {
+                send_response(session, msg_parser, request_id, msg::MSGTYPE_RELOAD_ERROR, BUSY_ERROR);
+                return -1;
+            }
         }
         else
-            __HANDLE_RESPONSE("error", TYPE_ERROR, -1);
+        {
+            send_response(session, msg_parser, request_id, msg::MSGTYPE_ERROR, TYPE_ERROR);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Builds a response into the response buffer of the thread and sends it to the session. A session which the
+     * response can't be sent to is already being closed by send, so the failure is only logged.
+     * This gets called whithin the comm handler thread and whithin worker threads.
+     * @param session Session to send the response to.
+     * @param msg_parser Parser of the session encoding.
+     * @param request_id Id of the request. The connection is kept open if the request has one.
+     * @param type Response type.
+     * @param content Response content.
+     * @param content_kind Kind of the content as returned by its builder. Plain strings are text.
+     * @return 0 on success -1 if the response could not be sent.
+     */
+    int send_response(const std::shared_ptr<comm_session> &session, const msg::msg_parser &msg_parser, std::string_view request_id,
+                      std::string_view type, std::string_view content, const msg::CONTENT_KIND content_kind)
+    {
+        std::string &res = reset_buffer(response_buffer);
+        msg_parser.build_response(res, type, content, content_kind, request_id);
+        metrics::increment(std::string("responses.").append(type));
+        if (send(session, res, !request_id.empty()) == -1)
+        {
+            LOG_WARNING << "Could not send the " << type << " response. Client has disconnected.";
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Gets the message parser of an encoding. Parsing is only done by the comm handler thread, building the responses
+     * is done by any thread.
+     * @param encoding Message encoding.
+     * @return The parser of the encoding.
+     */
+    msg::msg_parser &get_parser(const msg::MSG_ENCODING encoding)
+    {
+        return encoding == msg::ENCODING_BINARY ? binary_parser : json_parser;
+    }
+
+    /**
+     * Queues a mutating request to be executed by the worker pool. Requests of the same container
+     * are executed in the order they were received and never in parallel.
+     * This gets called whithin the comm handler thread, and whithin worker threads for batch requests.
+     * @param container_name Name of the container the request operates on.
+     * @param task Request handler.
+     * @return 0 on success -1 if the request cannot be queued.
+     */
+    int dispatch(const std::string &container_name, std::function<void()> task)
+    {
+        std::scoped_lock lock(lanes_mutex);
+
+        const auto itr = lanes.find(container_name);
+        if (itr != lanes.end())
+        {
+            // A request of this container is already running. It will pick this up once it finishes.
+            if (itr->second.size() >= MAX_LANE_TASKS)
+                return -1;
+            itr->second.push(std::move(task));
+            return 0;
+        }
+
+        lanes.try_emplace(container_name);
+        if (workers.submit([container_name, task = std::move(task)]()
+                           { run_lane(container_name, task); }) == -1)
+        {
+            lanes.erase(container_name);
+            LOG_ERROR << "Request queue is full. Rejected request for " << container_name;
+            return -1;
+        }
 
         return 0;
     }
 
     /**
-     * Sends the given message to the connected client.
+     * Queues a request of the session to be executed by the worker pool. The session is kept until the response is
+     * written even if the client stops sending.
+     * This only gets called whithin the comm handler thread.
+     * @param session Session the request was received from.
+     * @param container_name Name of the container the request operates on.
+     * @param task Request handler. It sends the response.
+     * @return 0 on success -1 if the request cannot be queued.
+     */
+    int dispatch_request(const std::shared_ptr<comm_session> &session, const std::string &container_name, std::function<void()> task)
+    {
+        session->pending_requests++;
+        if (dispatch(container_name, [session, task = std::move(task)]()
+                     {
+                         task();
+                         finish_request(session);
+                     }) == 0)
+            return 0;
+
+        session->pending_requests--;
+        return -1;
+    }
+
+    /**
+     * Marks a request of the session as answered. The comm handler thread is woken up through the writability of the
+     * socket to disconnect a draining session which has no more requests pending.
+     * @param session Session the request was received from.
+     */
+    void finish_request(const std::shared_ptr<comm_session> &session)
+    {
+        std::scoped_lock lock(session->write_mutex);
+        if (--session->pending_requests == 0 && session->is_draining)
+            update_events(*session);
+    }
+
+    /**
+     * Executes the given request and then the requests queued behind it for the same container.
+     * This gets called whithin a worker thread.
+     * @param container_name Name of the container.
+     * @param task First request to execute.
+     */
+    void run_lane(const std::string &container_name, std::function<void()> task)
+    {
+        while (true)
+        {
+            task();
+
+            std::scoped_lock lock(lanes_mutex);
+            const auto itr = lanes.find(container_name);
+            if (itr == lanes.end() || itr->second.empty())
+            {
+                lanes.erase(container_name);
+                return;
+            }
+            task = std::move(itr->second.front());
+            itr->second.pop();
+        }
+    }
+
+    /**
+     * Dispatches the next operations of the batch to the lanes of their containers. An operation which
+     * cannot be queued is reported as busy without holding up the rest of the batch.
+     * @param batch Batch request.
+     * @param count Number of operations to dispatch.
+     */
+    void dispatch_batch_items(const std::shared_ptr<batch_ctx> &batch, const size_t count)
+    {
+        size_t dispatched = 0;
+        while (dispatched < count)
+        {
+            size_t index;
+            {
+                std::scoped_lock lock(batch->mutex);
+                if (batch->next_index == batch->container_names.size())
+                    return;
+                index = batch->next_index++;
+            }
+
+            if (dispatch(batch->container_names[index], [batch, index]()
+                         { run_batch_item(batch, index); }) == 0)
+            {
+                dispatched++;
+            }
+            else if (complete_batch_item(batch, index, false, BUSY_ERROR))
+            {
+                send_batch_response(batch);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Executes a single operation of the batch and dispatches the next one when it finishes.
+     * This gets called whithin a worker thread.
+     * @param batch Batch request.
+     * @param index Index of the container in the batch.
+     */
+    void run_batch_item(const std::shared_ptr<batch_ctx> &batch, const size_t index)
+    {
+        const std::string &container_name = batch->container_names[index];
+        bool is_last = false;
+        if (batch->type == msg::MSGTYPE_BATCH_START)
+        {
+            const bool is_success = hp::start_container(container_name) == 0;
+            is_last = complete_batch_item(batch, index, is_success, is_success ? "started" : START_ERROR);
+        }
+        else if (batch->type == msg::MSGTYPE_BATCH_STOP)
+        {
+            const bool is_success = hp::stop_container(container_name) == 0;
+            is_last = complete_batch_item(batch, index, is_success, is_success ? "stopped" : STOP_ERROR);
+        }
+        else
+        {
+            std::string error_msg;
+            const bool is_success = hp::destroy_container(error_msg, container_name) == 0;
+            is_last = complete_batch_item(batch, index, is_success, is_success ? "destroyed" : (error_msg.empty() ? DESTROY_ERROR : error_msg));
+        }
+
+        if (is_last)
+            send_batch_response(batch);
+        else
+            dispatch_batch_items(batch, 1);
+    }
+
+    /**
+     * Records the result of a batch operation.
+     * @param batch Batch request.
+     * @param index Index of the container in the batch.
+     * @param is_success Whether the operation succeeded.
+     * @param content Result or the error code.
+     * @return Whether this was the last operation of the batch to complete.
+     */
+    bool complete_batch_item(const std::shared_ptr<batch_ctx> &batch, const size_t index, const bool is_success, std::string_view content)
+    {
+        std::scoped_lock lock(batch->mutex);
+        msg::batch_result &result = batch->results[index];
+        result.container_name = batch->container_names[index];
+        result.is_success = is_success;
+        result.content = content;
+        return --batch->remaining == 0;
+    }
+
+    /**
+     * Sends the results of all the operations of the batch in a single response.
+     * @param batch Completed batch request.
+     */
+    void send_batch_response(const std::shared_ptr<batch_ctx> &batch)
+    {
+        const msg::msg_parser &msg_parser = get_parser(batch->encoding);
+        std::string content;
+        const msg::CONTENT_KIND content_kind = msg_parser.build_batch_response(content, batch->results);
+        send_response(batch->session, msg_parser, batch->request_id, msg::MSGTYPE_BATCH_RES, content, content_kind);
+        finish_request(batch->session);
+    }
+
+    /**
+     * Sends the given message to the connected client. This never blocks, so it can be called whithin the comm handler
+     * thread. The packets the socket can't take yet are queued and written by the comm handler thread once the socket
+     * becomes writable.
+     * @param session Session to send the message to.
      * @param message Message to send.
+     * @param keep_open Whether to keep the connection open for more requests after sending.
      * @return 0 on success -1 on error.
      **/
-    int send(std::string_view message)
+    int send(const std::shared_ptr<comm_session> &session, std::string_view message, const bool keep_open)
     {
-        if (ctx.data_socket == -1)
+        std::scoped_lock lock(session->write_mutex);
+        if (session->is_closed || session->is_closing)
             return -1;
 
-        uint8_t length_buffer[8];
+        uint8_t length_buffer[HEADER_SIZE] = {};
         // Convert message length to a byte array
         uint32_to_bytes(length_buffer, message.length());
 
-        int res = write(ctx.data_socket, length_buffer, 8);
-        if (res == -1)
+        const bool was_queued = !session->out_packets.empty();
+        int res = send_packet(*session, std::string_view((char *)length_buffer, HEADER_SIZE));
+
+        // Split the message into packets so large messages do not exceed the socket buffer.
+        for (size_t offset = 0; res != -1 && offset < message.length(); offset += MAX_PACKET_SIZE)
+            res = send_packet(*session, message.substr(offset, MAX_PACKET_SIZE));
+
+        if (res == -1 || session->out_bytes > MAX_QUEUED_BYTES)
         {
-            disconnect();
+            if (res != -1)
+                LOG_WARNING << "Dropping a client which is not reading its responses.";
+            // The session itself is released by the comm handler thread once it sees the hangup, since this may run
+            // whithin a worker thread.
+            session->is_closing = true;
+            session->out_packets.clear();
+            session->out_bytes = 0;
+            shutdown(session->fd, SHUT_RDWR);
             return -1;
         }
 
-        res = write(ctx.data_socket, message.data(), message.length());
         // Close connection after sending the response to the client.
-        disconnect();
+        if (!keep_open)
+            session->is_closing = true;
 
-        return res == -1 ? -1 : 0;
+        if (session->out_packets.empty())
+        {
+            if (session->is_closing)
+                shutdown(session->fd, SHUT_RDWR);
+        }
+        else if (!was_queued)
+        {
+            update_events(*session);
+        }
+        return 0;
+    }
+
+    /**
+     * Writes a packet without blocking, or queues it behind the packets already waiting. Must be called holding the
+     * write mutex of the session.
+     * @param session Session to send the packet to.
+     * @param packet Packet to send.
+     * @return 0 on success -1 on error.
+     */
+    int send_packet(comm_session &session, std::string_view packet)
+    {
+        if (session.out_packets.empty())
+        {
+            ssize_t ret;
+            while ((ret = ::send(session.fd, packet.data(), packet.size(), MSG_DONTWAIT | MSG_NOSIGNAL)) == -1 && errno == EINTR)
+                ;
+            if (ret != -1)
+                return 0;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                LOG_ERROR << errno << ": Error sending data.";
+                return -1;
+            }
+        }
+
+        session.out_packets.emplace_back(packet);
+        session.out_bytes += packet.size();
+        return 0;
+    }
+
+    /**
+     * Writes the queued packets of the session until the socket buffer is full again.
+     * This only gets called whithin the comm handler thread.
+     * @param session Session whose socket is writable.
+     * @return 0 on success -1 on error.
+     */
+    int flush_session(comm_session &session)
+    {
+        std::scoped_lock lock(session.write_mutex);
+        while (!session.out_packets.empty())
+        {
+            const std::string &packet = session.out_packets.front();
+            const ssize_t ret = ::send(session.fd, packet.data(), packet.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (ret == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    return 0;
+                LOG_ERROR << errno << ": Error sending data.";
+                return -1;
+            }
+            session.out_bytes -= packet.size();
+            session.out_packets.pop_front();
+        }
+
+        update_events(session);
+        if (session.is_closing)
+            shutdown(session.fd, SHUT_RDWR);
+        return 0;
+    }
+
+    /**
+     * Updates the events watched for the session. Writability is only watched while there are queued packets, or once
+     * a draining session has no more pending requests so the comm handler thread disconnects it. A draining session
+     * is not read anymore.
+     * Must be called holding the write mutex of the session.
+     * @param session Session to update.
+     */
+    void update_events(comm_session &session)
+    {
+        if (session.is_closed)
+            return;
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        const bool is_writable_watched = !session.out_packets.empty() || (session.is_draining && session.pending_requests == 0);
+        event.events = (session.is_draining ? 0 : EPOLLIN | EPOLLRDHUP) | (is_writable_watched ? EPOLLOUT : 0);
+        event.data.fd = session.fd;
+        // The fd is already out of the epoll set if the session got disconnected meanwhile.
+        if (epoll_ctl(ctx.epoll_fd, EPOLL_CTL_MOD, session.fd, &event) == -1 && errno != ENOENT)
+            LOG_ERROR << errno << ": Error updating the events of fd " << session.fd;
+    }
+
+    /**
+     * Clears a reusable response buffer. Buffers grown beyond the retained size are freed.
+     * @param buffer Buffer to clear.
+     * @return The cleared buffer.
+     */
+    std::string &reset_buffer(std::string &buffer)
+    {
+        if (buffer.capacity() > MAX_RETAINED_BUFFER_SIZE)
+            std::string().swap(buffer);
+        buffer.clear();
+        return buffer;
     }
 
     /**
@@ -333,17 +1030,101 @@ namespace comm
     }
 
     /**
-     * Reads the message from the connected client to the global buffer.
-     * @return Number of bytes read on success -1 on error.
+     * Reads the next packet of the connected client into the session buffer.
+     * A framed message is a packet holding the 8 byte length prefix followed by one or more packets holding the
+     * message. A packet which is not a length prefix is treated as a whole message, as sent by older clients.
+     * @param session Session to read from.
+     * @return Size of the message if a complete message is in the buffer, 0 if more packets are needed,
+     *         -1 on error or if the client sent an invalid message and -2 if the client shut down its sending side.
      **/
-    int read_socket()
+    int read_socket(comm_session &session)
     {
-        const int ret = read(ctx.data_socket, read_buffer.data(), BUFFER_SIZE);
+        // Peek the real packet size so the buffer can fit the whole packet.
+        uint8_t first_byte = 0;
+        const ssize_t packet_size = recv(session.fd, &first_byte, 1, MSG_PEEK | MSG_TRUNC);
+        if (packet_size <= 0)
+        {
+            // Zero length read means the client shut down its sending side. It might still read the responses.
+            if (packet_size == 0)
+                return -2;
+            LOG_ERROR << errno << ": Error receiving data.";
+            return -1;
+        }
+
+        const uint32_t max_msg_bytes = conf::cfg.comm.max_msg_bytes;
+        if (session.expected_size == 0)
+        {
+            if ((size_t)packet_size == HEADER_SIZE && first_byte != '{' && first_byte != msg::binary::MAGIC)
+            {
+                uint8_t header[HEADER_SIZE];
+                if (read(session.fd, header, HEADER_SIZE) == -1)
+                {
+                    LOG_ERROR << errno << ": Error receiving data.";
+                    return -1;
+                }
+
+                const uint32_t size = uint32_from_bytes(header);
+                if (size == 0 || size > max_msg_bytes)
+                {
+                    LOG_ERROR << "Invalid message size " << size << " received. Max allowed is " << max_msg_bytes;
+                    return -1;
+                }
+
+                session.expected_size = size;
+                session.received_size = 0;
+                if (session.buffer.size() < size)
+                    session.buffer.resize(size);
+                return 0;
+            }
+
+            if ((size_t)packet_size > max_msg_bytes)
+            {
+                LOG_ERROR << "Message of size " << packet_size << " exceeds max allowed size " << max_msg_bytes;
+                return -1;
+            }
+
+            if (session.buffer.size() < (size_t)packet_size)
+                session.buffer.resize(packet_size);
+            const int ret = read(session.fd, session.buffer.data(), packet_size);
+            if (ret == -1)
+                LOG_ERROR << errno << ": Error receiving data.";
+            return ret;
+        }
+
+        // Continuation of a framed message.
+        if ((size_t)packet_size > session.expected_size - session.received_size)
+        {
+            LOG_ERROR << "Received data exceeds the announced message size " << session.expected_size;
+            return -1;
+        }
+
+        const int ret = read(session.fd, session.buffer.data() + session.received_size, packet_size);
         if (ret == -1)
         {
             LOG_ERROR << errno << ": Error receiving data.";
             return -1;
         }
-        return ret;
+
+        session.received_size += ret;
+        if (session.received_size < session.expected_size)
+            return 0;
+
+        const int message_size = session.expected_size;
+        session.expected_size = 0;
+        session.received_size = 0;
+        return message_size;
+    }
+
+    /**
+     * Convert the given bytes in big endian format to a uint32_t number.
+     * @param data Byte array pointer.
+     * @return Converted number.
+     */
+    uint32_t uint32_from_bytes(const uint8_t *data)
+    {
+        return ((uint32_t)data[0] << 24) +
+               ((uint32_t)data[1] << 16) +
+               ((uint32_t)data[2] << 8) +
+               ((uint32_t)data[3]);
     }
 } // namespace comm
@@ -6,12 +6,55 @@
 
 namespace comm
 {
+    // Represents a connected client of the agent socket. The socket is closed when the last holder releases the session,
+    // so a worker still holding it never writes to a reused fd.
+    struct comm_session
+    {
+        int fd = -1;
+        std::atomic<bool> is_closed = false; // Set on disconnect. No more responses are sent.
+        std::mutex write_mutex;      // Responses can be sent from worker threads.
+        std::vector<uint8_t> buffer; // Reusable buffer holding the message being received.
+        uint32_t expected_size = 0;  // Size of the framed message being received. 0 if waiting for a new message.
+        uint32_t received_size = 0;  // Bytes of the framed message received so far.
+        std::atomic<msg::MSG_ENCODING> encoding = msg::ENCODING_JSON; // Encoding of the messages, switched by the encoding message.
+
+        // Guarded by the write mutex.
+        std::deque<std::string> out_packets; // Packets waiting for the socket to become writable, in the order they are sent.
+        size_t out_bytes = 0;                // Total size of the waiting packets.
+        bool is_closing = false;             // Connection is shut down once the waiting packets are written.
+        bool is_draining = false;            // Client shut down its sending side. Disconnected once the pending responses are written.
+
+        std::atomic<size_t> pending_requests = 0; // Requests of the session being executed by the workers.
+
+        ~comm_session()
+        {
+            if (fd != -1)
+                close(fd);
+        }
+    };
+
+    // A batch request in progress. Its container operations are dispatched a few at a time.
+    struct batch_ctx
+    {
+        std::shared_ptr<comm_session> session;
+        std::string request_id;
+        std::string type;
+        msg::MSG_ENCODING encoding = msg::ENCODING_JSON; // Encoding of the batch request.
+        std::vector<std::string> container_names;
+        std::vector<msg::batch_result> results; // Results in the order of the container names.
+        std::mutex mutex;
+        size_t next_index = 0; // Next container to dispatch.
+        size_t remaining = 0;  // Operations not completed yet.
+    };
+
     struct comm_ctx
     {
         bool is_shutting_down = false;
         std::thread comm_handler_thread; // Incoming message processor thread.
         int connection_socket = -1;
-        int data_socket = -1;
+        int epoll_fd = -1;                               // Epoll instance watching the listening socket and all sessions.
+        int event_fd = -1;                               // Used to wake up the epoll loop on shutdown.
+        std::unordered_map<int, std::shared_ptr<comm_session>> sessions; // Connected sessions keyed by socket fd.
     };
 
     extern comm_ctx ctx;
@@ -20,22 +63,61 @@ namespace comm
 
     void deinit();
 
-    int connect();
+    int watch_fd(const int fd);
 
-    void disconnect();
+    void accept_connections();
+
+    void disconnect(const int fd);
 
     void comm_handler_loop();
 
-    int handle_message(const int message_size);
+    void handle_session_event(const int fd, const uint32_t events);
+
+    int handle_message(const std::shared_ptr<comm_session> &session, const int message_size);
+
+    int send_response(const std::shared_ptr<comm_session> &session, const msg::msg_parser &msg_parser, std::string_view request_id,
+                      std::string_view type, std::string_view content, const msg::CONTENT_KIND content_kind = msg::CONTENT_TEXT);
+
+    msg::msg_parser &get_parser(const msg::MSG_ENCODING encoding);
+
+    int dispatch(const std::string &container_name, std::function<void()> task);
 
-    int send(std::string_view message);
+    int dispatch_request(const std::shared_ptr<comm_session> &session, const std::string &container_name, std::function<void()> task);
+
+    void finish_request(const std::shared_ptr<comm_session> &session);
+
+    bool start_draining(comm_session &session);
+
+    bool is_drained(comm_session &session);
+
+    void run_lane(const std::string &container_name, std::function<void()> task);
+
+    void dispatch_batch_items(const std::shared_ptr<batch_ctx> &batch, const size_t count);
+
+    void run_batch_item(const std::shared_ptr<batch_ctx> &batch, const size_t index);
+
+    bool complete_batch_item(const std::shared_ptr<batch_ctx> &batch, const size_t index, const bool is_success, std::string_view content);
+
+    void send_batch_response(const std::shared_ptr<batch_ctx> &batch);
+
+    int send(const std::shared_ptr<comm_session> &session, std::string_view message, const bool keep_open = false);
+
+    int send_packet(comm_session &session, std::string_view packet);
+
+    int flush_session(comm_session &session);
+
+    void update_events(comm_session &session);
 
     void wait();
 
-    int read_socket();
+    int read_socket(comm_session &session);
+
+    std::string &reset_buffer(std::string &buffer);
 
     void uint32_to_bytes(uint8_t *dest, const uint32_t x);
 
+    uint32_t uint32_from_bytes(const uint8_t *data);
+
 } // namespace comm
 
 #endif
@@ -74,6 +74,14 @@ namespace conf
             cfg.docker.image_prefix = "evernode/sashimono:";
             cfg.docker.registry_port = docker_registry_port;
 
+            cfg.comm.max_msg_bytes = DEFAULT_MAX_MSG_BYTES;
+
+            cfg.db.journal_mode = DEFAULT_DB_JOURNAL_MODE;
+            cfg.db.synchronous = DEFAULT_DB_SYNCHRONOUS;
+            cfg.db.mmap_bytes = DEFAULT_DB_MMAP_BYTES;
+            cfg.db.busy_timeout_ms = DEFAULT_DB_BUSY_TIMEOUT_MS;
+            cfg.db.reader_count = DEFAULT_DB_READER_COUNT;
+
             cfg.log.max_file_count = 50;
             cfg.log.max_mbytes_per_file = 10;
             cfg.log.log_level = "inf";
@@ -171,8 +179,10 @@ namespace conf
         if (util::read_from_fd(fd, buf) == -1)
         {
             std::cerr << "Error reading from the config file. " << errno << '\n';
+            close(fd);
             return -1;
         }
+        close(fd);
 
         jsoncons::ojson d;
         try
@@ -267,6 +277,11 @@ namespace conf
                 cfg.system.max_cpu_us = system["max_cpu_us"].as<size_t>();
                 cfg.system.max_storage_kbytes = system["max_storage_kbytes"].as<size_t>();
                 cfg.system.max_instance_count = system["max_instance_count"].as<size_t>();
+                // Warm pool is optional and disabled by default.
+                cfg.system.warm_pool_size = system.contains("warm_pool_size") ? system["warm_pool_size"].as<size_t>() : 0;
+                cfg.system.restore_concurrency = system.contains("restore_concurrency") ? system["restore_concurrency"].as<size_t>() : 4;
+                cfg.system.usage_sample_secs = system.contains("usage_sample_secs") ? system["usage_sample_secs"].as<size_t>() : 5;
+                cfg.system.max_host_cpu_percent = system.contains("max_host_cpu_percent") ? system["max_host_cpu_percent"].as<size_t>() : 90;
             }
             catch (const std::exception &e)
             {
@@ -285,6 +300,64 @@ namespace conf
 
                 if (docker.contains("registry_port"))
                     cfg.docker.registry_port = docker["registry_port"].as<uint16_t>();
+                cfg.docker.image_cache_size = docker.contains("image_cache_size") ? docker["image_cache_size"].as<size_t>() : 5;
+                cfg.docker.image_prefetch_count = docker.contains("image_prefetch_count") ? docker["image_prefetch_count"].as<size_t>() : 2;
+            }
+            catch (const std::exception &e)
+            {
+                print_missing_field_error(jpath, e);
+                return -1;
+            }
+        }
+
+        // comm
+        {
+            jpath = "comm";
+
+            try
+            {
+                // Configs created by older versions do not have this section.
+                cfg.comm.max_msg_bytes = DEFAULT_MAX_MSG_BYTES;
+                if (d.contains("comm"))
+                {
+                    const jsoncons::ojson &comm = d["comm"];
+                    if (comm.contains("max_msg_bytes"))
+                        cfg.comm.max_msg_bytes = comm["max_msg_bytes"].as<uint32_t>();
+                }
+            }
+            catch (const std::exception &e)
+            {
+                print_missing_field_error(jpath, e);
+                return -1;
+            }
+        }
+
+        // db
+        {
+            jpath = "db";
+
+            try
+            {
+                // Configs created by older versions do not have this section.
+                cfg.db.journal_mode = DEFAULT_DB_JOURNAL_MODE;
+                cfg.db.synchronous = DEFAULT_DB_SYNCHRONOUS;
+                cfg.db.mmap_bytes = DEFAULT_DB_MMAP_BYTES;
+                cfg.db.busy_timeout_ms = DEFAULT_DB_BUSY_TIMEOUT_MS;
+                cfg.db.reader_count = DEFAULT_DB_READER_COUNT;
+                if (d.contains("db"))
+                {
+                    const jsoncons::ojson &db = d["db"];
+                    if (db.contains("journal_mode"))
+                        cfg.db.journal_mode = db["journal_mode"].as<std::string>();
+                    if (db.contains("synchronous"))
+                        cfg.db.synchronous = db["synchronous"].as<std::string>();
+                    if (db.contains("mmap_bytes"))
+                        cfg.db.mmap_bytes = db["mmap_bytes"].as<size_t>();
+                    if (db.contains("busy_timeout_ms"))
+                        cfg.db.busy_timeout_ms = db["busy_timeout_ms"].as<uint32_t>();
+                    if (db.contains("reader_count"))
+                        cfg.db.reader_count = db["reader_count"].as<size_t>();
+                }
             }
             catch (const std::exception &e)
             {
@@ -356,6 +429,10 @@ namespace conf
             system_config.insert_or_assign("max_cpu_us", cfg.system.max_cpu_us);
             system_config.insert_or_assign("max_storage_kbytes", cfg.system.max_storage_kbytes);
             system_config.insert_or_assign("max_instance_count", cfg.system.max_instance_count);
+            system_config.insert_or_assign("warm_pool_size", cfg.system.warm_pool_size);
+            system_config.insert_or_assign("restore_concurrency", cfg.system.restore_concurrency);
+            system_config.insert_or_assign("usage_sample_secs", cfg.system.usage_sample_secs);
+            system_config.insert_or_assign("max_host_cpu_percent", cfg.system.max_host_cpu_percent);
 
             d.insert_or_assign("system", system_config);
         }
@@ -364,9 +441,29 @@ namespace conf
         {
             jsoncons::ojson docker_config;
             docker_config.insert_or_assign("registry_port", cfg.docker.registry_port);
+            docker_config.insert_or_assign("image_cache_size", cfg.docker.image_cache_size);
+            docker_config.insert_or_assign("image_prefetch_count", cfg.docker.image_prefetch_count);
             d.insert_or_assign("docker", docker_config);
         }
 
+        // Comm configs.
+        {
+            jsoncons::ojson comm_config;
+            comm_config.insert_or_assign("max_msg_bytes", cfg.comm.max_msg_bytes);
+            d.insert_or_assign("comm", comm_config);
+        }
+
+        // Database configs.
+        {
+            jsoncons::ojson db_config;
+            db_config.insert_or_assign("journal_mode", cfg.db.journal_mode);
+            db_config.insert_or_assign("synchronous", cfg.db.synchronous);
+            db_config.insert_or_assign("mmap_bytes", cfg.db.mmap_bytes);
+            db_config.insert_or_assign("busy_timeout_ms", cfg.db.busy_timeout_ms);
+            db_config.insert_or_assign("reader_count", cfg.db.reader_count);
+            d.insert_or_assign("db", db_config);
+        }
+
         // Log configs.
         {
             jsoncons::ojson log_config;
@@ -464,6 +561,14 @@ namespace conf
 
         bool fields_invalid = false;
         fields_invalid |= cfg.log.log_level.empty() && std::cerr << "Invalid value for loglevel.\n";
+        fields_invalid |= cfg.comm.max_msg_bytes == 0 && std::cerr << "Invalid value for max_msg_bytes.\n";
+        fields_invalid |= (cfg.db.journal_mode != "wal" && cfg.db.journal_mode != "delete" && cfg.db.journal_mode != "truncate" && cfg.db.journal_mode != "persist") && std::cerr << "Invalid value for db journal_mode.\n";
+        fields_invalid |= (cfg.db.synchronous != "off" && cfg.db.synchronous != "normal" && cfg.db.synchronous != "full" && cfg.db.synchronous != "extra") && std::cerr << "Invalid value for db synchronous.\n";
+        fields_invalid |= cfg.system.max_instance_count == 0 && std::cerr << "Invalid value for max_instance_count.\n";
+        fields_invalid |= cfg.system.warm_pool_size > cfg.system.max_instance_count && std::cerr << "warm_pool_size cannot exceed max_instance_count.\n";
+        fields_invalid |= cfg.system.restore_concurrency == 0 && std::cerr << "Invalid value for restore_concurrency.\n";
+        fields_invalid |= (cfg.system.max_host_cpu_percent == 0 || cfg.system.max_host_cpu_percent > 100) && std::cerr << "Invalid value for max_host_cpu_percent.\n";
+        fields_invalid |= cfg.docker.image_prefetch_count > cfg.docker.image_cache_size && std::cerr << "image_prefetch_count cannot exceed image_cache_size.\n";
 
         if (fields_invalid)
         {
@@ -481,4 +586,42 @@ namespace conf
         return 0;
     }
 
+    /**
+     * Lists the fields of the new config which differ from the running config but only take effect after a restart.
+     * The log level, the resources, the warm pool size and the docker registry port are applied by a reload and are not listed.
+     * The restore concurrency only applies to the instance restore at start, so it is listed.
+     * @param fields List to populate with the json paths of the changed fields.
+     * @param running Config the agent is running with.
+     * @param next Config read from the config file.
+     */
+    void get_restart_fields(std::vector<std::string> &fields, const sa_config &running, const sa_config &next)
+    {
+        const auto check = [&](const char *path, const bool is_changed)
+        {
+            if (is_changed)
+                fields.push_back(path);
+        };
+
+        check("hp.host_address", running.hp.host_address != next.hp.host_address);
+        check("hp.init_peer_port", running.hp.init_peer_port != next.hp.init_peer_port);
+        check("hp.init_user_port", running.hp.init_user_port != next.hp.init_user_port);
+        check("hp.init_gp_tcp_port", running.hp.init_gp_tcp_port != next.hp.init_gp_tcp_port);
+        check("hp.init_gp_udp_port", running.hp.init_gp_udp_port != next.hp.init_gp_udp_port);
+        check("system.restore_concurrency", running.system.restore_concurrency != next.system.restore_concurrency);
+        check("system.usage_sample_secs", running.system.usage_sample_secs != next.system.usage_sample_secs);
+        check("system.max_host_cpu_percent", running.system.max_host_cpu_percent != next.system.max_host_cpu_percent);
+        check("docker.image_prefix", running.docker.image_prefix != next.docker.image_prefix);
+        check("docker.image_cache_size", running.docker.image_cache_size != next.docker.image_cache_size);
+        check("docker.image_prefetch_count", running.docker.image_prefetch_count != next.docker.image_prefetch_count);
+        check("comm.max_msg_bytes", running.comm.max_msg_bytes != next.comm.max_msg_bytes);
+        check("db.journal_mode", running.db.journal_mode != next.db.journal_mode);
+        check("db.synchronous", running.db.synchronous != next.db.synchronous);
+        check("db.mmap_bytes", running.db.mmap_bytes != next.db.mmap_bytes);
+        check("db.busy_timeout_ms", running.db.busy_timeout_ms != next.db.busy_timeout_ms);
+        check("db.reader_count", running.db.reader_count != next.db.reader_count);
+        check("log.loggers", running.log.loggers != next.log.loggers);
+        check("log.max_mbytes_per_file", running.log.max_mbytes_per_file != next.log.max_mbytes_per_file);
+        check("log.max_file_count", running.log.max_file_count != next.log.max_file_count);
+    }
+
 }
\ No newline at end of file
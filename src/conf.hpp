@@ -75,6 +75,8 @@ namespace conf
         uint16_t init_gp_udp_port = 0;
     };
 
+    // The max instance count and the max resources are changed by config reloads. They are read under the allocation
+    // lock of hp_manager while the agent runs.
     struct system_config
     {
         size_t max_cpu_us = 0;         // Max CPU time allocated to all instances (out of 1000000 microsec).
@@ -82,6 +84,10 @@ namespace conf
         size_t max_swap_kbytes = 0;    // Max swap memory allocated to all instances in KB.
         size_t max_storage_kbytes = 0; // Max physical storage  allocated to all instances in KB.
         size_t max_instance_count = 0; // Max number of instances that can be created.
+        size_t warm_pool_size = 0;     // Number of pre-provisioned instance users kept ready for new instances.
+        size_t restore_concurrency = 4; // Max instances brought up in parallel when the agent starts.
+        size_t usage_sample_secs = 5;    // Interval of the instance resource usage sampling. 0 disables sampling and the host admission check.
+        size_t max_host_cpu_percent = 90; // Creates are refused while the host cpu usage is above this.
     };
 
     struct docker_config
@@ -89,6 +95,22 @@ namespace conf
         std::string image_prefix;     // Docker image prefixes allowed to be used for contracts.
         uint16_t registry_port = 0;   // 0 means bypass private docker registry.
         std::string registry_address; // This is dynamically constructed at load time.
+        size_t image_cache_size = 5;     // Images kept in the host image cache shared by the instance users. 0 disables the cache.
+        size_t image_prefetch_count = 2; // Most used cached images loaded into the warm pool users ahead of their leases.
+    };
+
+    struct comm_config
+    {
+        uint32_t max_msg_bytes = 0; // Max size of a message accepted on the agent socket.
+    };
+
+    struct db_config
+    {
+        std::string journal_mode;     // Sqlite journal mode of the agent database (wal, delete, truncate or persist).
+        std::string synchronous;      // Sqlite synchronous setting of the agent database (off, normal, full or extra).
+        size_t mmap_bytes = 0;        // Bytes of the database memory mapped for reads. 0 disables memory mapping.
+        uint32_t busy_timeout_ms = 0; // Max time to wait for a lock held by another connection or process.
+        size_t reader_count = 0;      // Read only connections serving concurrent queries. Only used in wal mode.
     };
 
     struct sa_config
@@ -97,6 +119,8 @@ namespace conf
         hp_config hp;
         system_config system;
         docker_config docker;
+        comm_config comm;
+        db_config db;
         log_config log;
     };
 
@@ -110,6 +134,7 @@ namespace conf
         std::string socket_path; // Path to the unix socket file.
 
         std::string user_install_sh;
+        std::string dns_evernode_sh;
         std::string user_uninstall_sh;
 
         std::string config_file; // Full path to the config file.
@@ -117,6 +142,13 @@ namespace conf
         std::string data_dir;    // Data directory full path.
     };
 
+    constexpr uint32_t DEFAULT_MAX_MSG_BYTES = 1 * 1024 * 1024; // 1MB
+    constexpr const char *DEFAULT_DB_JOURNAL_MODE = "wal";
+    constexpr const char *DEFAULT_DB_SYNCHRONOUS = "normal";
+    constexpr size_t DEFAULT_DB_MMAP_BYTES = 64 * 1024 * 1024; // 64MB
+    constexpr uint32_t DEFAULT_DB_BUSY_TIMEOUT_MS = 5000;
+    constexpr size_t DEFAULT_DB_READER_COUNT = 2;
+
     // Global context struct exposed to the application.
     // Other modules will access context values via this.
     extern sa_context ctx;
@@ -146,6 +178,8 @@ namespace conf
 
     int validate_config(const sa_config &cfg);
 
+    void get_restart_fields(std::vector<std::string> &fields, const sa_config &running, const sa_config &next);
+
 }
 
 #endif
\ No newline at end of file
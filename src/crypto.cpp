@@ -3,6 +3,10 @@
 
 namespace crypto
 {
+    key_pool keys;
+
+    constexpr int KEY_POOL_NICE = 19;          // Key generation only uses idle cpu time.
+    constexpr int KEY_POOL_IDLE_WAIT_SECS = 1; // Max wait of the pool thread before checking for free slots.
 
     /**
      * Initializes the crypto subsystem. Must be called once during application startup.
@@ -19,8 +23,126 @@ namespace crypto
         return 0;
     }
 
+    /**
+     * Starts the thread keeping the key pool filled.
+     * @param capacity Number of key pairs to keep ready.
+     * @return 0 on success and -1 on error.
+     */
+    int init_key_pool(const size_t capacity)
+    {
+        keys.capacity = std::max(capacity, MIN_KEY_POOL_SIZE);
+        keys.slots = std::make_unique<key_slot[]>(keys.capacity);
+        for (size_t i = 0; i < keys.capacity; i++)
+            keys.slots[i].sequence.store(i, std::memory_order_relaxed);
+
+        try
+        {
+            keys.pool_thread = std::thread(key_pool_loop);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error starting the key pool thread. " << e.what() << "\n";
+            keys.slots.reset();
+            keys.capacity = 0;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Stops the key pool thread and clears the pooled keys.
+     */
+    void deinit()
+    {
+        if (keys.pool_thread.joinable())
+        {
+            {
+                std::scoped_lock lock(keys.wake_mutex);
+                keys.is_shutting_down = true;
+            }
+            keys.wake_cv.notify_one();
+            keys.pool_thread.join();
+        }
+
+        if (keys.slots)
+            sodium_memzero(keys.slots.get(), sizeof(key_slot) * keys.capacity);
+        keys.slots.reset();
+        keys.capacity = 0;
+    }
+
+    /**
+     * Fills the free slots of the key pool at the lowest priority and sleeps while the pool is full.
+     */
+    void key_pool_loop()
+    {
+        util::mask_signal();
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), KEY_POOL_NICE);
+
+        while (true)
+        {
+            key_slot &slot = keys.slots[keys.tail % keys.capacity];
+            if (slot.sequence.load(std::memory_order_acquire) == keys.tail)
+            {
+                crypto_sign_ed25519_keypair(slot.pubkey, slot.seckey);
+                slot.sequence.store(keys.tail + 1, std::memory_order_release);
+                keys.tail++;
+                continue;
+            }
+
+            // Pool is full. Taking a key notifies, the timeout covers a notification missed while not waiting.
+            std::unique_lock lock(keys.wake_mutex);
+            if (keys.is_shutting_down)
+                break;
+            keys.wake_cv.wait_for(lock, std::chrono::seconds(KEY_POOL_IDLE_WAIT_SECS));
+            if (keys.is_shutting_down)
+                break;
+        }
+    }
+
+    /**
+     * Takes a ready key pair from the key pool.
+     * @param pubkey Buffer of crypto_sign_ed25519_PUBLICKEYBYTES to hold the public key.
+     * @param seckey Buffer of crypto_sign_ed25519_SECRETKEYBYTES to hold the secret key.
+     * @return true if a key pair was taken, false if the pool is empty or not running.
+     */
+    bool take_pooled_keys(unsigned char *pubkey, unsigned char *seckey)
+    {
+        if (!keys.slots)
+            return false;
+
+        size_t pos = keys.head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            key_slot &slot = keys.slots[pos % keys.capacity];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == pos + 1)
+            {
+                if (keys.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    memcpy(pubkey, slot.pubkey, sizeof(slot.pubkey));
+                    memcpy(seckey, slot.seckey, sizeof(slot.seckey));
+                    sodium_memzero(slot.seckey, sizeof(slot.seckey));
+                    slot.sequence.store(pos + keys.capacity, std::memory_order_release); // Free for the next round.
+                    keys.wake_cv.notify_one();
+                    return true;
+                }
+                // Failed exchange reloads pos with the current head.
+            }
+            else if (sequence <= pos)
+            {
+                return false; // Slot at the head is not filled yet.
+            }
+            else
+            {
+                pos = keys.head.load(std::memory_order_relaxed); // Another thread took this slot.
+            }
+        }
+    }
+
     /**
      * Generates a signing key pair using libsodium and assigns them to the provided strings.
+     * A pre-generated key pair is used if the key pool has one.
      */
     void generate_signing_keys(std::string &pubkey, std::string &seckey)
     {
@@ -33,9 +155,10 @@ namespace crypto
         seckey.resize(crypto_sign_ed25519_SECRETKEYBYTES + 1);
         seckey[0] = crypto::KEYPFX_ed25519;
 
-        crypto_sign_ed25519_keypair(
-            reinterpret_cast<unsigned char *>(pubkey.data() + 1),  // +1 to skip the prefix byte.
-            reinterpret_cast<unsigned char *>(seckey.data() + 1)); // +1 to skip the prefix byte.
+        unsigned char *pk = reinterpret_cast<unsigned char *>(pubkey.data() + 1); // +1 to skip the prefix byte.
+        unsigned char *sk = reinterpret_cast<unsigned char *>(seckey.data() + 1); // +1 to skip the prefix byte.
+        if (!take_pooled_keys(pk, sk))
+            crypto_sign_ed25519_keypair(pk, sk);
     }
 
     /**
@@ -13,8 +13,39 @@ namespace crypto
     // Prefix byte to append to ed25519 keys.
     constexpr unsigned char KEYPFX_ed25519 = 0xED;
 
+    constexpr size_t MIN_KEY_POOL_SIZE = 2; // Keys kept ready even without a warm pool.
+
+    // Slot of the key pool ring holding a pre-generated ed25519 key pair.
+    struct key_slot
+    {
+        std::atomic<size_t> sequence = 0; // Equals the fill position when free and the take position + 1 when filled.
+        unsigned char pubkey[crypto_sign_ed25519_PUBLICKEYBYTES];
+        unsigned char seckey[crypto_sign_ed25519_SECRETKEYBYTES];
+    };
+
+    // Bounded ring of key pairs filled by a low priority thread. Taking a key from the ring does not lock.
+    struct key_pool
+    {
+        std::unique_ptr<key_slot[]> slots;
+        size_t capacity = 0;
+        std::atomic<size_t> head = 0; // Next position to take a key from.
+        size_t tail = 0;              // Next position to fill. Only used by the pool thread.
+        std::thread pool_thread;
+        bool is_shutting_down = false;
+        std::mutex wake_mutex;
+        std::condition_variable wake_cv; // Notified when a key is taken or the pool is shutting down.
+    };
+
     int init();
 
+    int init_key_pool(const size_t capacity);
+
+    void deinit();
+
+    void key_pool_loop();
+
+    bool take_pooled_keys(unsigned char *pubkey, unsigned char *seckey);
+
     void random_bytes(std::string &result, const size_t len);
 
     void generate_signing_keys(std::string &pubkey, std::string &seckey);
@@ -23,4 +54,4 @@ namespace crypto
 
     const bool verify_uuid(const std::string &uuid);
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,836 @@
+#include "docker_client.hpp"
+#include "image_cache.hpp"
+#include "../util/util.hpp"
+#include "../metrics.hpp"
+
+namespace docker
+{
+    constexpr const char *DOCKER_SOCKET_PATH = "/run/user/%d/docker.sock";
+    constexpr int PING_TIMEOUT_SECS = 5;
+    constexpr const char *HEADER_END = "\r\n\r\n";
+    constexpr const char *LINE_END = "\r\n";
+    constexpr size_t READ_CHUNK_SIZE = 4096;
+    constexpr size_t MAX_RESPONSE_SIZE = 16 * 1024 * 1024; // Max bytes buffered while reading a response.
+
+    // Daemon connections keyed by the uid of the instance user.
+    std::unordered_map<int, std::shared_ptr<daemon_connection>> connections;
+    std::mutex connections_mutex;
+
+    /**
+     * Closes all the daemon connections.
+     */
+    void deinit()
+    {
+        std::scoped_lock lock(connections_mutex);
+        for (auto &[uid, conn] : connections)
+        {
+            std::scoped_lock conn_lock(conn->mutex);
+            if (conn->fd != -1)
+            {
+                close(conn->fd);
+                conn->fd = -1;
+            }
+        }
+        connections.clear();
+    }
+
+    /**
+     * Sends a request to the docker daemon of the given user and reads the response. Connections are kept alive
+     * and reused for the next requests to the same daemon.
+     * @param uid Uid of the instance user running the rootless docker daemon.
+     * @param method HTTP method.
+     * @param path Request path including the query string.
+     * @param res Response to be populated.
+     * @param body JSON request body if any.
+     * @param timeout_secs Max time to wait for sending the request and for each read of the response.
+     * @param upload_fd File to be sent as a tar request body instead of the JSON body. -1 if none.
+     * @param download_fd File to write a successful response body into instead of buffering it. -1 if none.
+     * @return 0 if a response is received and -1 on connection error.
+     */
+    int request(const int uid, std::string_view method, std::string_view path, response &res, std::string_view body, const int timeout_secs,
+                const int upload_fd, const int download_fd)
+    {
+        std::shared_ptr<daemon_connection> conn;
+        {
+            std::scoped_lock lock(connections_mutex);
+            std::shared_ptr<daemon_connection> &entry = connections[uid];
+            if (!entry)
+                entry = std::make_shared<daemon_connection>();
+            conn = entry;
+        }
+
+        std::scoped_lock lock(conn->mutex);
+        const timeval timeout{timeout_secs, 0};
+
+        // A kept alive connection might have been closed by the daemon meanwhile (eg. on a daemon restart).
+        // If nothing was received on such a connection the request is retried once on a new connection.
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            const bool is_reused = conn->fd != -1;
+            if (!is_reused && (conn->fd = connect_daemon(uid)) == -1)
+                return -1;
+
+            bool keep_alive = true, is_received = false;
+            if (setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+                setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0 &&
+                send_request(conn->fd, method, path, body, upload_fd) == 0 &&
+                read_response(conn->fd, res, keep_alive, is_received, download_fd) == 0)
+            {
+                if (!keep_alive)
+                {
+                    close(conn->fd);
+                    conn->fd = -1;
+                }
+                return 0;
+            }
+
+            close(conn->fd);
+            conn->fd = -1;
+
+            if (!is_reused || is_received)
+                break;
+        }
+
+        LOG_ERROR << "Docker request failed. uid: " << uid << " " << method << " " << path;
+        return -1;
+    }
+
+    /**
+     * Creates a container. The image is provided through the host image cache if it does not exist in the daemon.
+     * @param uid Uid of the instance user.
+     * @param config Settings of the container.
+     * @param timeout_secs Max time to wait for the daemon.
+     * @return 0 on success and -1 on error.
+     */
+    int create_container(const int uid, const container_config &config, const int timeout_secs)
+    {
+        metrics::scoped_timer timer("docker.create");
+        count_image_use(config.image);
+
+        jsoncons::ojson exposed_ports(jsoncons::json_object_arg);
+        jsoncons::ojson port_bindings(jsoncons::json_object_arg);
+        for (const port_binding &binding : config.ports)
+        {
+            const std::string port = std::to_string(binding.port);
+            const std::string key = port + (binding.is_udp ? "/udp" : "/tcp");
+
+            jsoncons::ojson host_port(jsoncons::json_object_arg);
+            host_port.insert_or_assign("HostPort", port);
+            jsoncons::ojson host_ports(jsoncons::json_array_arg);
+            host_ports.push_back(host_port);
+
+            exposed_ports.insert_or_assign(key, jsoncons::ojson(jsoncons::json_object_arg));
+            port_bindings.insert_or_assign(key, host_ports);
+        }
+
+        jsoncons::ojson cmd(jsoncons::json_array_arg);
+        for (const std::string &arg : config.cmd)
+            cmd.push_back(arg);
+
+        // We keep docker logs at size limit of 10mb. For the local log driver compression, minimum max-file should be 2.
+        jsoncons::ojson log_options(jsoncons::json_object_arg);
+        log_options.insert_or_assign("max-size", "5m");
+        log_options.insert_or_assign("max-file", "2");
+        jsoncons::ojson log_config(jsoncons::json_object_arg);
+        log_config.insert_or_assign("Type", "local");
+        log_config.insert_or_assign("Config", log_options);
+
+        jsoncons::ojson restart_policy(jsoncons::json_object_arg);
+        restart_policy.insert_or_assign("Name", "unless-stopped");
+
+        jsoncons::ojson mount(jsoncons::json_object_arg);
+        mount.insert_or_assign("Type", "bind");
+        mount.insert_or_assign("Source", config.mount_source);
+        mount.insert_or_assign("Target", config.mount_target);
+        jsoncons::ojson mounts(jsoncons::json_array_arg);
+        mounts.push_back(mount);
+
+        jsoncons::ojson host_config(jsoncons::json_object_arg);
+        host_config.insert_or_assign("PortBindings", port_bindings);
+        host_config.insert_or_assign("RestartPolicy", restart_policy);
+        host_config.insert_or_assign("LogConfig", log_config);
+        host_config.insert_or_assign("Mounts", mounts);
+
+        jsoncons::ojson d(jsoncons::json_object_arg);
+        d.insert_or_assign("Image", config.image);
+        d.insert_or_assign("Cmd", cmd);
+        d.insert_or_assign("Tty", true);
+        d.insert_or_assign("OpenStdin", true);
+        d.insert_or_assign("StopSignal", "SIGINT");
+        d.insert_or_assign("ExposedPorts", exposed_ports);
+        d.insert_or_assign("HostConfig", host_config);
+
+        const std::string path = "/containers/create?name=" + url_encode(config.name);
+        const std::string body = d.to_string();
+
+        response res;
+        if (request(uid, "POST", path, res, body, timeout_secs) == -1)
+            return -1;
+
+        // Unlike the docker cli, the api does not pull a missing image on create.
+        if (res.status == 404)
+        {
+            LOG_INFO << "Image " << config.image << " not found in the daemon of uid " << uid << ". Providing.";
+            if (provide_image(uid, config.image, timeout_secs) == -1 ||
+                request(uid, "POST", path, res, body, timeout_secs) == -1)
+                return -1;
+        }
+
+        if (res.status != 201)
+        {
+            LOG_ERROR << "Error creating container " << config.name << ". " << res.status << ": " << res.message;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Pulls an image into the daemon.
+     * @param uid Uid of the instance user.
+     * @param image Image name with an optional tag.
+     * @param timeout_secs Max time to wait for each progress update of the daemon.
+     * @return 0 on success and -1 on error.
+     */
+    int pull_image(const int uid, std::string_view image, const int timeout_secs)
+    {
+        metrics::scoped_timer timer("docker.pull");
+        // The daemon pulls all the tags if no tag is given.
+        std::string_view name = image, tag = "latest";
+        const size_t slash_pos = image.rfind('/');
+        const size_t colon_pos = image.rfind(':');
+        if (colon_pos != std::string_view::npos && (slash_pos == std::string_view::npos || colon_pos > slash_pos))
+        {
+            name = image.substr(0, colon_pos);
+            tag = image.substr(colon_pos + 1);
+        }
+
+        const std::string path = "/images/create?fromImage=" + url_encode(name) + "&tag=" + url_encode(tag);
+        response res;
+        if (request(uid, "POST", path, res, {}, timeout_secs) == -1)
+            return -1;
+
+        // Pull failures after the progress stream started are reported inside the stream.
+        if (res.status != 200 || res.body.find("\"error\"") != std::string::npos)
+        {
+            LOG_ERROR << "Error pulling image " << image << ". " << res.status << ": " << (res.message.empty() ? res.body : res.message);
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Gets the content addressed id of an image in the daemon.
+     * @param uid Uid of the instance user.
+     * @param image Image name with an optional tag.
+     * @param id Image id (sha256:<digest>) to be populated.
+     * @return 0 on success and -1 on error.
+     */
+    int get_image_id(const int uid, std::string_view image, std::string &id)
+    {
+        response res;
+        if (request(uid, "GET", "/images/" + url_encode(image) + "/json", res) == -1)
+            return -1;
+
+        if (res.status != 200)
+        {
+            LOG_ERROR << "Error inspecting image " << image << ". " << res.status << ": " << res.message;
+            return -1;
+        }
+
+        try
+        {
+            const jsoncons::ojson d = jsoncons::ojson::parse(res.body);
+            id = d["Id"].as<std::string>();
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Invalid inspect response for image " << image << ". " << e.what();
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Exports an image with its layers as a tar archive.
+     * @param uid Uid of the instance user.
+     * @param image Image name with an optional tag.
+     * @param out_fd File to write the archive into.
+     * @param timeout_secs Max time to wait for each read of the archive.
+     * @return 0 on success and -1 on error.
+     */
+    int save_image(const int uid, std::string_view image, const int out_fd, const int timeout_secs)
+    {
+        metrics::scoped_timer timer("docker.save");
+        response res;
+        if (request(uid, "GET", "/images/get?names=" + url_encode(image), res, {}, timeout_secs, -1, out_fd) == -1)
+            return -1;
+
+        if (res.status != 200)
+        {
+            LOG_ERROR << "Error saving image " << image << ". " << res.status << ": " << res.message;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Imports the images of a tar archive made by save_image. Layers the daemon already has are not imported again.
+     * @param uid Uid of the instance user.
+     * @param in_fd Archive file.
+     * @param timeout_secs Max time to wait for sending the archive and for each progress update of the import.
+     * @return 0 on success and -1 on error.
+     */
+    int load_image(const int uid, const int in_fd, const int timeout_secs)
+    {
+        metrics::scoped_timer timer("docker.load");
+        response res;
+        if (request(uid, "POST", "/images/load", res, {}, timeout_secs, in_fd) == -1)
+            return -1;
+
+        // Import failures are reported inside the progress stream like with the pulls.
+        if (res.status != 200 || res.body.find("\"error\"") != std::string::npos)
+        {
+            LOG_ERROR << "Error loading image archive. " << res.status << ": " << (res.message.empty() ? res.body : res.message);
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Starts a container. Starting an already running container is considered a success.
+     * @param uid Uid of the instance user.
+     * @param name Name of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int start_container(const int uid, std::string_view name)
+    {
+        metrics::scoped_timer timer("docker.start");
+        response res;
+        if (request(uid, "POST", "/containers/" + url_encode(name) + "/start", res) == -1)
+            return -1;
+
+        if (res.status != 204 && res.status != 304)
+        {
+            LOG_ERROR << "Error starting container " << name << ". " << res.status << ": " << res.message;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Stops a container. Stopping an already stopped container is considered a success.
+     * @param uid Uid of the instance user.
+     * @param name Name of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int stop_container(const int uid, std::string_view name)
+    {
+        metrics::scoped_timer timer("docker.stop");
+        response res;
+        if (request(uid, "POST", "/containers/" + url_encode(name) + "/stop", res) == -1)
+            return -1;
+
+        if (res.status != 204 && res.status != 304)
+        {
+            LOG_ERROR << "Error stopping container " << name << ". " << res.status << ": " << res.message;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Forcefully removes a container.
+     * @param uid Uid of the instance user.
+     * @param name Name of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int remove_container(const int uid, std::string_view name)
+    {
+        metrics::scoped_timer timer("docker.remove");
+        response res;
+        if (request(uid, "DELETE", "/containers/" + url_encode(name) + "?force=true", res) == -1)
+            return -1;
+
+        if (res.status != 204)
+        {
+            LOG_ERROR << "Error removing container " << name << ". " << res.status << ": " << res.message;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Gets the state of a container as reported by the daemon (created, running, exited etc.).
+     * @param uid Uid of the instance user.
+     * @param name Name of the container.
+     * @param status Container status to be populated.
+     * @return 0 on success and -1 on error.
+     */
+    int get_container_status(const int uid, std::string_view name, std::string &status)
+    {
+        metrics::scoped_timer timer("docker.inspect");
+        response res;
+        if (request(uid, "GET", "/containers/" + url_encode(name) + "/json", res) == -1)
+            return -1;
+
+        if (res.status != 200)
+        {
+            LOG_ERROR << "Error inspecting container " << name << ". " << res.status << ": " << res.message;
+            return -1;
+        }
+
+        try
+        {
+            const jsoncons::ojson d = jsoncons::ojson::parse(res.body);
+            status = d["State"]["Status"].as<std::string>();
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Invalid inspect response for container " << name << ". " << e.what();
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Checks whether the daemon of the given user is up and answering requests.
+     * @param uid Uid of the instance user.
+     * @return 0 if the daemon is ready and -1 otherwise.
+     */
+    int ping(const int uid)
+    {
+        // Check the socket first so a daemon which is still starting up is not logged as an error.
+        char path[sizeof(sockaddr_un::sun_path)];
+        snprintf(path, sizeof(path), DOCKER_SOCKET_PATH, uid);
+        if (access(path, F_OK) == -1)
+            return -1;
+
+        response res;
+        if (request(uid, "GET", "/_ping", res, {}, PING_TIMEOUT_SECS) == -1 || res.status != 200)
+            return -1;
+        return 0;
+    }
+
+    /**
+     * Closes and forgets the daemon connection of the given user. Used when the user is being removed.
+     * @param uid Uid of the instance user.
+     */
+    void disconnect(const int uid)
+    {
+        std::shared_ptr<daemon_connection> conn;
+        {
+            std::scoped_lock lock(connections_mutex);
+            const auto itr = connections.find(uid);
+            if (itr == connections.end())
+                return;
+            conn = itr->second;
+            connections.erase(itr);
+        }
+
+        std::scoped_lock lock(conn->mutex);
+        if (conn->fd != -1)
+        {
+            close(conn->fd);
+            conn->fd = -1;
+        }
+    }
+
+    /**
+     * Connects to the rootless docker daemon socket of the given user.
+     * @param uid Uid of the instance user.
+     * @return Connected socket fd on success and -1 on error.
+     */
+    int connect_daemon(const int uid)
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), DOCKER_SOCKET_PATH, uid);
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            LOG_ERROR << errno << ": Error creating docker daemon socket.";
+            return -1;
+        }
+
+        if (connect(fd, (const sockaddr *)&addr, sizeof(addr)) == -1)
+        {
+            LOG_ERROR << errno << ": Error connecting to docker daemon " << addr.sun_path;
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /**
+     * Writes a HTTP request to the connection.
+     * @param fd Connection fd.
+     * @param method HTTP method.
+     * @param path Request path including the query string.
+     * @param body JSON request body if any.
+     * @param upload_fd File to be sent as a tar request body instead of the JSON body. -1 if none.
+     * @return 0 on success and -1 on error.
+     */
+    int send_request(const int fd, std::string_view method, std::string_view path, std::string_view body, const int upload_fd)
+    {
+        struct stat st{};
+        if (upload_fd != -1 && fstat(upload_fd, &st) == -1)
+            return -1;
+        const size_t content_length = upload_fd != -1 ? st.st_size : body.size();
+
+        std::string req;
+        req.reserve(128 + path.size() + body.size());
+        req.append(method).append(" ").append(path).append(" HTTP/1.1\r\nHost: docker\r\n");
+        if (upload_fd != -1)
+            req.append("Content-Type: application/x-tar\r\n");
+        else if (!body.empty())
+            req.append("Content-Type: application/json\r\n");
+        req.append("Content-Length: ").append(std::to_string(content_length)).append(HEADER_END);
+        if (upload_fd == -1)
+            req.append(body);
+
+        size_t sent = 0;
+        while (sent < req.size())
+        {
+            const ssize_t ret = send(fd, req.data() + sent, req.size() - sent, MSG_NOSIGNAL);
+            if (ret == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            sent += ret;
+        }
+
+        // The file is sent from the page cache without copying it through the agent.
+        off_t offset = 0;
+        while (upload_fd != -1 && (size_t)offset < content_length)
+        {
+            const ssize_t ret = sendfile(fd, upload_fd, &offset, content_length - offset);
+            if (ret == -1 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Reads a HTTP response from the connection. Content-Length, chunked and connection close delimited bodies are supported.
+     * @param fd Connection fd.
+     * @param res Response to be populated.
+     * @param keep_alive Set to false if the connection cannot be reused.
+     * @param is_received Set to true if any part of the response was received.
+     * @param download_fd File to write a successful response body into instead of buffering it. -1 if none.
+     * @return 0 on success and -1 on error.
+     */
+    int read_response(const int fd, response &res, bool &keep_alive, bool &is_received, const int download_fd)
+    {
+        std::string buf;
+        size_t header_end = 0;
+        const int header_res = read_until(fd, buf, 0, HEADER_END, header_end);
+        is_received = !buf.empty();
+        if (header_res == -1)
+            return -1;
+
+        // Status line looks like "HTTP/1.1 200 OK".
+        const std::string_view headers(buf.data(), header_end);
+        const size_t status_pos = headers.find(' ');
+        if (status_pos == std::string_view::npos || util::stoi(std::string(headers.substr(status_pos + 1, 3)), res.status) == -1)
+        {
+            LOG_ERROR << "Invalid docker response status line.";
+            return -1;
+        }
+        keep_alive = headers.substr(0, 8) != "HTTP/1.0";
+
+        bool is_chunked = false, has_length = false;
+        size_t content_length = 0;
+        size_t line_start = headers.find(LINE_END);
+        while (line_start != std::string_view::npos)
+        {
+            line_start += 2;
+            const size_t line_end = headers.find(LINE_END, line_start);
+            const std::string_view line = headers.substr(line_start, line_end == std::string_view::npos ? std::string_view::npos : line_end - line_start);
+            const size_t colon_pos = line.find(':');
+            if (colon_pos != std::string_view::npos)
+            {
+                std::string name(line.substr(0, colon_pos));
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                std::string value(line.substr(colon_pos + 1));
+                std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+
+                if (name == "content-length")
+                {
+                    has_length = true;
+                    content_length = strtoull(value.data(), NULL, 10);
+                }
+                else if (name == "transfer-encoding")
+                {
+                    is_chunked = value.find("chunked") != std::string::npos;
+                }
+                else if (name == "connection")
+                {
+                    keep_alive = value.find("close") == std::string::npos;
+                }
+            }
+            line_start = line_end;
+        }
+
+        size_t pos = header_end + 4;
+        res.body.clear();
+        res.message.clear();
+
+        // Large bodies like image archives go to the file as they arrive. Error bodies are still buffered for the message.
+        const bool is_streamed = download_fd != -1 && res.status == 200;
+
+        if (is_chunked)
+        {
+            while (true)
+            {
+                size_t size_end = 0;
+                if (read_until(fd, buf, pos, LINE_END, size_end) == -1)
+                    return -1;
+                const size_t chunk_size = strtoull(buf.data() + pos, NULL, 16);
+                pos = size_end + 2;
+
+                if (chunk_size == 0)
+                {
+                    // Skip the trailers until the empty line which ends the message.
+                    bool is_empty_line = false;
+                    while (!is_empty_line)
+                    {
+                        size_t trailer_end = 0;
+                        if (read_until(fd, buf, pos, LINE_END, trailer_end) == -1)
+                            return -1;
+                        is_empty_line = trailer_end == pos;
+                        pos = trailer_end + 2;
+                    }
+                    break;
+                }
+
+                if (is_streamed)
+                {
+                    if (stream_bytes(fd, buf, pos, chunk_size, download_fd) == -1 || read_bytes(fd, buf, pos + 2) == -1)
+                        return -1;
+                    buf.erase(0, pos + 2);
+                    pos = 0;
+                    continue;
+                }
+
+                // The buffer is limited by read_more, but the body piles up across the chunks.
+                if (chunk_size > MAX_RESPONSE_SIZE - res.body.size())
+                {
+                    LOG_ERROR << "Docker response exceeded " << MAX_RESPONSE_SIZE << " bytes.";
+                    return -1;
+                }
+
+                if (read_bytes(fd, buf, pos + chunk_size + 2) == -1)
+                    return -1;
+                res.body.append(buf, pos, chunk_size);
+
+                // Drop the consumed data so long progress streams don't pile up in the buffer.
+                buf.erase(0, pos + chunk_size + 2);
+                pos = 0;
+            }
+        }
+        else if (has_length && is_streamed)
+        {
+            if (stream_bytes(fd, buf, pos, content_length, download_fd) == -1)
+                return -1;
+        }
+        else if (has_length)
+        {
+            if (read_bytes(fd, buf, pos + content_length) == -1)
+                return -1;
+            res.body = buf.substr(pos, content_length);
+        }
+        else if (res.status != 204 && res.status != 304)
+        {
+            // Body is delimited by the connection close.
+            if (is_streamed)
+            {
+                if (write_all(download_fd, buf.data() + pos, buf.size() - pos) == -1)
+                    return -1;
+                buf.clear();
+                pos = 0;
+            }
+            int ret;
+            while ((ret = read_more(fd, buf)) > 0)
+            {
+                if (is_streamed)
+                {
+                    if (write_all(download_fd, buf.data(), buf.size()) == -1)
+                        return -1;
+                    buf.clear();
+                }
+            }
+            if (ret == -1)
+                return -1;
+            res.body = buf.substr(pos);
+            keep_alive = false;
+        }
+
+        if (res.status >= 400 && !res.body.empty())
+        {
+            try
+            {
+                const jsoncons::ojson d = jsoncons::ojson::parse(res.body);
+                if (d.contains("message"))
+                    res.message = d["message"].as<std::string>();
+            }
+            catch (const std::exception &e)
+            {
+                res.message = res.body;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * Reads the next available bytes from the connection into the buffer.
+     * @param fd Connection fd.
+     * @param buf Buffer to append to.
+     * @return Number of bytes read, 0 if the connection is closed and -1 on error.
+     */
+    int read_more(const int fd, std::string &buf)
+    {
+        if (buf.size() >= MAX_RESPONSE_SIZE)
+        {
+            LOG_ERROR << "Docker response exceeded " << MAX_RESPONSE_SIZE << " bytes.";
+            return -1;
+        }
+
+        char chunk[READ_CHUNK_SIZE];
+        while (true)
+        {
+            const ssize_t ret = recv(fd, chunk, sizeof(chunk), 0);
+            if (ret == -1 && errno == EINTR)
+                continue;
+            if (ret > 0)
+                buf.append(chunk, ret);
+            return ret;
+        }
+    }
+
+    /**
+     * Reads until the delimiter appears in the buffer at or after the given position.
+     * @param fd Connection fd.
+     * @param buf Buffer to append to.
+     * @param pos Position to start searching from.
+     * @param delimiter Delimiter to look for.
+     * @param found_pos Position of the delimiter to be populated.
+     * @return 0 on success and -1 on error or premature connection close.
+     */
+    int read_until(const int fd, std::string &buf, const size_t pos, std::string_view delimiter, size_t &found_pos)
+    {
+        while ((found_pos = buf.find(delimiter, pos)) == std::string::npos)
+        {
+            if (read_more(fd, buf) <= 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Reads until the buffer holds at least the given number of bytes.
+     * @param fd Connection fd.
+     * @param buf Buffer to append to.
+     * @param size Required buffer size.
+     * @return 0 on success and -1 on error or premature connection close.
+     */
+    int read_bytes(const int fd, std::string &buf, const size_t size)
+    {
+        while (buf.size() < size)
+        {
+            if (read_more(fd, buf) <= 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Writes the given number of bytes from the connection into a file. Bytes already in the buffer are written first.
+     * @param fd Connection fd.
+     * @param buf Buffer holding the received bytes. Only holds the bytes after the written ones when returned.
+     * @param pos Position of the first byte to write. Set to the position after the written bytes.
+     * @param size Number of bytes to write.
+     * @param out_fd File to write into.
+     * @return 0 on success and -1 on error or premature connection close.
+     */
+    int stream_bytes(const int fd, std::string &buf, size_t &pos, size_t size, const int out_fd)
+    {
+        while (size > 0)
+        {
+            if (pos == buf.size())
+            {
+                buf.clear();
+                pos = 0;
+                if (read_more(fd, buf) <= 0)
+                    return -1;
+            }
+
+            const size_t len = std::min(size, buf.size() - pos);
+            if (write_all(out_fd, buf.data() + pos, len) == -1)
+                return -1;
+            pos += len;
+            size -= len;
+        }
+
+        buf.erase(0, pos);
+        pos = 0;
+        return 0;
+    }
+
+    /**
+     * Writes all the given bytes into a file.
+     * @param fd File fd.
+     * @param data Bytes to write.
+     * @param size Number of bytes.
+     * @return 0 on success and -1 on error.
+     */
+    int write_all(const int fd, const char *data, const size_t size)
+    {
+        size_t written = 0;
+        while (written < size)
+        {
+            const ssize_t ret = write(fd, data + written, size - written);
+            if (ret == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                LOG_ERROR << errno << ": Error writing docker response body.";
+                return -1;
+            }
+            written += ret;
+        }
+        return 0;
+    }
+
+    /**
+     * Percent encodes a value to be used in a request path or query string.
+     * @param value Value to encode.
+     * @return Encoded value.
+     */
+    const std::string url_encode(std::string_view value)
+    {
+        constexpr const char *HEX_CHARS = "0123456789ABCDEF";
+        std::string encoded;
+        encoded.reserve(value.size());
+        for (const char c : value)
+        {
+            if (isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.' || c == '~')
+            {
+                encoded.push_back(c);
+            }
+            else
+            {
+                encoded.push_back('%');
+                encoded.push_back(HEX_CHARS[((unsigned char)c) >> 4]);
+                encoded.push_back(HEX_CHARS[((unsigned char)c) & 0x0F]);
+            }
+        }
+        return encoded;
+    }
+
+} // namespace docker
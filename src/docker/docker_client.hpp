@@ -0,0 +1,93 @@
+#ifndef _SA_DOCKER_DOCKER_CLIENT_
+#define _SA_DOCKER_DOCKER_CLIENT_
+
+#include "../pchheader.hpp"
+
+/**
+ * Minimal Docker Engine API client talking HTTP over the rootless docker daemon socket of each instance user.
+ */
+namespace docker
+{
+    constexpr int DEFAULT_TIMEOUT_SECS = 30; // Max time to wait for a daemon response.
+
+    // Response of a Docker Engine API request.
+    struct response
+    {
+        int status = 0;      // HTTP status code.
+        std::string body;    // Response body (chunked bodies are decoded).
+        std::string message; // Error message given by the daemon if any.
+    };
+
+    // A container port published on the host with the same port number.
+    struct port_binding
+    {
+        uint16_t port = 0;
+        bool is_udp = false;
+    };
+
+    // Settings of a container to be created.
+    struct container_config
+    {
+        std::string name;
+        std::string image;
+        std::vector<std::string> cmd;
+        std::vector<port_binding> ports;
+        std::string mount_source; // Host directory bind mounted into the container.
+        std::string mount_target;
+    };
+
+    // Keep-alive connection to a user's docker daemon. Requests on a connection are serialized.
+    struct daemon_connection
+    {
+        std::mutex mutex;
+        int fd = -1;
+    };
+
+    void deinit();
+
+    int request(const int uid, std::string_view method, std::string_view path, response &res, std::string_view body = {}, const int timeout_secs = DEFAULT_TIMEOUT_SECS,
+                const int upload_fd = -1, const int download_fd = -1);
+
+    int create_container(const int uid, const container_config &config, const int timeout_secs);
+
+    int pull_image(const int uid, std::string_view image, const int timeout_secs);
+
+    int get_image_id(const int uid, std::string_view image, std::string &id);
+
+    int save_image(const int uid, std::string_view image, const int out_fd, const int timeout_secs);
+
+    int load_image(const int uid, const int in_fd, const int timeout_secs);
+
+    int start_container(const int uid, std::string_view name);
+
+    int stop_container(const int uid, std::string_view name);
+
+    int remove_container(const int uid, std::string_view name);
+
+    int get_container_status(const int uid, std::string_view name, std::string &status);
+
+    int ping(const int uid);
+
+    void disconnect(const int uid);
+
+    int connect_daemon(const int uid);
+
+    int send_request(const int fd, std::string_view method, std::string_view path, std::string_view body, const int upload_fd = -1);
+
+    int read_response(const int fd, response &res, bool &keep_alive, bool &is_received, const int download_fd = -1);
+
+    int read_more(const int fd, std::string &buf);
+
+    int read_until(const int fd, std::string &buf, const size_t pos, std::string_view delimiter, size_t &found_pos);
+
+    int read_bytes(const int fd, std::string &buf, const size_t size);
+
+    int stream_bytes(const int fd, std::string &buf, size_t &pos, size_t size, const int out_fd);
+
+    int write_all(const int fd, const char *data, const size_t size);
+
+    const std::string url_encode(std::string_view value);
+
+} // namespace docker
+
+#endif
@@ -0,0 +1,395 @@
+#include "docker_events.hpp"
+#include "docker_client.hpp"
+#include "../util/util.hpp"
+
+namespace docker
+{
+    events_ctx events;
+
+    constexpr int MAX_EPOLL_EVENTS = 32;
+    constexpr int EPOLL_TIMEOUT_MS = 1000;            // Max wait before checking for streams to reconnect.
+    constexpr uint64_t RECONNECT_INTERVAL_MS = 5000;  // Wait before reconnecting a failed stream.
+    constexpr size_t READ_BUFFER_SIZE = 4096;
+    constexpr size_t MAX_EVENT_LINE_SIZE = 65536;
+
+    // Only the container events are subscribed. Filter is the url encoded {"type":["container"]}.
+    constexpr const char *EVENTS_PATH = "/events?filters=%7B%22type%22%3A%5B%22container%22%5D%7D";
+
+    /**
+     * Starts the events thread.
+     * @param handler Callback invoked from the events thread for each received event.
+     * @return 0 on success and -1 on error.
+     */
+    int init_events(const std::function<void(const container_event &)> &handler)
+    {
+        events.handler = handler;
+        events.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        events.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (events.epoll_fd == -1 || events.event_fd == -1)
+        {
+            LOG_ERROR << errno << ": Error creating docker events epoll.";
+            deinit_events();
+            return -1;
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = events.event_fd;
+        if (epoll_ctl(events.epoll_fd, EPOLL_CTL_ADD, events.event_fd, &ev) == -1)
+        {
+            LOG_ERROR << errno << ": Error watching docker events wake up fd.";
+            deinit_events();
+            return -1;
+        }
+
+        events.events_thread = std::thread(events_loop);
+        return 0;
+    }
+
+    /**
+     * Stops the events thread and closes all the streams.
+     */
+    void deinit_events()
+    {
+        if (events.events_thread.joinable())
+        {
+            {
+                std::scoped_lock lock(events.watch_mutex);
+                events.is_shutting_down = true;
+            }
+            wake_events_loop();
+            events.events_thread.join();
+        }
+
+        for (auto &[uid, stream] : events.streams)
+            close_stream(stream);
+        events.streams.clear();
+
+        if (events.event_fd != -1)
+        {
+            close(events.event_fd);
+            events.event_fd = -1;
+        }
+        if (events.epoll_fd != -1)
+        {
+            close(events.epoll_fd);
+            events.epoll_fd = -1;
+        }
+    }
+
+    /**
+     * Starts receiving the container events of the given user's daemon. Reconnects automatically until unwatched.
+     * @param uid Uid of the instance user.
+     */
+    void watch_events(const int uid)
+    {
+        {
+            std::scoped_lock lock(events.watch_mutex);
+            events.watch_changes.emplace_back(uid, true);
+        }
+        wake_events_loop();
+    }
+
+    /**
+     * Stops receiving the container events of the given user's daemon.
+     * @param uid Uid of the instance user.
+     */
+    void unwatch_events(const int uid)
+    {
+        {
+            std::scoped_lock lock(events.watch_mutex);
+            events.watch_changes.emplace_back(uid, false);
+        }
+        wake_events_loop();
+    }
+
+    /**
+     * Wakes up the events thread to apply the watch changes or to shut down.
+     */
+    void wake_events_loop()
+    {
+        const uint64_t value = 1;
+        if (events.event_fd != -1 && write(events.event_fd, &value, sizeof(value)) == -1)
+            LOG_ERROR << errno << ": Error waking up the docker events thread.";
+    }
+
+    /**
+     * Receives the events of all the watched daemons and reconnects the failed streams.
+     */
+    void events_loop()
+    {
+        util::mask_signal();
+
+        epoll_event ready[MAX_EPOLL_EVENTS];
+        while (true)
+        {
+            {
+                std::scoped_lock lock(events.watch_mutex);
+                if (events.is_shutting_down)
+                    break;
+            }
+
+            apply_watch_changes();
+
+            const uint64_t now = util::get_epoch_milliseconds();
+            for (auto &[uid, stream] : events.streams)
+            {
+                if (stream.fd == -1 && stream.retry_at <= now)
+                    connect_stream(stream);
+            }
+
+            const int count = epoll_wait(events.epoll_fd, ready, MAX_EPOLL_EVENTS, EPOLL_TIMEOUT_MS);
+            if (count == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                LOG_ERROR << errno << ": Error waiting for docker events.";
+                break;
+            }
+
+            for (int i = 0; i < count; i++)
+            {
+                const int fd = ready[i].data.fd;
+                if (fd == events.event_fd)
+                {
+                    uint64_t value;
+                    if (read(events.event_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+                        LOG_ERROR << errno << ": Error reading docker events wake up fd.";
+                    continue;
+                }
+
+                const auto itr = events.stream_uids.find(fd);
+                if (itr == events.stream_uids.end())
+                    continue;
+
+                event_stream &stream = events.streams[itr->second];
+                if (read_stream(stream) == -1)
+                {
+                    LOG_DEBUG << "Docker events stream of uid " << stream.uid << " closed. Reconnecting.";
+                    close_stream(stream);
+                    stream.retry_at = util::get_epoch_milliseconds() + RECONNECT_INTERVAL_MS;
+                }
+            }
+        }
+    }
+
+    /**
+     * Adds streams for the newly watched daemons and removes the unwatched ones.
+     */
+    void apply_watch_changes()
+    {
+        std::vector<std::pair<int, bool>> changes;
+        {
+            std::scoped_lock lock(events.watch_mutex);
+            changes.swap(events.watch_changes);
+        }
+
+        for (const auto &[uid, is_watch] : changes)
+        {
+            const auto itr = events.streams.find(uid);
+            if (is_watch && itr == events.streams.end())
+            {
+                // Stream gets connected by the events loop.
+                event_stream stream;
+                stream.uid = uid;
+                events.streams.emplace(uid, std::move(stream));
+            }
+            else if (!is_watch && itr != events.streams.end())
+            {
+                close_stream(itr->second);
+                events.streams.erase(itr);
+            }
+        }
+    }
+
+    /**
+     * Connects to the daemon and sends the events request. A retry is scheduled if this fails.
+     * @param stream Stream to connect.
+     */
+    void connect_stream(event_stream &stream)
+    {
+        stream.fd = connect_daemon(stream.uid);
+        if (stream.fd != -1)
+        {
+            const timeval timeout{DEFAULT_TIMEOUT_SECS, 0};
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = stream.fd;
+            if (setsockopt(stream.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0 &&
+                send_request(stream.fd, "GET", EVENTS_PATH, {}) == 0 &&
+                fcntl(stream.fd, F_SETFL, fcntl(stream.fd, F_GETFL) | O_NONBLOCK) == 0 &&
+                epoll_ctl(events.epoll_fd, EPOLL_CTL_ADD, stream.fd, &ev) == 0)
+            {
+                events.stream_uids[stream.fd] = stream.uid;
+                return;
+            }
+
+            LOG_ERROR << errno << ": Error subscribing to docker events of uid " << stream.uid;
+            close(stream.fd);
+            stream.fd = -1;
+        }
+        stream.retry_at = util::get_epoch_milliseconds() + RECONNECT_INTERVAL_MS;
+    }
+
+    /**
+     * Closes the stream connection and resets the parsing state.
+     * @param stream Stream to close.
+     */
+    void close_stream(event_stream &stream)
+    {
+        if (stream.fd != -1)
+        {
+            events.stream_uids.erase(stream.fd);
+            epoll_ctl(events.epoll_fd, EPOLL_CTL_DEL, stream.fd, NULL);
+            close(stream.fd);
+            stream.fd = -1;
+        }
+        stream.is_subscribed = false;
+        stream.expect_crlf = false;
+        stream.chunk_remaining = 0;
+        stream.buffer.clear();
+        stream.line.clear();
+    }
+
+    /**
+     * Reads the available bytes of the stream and handles the complete events.
+     * @param stream Stream to read.
+     * @return 0 if the stream is still usable and -1 if it needs to be reconnected.
+     */
+    int read_stream(event_stream &stream)
+    {
+        char buf[READ_BUFFER_SIZE];
+        while (true)
+        {
+            const ssize_t ret = recv(stream.fd, buf, sizeof(buf), 0);
+            if (ret > 0)
+            {
+                stream.buffer.append(buf, ret);
+                continue;
+            }
+            if (ret == -1 && errno == EINTR)
+                continue;
+            if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+
+            // Connection is closed or failed. Events received so far are still handled.
+            parse_stream(stream);
+            return -1;
+        }
+        return parse_stream(stream);
+    }
+
+    /**
+     * Parses the received bytes of the chunked events response. Each event is a json object on its own line.
+     * @param stream Stream to parse.
+     * @return 0 if more bytes are needed and -1 if the stream is invalid or ended.
+     */
+    int parse_stream(event_stream &stream)
+    {
+        while (true)
+        {
+            if (!stream.is_subscribed)
+            {
+                const size_t header_end = stream.buffer.find("\r\n\r\n");
+                if (header_end == std::string::npos)
+                    return 0;
+
+                std::string headers = stream.buffer.substr(0, header_end);
+                std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+                if (headers.find(" 200 ") == std::string::npos || headers.find("transfer-encoding: chunked") == std::string::npos)
+                {
+                    LOG_ERROR << "Unexpected docker events response for uid " << stream.uid;
+                    return -1;
+                }
+
+                stream.buffer.erase(0, header_end + 4);
+                stream.is_subscribed = true;
+
+                container_event event;
+                event.uid = stream.uid;
+                event.action = EVENT_SUBSCRIBED;
+                events.handler(event);
+                continue;
+            }
+
+            if (stream.expect_crlf)
+            {
+                if (stream.buffer.size() < 2)
+                    return 0;
+                stream.buffer.erase(0, 2);
+                stream.expect_crlf = false;
+            }
+
+            if (stream.chunk_remaining == 0)
+            {
+                const size_t size_end = stream.buffer.find("\r\n");
+                if (size_end == std::string::npos)
+                    return 0;
+
+                const size_t chunk_size = strtoull(stream.buffer.data(), NULL, 16);
+                stream.buffer.erase(0, size_end + 2);
+                if (chunk_size == 0)
+                    return -1; // Daemon ended the stream.
+                stream.chunk_remaining = chunk_size;
+            }
+
+            if (stream.buffer.empty())
+                return 0;
+
+            const size_t size = std::min(stream.chunk_remaining, stream.buffer.size());
+            stream.line.append(stream.buffer, 0, size);
+            stream.buffer.erase(0, size);
+            stream.chunk_remaining -= size;
+            stream.expect_crlf = stream.chunk_remaining == 0;
+
+            size_t line_end;
+            while ((line_end = stream.line.find('\n')) != std::string::npos)
+            {
+                handle_event_line(stream, std::string_view(stream.line.data(), line_end));
+                stream.line.erase(0, line_end + 1);
+            }
+
+            if (stream.line.size() > MAX_EVENT_LINE_SIZE)
+            {
+                LOG_ERROR << "Docker event exceeded " << MAX_EVENT_LINE_SIZE << " bytes for uid " << stream.uid;
+                return -1;
+            }
+        }
+    }
+
+    /**
+     * Extracts the container event from a json event line and passes it to the handler.
+     * @param stream Stream the event was received from.
+     * @param line Json event.
+     */
+    void handle_event_line(const event_stream &stream, std::string_view line)
+    {
+        if (line.empty())
+            return;
+
+        container_event event;
+        event.uid = stream.uid;
+        try
+        {
+            const jsoncons::ojson d = jsoncons::ojson::parse(line);
+            if (!d.contains("Action") || !d.contains("Actor"))
+                return;
+
+            event.action = d["Action"].as<std::string>();
+            const jsoncons::ojson &attributes = d["Actor"]["Attributes"];
+            if (attributes.contains("name"))
+                event.container_name = attributes["name"].as<std::string>();
+            if (attributes.contains("exitCode"))
+                util::stoi(attributes["exitCode"].as<std::string>(), event.exit_code);
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Invalid docker event for uid " << stream.uid << ". " << e.what();
+            return;
+        }
+
+        if (!event.container_name.empty())
+            events.handler(event);
+    }
+
+} // namespace docker
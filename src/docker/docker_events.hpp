@@ -0,0 +1,74 @@
+#ifndef _SA_DOCKER_DOCKER_EVENTS_
+#define _SA_DOCKER_DOCKER_EVENTS_
+
+#include "../pchheader.hpp"
+
+/**
+ * Subscribes to the container event streams of the instance user docker daemons and reports the events.
+ */
+namespace docker
+{
+    constexpr const char *EVENT_SUBSCRIBED = "subscribed"; // Reported when a stream is (re)established. Events might have been missed before this.
+
+    // A container event received from a daemon.
+    struct container_event
+    {
+        int uid = -1;
+        std::string container_name; // Empty for the subscribed event.
+        std::string action;         // Docker event action (start, die, oom, etc.) or EVENT_SUBSCRIBED.
+        int exit_code = 0;          // Exit code given with the die event.
+    };
+
+    // Events stream of a single daemon.
+    struct event_stream
+    {
+        int uid = -1;
+        int fd = -1;
+        uint64_t retry_at = 0;       // Time to reconnect at if not connected.
+        bool is_subscribed = false;  // Response headers of the events request are received.
+        bool expect_crlf = false;    // Waiting for the line end after a chunk.
+        size_t chunk_remaining = 0;  // Bytes of the current chunk not received yet.
+        std::string buffer;          // Received bytes not parsed yet.
+        std::string line;            // Event line being assembled from the chunks.
+    };
+
+    struct events_ctx
+    {
+        bool is_shutting_down = false;
+        std::thread events_thread;
+        int epoll_fd = -1;
+        int event_fd = -1; // Used to wake up the epoll loop for watch changes and shutdown.
+        std::function<void(const container_event &)> handler;
+        std::mutex watch_mutex;
+        std::vector<std::pair<int, bool>> watch_changes;   // Pending watch (true) and unwatch (false) requests by uid.
+        std::unordered_map<int, event_stream> streams;     // Streams keyed by uid. Only accessed from the events thread.
+        std::unordered_map<int, int> stream_uids;          // Uids keyed by the stream socket fd.
+    };
+
+    int init_events(const std::function<void(const container_event &)> &handler);
+
+    void deinit_events();
+
+    void watch_events(const int uid);
+
+    void unwatch_events(const int uid);
+
+    void wake_events_loop();
+
+    void events_loop();
+
+    void apply_watch_changes();
+
+    void connect_stream(event_stream &stream);
+
+    void close_stream(event_stream &stream);
+
+    int read_stream(event_stream &stream);
+
+    int parse_stream(event_stream &stream);
+
+    void handle_event_line(const event_stream &stream, std::string_view line);
+
+} // namespace docker
+
+#endif
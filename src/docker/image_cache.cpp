@@ -0,0 +1,416 @@
+#include "image_cache.hpp"
+#include "docker_client.hpp"
+#include "../conf.hpp"
+#include "../util/util.hpp"
+
+namespace docker
+{
+    image_cache_ctx ctx;
+
+    constexpr const char *INDEX_FILE = "index.json";
+    constexpr const char *INDEX_TMP_FILE = "index.json.tmp";
+    constexpr const char *ARCHIVE_EXT = ".tar";
+    constexpr const char *ARCHIVE_TMP_EXT = ".tar.tmp";
+    constexpr const char *ID_PREFIX = "sha256:";
+    constexpr mode_t ARCHIVE_PERMS = 0600;
+    constexpr int IMAGE_TRANSFER_TIMEOUT_SECS = 600;       // Max time to wait for each progress of an image archive transfer.
+    constexpr uint64_t IMAGE_MAX_AGE_MS = 6 * 60 * 60 * 1000; // Cached images are pulled again after this, since their tags might have moved.
+    constexpr size_t MAX_TRACKED_IMAGES = 64;               // Uncached images whose uses are remembered.
+
+    /**
+     * Loads the cache index if the cache is enabled.
+     * @return 0 on success and -1 on error.
+     */
+    int init_image_cache()
+    {
+        if (conf::cfg.docker.image_cache_size == 0)
+            return 0;
+
+        ctx.dir = conf::ctx.data_dir + "/" + IMAGE_CACHE_DIR;
+        if (!util::is_dir_exists(ctx.dir) && util::create_dir_tree_recursive(ctx.dir) == -1)
+        {
+            LOG_ERROR << errno << ": Error creating image cache dir " << ctx.dir;
+            return -1;
+        }
+
+        // A lost index only costs the pulls to rebuild the cache.
+        if (read_index() == -1)
+        {
+            LOG_WARNING << "Image cache index could not be read. Starting with an empty image cache.";
+            ctx.images.clear();
+        }
+        return 0;
+    }
+
+    /**
+     * Persists the image uses counted since the last export.
+     */
+    void deinit_image_cache()
+    {
+        // Nothing to write if the cache was never initialized.
+        if (conf::cfg.docker.image_cache_size > 0 && !ctx.dir.empty())
+            write_index();
+    }
+
+    /**
+     * Counts an instance creation using the given image. The most used images are kept in the cache and prefetched.
+     * @param image Image name with an optional tag.
+     */
+    void count_image_use(std::string_view image)
+    {
+        if (conf::cfg.docker.image_cache_size == 0)
+            return;
+
+        std::scoped_lock lock(ctx.mutex);
+        ctx.images[std::string(image)].uses++;
+    }
+
+    /**
+     * Makes an image available in the daemon of the given user. A fresh cached image is imported from the cache.
+     * Otherwise the image is pulled and exported into the cache. Concurrent creations of the same image wait for
+     * that pull and import the image from the cache.
+     * @param uid Uid of the instance user.
+     * @param image Image name with an optional tag.
+     * @param timeout_secs Max time to wait for each progress update of a pull.
+     * @return 0 on success and -1 on error.
+     */
+    int provide_image(const int uid, std::string_view image, const int timeout_secs)
+    {
+        if (conf::cfg.docker.image_cache_size == 0)
+            return pull_image(uid, image, timeout_secs);
+
+        const std::string name(image);
+        std::unique_lock lock(ctx.mutex);
+        ctx.pull_cv.wait(lock, [&]
+                         { return ctx.pulling.count(name) == 0; });
+
+        const auto itr = ctx.images.find(name);
+        if (itr != ctx.images.end() && !itr->second.id.empty() && is_fresh(itr->second))
+        {
+            const std::string id = itr->second.id;
+            lock.unlock();
+            if (load_cached_image(uid, id, IMAGE_TRANSFER_TIMEOUT_SECS) == 0)
+                return 0;
+            LOG_WARNING << "Cached image " << image << " could not be loaded for uid " << uid << ". Pulling.";
+            lock.lock();
+        }
+
+        ctx.pulling.emplace(name);
+        lock.unlock();
+
+        // The daemon is exported from before any instance runs on it, so an instance cannot tamper with the shared archive.
+        const int ret = pull_image(uid, image, timeout_secs);
+        if (ret == 0 && export_image(uid, name) == 0)
+        {
+            evict_images();
+            write_index();
+        }
+
+        lock.lock();
+        ctx.pulling.erase(name);
+        lock.unlock();
+        ctx.pull_cv.notify_all();
+        return ret;
+    }
+
+    /**
+     * Imports the most used cached images into the daemon of the given user, so the instance created on it does not wait for them.
+     * Errors are only logged since the images are provided again on the instance creation.
+     * @param uid Uid of the instance user.
+     * @param timeout_secs Max time to wait for each progress of an import.
+     */
+    void prefetch_images(const int uid, const int timeout_secs)
+    {
+        if (conf::cfg.docker.image_cache_size == 0 || conf::cfg.docker.image_prefetch_count == 0)
+            return;
+
+        // Tags of the same image share an archive.
+        std::vector<std::pair<uint64_t, std::string>> ranked;
+        {
+            std::scoped_lock lock(ctx.mutex);
+            std::unordered_map<std::string, uint64_t> id_uses;
+            for (const auto &[image, entry] : ctx.images)
+            {
+                if (!entry.id.empty() && is_fresh(entry))
+                    id_uses[entry.id] += entry.uses;
+            }
+            for (const auto &[id, uses] : id_uses)
+                ranked.emplace_back(uses, id);
+        }
+
+        std::sort(ranked.begin(), ranked.end(), std::greater<>());
+        if (ranked.size() > conf::cfg.docker.image_prefetch_count)
+            ranked.resize(conf::cfg.docker.image_prefetch_count);
+
+        for (const auto &[uses, id] : ranked)
+        {
+            if (load_cached_image(uid, id, timeout_secs) == -1)
+                LOG_WARNING << "Prefetching image " << id << " failed for uid " << uid;
+        }
+    }
+
+    /**
+     * Imports a cached image archive into the daemon of the given user.
+     * @param uid Uid of the instance user.
+     * @param id Image id of the archive.
+     * @param timeout_secs Max time to wait for each progress of the import.
+     * @return 0 on success and -1 on error.
+     */
+    int load_cached_image(const int uid, std::string_view id, const int timeout_secs)
+    {
+        // An archive evicted meanwhile stays readable through the open fd.
+        const std::string path = get_archive_path(id);
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening cached image " << path;
+            return -1;
+        }
+
+        const int ret = load_image(uid, fd, timeout_secs);
+        close(fd);
+        return ret;
+    }
+
+    /**
+     * Exports an image from the daemon which pulled it into the cache. Archives are named by the image id, so the tags
+     * of the same image and the pulls of an unchanged image share an archive.
+     * @param uid Uid of the daemon holding the image.
+     * @param image Image name with an optional tag.
+     * @return 0 on success and -1 on error.
+     */
+    int export_image(const int uid, const std::string &image)
+    {
+        std::string id;
+        if (get_image_id(uid, image, id) == -1)
+            return -1;
+
+        if (!is_valid_id(id))
+        {
+            LOG_ERROR << "Unexpected id " << id << " for image " << image;
+            return -1;
+        }
+
+        const std::string path = get_archive_path(id);
+        const std::string tmp_path = path.substr(0, path.size() - strlen(ARCHIVE_EXT)) + ARCHIVE_TMP_EXT;
+        const bool is_saved = !util::is_file_exists(path);
+        if (is_saved)
+        {
+            const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, ARCHIVE_PERMS);
+            if (fd == -1)
+            {
+                LOG_ERROR << errno << ": Error creating image archive " << tmp_path;
+                return -1;
+            }
+
+            if (save_image(uid, image, fd, IMAGE_TRANSFER_TIMEOUT_SECS) == -1 || fsync(fd) == -1)
+            {
+                close(fd);
+                unlink(tmp_path.c_str());
+                return -1;
+            }
+            close(fd);
+        }
+
+        // The archive is placed and recorded under the lock, so an eviction can't remove it in between.
+        std::scoped_lock lock(ctx.mutex);
+        if (is_saved)
+        {
+            if (rename(tmp_path.c_str(), path.c_str()) == -1)
+            {
+                LOG_ERROR << errno << ": Error placing image archive " << path;
+                unlink(tmp_path.c_str());
+                return -1;
+            }
+            LOG_INFO << "Cached image " << image << " as " << id;
+        }
+        else if (!util::is_file_exists(path))
+        {
+            LOG_WARNING << "Image archive " << path << " was evicted before it was recorded for " << image;
+            return -1;
+        }
+
+        cached_image &entry = ctx.images[image];
+        entry.id = id;
+        entry.cached_at = util::get_epoch_milliseconds();
+        return 0;
+    }
+
+    /**
+     * Keeps only the most used images in the cache and removes the archives no cached image refers to.
+     * The lock is held while removing, since the exports place and record their archives under it.
+     */
+    void evict_images()
+    {
+        std::unordered_set<std::string> kept_files;
+        std::scoped_lock lock(ctx.mutex);
+        std::vector<std::pair<uint64_t, std::string>> cached, uncached;
+        for (const auto &[image, entry] : ctx.images)
+            (entry.id.empty() ? uncached : cached).emplace_back(entry.uses, image);
+        std::sort(cached.begin(), cached.end(), std::greater<>());
+        std::sort(uncached.begin(), uncached.end(), std::greater<>());
+
+        for (size_t i = conf::cfg.docker.image_cache_size; i < cached.size(); i++)
+        {
+            cached_image &entry = ctx.images[cached[i].second];
+            entry.id.clear();
+            entry.cached_at = 0;
+        }
+        for (size_t i = MAX_TRACKED_IMAGES; i < uncached.size(); i++)
+            ctx.images.erase(uncached[i].second);
+
+        for (const auto &[image, entry] : ctx.images)
+        {
+            if (!entry.id.empty())
+                kept_files.emplace(entry.id.substr(entry.id.rfind(':') + 1) + ARCHIVE_EXT);
+        }
+
+        DIR *dir = opendir(ctx.dir.c_str());
+        if (dir == NULL)
+            return;
+
+        // Partial archives of the exports in progress have a different extension.
+        const std::string_view ext = ARCHIVE_EXT;
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL)
+        {
+            const std::string_view name = ent->d_name;
+            if (name.size() > ext.size() && name.substr(name.size() - ext.size()) == ext && kept_files.count(std::string(name)) == 0)
+            {
+                LOG_INFO << "Evicting cached image archive " << name;
+                unlinkat(dirfd(dir), ent->d_name, 0);
+            }
+        }
+        closedir(dir);
+    }
+
+    /**
+     * Checks whether a cached image is recent enough to be used without pulling it again.
+     * @param entry Cached image.
+     * @return Whether the cached image can be used.
+     */
+    bool is_fresh(const cached_image &entry)
+    {
+        return util::get_epoch_milliseconds() - entry.cached_at < IMAGE_MAX_AGE_MS;
+    }
+
+    /**
+     * Checks whether an image id is a sha256 digest, so it can name an archive.
+     * @param id Image id.
+     * @return Whether the id is valid.
+     */
+    bool is_valid_id(std::string_view id)
+    {
+        constexpr size_t DIGEST_LEN = 64;
+        const std::string_view prefix = ID_PREFIX;
+        if (id.size() != prefix.size() + DIGEST_LEN || id.substr(0, prefix.size()) != prefix)
+            return false;
+        return std::all_of(id.begin() + prefix.size(), id.end(), [](const char c)
+                           { return isxdigit((unsigned char)c) && !isupper((unsigned char)c); });
+    }
+
+    /**
+     * Gets the path of the archive of a cached image.
+     * @param id Image id.
+     * @return Archive path.
+     */
+    const std::string get_archive_path(std::string_view id)
+    {
+        const size_t colon_pos = id.rfind(':');
+        const std::string_view digest = colon_pos == std::string_view::npos ? id : id.substr(colon_pos + 1);
+        return ctx.dir + "/" + std::string(digest) + ARCHIVE_EXT;
+    }
+
+    /**
+     * Reads the cached images and their uses from the index file.
+     * @return 0 on success and -1 on error.
+     */
+    int read_index()
+    {
+        const std::string path = ctx.dir + "/" + INDEX_FILE;
+        if (!util::is_file_exists(path))
+            return 0;
+
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return -1;
+
+        jsoncons::ojson d;
+        const int ret = util::read_json_file(fd, d);
+        close(fd);
+        if (ret == -1)
+            return -1;
+
+        try
+        {
+            for (const auto &image : d["images"].array_range())
+            {
+                cached_image &entry = ctx.images[image["image"].as<std::string>()];
+                entry.id = image["id"].as<std::string>();
+                entry.cached_at = image["cached_at"].as<uint64_t>();
+                entry.uses = image["uses"].as<uint64_t>();
+
+                // Drop the entries whose archives are gone.
+                if (!entry.id.empty() && (!is_valid_id(entry.id) || !util::is_file_exists(get_archive_path(entry.id))))
+                {
+                    entry.id.clear();
+                    entry.cached_at = 0;
+                }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Invalid image cache index. " << e.what();
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Writes the cached images and their uses into the index file. The index is replaced through a rename so a failed
+     * write does not lose the previous index. Writes are serialized so the last one holds the latest entries.
+     * @return 0 on success and -1 on error.
+     */
+    int write_index()
+    {
+        std::scoped_lock index_lock(ctx.index_mutex);
+        jsoncons::ojson images(jsoncons::json_array_arg);
+        {
+            std::scoped_lock lock(ctx.mutex);
+            for (const auto &[image, entry] : ctx.images)
+            {
+                jsoncons::ojson item;
+                item.insert_or_assign("image", image);
+                item.insert_or_assign("id", entry.id);
+                item.insert_or_assign("cached_at", entry.cached_at);
+                item.insert_or_assign("uses", entry.uses);
+                images.push_back(item);
+            }
+        }
+
+        jsoncons::ojson d;
+        d.insert_or_assign("images", images);
+        std::string json;
+        if (util::serialize_json(d, json) == -1)
+            return -1;
+
+        const std::string tmp_path = ctx.dir + "/" + INDEX_TMP_FILE;
+        const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, ARCHIVE_PERMS);
+        if (fd == -1 || write(fd, json.data(), json.size()) == -1)
+        {
+            LOG_ERROR << errno << ": Error writing image cache index " << tmp_path;
+            if (fd != -1)
+                close(fd);
+            return -1;
+        }
+        close(fd);
+
+        if (rename(tmp_path.c_str(), (ctx.dir + "/" + INDEX_FILE).c_str()) == -1)
+        {
+            LOG_ERROR << errno << ": Error replacing image cache index.";
+            return -1;
+        }
+        return 0;
+    }
+
+} // namespace docker
@@ -0,0 +1,61 @@
+#ifndef _SA_DOCKER_IMAGE_CACHE_
+#define _SA_DOCKER_IMAGE_CACHE_
+
+#include "../pchheader.hpp"
+
+/**
+ * Host level cache of the instance images. Every instance user has its own rootless docker daemon, so an image is pulled
+ * once into one of them, exported into the cache and imported into the other daemons from there. Images are exported
+ * right after the pull, before any instance runs on that daemon.
+ */
+namespace docker
+{
+    constexpr const char *IMAGE_CACHE_DIR = "image_cache"; // Cache directory inside the data dir.
+
+    // An image reference seen in the instance creations.
+    struct cached_image
+    {
+        std::string id;          // Content addressed id of the cached archive. Empty if not cached.
+        uint64_t cached_at = 0;  // Epoch milliseconds of the export.
+        uint64_t uses = 0;       // Number of instance creations which used the image.
+    };
+
+    struct image_cache_ctx
+    {
+        std::string dir;
+        std::unordered_map<std::string, cached_image> images; // Keyed by the image reference.
+        std::unordered_set<std::string> pulling;               // Images being pulled and exported.
+        std::mutex mutex;
+        std::condition_variable pull_cv;                       // Notified when a pull is over.
+        std::mutex index_mutex;                                // Serializes the index writes, which share the temp file.
+    };
+
+    int init_image_cache();
+
+    void deinit_image_cache();
+
+    void count_image_use(std::string_view image);
+
+    int provide_image(const int uid, std::string_view image, const int timeout_secs);
+
+    void prefetch_images(const int uid, const int timeout_secs);
+
+    int load_cached_image(const int uid, std::string_view id, const int timeout_secs);
+
+    int export_image(const int uid, const std::string &image);
+
+    void evict_images();
+
+    bool is_fresh(const cached_image &entry);
+
+    bool is_valid_id(std::string_view id);
+
+    const std::string get_archive_path(std::string_view id);
+
+    int read_index();
+
+    int write_index();
+
+} // namespace docker
+
+#endif
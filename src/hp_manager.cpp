@@ -1,47 +1,78 @@
 #include "hp_manager.hpp"
+#include "hp_readiness.hpp"
 #include "crypto.hpp"
 #include "util/util.hpp"
+#include "util/slot_allocator.hpp"
+#include "systemd/systemd_client.hpp"
 #include "sqlite.hpp"
+#include "docker/docker_client.hpp"
+#include "docker/image_cache.hpp"
+#include "metrics.hpp"
+#include "salog.hpp"
 
 namespace hp
 {
-    // Keep track of the ports of the most recent hp instance.
-    ports last_assigned_ports;
-
     resources instance_resources;
 
-    // This is defaults to true because it initialize last assigned ports when a new instance is created if there is no vacant ports available.
-    bool last_port_assign_from_vacant = true;
-
     constexpr int FILE_PERMS = 0644;
-    constexpr int DOCKER_CREATE_TIMEOUT_SECS = 120; // Max timeout for docker create command to execute.
+    constexpr mode_t CONTRACT_DIR_PERMS = 0775;            // Contract user is in the instance user's group and needs write access.
+    constexpr const char *HP_CONFIG_PATH = "cfg/hp.cfg"; // Hp config path relative to the contract dir.
+    constexpr int DOCKER_CREATE_TIMEOUT_SECS = 120; // Max timeout for docker create request to execute.
 
     sqlite3 *db = NULL;    // Database connection for hp related sqlite stuff.
-    sqlite3 *db_mb = NULL; // Database connection for messageboard related sqlite stuff.
+    sqlite3 *db_status = NULL; // Writer connection of the batched status commits, so their transaction doesn't take in other writes.
+    sqlite::connection_pool db_readers; // Read only connections for the instance queries. Empty if not in wal mode.
+    sqlite3 *db_mb = NULL; // Read only database connection for messageboard related sqlite stuff. Opened on first use.
+    std::mutex db_mb_mutex;
+
+    // Hp config of the default contract, parsed and validated once. New instance configs are patched copies of it.
+    jsoncons::ojson config_template;
+    std::string template_hpfs_log_level;
+    bool template_full_history = false;
+
+    // Port slots of the instances and the in-flight creations. Slot n owns the nth ports of each configured range.
+    util::slot_allocator port_slots;
 
-    // Vector keeping vacant ports from destroyed instances.
-    std::vector<ports> vacant_ports;
+    // Guards the instance count and port allocation state since instances are created in parallel worker threads.
+    // Also guards the resource limits and the registry address of the running config, which a reload can change.
+    std::mutex allocation_mutex;
+
+    std::mutex reload_mutex; // Serializes the config reloads.
 
     bool is_shutting_down = false;
 
+    // Whether start() finished or failed. Guarded by the allocation mutex.
+    bool is_started = false;
+    bool is_start_failed = false;
+    std::condition_variable startup_cv; // Notified when start() is over.
+
+    // Pre-provisioned users ready to be bound to new instances, oldest first. Guarded by the allocation mutex.
+    std::vector<warm_user> warm_users;
+    std::vector<std::string> retired_warm_users; // Pool users installed with outdated limits, removed by the warm pool thread.
+    std::thread warm_pool_thread;
+    std::condition_variable warm_pool_cv; // Notified when the warm pool needs a refill or the agent is shutting down.
+    constexpr int WARM_POOL_RETRY_SECS = 60; // Wait before retrying after a failed warm user provisioning.
+
+    constexpr int RESTORE_DOCKER_TIMEOUT_SECS = 120; // Max wait for the docker daemon of an instance user to come up when restoring.
+    const std::vector<std::string> DOCKER_UNITS{"docker.service"};
+
+    // Instances which are not destroyed, indexed for the lookups so they don't hit the database.
+    instance_registry registry;
+
+    // Container states keyed by container name. Updated from the docker events so status reads don't hit the daemons.
+    std::unordered_map<std::string, container_state> container_states;
+    std::mutex states_mutex;
+
+    // Status writes waiting for the next commit. Concurrent writers share a single transaction.
+    std::shared_ptr<status_write_batch> open_status_batch = std::make_shared<status_write_batch>();
+    bool is_committing_statuses = false;
+    std::mutex status_write_mutex;
+    std::condition_variable status_write_cv;
+
     conf::ugid contract_ugid;
     constexpr int CONTRACT_USER_ID = 10000;
     constexpr int CONTRACT_GROUP_ID = 0;
 
-    // We instruct the demon to restart the container automatically once the container exits except manually stopping.
-    // We keep docker logs at size limit of 10mb, We only need these logs for docker instance failure debugging since all other logs are kept in files.
-    // For the local log driver compression, minimum max-file should be 2. So we keep two logs each max-size is 5mb
-    constexpr const char *DOCKER_CREATE = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock timeout --foreground -v -s SIGINT %ss %s/dockerbin/docker create -t -i --stop-signal=SIGINT --log-driver local \
-     --log-opt max-size=5m --log-opt max-file=2 --name=%s -p %s:%s -p %s:%s -p %s:%s/udp -p %s:%s -p %s:%s -p %s:%s/udp -p %s:%s/udp --restart unless-stopped --mount type=bind,source=%s,target=/contract %s run /contract";
-    constexpr const char *DOCKER_START = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock %s/dockerbin/docker start %s";
-    constexpr const char *DOCKER_STOP = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock %s/dockerbin/docker stop %s";
-    constexpr const char *DOCKER_REMOVE = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock %s/dockerbin/docker rm -f %s";
-    constexpr const char *DOCKER_STATUS = "DOCKER_HOST=unix:///run/user/$(id -u %s)/docker.sock %s/dockerbin/docker inspect --format='{{json .State.Status}}' %s";
-    constexpr const char *COPY_DIR = "cp -r %s %s";
-    constexpr const char *MOVE_DIR = "mv %s %s";
-    constexpr const char *CHOWN_DIR = "chown -R %s:%s %s";
-    constexpr const char *CHMOD_DIR = "chmod -R %s %s";
-
     // Error codes used in create and initiate instance.
     constexpr const char *DB_READ_ERROR = "db_read_error";
     constexpr const char *DB_WRITE_ERROR = "db_write_error";
@@ -56,60 +87,139 @@ namespace hp
     constexpr const char *NO_CONTAINER = "no_container";
     constexpr const char *DUP_CONTAINER = "dup_container";
     constexpr const char *MAX_ALLOCATION_REACHED = "max_alloc_reached";
+    constexpr const char *HOST_SATURATED = "host_saturated";
     constexpr const char *CONTRACT_ID_INVALID = "contractid_bad_format";
     constexpr const char *DOCKER_IMAGE_INVALID = "docker_image_invalid";
     constexpr const char *DOCKER_CONTAINER_NOT_FOUND = "container_not_found";
     constexpr const char *INSTANCE_ALREADY_EXISTS = "instance_already_exists";
+    constexpr const char *NOT_STARTED = "not_started";
 
-    // Cgrules check related constants.
-    constexpr const char *CGRULE_ACTIVE = "service=$(grep \"ExecStart.*=.*/cgrulesengd$\" /etc/systemd/system/*.service | head -1 | awk -F : ' { print $1 } ') && [ ! -z $service ] && systemctl is-active $(basename $service)";
-    constexpr const char *CGRULE_CPU_DIR = "/sys/fs/cgroup/cpu";
-    constexpr const char *CGRULE_MEM_DIR = "/sys/fs/cgroup/memory";
-    constexpr const char *CGRULE_CONF = "/etc/cgrules.conf";
-    constexpr const char *CGRULE_REGEXP = "(^|\n)(\\s*)@sashiuser(\\s+)cpu,memory(\\s+)\%u-cg(\\s*)($|\n)";
-    constexpr const char *REBOOT_FILE = "/run/reboot-required.pkgs";
-    constexpr const char *REBOOT_REGEXP = "(^|\n)(\\s*)sashimono(\\s*)($|\n)";
+    // Error codes used in config reload.
+    constexpr const char *CONFIG_INVALID = "config_invalid";
+    constexpr const char *RESOURCES_INVALID = "resources_invalid";
 
     /**
-     * Initialize hp related environment.
+     * Opens the database and loads the instance registry, which is enough to answer the read only requests.
+     * The host checks and the container related setup are done by start().
+     * @return 0 on success and -1 on error.
      */
     int init()
     {
-        // First, check whether system is ready to start.
-        if (!system_ready())
-            return -1;
-
         const std::string db_path = conf::ctx.data_dir + "/sa.sqlite";
         if (sqlite::open_db(db_path, &db, true) == -1 ||
-            sqlite::initialize_hp_db(db) == -1)
+            sqlite::configure_db(db, conf::cfg.db, true) == -1 ||
+            sqlite::initialize_hp_db(db) == -1 ||
+            sqlite::open_db(db_path, &db_status, true) == -1 ||
+            sqlite::configure_db(db_status, conf::cfg.db, true) == -1)
         {
             LOG_ERROR << "Error preparing database in " << db_path;
             return -1;
         }
 
-        // Populate the vacant ports vector with vacant ports of destroyed containers.
-        get_vacant_ports_list(vacant_ports);
+        // Readers only run alongside the writer in wal mode.
+        if (conf::cfg.db.journal_mode == "wal" && conf::cfg.db.reader_count > 0 &&
+            sqlite::open_pool(db_readers, db_path, conf::cfg.db.reader_count, conf::cfg.db) == -1)
+        {
+            LOG_ERROR << "Error opening database readers in " << db_path;
+            return -1;
+        }
+
         // Calculate the resources per instance.
-        instance_resources.cpu_us = conf::cfg.system.max_cpu_us / conf::cfg.system.max_instance_count;
-        instance_resources.mem_kbytes = conf::cfg.system.max_mem_kbytes / conf::cfg.system.max_instance_count;
-        instance_resources.swap_kbytes = instance_resources.mem_kbytes + (conf::cfg.system.max_swap_kbytes / conf::cfg.system.max_instance_count);
-        instance_resources.storage_kbytes = conf::cfg.system.max_storage_kbytes / conf::cfg.system.max_instance_count;
+        instance_resources = split_resources(conf::cfg.system);
         // Set run as group id 0 (sashimono user group id, root user inside docker container).
         // Because contract user is in sashimono user's group, so the contract user will get the group permissions.
         contract_ugid = {CONTRACT_USER_ID, CONTRACT_GROUP_ID};
 
+        load_registry();
+        init_port_slots();
+        return 0;
+    }
+
+    /**
+     * Checks whether the host is ready and brings up the container related environment. The requests which change
+     * the instances wait until this is over.
+     * @param restore Whether to bring up the instances which should be running before returning.
+     * @return 0 on success and -1 on error.
+     */
+    int start(const bool restore)
+    {
+        if (!system_ready() ||
+            load_config_template() == -1 ||
+            docker::init_image_cache() == -1 ||
+            docker::init_events(on_container_event) == -1)
+        {
+            std::scoped_lock lock(allocation_mutex);
+            is_start_failed = true;
+            startup_cv.notify_all();
+            return -1;
+        }
+
+        resume_pending_instances();
+
+        // Start tracking the existing instances. Their states get reconciled once the event streams are subscribed.
+        std::vector<instance_info> instances;
+        get_instance_list(instances);
+        for (const instance_info &instance : instances)
+        {
+            if (instance.status != CONTAINER_STATES[STATES::PROVISIONING])
+                watch_container(instance.container_name, instance.username, instance.status);
+        }
+
+        if (restore)
+            restore_running_instances();
+
+        init_warm_pool();
+
+        {
+            std::scoped_lock lock(allocation_mutex);
+            is_started = true;
+        }
+        startup_cv.notify_all();
+        LOG_INFO << "Instance management started.";
         return 0;
     }
 
+    /**
+     * Waits until start() is over.
+     * @return 0 if started and -1 if the start failed or the agent is shutting down.
+     */
+    int wait_for_start()
+    {
+        std::unique_lock lock(allocation_mutex);
+        startup_cv.wait(lock, []
+                        { return is_started || is_start_failed || is_shutting_down; });
+        return is_started ? 0 : -1;
+    }
+
     /**
      * Do hp related cleanups.
      */
     void deinit()
     {
-        is_shutting_down = true;
+        {
+            std::scoped_lock lock(allocation_mutex);
+            is_shutting_down = true;
+        }
+        warm_pool_cv.notify_all();
+        startup_cv.notify_all();
+
+        // Wait until any ongoing warm user provisioning finishes.
+        if (warm_pool_thread.joinable())
+            warm_pool_thread.join();
+
+        docker::deinit_events();
+        docker::deinit_image_cache();
+        docker::deinit();
 
+        sqlite::close_pool(db_readers);
+        if (db_status != NULL)
+            sqlite::close_db(&db_status);
         if (db != NULL)
             sqlite::close_db(&db);
+
+        std::scoped_lock lock(db_mb_mutex);
+        if (db_mb != NULL)
+            sqlite::close_db(&db_mb);
     }
 
     /**
@@ -123,32 +233,13 @@ namespace hp
      */
     int create_new_instance(std::string &error_msg, instance_info &info, std::string_view container_name, std::string_view owner_pubkey, const std::string &contract_id, const std::string &image, std::string_view outbound_ipv6, std::string_view outbound_net_interface)
     {
-        // Creating an instance with same name is not allowed.
-        hp::instance_info existing_instance;
-        if (sqlite::get_instance(db, container_name, existing_instance) == 0)
-        {
-            error_msg = INSTANCE_ALREADY_EXISTS;
-            LOG_ERROR << "Found another instance with name: " << container_name << ".";
-            return -1;
-        }
-
-        // If the max allowed instance count is already allocated. We won't allow more.
-        const int allocated_count = sqlite::get_allocated_instance_count(db);
-        if (allocated_count == -1)
+        if (wait_for_start() == -1)
         {
-            error_msg = DB_READ_ERROR;
-            LOG_ERROR << "Error getting allocated instance count from db.";
+            error_msg = NOT_STARTED;
             return -1;
         }
-        else if ((size_t)allocated_count >= conf::cfg.system.max_instance_count)
-        {
-            error_msg = MAX_ALLOCATION_REACHED;
-            LOG_ERROR << "Max instance count is reached.";
-            return -1;
-        }
-
-        LOG_INFO << "Resources for instance - CPU: " << instance_resources.cpu_us << " MicroS, RAM: " << instance_resources.mem_kbytes << " KB, Storage: " << instance_resources.storage_kbytes << " KB.";
 
+        metrics::scoped_timer timer("hp.create");
         // First check whether contract_id is valid uuid.
         if (!crypto::verify_uuid(contract_id))
         {
@@ -165,426 +256,888 @@ namespace hp
         //     return -1;
         // }
 
-        const std::string image_name = image;
+        info.container_name = container_name;
+        info.owner_pubkey = owner_pubkey;
+        info.contract_id = contract_id;
+        info.image_name = image; // Full image key is kept until the container is created, since user install needs it.
+        info.outbound_ipv6 = outbound_ipv6;
+        info.outbound_net_interface = outbound_net_interface;
+        info.ip = conf::cfg.hp.host_address;
+        info.status = CONTAINER_STATES[STATES::PROVISIONING];
+        info.create_stage = CREATE_STAGES[CREATE_STAGE::RESERVED];
+        info.hpfs_log_level = template_hpfs_log_level;
+        info.is_full_history = template_full_history;
+
+        // Take a pre-provisioned user if there's one, so only the instance specific parts need to be installed.
+        const warm_user pooled_user = acquire_warm_user();
+        const bool is_warm_user = !pooled_user.username.empty();
+        info.username = is_warm_user ? pooled_user.username : generate_username();
 
-        ports instance_ports;
-        if (!vacant_ports.empty())
+        if (reserve_instance(error_msg, info) == -1)
         {
-            // Assign a port pair from one of destroyed instances.
-            instance_ports = vacant_ports.back();
-            last_port_assign_from_vacant = true;
+            if (is_warm_user)
+                release_warm_user(pooled_user);
+            return -1;
         }
-        else
+
+        if (is_warm_user)
         {
-            if (last_port_assign_from_vacant)
-            {
-                sqlite::get_max_ports(db, last_assigned_ports);
-                last_port_assign_from_vacant = false;
-            }
-            instance_ports = {(uint16_t)(last_assigned_ports.peer_port + 1), (uint16_t)(last_assigned_ports.user_port + 1), (uint16_t)(last_assigned_ports.gp_tcp_port_start + 2), (uint16_t)(last_assigned_ports.gp_udp_port_start + 2)};
+            // The instance record is the owner of the user from now on.
+            sqlite::delete_warm_user(db, info.username);
+            LOG_INFO << "Using warm user " << info.username << " for instance " << info.container_name;
         }
+        warm_pool_cv.notify_one();
 
-        int user_id;
-        std::string username;
-        if (install_user(
-                user_id, username, instance_resources.cpu_us, instance_resources.mem_kbytes, instance_resources.swap_kbytes,
-                instance_resources.storage_kbytes, container_name, instance_ports, image_name, outbound_ipv6, outbound_net_interface) == -1)
+        const resources limits = get_instance_resources();
+        LOG_INFO << "Resources for instance - CPU: " << limits.cpu_us << " MicroS, RAM: " << limits.mem_kbytes << " KB, Storage: " << limits.storage_kbytes << " KB.";
+
+        return run_create_stages(error_msg, info, false);
+    }
+
+    /**
+     * Checks the instance name and the allocation limit, assigns ports and records the instance in the database
+     * in the reserved stage. The record holds the reservation until the instance is destroyed or the creation fails.
+     * @param error_msg Error message if any.
+     * @param info Instance to reserve. Assigned ports are populated.
+     * @return 0 on success and -1 on error.
+     */
+    int reserve_instance(std::string &error_msg, instance_info &info)
+    {
+        metrics::scoped_timer timer("hp.reserve_instance");
+        std::scoped_lock lock(allocation_mutex);
+
+        // Creating an instance with same name is not allowed.
+        hp::instance_info existing_instance;
+        if (find_instance(info.container_name, existing_instance) == 0)
         {
-            error_msg = USER_INSTALL_ERROR;
+            error_msg = INSTANCE_ALREADY_EXISTS;
+            LOG_ERROR << "Found another instance with name: " << info.container_name << ".";
             return -1;
         }
 
-        const std::string contract_dir = util::get_user_contract_dir(username, container_name);
+        // If the max allowed instance count or resources are already allocated. We won't allow more.
+        size_t allocated_count;
+        resources allocated;
+        get_allocation(allocated_count, allocated);
+        if (allocated_count >= conf::cfg.system.max_instance_count ||
+            allocated.cpu_us + instance_resources.cpu_us > conf::cfg.system.max_cpu_us ||
+            allocated.mem_kbytes + instance_resources.mem_kbytes > conf::cfg.system.max_mem_kbytes ||
+            allocated.storage_kbytes + instance_resources.storage_kbytes > conf::cfg.system.max_storage_kbytes)
+        {
+            error_msg = MAX_ALLOCATION_REACHED;
+            LOG_ERROR << "Max instance count is reached.";
+            return -1;
+        }
 
-        auto pos = image_name.find("--");
-        if (pos != std::string::npos) {
-        image_name = image_name.substr(0, pos);
+        // Allocations are only an upper bound. The host might still be too busy for another instance.
+        std::string saturated_resource;
+        if (usage::check_admission(saturated_resource, instance_resources.mem_kbytes, instance_resources.storage_kbytes) == -1)
+        {
+            error_msg = HOST_SATURATED;
+            LOG_ERROR << "Host " << saturated_resource << " is saturated. Instance not allowed.";
+            return -1;
         }
 
-        if (create_contract(username, owner_pubkey, contract_id, contract_dir, instance_ports, info) == -1 ||
-            create_container(username, image_name, container_name, contract_dir, instance_ports, info) == -1)
+        // The slot stays reserved while the instance is being created and is released if the creation fails.
+        size_t slot;
+        if (port_slots.reserve(slot) == -1)
         {
-            error_msg = INSTANCE_ERROR;
-            LOG_ERROR << "Error creating hp instance for " << owner_pubkey;
-            // Remove user if instance creation failed.
-            uninstall_user(username, instance_ports, container_name);
+            error_msg = MAX_ALLOCATION_REACHED;
+            LOG_ERROR << "No free ports for the instance.";
             return -1;
         }
 
+        info.assigned_ports = get_slot_ports(slot);
         if (sqlite::insert_hp_instance_row(db, info) == -1)
         {
+            port_slots.release(slot);
             error_msg = DB_WRITE_ERROR;
-            LOG_ERROR << "Error inserting instance data into db for " << owner_pubkey;
-            // Remove container and uninstall user if database update failed.
-            docker_remove(username, container_name);
-            uninstall_user(username, instance_ports, container_name);
+            LOG_ERROR << "Error inserting instance data into db for " << info.owner_pubkey;
             return -1;
         }
-
-        if (last_port_assign_from_vacant)
-            vacant_ports.pop_back();
-        else
-            last_assigned_ports = instance_ports;
+        register_instance(info);
 
         return 0;
     }
 
     /**
-     * Initiate the instance. The config will be updated and container will be started.
+     * Runs the instance creation stages starting after the last finished stage of the instance.
+     * Contract preparation and key generation runs in parallel with the user installation.
+     * The finished stage is persisted after each stage. The instance is rolled back if a stage fails.
      * @param error_msg Error message if any.
-     * @param container_name Name of the container.
-     * @param config_msg Config values for the hp instance.
+     * @param info Instance to create. Populated with the created instance info.
+     * @param is_resume Whether this is resuming a creation interrupted by an agent restart.
      * @return 0 on success and -1 on error.
      */
-    int initiate_instance(std::string &error_msg, std::string_view container_name, const msg::initiate_msg &config_msg)
+    int run_create_stages(std::string &error_msg, instance_info &info, const bool is_resume)
     {
-        instance_info info;
-        const int res = sqlite::is_container_exists(db, container_name, info);
-        if (res == 0)
+        const auto stage_itr = std::find(std::begin(CREATE_STAGES), std::end(CREATE_STAGES), info.create_stage);
+        int stage = stage_itr == std::end(CREATE_STAGES) ? CREATE_STAGE::RESERVED : (stage_itr - std::begin(CREATE_STAGES));
+        if (stage == CREATE_STAGE::COMPLETED)
+            return 0;
+
+        info.contract_dir = util::get_user_contract_dir(info.username, info.container_name);
+
+        // Contract preparation does not depend on the user, so it runs while the user is being installed.
+        std::string contract_config, pubkey_hex;
+        std::future<int> contract_prepared;
+        if (stage < CREATE_STAGE::CONTRACT_PLACED)
+            contract_prepared = std::async(std::launch::async, prepare_contract, std::ref(contract_config), std::ref(pubkey_hex),
+                                           std::string_view(info.owner_pubkey), std::string_view(info.contract_id), info.assigned_ports);
+
+        bool is_user_left = false; // A warm user is left in place by a failed bind, so the rollback removes it.
+        const auto fail = [&](const char *error)
         {
-            error_msg = NO_CONTAINER;
-            LOG_ERROR << "Given container not found. name: " << container_name;
+            error_msg = error;
+            if (contract_prepared.valid())
+                contract_prepared.wait();
+            rollback_instance(info, stage >= CREATE_STAGE::USER_INSTALLED || is_user_left);
             return -1;
-        }
-        else if (info.status != CONTAINER_STATES[STATES::CREATED])
+        };
+
+        const auto persist = [&](const int next_stage)
         {
-            error_msg = DUP_CONTAINER;
-            LOG_ERROR << "Given container is already initiated. name: " << container_name;
-            return -1;
-        }
+            stage = next_stage;
+            info.create_stage = CREATE_STAGES[next_stage];
+            if (sqlite::update_instance_stage(db, info) == -1)
+                return -1;
+            register_instance(info);
+            return 0;
+        };
 
-        // Read the config file into json document object.
-        const std::string contract_dir = util::get_user_contract_dir(info.username, container_name);
-        std::string config_file_path(contract_dir);
-        config_file_path.append("/cfg/hp.cfg");
-        const int config_fd = open(config_file_path.data(), O_RDWR, FILE_PERMS);
-        if (config_fd == -1)
+        if (stage == CREATE_STAGE::RESERVED)
         {
-            error_msg = CONF_READ_ERROR;
-            LOG_ERROR << errno << ": Error opening config file " << config_file_path;
-            return -1;
+            util::user_info existing_user;
+            const bool user_exists = util::get_system_user_info(info.username, existing_user) == 0;
+            if (is_resume && user_exists)
+            {
+                // Agent died during the user installation. Remove the partially installed user and start over.
+                LOG_INFO << "Removing partially installed user " << info.username;
+                uninstall_user(info.username, info.assigned_ports, info.container_name);
+            }
+
+            // A user which exists on a fresh creation is a warm pool user which only needs to be bound to the instance.
+            const std::string_view install_mode = (user_exists && !is_resume) ? INSTALL_MODE_BIND : INSTALL_MODE_FULL;
+
+            int user_id;
+            const resources limits = get_instance_resources();
+            if (install_user(
+                    user_id, info.username, limits.cpu_us, limits.mem_kbytes, limits.swap_kbytes,
+                    limits.storage_kbytes, info.container_name, info.assigned_ports, info.image_name, info.outbound_ipv6, info.outbound_net_interface,
+                    install_mode) == -1)
+            {
+                is_user_left = install_mode == INSTALL_MODE_BIND && util::get_system_user_info(info.username, existing_user) == 0;
+                return fail(USER_INSTALL_ERROR);
+            }
+
+            if (persist(CREATE_STAGE::USER_INSTALLED) == -1)
+                return fail(DB_WRITE_ERROR);
         }
 
-        jsoncons::ojson d;
-        std::string hpfs_log_level;
-        bool is_full_history;
-        if (util::read_json_file(config_fd, d) == -1 ||
-            write_json_values(d, config_msg.config) == -1 ||
-            read_json_values(d, hpfs_log_level, is_full_history) == -1 ||
-            util::write_json_file(config_fd, d) == -1 ||
-            hpfs::update_service_conf(info.username, hpfs_log_level, is_full_history) == -1 ||
-            hpfs::start_hpfs_systemd(info.username) == -1)
+        if (stage == CREATE_STAGE::USER_INSTALLED)
         {
-            error_msg = CONTAINER_CONF_ERROR;
-            LOG_ERROR << "Error when setting up container. name: " << container_name;
-            close(config_fd);
-            return -1;
+            if (contract_prepared.get() == -1)
+                return fail(INSTANCE_ERROR);
+
+            // A contract dir might be left behind if the agent died while placing it.
+            if (util::is_dir_exists(info.contract_dir))
+                util::remove_directory_recursively(info.contract_dir);
+
+            if (place_contract(info.username, contract_config, info.contract_dir) == -1)
+                return fail(INSTANCE_ERROR);
+
+            info.pubkey = pubkey_hex;
+            if (persist(CREATE_STAGE::CONTRACT_PLACED) == -1)
+                return fail(DB_WRITE_ERROR);
         }
-        close(config_fd);
 
-        if (docker_start(info.username, container_name) == -1)
+        // Remove the additional settings given with the image key.
+        std::string image_name = info.image_name;
+        const auto pos = image_name.find("--");
+        if (pos != std::string::npos)
+            image_name = image_name.substr(0, pos);
+
+        // The container might already be created if the agent died before persisting the stage.
+        if (is_resume)
+            docker_remove(info.username, info.container_name);
+
+        if (create_container(info.username, image_name, info.container_name, info.contract_dir, info.assigned_ports, info) == -1)
         {
-            error_msg = CONTAINER_START_ERROR;
-            LOG_ERROR << "Error when starting container. name: " << container_name;
-            // Stop started hpfs processes if starting instance failed.
-            hpfs::stop_hpfs_systemd(info.username);
-            return -1;
+            LOG_ERROR << "Error creating hp instance for " << info.owner_pubkey;
+            return fail(INSTANCE_ERROR);
         }
 
-        if (sqlite::update_status_in_container(db, container_name, CONTAINER_STATES[STATES::RUNNING]) == -1)
+        info.status = CONTAINER_STATES[STATES::CREATED];
+        if (persist(CREATE_STAGE::COMPLETED) == -1)
         {
-            error_msg = CONTAINER_UPDATE_ERROR;
-            LOG_ERROR << "Error when updating container status. name: " << container_name;
-            // Stop started docker and hpfs processes if database update fails.
-            docker_stop(info.username, container_name);
-            hpfs::stop_hpfs_systemd(info.username);
-            return -1;
+            LOG_ERROR << "Error updating instance data in db for " << info.owner_pubkey;
+            // Remove container and uninstall user if database update failed.
+            docker_remove(info.username, info.container_name);
+            return fail(DB_WRITE_ERROR);
         }
 
+        watch_container(info.container_name, info.username, info.status);
         return 0;
     }
 
     /**
-     * Creates a hotpocket docker image on the given contract and the ports.
-     * @param username Username of the instance user.
-     * @param image_name Conatiner image name to use.
-     * @param container_name Name of the container.
-     * @param contract_dir Directory for the contract.
-     * @param assigned_ports Assigned ports to the container.
-     * @return 0 on success execution or relavent error code on error.
+     * Removes everything created for a failed instance creation and releases its reservation.
+     * The reservation is released even if the instance record can't be deleted, so it doesn't hold the ports until a restart.
+     * @param info Instance to roll back.
+     * @param is_user_installed Whether the instance user has been installed.
+     * @return 0 on success and -1 if the instance record could not be deleted.
      */
-    int create_container(std::string_view username, std::string_view image_name, std::string_view container_name, std::string_view contract_dir, const ports &assigned_ports, instance_info &info)
+    int rollback_instance(const instance_info &info, const bool is_user_installed)
     {
-        const std::string user_port = std::to_string(assigned_ports.user_port);
-        const std::string peer_port = std::to_string(assigned_ports.peer_port);
-        const std::string gp_tcp_port_1 = std::to_string(assigned_ports.gp_tcp_port_start);
-        const std::string gp_tcp_port_2 = std::to_string(assigned_ports.gp_tcp_port_start + 1);
-        const std::string gp_udp_port_1 = std::to_string(assigned_ports.gp_udp_port_start);
-        const std::string gp_udp_port_2 = std::to_string(assigned_ports.gp_udp_port_start + 1);
-        const std::string timeout = std::to_string(DOCKER_CREATE_TIMEOUT_SECS);
-        const int len = 376 + username.length() + timeout.length() + conf::ctx.exe_dir.length() + container_name.length() + (user_port.length() * 2) + (peer_port.length() * 4) + (gp_tcp_port_1.length() * 2) + (gp_tcp_port_2.length() * 2) + (gp_udp_port_1.length() * 2) + (gp_udp_port_2.length() * 2) + contract_dir.length() + image_name.length();
-        char command[len];
-        sprintf(command, DOCKER_CREATE, username.data(), timeout.data(), conf::ctx.exe_dir.data(), container_name.data(),
-                user_port.data(), user_port.data(),
-                peer_port.data(), peer_port.data(),
-                peer_port.data(), peer_port.data(),
-                gp_tcp_port_1.data(), gp_tcp_port_1.data(),
-                gp_tcp_port_2.data(), gp_tcp_port_2.data(),
-                gp_udp_port_1.data(), gp_udp_port_1.data(),
-                gp_udp_port_2.data(), gp_udp_port_2.data(),
-                contract_dir.data(), image_name.data());
+        // Remove user if instance creation failed.
+        if (is_user_installed)
+            uninstall_user(info.username, info.assigned_ports, info.container_name);
+
+        std::scoped_lock lock(allocation_mutex);
+        const int ret = sqlite::delete_hp_instance(db, info.container_name);
+        if (ret == -1)
+            LOG_ERROR << "Error deleting the record of the rolled back instance " << info.container_name;
+
+        unregister_instance(info.container_name);
+        release_port_slot(info.assigned_ports);
+        return ret;
+    }
 
-        LOG_INFO << "Creating the docker container. name: " << container_name;
-        if (system(command) != 0)
+    /**
+     * Continues the instance creations which were interrupted by an agent restart.
+     */
+    void resume_pending_instances()
+    {
+        std::vector<instance_info> instances;
+        sqlite::get_pending_instances(db, instances);
+
+        for (instance_info &info : instances)
         {
-            LOG_ERROR << "Error when running container. name: " << container_name;
-            return -1;
+            LOG_INFO << "Resuming creation of instance " << info.container_name << " after stage " << info.create_stage;
+            std::string error_msg;
+            if (run_create_stages(error_msg, info, true) == -1)
+                LOG_ERROR << "Resuming creation of instance " << info.container_name << " failed. " << error_msg;
         }
-
-        info.container_name = container_name;
-        info.contract_dir = contract_dir;
-        info.image_name = image_name;
-        return 0;
     }
 
     /**
-     * Stops the container with given name if exists.
-     * @param container_name Name of the container.
-     * @return 0 on success execution or relavent error code on error.
+     * Brings up the instances which should be running, after an agent or host restart. Instances are restored in
+     * parallel by a bounded number of workers, the ones with the most lease time remaining first.
      */
-    int stop_container(std::string_view container_name)
+    void restore_running_instances()
     {
-        instance_info info;
-        const int res = sqlite::is_container_exists(db, container_name, info);
-        if (res == 0)
-        {
-            LOG_ERROR << "Given container not found. name: " << container_name;
-            return -1;
-        }
-        else if (info.status != CONTAINER_STATES[STATES::RUNNING])
+        std::vector<instance_info> instances;
+        get_instance_list(instances);
+
+        // Exited instances have crashed, so they are also expected to be running.
+        std::vector<instance_info> targets;
+        for (instance_info &instance : instances)
         {
-            LOG_ERROR << "Given container is not running. name: " << container_name;
-            return -1;
+            if (instance.status == CONTAINER_STATES[STATES::RUNNING] || instance.status == CONTAINER_STATES[STATES::EXITED])
+                targets.push_back(std::move(instance));
         }
 
-        if (docker_stop(info.username, container_name) == -1 ||
-            sqlite::update_status_in_container(db, container_name, CONTAINER_STATES[STATES::STOPPED]) == -1 ||
-            hpfs::stop_hpfs_systemd(info.username) == -1)
+        if (targets.empty())
+            return;
+
+        // Instances without a lease record are restored last.
+        std::vector<lease_info> leases;
+        get_lease_list(leases);
+        std::unordered_map<std::string, uint64_t> expiry_times;
+        for (const lease_info &lease : leases)
+            expiry_times[lease.container_name] = lease.timestamp + (lease.life_moments * msg::MOMENT_SIZE);
+
+        std::stable_sort(targets.begin(), targets.end(), [&](const instance_info &a, const instance_info &b)
+                         {
+                             const auto a_itr = expiry_times.find(a.container_name);
+                             const auto b_itr = expiry_times.find(b.container_name);
+                             return (a_itr == expiry_times.end() ? 0 : a_itr->second) > (b_itr == expiry_times.end() ? 0 : b_itr->second);
+                         });
+
+        LOG_INFO << "Restoring " << targets.size() << " instances.";
+        const uint64_t start_time = util::get_epoch_milliseconds();
+
+        std::atomic<size_t> next_index = 0;
+        std::atomic<size_t> restored_count = 0;
+        std::vector<std::thread> workers;
+        const size_t worker_count = std::min(conf::cfg.system.restore_concurrency, targets.size());
+        for (size_t i = 0; i < worker_count; i++)
         {
-            LOG_ERROR << "Error when stopping container. name: " << container_name;
-            return -1;
+            workers.emplace_back([&]()
+                                 {
+                                     util::mask_signal();
+                                     size_t index;
+                                     while ((index = next_index++) < targets.size())
+                                     {
+                                         if (restore_instance(targets[index]) == 0)
+                                             restored_count++;
+                                     }
+                                 });
         }
 
-        return 0;
+        for (std::thread &worker : workers)
+            worker.join();
+
+        LOG_INFO << "Restored " << restored_count << " of " << targets.size() << " instances in " << (util::get_epoch_milliseconds() - start_time) << "ms.";
     }
 
     /**
-     * Starts the container with given name if exists.
-     * @param container_name Name of the container.
-     * @return 0 on success execution or relavent error code on error.
+     * Makes sure the docker daemon, the hpfs services and the container of the given instance are running.
+     * @param info Instance to restore.
+     * @return 0 on success and -1 on error.
      */
-    int start_container(std::string_view container_name)
+    int restore_instance(const instance_info &info)
     {
-        instance_info info;
-        const int res = sqlite::is_container_exists(db, container_name, info);
-        if (res == 0)
-        {
-            LOG_ERROR << "Given container not found. name: " << container_name;
-            return -1;
-        }
-        else if (info.status != CONTAINER_STATES[STATES::STOPPED])
+        util::user_info user;
+        if (util::get_system_user_info(info.username, user) == -1)
         {
-            LOG_ERROR << "Given container is not stopped. name: " << container_name;
+            LOG_ERROR << "Cannot restore instance " << info.container_name << ". User " << info.username << " not found.";
             return -1;
         }
-        // Read the config file into json document object.
-        const std::string contract_dir = util::get_user_contract_dir(info.username, container_name);
-        std::string config_file_path(contract_dir);
-        config_file_path.append("/cfg/hp.cfg");
-        const int config_fd = open(config_file_path.data(), O_RDONLY, FILE_PERMS);
-        if (config_fd == -1)
+
+        // The daemon is normally brought up by the user's systemd manager at boot. Start it if that hasn't happened yet.
+        if (docker::ping(user.user_id) == -1)
         {
-            LOG_ERROR << errno << ": Error opening hp config file " << config_file_path;
-            return -1;
+            if (systemd::start_units(user.user_id, DOCKER_UNITS) == -1)
+                LOG_ERROR << "Error starting the docker service of " << info.username;
+
+            const uint64_t timeout_at = util::get_epoch_milliseconds() + (RESTORE_DOCKER_TIMEOUT_SECS * 1000);
+            while (docker::ping(user.user_id) == -1)
+            {
+                if (util::get_epoch_milliseconds() >= timeout_at)
+                {
+                    LOG_ERROR << "Docker daemon of " << info.username << " did not come up. Cannot restore instance " << info.container_name;
+                    return -1;
+                }
+                util::sleep(1000);
+            }
         }
 
-        jsoncons::ojson d;
-        std::string hpfs_log_level;
-        bool is_full_history;
-        if (util::read_json_file(config_fd, d) == -1 ||
-            read_json_values(d, hpfs_log_level, is_full_history) == -1 ||
-            hpfs::update_service_conf(info.username, hpfs_log_level, is_full_history) == -1 ||
-            hpfs::start_hpfs_systemd(info.username) == -1 ||
-            docker_start(info.username, container_name) == -1)
+        std::string status;
+        if (hpfs::start_hpfs_systemd(info.username) == -1 ||
+            docker::get_container_status(user.user_id, info.container_name, status) == -1 ||
+            (status != "running" && docker::start_container(user.user_id, info.container_name) == -1))
         {
-            LOG_ERROR << "Error when starting container. name: " << container_name;
-            close(config_fd);
+            LOG_ERROR << "Error restoring instance " << info.container_name;
             return -1;
         }
-        close(config_fd);
 
-        if (sqlite::update_status_in_container(db, container_name, CONTAINER_STATES[STATES::RUNNING]) == -1)
-        {
-            LOG_ERROR << "Error when starting container. name: " << container_name;
-            // Stop started docker and hpfs processes if database update fails.
-            docker_stop(info.username, container_name);
-            hpfs::stop_hpfs_systemd(info.username);
+        if (update_container_status(info.container_name, CONTAINER_STATES[STATES::RUNNING]) == -1)
             return -1;
-        }
 
         return 0;
     }
 
     /**
-     * Execute docker start <container_name> command.
-     * @param username Username of the instance user.
-     * @param container_name Name of the container.
-     * @return 0 on successful execution and -1 on error.
+     * Loads the warm pool users and starts refilling the pool in the background if the pool is enabled.
+     * Users whose provisioning was interrupted, users installed with other limits than the current instance resources
+     * and users beyond the configured pool size are removed.
      */
-    int docker_start(std::string_view username, std::string_view container_name)
+    void init_warm_pool()
     {
-        const int len = 100 + username.length() + conf::ctx.exe_dir.length() + container_name.length();
-        char command[len];
-        sprintf(command, DOCKER_START, username.data(), conf::ctx.exe_dir.data(), container_name.data());
-        return system(command) == 0 ? 0 : -1;
-    }
+        sqlite::delete_allocated_warm_users(db);
 
-    /**
-     * Execute docker stop <container_name> command.
-     * @param username Username of the instance user.
+        std::vector<warm_user> unfinished_users, ready_users;
+        sqlite::get_warm_users(db, unfinished_users, false);
+        sqlite::get_warm_users(db, ready_users, true);
+
+        const resources limits = get_instance_resources();
+        for (warm_user &user : ready_users)
+        {
+            if (user.limits == limits && warm_users.size() < conf::cfg.system.warm_pool_size)
+                warm_users.push_back(std::move(user));
+            else
+                unfinished_users.push_back(std::move(user));
+        }
+
+        const ports no_ports;
+        for (const warm_user &user : unfinished_users)
+        {
+            util::user_info existing_user;
+            if (util::get_system_user_info(user.username, existing_user) == 0 && uninstall_user(user.username, no_ports, "-") == -1)
+                continue; // Keep the record so the removal is retried on the next start.
+            sqlite::delete_warm_user(db, user.username);
+        }
+
+        if (conf::cfg.system.warm_pool_size > 0)
+        {
+            LOG_INFO << "Warm pool has " << warm_users.size() << " of " << conf::cfg.system.warm_pool_size << " users.";
+            warm_pool_thread = std::thread(warm_pool_loop);
+        }
+    }
+
+    /**
+     * Keeps the warm pool filled up to the configured size. The pool never takes the instances and the pool users
+     * together beyond the max instance count. Retired pool users are removed before refilling.
+     */
+    void warm_pool_loop()
+    {
+        util::mask_signal();
+
+        const ports no_ports;
+        std::unique_lock lock(allocation_mutex);
+        while (!is_shutting_down)
+        {
+            if (!retired_warm_users.empty())
+            {
+                const std::string username = retired_warm_users.back();
+                retired_warm_users.pop_back();
+                lock.unlock();
+                // The record is kept on failure, so the removal is retried on the next start.
+                if (uninstall_user(username, no_ports, "-") == 0)
+                    sqlite::delete_warm_user(db, username);
+                lock.lock();
+                continue;
+            }
+
+            size_t allocated_count;
+            resources allocated;
+            get_allocation(allocated_count, allocated);
+            const size_t free_count = allocated_count >= conf::cfg.system.max_instance_count
+                                          ? 0
+                                          : conf::cfg.system.max_instance_count - allocated_count;
+            if (warm_users.size() >= std::min(conf::cfg.system.warm_pool_size, free_count))
+            {
+                warm_pool_cv.wait(lock);
+                continue;
+            }
+
+            lock.unlock();
+            const int ret = provision_warm_user();
+            lock.lock();
+
+            if (ret == -1 && !is_shutting_down)
+                warm_pool_cv.wait_for(lock, std::chrono::seconds(WARM_POOL_RETRY_SECS));
+        }
+    }
+
+    /**
+     * Installs the instance independent parts of a new user and adds it to the warm pool.
+     * @return 0 on success and -1 on error.
+     */
+    int provision_warm_user()
+    {
+        warm_user user{generate_username(), get_instance_resources()};
+        std::string &username = user.username;
+        if (sqlite::insert_warm_user(db, user) == -1)
+            return -1;
+
+        int user_id;
+        const ports no_ports;
+        const resources &limits = user.limits;
+        if (install_user(
+                user_id, username, limits.cpu_us, limits.mem_kbytes, limits.swap_kbytes,
+                limits.storage_kbytes, "-", no_ports, "-", "-", "-", INSTALL_MODE_BASE) == -1)
+        {
+            sqlite::delete_warm_user(db, username);
+            return -1;
+        }
+
+        // The most used images are imported while the user waits in the pool, so its lease doesn't wait for them.
+        docker::prefetch_images(user_id, DOCKER_CREATE_TIMEOUT_SECS);
+
+        if (sqlite::update_warm_user_ready(db, username) == -1)
+        {
+            if (uninstall_user(username, no_ports, "-") == 0)
+                sqlite::delete_warm_user(db, username);
+            return -1;
+        }
+
+        std::scoped_lock lock(allocation_mutex);
+        // The instance resources might have changed during the install.
+        if (limits == instance_resources)
+        {
+            warm_users.push_back(user);
+            LOG_INFO << "Added warm user " << username << " to the pool.";
+        }
+        else
+        {
+            retired_warm_users.push_back(username);
+        }
+        return 0;
+    }
+
+    /**
+     * Takes the oldest user from the warm pool.
+     * @return The taken user. Username is empty if the pool is empty.
+     */
+    const warm_user acquire_warm_user()
+    {
+        std::scoped_lock lock(allocation_mutex);
+        if (warm_users.empty())
+            return {};
+
+        const warm_user user = warm_users.front();
+        warm_users.erase(warm_users.begin());
+        return user;
+    }
+
+    /**
+     * Puts back a warm user which could not be used for an instance. It's retired instead if the instance resources
+     * changed since it was installed.
+     * @param user The warm user.
+     */
+    void release_warm_user(const warm_user &user)
+    {
+        std::scoped_lock lock(allocation_mutex);
+        if (user.limits == instance_resources)
+        {
+            warm_users.insert(warm_users.begin(), user);
+        }
+        else
+        {
+            retired_warm_users.push_back(user.username);
+            warm_pool_cv.notify_one();
+        }
+    }
+
+    /**
+     * Moves the warm pool users which don't match the instance resources or exceed the pool size to the retired users,
+     * so the pool thread replaces or removes them. Must be called holding the allocation mutex.
+     */
+    void retire_warm_users()
+    {
+        auto itr = std::stable_partition(warm_users.begin(), warm_users.end(), [](const warm_user &user)
+                                         { return user.limits == instance_resources; });
+        if ((size_t)(itr - warm_users.begin()) > conf::cfg.system.warm_pool_size)
+            itr = warm_users.begin() + conf::cfg.system.warm_pool_size;
+        for (auto retired = itr; retired != warm_users.end(); retired++)
+            retired_warm_users.push_back(retired->username);
+        if (itr != warm_users.end())
+            LOG_INFO << "Retiring " << (warm_users.end() - itr) << " warm users not matching the instance resources or the pool size.";
+        warm_users.erase(itr, warm_users.end());
+    }
+
+    /**
+     * Initiate the instance. The config will be updated and container will be started.
+     * @param error_msg Error message if any.
      * @param container_name Name of the container.
-     * @return 0 on successful execution and -1 on error.
+     * @param config_msg Config values for the hp instance.
+     * @return 0 on success and -1 on error.
      */
-    int docker_stop(std::string_view username, std::string_view container_name)
+    int initiate_instance(std::string &error_msg, std::string_view container_name, const msg::initiate_msg &config_msg)
     {
-        const int len = 99 + username.length() + conf::ctx.exe_dir.length() + container_name.length();
-        char command[len];
-        sprintf(command, DOCKER_STOP, username.data(), conf::ctx.exe_dir.data(), container_name.data());
-        return system(command) == 0 ? 0 : -1;
+        if (wait_for_start() == -1)
+        {
+            error_msg = NOT_STARTED;
+            return -1;
+        }
+
+        metrics::scoped_timer timer("hp.initiate");
+        instance_info info;
+        if (find_instance(container_name, info) == -1)
+        {
+            error_msg = NO_CONTAINER;
+            LOG_ERROR << "Given container not found. name: " << container_name;
+            return -1;
+        }
+        else if (info.status != CONTAINER_STATES[STATES::CREATED])
+        {
+            error_msg = DUP_CONTAINER;
+            LOG_ERROR << "Given container is already initiated. name: " << container_name;
+            return -1;
+        }
+
+        // Read the config file into json document object.
+        const std::string contract_dir = util::get_user_contract_dir(info.username, container_name);
+        std::string config_file_path(contract_dir);
+        config_file_path.append("/cfg/hp.cfg");
+        const int config_fd = open(config_file_path.data(), O_RDWR, FILE_PERMS);
+        if (config_fd == -1)
+        {
+            error_msg = CONF_READ_ERROR;
+            LOG_ERROR << errno << ": Error opening config file " << config_file_path;
+            return -1;
+        }
+
+        jsoncons::ojson d;
+        std::string hpfs_log_level;
+        bool is_full_history;
+        msg::history_configuration history_config;
+        if (util::read_json_file(config_fd, d) == -1 ||
+            write_json_values(d, config_msg.config) == -1 ||
+            read_json_values(d, hpfs_log_level, is_full_history) == -1 ||
+            read_history_values(d, history_config) == -1 ||
+            util::write_json_file(config_fd, d) == -1 ||
+            sqlite::update_hpfs_settings(db, container_name, hpfs_log_level, is_full_history) == -1 ||
+            hpfs::update_service_conf(info.username, hpfs_log_level, is_full_history) == -1 ||
+            hpfs::start_hpfs_systemd(info.username) == -1)
+        {
+            error_msg = CONTAINER_CONF_ERROR;
+            LOG_ERROR << "Error when setting up container. name: " << container_name;
+            close(config_fd);
+            return -1;
+        }
+        close(config_fd);
+        set_registered_hpfs_settings(container_name, hpfs_log_level, is_full_history);
+        set_registered_history_config(container_name, history_config);
+
+        if (docker_start(info.username, container_name) == -1)
+        {
+            error_msg = CONTAINER_START_ERROR;
+            LOG_ERROR << "Error when starting container. name: " << container_name;
+            // Stop started hpfs processes if starting instance failed.
+            hpfs::stop_hpfs_systemd(info.username);
+            return -1;
+        }
+
+        if (update_container_status(container_name, CONTAINER_STATES[STATES::RUNNING]) == -1)
+        {
+            error_msg = CONTAINER_UPDATE_ERROR;
+            LOG_ERROR << "Error when updating container status. name: " << container_name;
+            // Stop started docker and hpfs processes if database update fails.
+            docker_stop(info.username, container_name);
+            hpfs::stop_hpfs_systemd(info.username);
+            return -1;
+        }
+
+        return 0;
     }
 
     /**
-     * Execute docker rm <container_name> command.
+     * Creates a hotpocket docker image on the given contract and the ports.
      * @param username Username of the instance user.
+     * @param image_name Conatiner image name to use.
      * @param container_name Name of the container.
-     * @return 0 on successful execution and -1 on error.
+     * @param contract_dir Directory for the contract.
+     * @param assigned_ports Assigned ports to the container.
+     * @return 0 on success execution or relavent error code on error.
      */
-    int docker_remove(std::string_view username, std::string_view container_name)
+    int create_container(std::string_view username, std::string_view image_name, std::string_view container_name, std::string_view contract_dir, const ports &assigned_ports, instance_info &info)
     {
-        const int len = 100 + username.length() + conf::ctx.exe_dir.length() + container_name.length();
-        char command[len];
-        sprintf(command, DOCKER_REMOVE, username.data(), conf::ctx.exe_dir.data(), container_name.data());
-        return system(command) == 0 ? 0 : -1;
+        metrics::scoped_timer timer("hp.create_container");
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
+            return -1;
+
+        // We instruct the demon to restart the container automatically once the container exits except manually stopping.
+        docker::container_config config;
+        config.name = container_name;
+        config.image = image_name;
+        config.cmd = {"run", "/contract"};
+        config.ports = {
+            {assigned_ports.user_port, false},
+            {assigned_ports.peer_port, false},
+            {assigned_ports.peer_port, true},
+            {assigned_ports.gp_tcp_port_start, false},
+            {(uint16_t)(assigned_ports.gp_tcp_port_start + 1), false},
+            {assigned_ports.gp_udp_port_start, true},
+            {(uint16_t)(assigned_ports.gp_udp_port_start + 1), true}};
+        config.mount_source = contract_dir;
+        config.mount_target = "/contract";
+
+        LOG_INFO << "Creating the docker container. name: " << container_name;
+        if (docker::create_container(user.user_id, config, DOCKER_CREATE_TIMEOUT_SECS) == -1)
+        {
+            LOG_ERROR << "Error when running container. name: " << container_name;
+            return -1;
+        }
+
+        info.container_name = container_name;
+        info.contract_dir = contract_dir;
+        info.image_name = image_name;
+        return 0;
     }
 
     /**
-     * Destroy the container with given name if exists.
-     * @param error_msg Error message if any.
+     * Stops the container with given name if exists.
      * @param container_name Name of the container.
      * @return 0 on success execution or relavent error code on error.
      */
-    int destroy_container(std::string &error_msg, std::string_view container_name)
+    int stop_container(std::string_view container_name)
     {
+        if (wait_for_start() == -1)
+            return -1;
+
+        metrics::scoped_timer timer("hp.stop");
         instance_info info;
-        const int res = sqlite::is_container_exists(db, container_name, info);
-        if (res == 0)
+        if (find_instance(container_name, info) == -1)
         {
-            error_msg = NO_CONTAINER;
             LOG_ERROR << "Given container not found. name: " << container_name;
             return -1;
         }
+        else if (info.status != CONTAINER_STATES[STATES::RUNNING])
+        {
+            LOG_ERROR << "Given container is not running. name: " << container_name;
+            return -1;
+        }
 
-        LOG_INFO << "Deleting instance " << container_name;
-        if (uninstall_user(info.username, info.assigned_ports, container_name) == -1 ||
-            // sqlite::update_status_in_container(db, container_name, CONTAINER_STATES[STATES::DESTROYED]) == -1) // Soft Deletion.
-            sqlite::delete_hp_instance(db, container_name) == -1) // Permanent Deletion.
+        // Mark the stop as intended so the resulting die event is not taken as a crash.
+        set_container_stopping(container_name, true);
+        if (docker_stop(info.username, container_name) == -1)
         {
-            error_msg = USER_UNINSTALL_ERROR;
+            set_container_stopping(container_name, false);
+            LOG_ERROR << "Error when stopping container. name: " << container_name;
             return -1;
         }
-        // Add the port pair of the destroyed container to the vacant port vector.
-        if (std::find(vacant_ports.begin(), vacant_ports.end(), info.assigned_ports) == vacant_ports.end())
+
+        if (update_container_status(container_name, CONTAINER_STATES[STATES::STOPPED]) == -1 ||
+            hpfs::stop_hpfs_systemd(info.username) == -1)
         {
-            if (info.assigned_ports.gp_tcp_port_start == 0)
-            {
-                const uint16_t increment = ((info.assigned_ports.peer_port - conf::cfg.hp.init_peer_port) * 2);
-                const uint16_t gp_tcp_port_start = conf::cfg.hp.init_gp_tcp_port + increment;
-                const uint16_t gp_udp_port_start = conf::cfg.hp.init_gp_udp_port + increment;
-                vacant_ports.push_back({info.assigned_ports.user_port, info.assigned_ports.peer_port, gp_tcp_port_start, gp_udp_port_start});
-            }
-            else
-            {
-                vacant_ports.push_back(info.assigned_ports);
-            }
+            LOG_ERROR << "Error when stopping container. name: " << container_name;
+            return -1;
         }
 
         return 0;
     }
 
     /**
-     * Creates a copy of default contract with the given name and the ports in the instance folder given in the config file.
-     * @param username Name of the instance user.
-     * @param owner_pubkey Public key of the owner of the instance.
-     * @param contract_id Contract id to be configured.
-     * @param contract_dir Directory of the contract.
-     * @param assigned_ports Assigned ports to the instance.
-     * @param info Information of the created contract instance.
-     * @return -1 on error and 0 on success.
-     *
+     * Starts the container with given name if exists.
+     * @param container_name Name of the container.
+     * @return 0 on success execution or relavent error code on error.
      */
-    int create_contract(std::string_view username, std::string_view owner_pubkey, std::string_view contract_id,
-                        std::string_view contract_dir, const ports &assigned_ports, instance_info &info)
+    int start_container(std::string_view container_name)
     {
-        // Creating a temporary directory to do the config manipulations before moved to the contract dir.
-        // Folders inside /tmp directory will be cleaned after a reboot. So this will self cleanup folders
-        // that might be remaining due to another error in the workflow.
-        char templ[17] = "/tmp/sashiXXXXXX";
-        const char *temp_dirpath = mkdtemp(templ);
-        if (temp_dirpath == NULL)
+        if (wait_for_start() == -1)
+            return -1;
+
+        metrics::scoped_timer timer("hp.start");
+        instance_info info;
+        if (find_instance(container_name, info) == -1)
         {
-            LOG_ERROR << errno << ": Error creating temporary directory to create contract folder.";
+            LOG_ERROR << "Given container not found. name: " << container_name;
             return -1;
         }
-        const std::string source_path = conf::ctx.contract_template_path + "/*";
-        int len = 25 + source_path.length();
-        char cp_command[len];
-        sprintf(cp_command, COPY_DIR, source_path.data(), temp_dirpath);
-        if (system(cp_command) != 0)
+        else if (info.status != CONTAINER_STATES[STATES::STOPPED] && info.status != CONTAINER_STATES[STATES::EXITED])
         {
-            LOG_ERROR << errno << ": Default contract copying failed to " << temp_dirpath;
+            LOG_ERROR << "Given container is not stopped. name: " << container_name;
             return -1;
         }
 
-        const std::string config_dir = std::string(temp_dirpath) + "/cfg";
+        // Hpfs settings are cached with the instance. Only the instances recorded before that need the config read.
+        if ((info.hpfs_log_level.empty() && load_hpfs_settings(info) == -1) ||
+            hpfs::update_service_conf(info.username, info.hpfs_log_level, info.is_full_history) == -1 ||
+            hpfs::start_hpfs_systemd(info.username) == -1 ||
+            docker_start(info.username, container_name) == -1)
+        {
+            LOG_ERROR << "Error when starting container. name: " << container_name;
+            return -1;
+        }
 
-        // Read the config file into json document object.
-        const std::string config_file_path = config_dir + "/hp.cfg";
-        const int config_fd = open(config_file_path.data(), O_RDWR, FILE_PERMS);
+        if (update_container_status(container_name, CONTAINER_STATES[STATES::RUNNING]) == -1)
+        {
+            LOG_ERROR << "Error when starting container. name: " << container_name;
+            // Stop started docker and hpfs processes if database update fails.
+            docker_stop(info.username, container_name);
+            hpfs::stop_hpfs_systemd(info.username);
+            return -1;
+        }
 
-        if (config_fd == -1)
+        return 0;
+    }
+
+    /**
+     * Start the container through the docker daemon api of the instance user.
+     * @param username Username of the instance user.
+     * @param container_name Name of the container.
+     * @return 0 on successful execution and -1 on error.
+     */
+    int docker_start(std::string_view username, std::string_view container_name)
+    {
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
+            return -1;
+        return docker::start_container(user.user_id, container_name);
+    }
+
+    /**
+     * Stop the container through the docker daemon api of the instance user.
+     * @param username Username of the instance user.
+     * @param container_name Name of the container.
+     * @return 0 on successful execution and -1 on error.
+     */
+    int docker_stop(std::string_view username, std::string_view container_name)
+    {
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
+            return -1;
+        return docker::stop_container(user.user_id, container_name);
+    }
+
+    /**
+     * Forcefully remove the container through the docker daemon api of the instance user.
+     * @param username Username of the instance user.
+     * @param container_name Name of the container.
+     * @return 0 on successful execution and -1 on error.
+     */
+    int docker_remove(std::string_view username, std::string_view container_name)
+    {
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
+            return -1;
+        return docker::remove_container(user.user_id, container_name);
+    }
+
+    /**
+     * Destroy the container with given name if exists.
+     * @param error_msg Error message if any.
+     * @param container_name Name of the container.
+     * @return 0 on success execution or relavent error code on error.
+     */
+    int destroy_container(std::string &error_msg, std::string_view container_name)
+    {
+        if (wait_for_start() == -1)
         {
-            LOG_ERROR << errno << ": Error opening hp config file " << config_file_path;
+            error_msg = NOT_STARTED;
             return -1;
         }
 
-        jsoncons::ojson d;
-        if (util::read_json_file(config_fd, d) == -1)
+        metrics::scoped_timer timer("hp.destroy");
+        instance_info info;
+        if (find_instance(container_name, info) == -1)
         {
-            close(config_fd);
+            error_msg = NO_CONTAINER;
+            LOG_ERROR << "Given container not found. name: " << container_name;
             return -1;
         }
 
+        LOG_INFO << "Deleting instance " << container_name;
+        // Stop listening before the daemon goes away with the user.
+        unwatch_container(container_name);
+        if (uninstall_user(info.username, info.assigned_ports, container_name) == -1 ||
+            // sqlite::update_status_in_container(db, container_name, CONTAINER_STATES[STATES::DESTROYED]) == -1) // Soft Deletion.
+            sqlite::delete_hp_instance(db, container_name) == -1) // Permanent Deletion.
+        {
+            error_msg = USER_UNINSTALL_ERROR;
+            watch_container(container_name, info.username, info.status);
+            return -1;
+        }
+        // Free the ports of the destroyed container. The slots are rebuilt from the registry under the same lock.
+        std::scoped_lock lock(allocation_mutex);
+        unregister_instance(container_name);
+        release_port_slot(info.assigned_ports);
+
+        // Freed instance slot might allow the warm pool to grow.
+        warm_pool_cv.notify_one();
+        return 0;
+    }
+
+    /**
+     * Prepares the hp config of a new contract from the default contract, configured with new keys, the contract id and the ports.
+     * @param config Prepared hp config json.
+     * @param pubkey_hex Generated public key of the contract in hex.
+     * @param owner_pubkey Public key of the owner of the instance.
+     * @param contract_id Contract id to be configured.
+     * @param assigned_ports Assigned ports to the instance.
+     * @return -1 on error and 0 on success.
+     */
+    int prepare_contract(std::string &config, std::string &pubkey_hex, std::string_view owner_pubkey, std::string_view contract_id, const ports &assigned_ports)
+    {
+        metrics::scoped_timer timer("hp.prepare_contract");
+        // Template is only read after init, so the copy needs no locking.
+        jsoncons::ojson d = config_template;
+
         std::string pubkey, seckey;
         crypto::generate_signing_keys(pubkey, seckey);
 
-        const std::string pubkey_hex = util::to_hex(pubkey);
+        pubkey_hex = util::to_hex(pubkey);
 
         d["node"]["public_key"] = pubkey_hex;
         d["node"]["private_key"] = util::to_hex(seckey);
         d["contract"]["id"] = contract_id;
         d["contract"]["run_as"] = contract_ugid.to_string();
         jsoncons::ojson unl(jsoncons::json_array_arg);
-        unl.push_back(util::to_hex(pubkey));
+        unl.push_back(pubkey_hex);
         d["contract"]["unl"] = unl;
         d["contract"]["bin_path"] = "bootstrap_contract";
         d["contract"]["bin_args"] = owner_pubkey;
@@ -592,51 +1145,61 @@ namespace hp
         d["user"]["port"] = assigned_ports.user_port;
         d["hpfs"]["external"] = true;
 
-        if (util::write_json_file(config_fd, d) == -1)
+        if (util::serialize_json(d, config) == -1)
         {
-            LOG_ERROR << "Writing modified hp config failed.";
-            close(config_fd);
+            LOG_ERROR << "Preparing modified hp config failed.";
             return -1;
         }
-        close(config_fd);
 
-        // Move the contract to contract dir
-        len = 22 + contract_dir.length();
-        char mv_command[len];
-        sprintf(mv_command, MOVE_DIR, temp_dirpath, contract_dir.data());
-        if (system(mv_command) != 0)
+        return 0;
+    }
+
+    /**
+     * Creates the contract dir of the instance user from the default contract with the prepared hp config.
+     * The default contract is copied in one pass, owned by the instance user, and the hp config is written separately.
+     * @param username Name of the instance user.
+     * @param config Prepared hp config json.
+     * @param contract_dir Directory of the contract.
+     * @return -1 on error and 0 on success.
+     */
+    int place_contract(std::string_view username, std::string_view config, std::string_view contract_dir)
+    {
+        metrics::scoped_timer timer("hp.place_contract");
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
         {
-            LOG_ERROR << "Default contract moving failed to " << contract_dir;
+            LOG_ERROR << "Instance user " << username << " not found for placing the contract.";
             return -1;
         }
 
-        // Transfer ownership to the instance user.
-        len = 12 + (username.length() * 2) + contract_dir.length();
-        char own_command[len];
-        sprintf(own_command, CHOWN_DIR, username.data(), username.data(), contract_dir.data());
-        len = 11 + 4 + contract_dir.length();
         // Give group write access to the contract directory, So contract user can write into it.
-        char perm_command[len];
-        sprintf(perm_command, CHMOD_DIR, "0775", contract_dir.data());
-        if (system(own_command) != 0 || system(perm_command) != 0)
+        if (util::clone_tree(conf::ctx.contract_template_path, contract_dir, user.user_id, user.group_id, CONTRACT_DIR_PERMS, {HP_CONFIG_PATH}) == -1)
         {
-            LOG_ERROR << "Changing contract ownership and permissions failed " << contract_dir;
+            LOG_ERROR << "Default contract copying failed to " << contract_dir;
+            util::remove_directory_recursively(contract_dir);
             return -1;
         }
 
-        info.owner_pubkey = owner_pubkey;
-        info.username = username;
-        info.contract_dir = contract_dir;
-        info.ip = conf::cfg.hp.host_address;
-        info.contract_id = contract_id;
-        info.pubkey = pubkey_hex;
-        info.assigned_ports = assigned_ports;
-        info.status = CONTAINER_STATES[STATES::CREATED];
+        const std::string config_file_path = std::string(contract_dir) + "/" + HP_CONFIG_PATH;
+        const int config_fd = open(config_file_path.data(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, CONTRACT_DIR_PERMS);
+        if (config_fd == -1 ||
+            fchown(config_fd, user.user_id, user.group_id) == -1 ||
+            fchmod(config_fd, CONTRACT_DIR_PERMS) == -1 ||
+            write(config_fd, config.data(), config.size()) != (ssize_t)config.size())
+        {
+            LOG_ERROR << errno << ": Writing hp config failed to " << config_file_path;
+            if (config_fd != -1)
+                close(config_fd);
+            util::remove_directory_recursively(contract_dir);
+            return -1;
+        }
+        close(config_fd);
+
         return 0;
     }
 
     /**
-     * Check the status of the given container using docker inspect command.
+     * Check the status of the given container through the docker daemon api.
      * @param username Username of the instance user.
      * @param container_name Name of the container.
      * @param status The variable that holds the status of the container.
@@ -644,21 +1207,236 @@ namespace hp
      */
     int check_instance_status(std::string_view username, std::string_view container_name, std::string &status)
     {
-        const int len = 136 + username.length() + conf::ctx.exe_dir.length() + container_name.length();
-        char command[len];
-        sprintf(command, DOCKER_STATUS, username.data(), conf::ctx.exe_dir.data(), container_name.data());
-
-        char buffer[20];
-
-        if (util::execute_bash_cmd(command, buffer, 20) == -1)
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
             return -1;
+        return docker::get_container_status(user.user_id, container_name, status);
+    }
 
-        status = buffer;
-        status = status.substr(1, status.length() - 3);
+    /**
+     * Starts tracking the state of the given container through the docker events of its user.
+     * @param container_name Name of the container.
+     * @param username Username of the instance user.
+     * @param status Current status of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int watch_container(std::string_view container_name, std::string_view username, std::string_view status)
+    {
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
+        {
+            LOG_ERROR << "Could not watch container " << container_name << ". User " << username << " not found.";
+            return -1;
+        }
 
+        {
+            std::scoped_lock lock(states_mutex);
+            container_state &state = container_states[std::string(container_name)];
+            state.uid = user.user_id;
+            state.status = status;
+            state.is_stopping = false;
+        }
+        docker::watch_events(user.user_id);
         return 0;
     }
 
+    /**
+     * Stops tracking the state of the given container.
+     * @param container_name Name of the container.
+     */
+    void unwatch_container(std::string_view container_name)
+    {
+        int uid = -1;
+        {
+            std::scoped_lock lock(states_mutex);
+            const auto itr = container_states.find(std::string(container_name));
+            if (itr == container_states.end())
+                return;
+            uid = itr->second.uid;
+            container_states.erase(itr);
+        }
+        docker::unwatch_events(uid);
+    }
+
+    /**
+     * Updates the cached status of the container and persists it only if it has changed.
+     * Writes arriving while a commit is in progress are committed together by the next writer in one transaction.
+     * @param container_name Name of the container.
+     * @param status New status.
+     * @return 0 on success and -1 on error.
+     */
+    int update_container_status(std::string_view container_name, std::string_view status)
+    {
+        metrics::scoped_timer timer("hp.update_container_status");
+        std::shared_ptr<status_write_batch> batch;
+        {
+            std::scoped_lock lock(states_mutex);
+            std::string previous_status;
+            const auto itr = container_states.find(std::string(container_name));
+            if (itr != container_states.end())
+            {
+                if (itr->second.status == status)
+                    return 0;
+                previous_status = itr->second.status;
+                itr->second.status = status;
+            }
+            const std::string registered_status = set_registered_status(container_name, status);
+            if (previous_status.empty())
+                previous_status = registered_status;
+
+            // Queued under the states lock so the writes keep the order of the cache updates.
+            std::scoped_lock write_lock(status_write_mutex);
+            open_status_batch->statuses.emplace_back(container_name, status);
+            open_status_batch->previous_statuses.push_back(std::move(previous_status));
+            batch = open_status_batch;
+        }
+
+        std::unique_lock lock(status_write_mutex);
+        while (!batch->is_done)
+        {
+            if (is_committing_statuses)
+            {
+                status_write_cv.wait(lock);
+                continue;
+            }
+
+            // Take over the open batch and commit it on behalf of all the writers in it.
+            std::shared_ptr<status_write_batch> committing = open_status_batch;
+            open_status_batch = std::make_shared<status_write_batch>();
+            is_committing_statuses = true;
+            lock.unlock();
+
+            committing->result = sqlite::update_statuses_in_containers(db_status, committing->statuses);
+            if (committing->result == -1)
+                revert_statuses(*committing);
+
+            lock.lock();
+            committing->is_done = true;
+            is_committing_statuses = false;
+            status_write_cv.notify_all();
+        }
+        return batch->result;
+    }
+
+    /**
+     * Restores the cached statuses replaced by a batch whose commit failed. A status which has been changed again since
+     * is left as is.
+     * @param batch The failed batch.
+     */
+    void revert_statuses(const status_write_batch &batch)
+    {
+        std::scoped_lock lock(states_mutex);
+        for (size_t i = batch.statuses.size(); i-- > 0;)
+        {
+            const auto &[container_name, status] = batch.statuses[i];
+            const std::string &previous_status = batch.previous_statuses[i];
+            if (previous_status.empty())
+                continue;
+
+            const auto itr = container_states.find(container_name);
+            if (itr != container_states.end() && itr->second.status == status)
+                itr->second.status = previous_status;
+            set_registered_status(container_name, previous_status, status);
+        }
+    }
+
+    /**
+     * Marks whether the agent is stopping the container.
+     * @param container_name Name of the container.
+     * @param is_stopping Whether a stop is in progress.
+     */
+    void set_container_stopping(std::string_view container_name, const bool is_stopping)
+    {
+        std::scoped_lock lock(states_mutex);
+        const auto itr = container_states.find(std::string(container_name));
+        if (itr != container_states.end())
+            itr->second.is_stopping = is_stopping;
+    }
+
+    /**
+     * Applies a docker event to the container state. Invoked from the docker events thread.
+     * @param event Received container event.
+     */
+    void on_container_event(const docker::container_event &event)
+    {
+        if (event.action == docker::EVENT_SUBSCRIBED)
+        {
+            // Events might have been missed while the stream was down.
+            reconcile_container_states(event.uid);
+            return;
+        }
+
+        std::string status;
+        {
+            std::scoped_lock lock(states_mutex);
+            const auto itr = container_states.find(event.container_name);
+            if (itr == container_states.end() || itr->second.status == CONTAINER_STATES[STATES::PROVISIONING])
+                return;
+
+            container_state &state = itr->second;
+            if (event.action == "start")
+            {
+                if (state.status == CONTAINER_STATES[STATES::EXITED])
+                    LOG_INFO << "Instance " << event.container_name << " was restarted by docker.";
+                state.is_stopping = false;
+                status = CONTAINER_STATES[STATES::RUNNING];
+            }
+            else if (event.action == "die")
+            {
+                if (state.is_stopping)
+                {
+                    status = CONTAINER_STATES[STATES::STOPPED];
+                }
+                else
+                {
+                    LOG_WARNING << "Instance " << event.container_name << " exited with code " << event.exit_code;
+                    status = CONTAINER_STATES[STATES::EXITED];
+                }
+            }
+            else if (event.action == "oom")
+            {
+                LOG_WARNING << "Instance " << event.container_name << " ran out of memory.";
+            }
+        }
+
+        if (!status.empty() && update_container_status(event.container_name, status) == -1)
+            LOG_ERROR << "Error when updating container status. name: " << event.container_name;
+    }
+
+    /**
+     * Syncs the cached states of the containers of the given user with their actual docker states.
+     * @param uid Uid of the instance user.
+     */
+    void reconcile_container_states(const int uid)
+    {
+        std::vector<std::pair<std::string, container_state>> states;
+        {
+            std::scoped_lock lock(states_mutex);
+            for (const auto &[name, state] : container_states)
+            {
+                if (state.uid == uid)
+                    states.emplace_back(name, state);
+            }
+        }
+
+        for (const auto &[name, state] : states)
+        {
+            std::string docker_status;
+            if (docker::get_container_status(uid, name, docker_status) == -1)
+                continue;
+
+            // Containers which are created but not initiated, or stopped by the agent, are left as they are.
+            std::string status;
+            if (docker_status == "running")
+                status = CONTAINER_STATES[STATES::RUNNING];
+            else if (docker_status == "exited" || docker_status == "dead")
+                status = state.status == CONTAINER_STATES[STATES::RUNNING] ? CONTAINER_STATES[STATES::EXITED] : state.status;
+
+            if (!status.empty() && status != state.status && update_container_status(name, status) == -1)
+                LOG_ERROR << "Error when updating container status. name: " << name;
+        }
+    }
+
     /**
      * Read only required contract config values
      * @param d Json file to be read.
@@ -706,6 +1484,71 @@ namespace hp
         return 0;
     }
 
+    /**
+     * Reads and validates the hp config of the default contract so new instance configs are prepared without reading it again.
+     * @return 0 on success. -1 on failure.
+     */
+    int load_config_template()
+    {
+        const std::string config_file_path = conf::ctx.contract_template_path + "/" + HP_CONFIG_PATH;
+        const int config_fd = open(config_file_path.data(), O_RDONLY | O_CLOEXEC);
+        if (config_fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening hp config file " << config_file_path;
+            return -1;
+        }
+
+        const int read_ret = util::read_json_file(config_fd, config_template);
+        close(config_fd);
+        if (read_ret == -1 || read_json_values(config_template, template_hpfs_log_level, template_full_history) == -1)
+        {
+            LOG_ERROR << "Invalid hp config template " << config_file_path;
+            return -1;
+        }
+
+        // Sections patched for each instance must be present.
+        for (const char *section : {"node", "contract", "mesh", "user", "hpfs"})
+        {
+            if (!config_template.contains(section) || !config_template[section].is_object())
+            {
+                LOG_ERROR << "Hp config template " << config_file_path << " does not have the " << section << " section.";
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    /**
+     * Reads the hpfs settings from the hp config of an instance recorded without them and caches them.
+     * @param info Instance whose settings should be loaded. Populated with the settings.
+     * @return 0 on success. -1 on failure.
+     */
+    int load_hpfs_settings(instance_info &info)
+    {
+        const std::string config_file_path = util::get_user_contract_dir(info.username, info.container_name) + "/" + HP_CONFIG_PATH;
+        const int config_fd = open(config_file_path.data(), O_RDONLY | O_CLOEXEC);
+        if (config_fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening hp config file " << config_file_path;
+            return -1;
+        }
+
+        jsoncons::ojson d;
+        const int read_ret = util::read_json_file(config_fd, d);
+        close(config_fd);
+        if (read_ret == -1 || read_json_values(d, info.hpfs_log_level, info.is_full_history) == -1)
+        {
+            info.hpfs_log_level.clear();
+            return -1;
+        }
+
+        // Settings are only a cache of the config file, so a failed write just means reading it again next time.
+        sqlite::update_hpfs_settings(db, info.container_name, info.hpfs_log_level, info.is_full_history);
+        set_registered_hpfs_settings(info.container_name, info.hpfs_log_level, info.is_full_history);
+        return 0;
+    }
+
     /**
      * Write contract config values (only updated if provided config values are not empty) into the json file.
      * @param d Json file to be populated.
@@ -910,39 +1753,114 @@ namespace hp
         return 0;
     }
 
+    /**
+     * Generates a username for a new instance user in the same format user install script uses.
+     * @return Generated username.
+     */
+    const std::string generate_username()
+    {
+        const uint64_t epoch_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return "sashi" + std::to_string(epoch_ns);
+    }
+
+    /**
+     * Collects the instance ports to be opened in the firewall.
+     * @param instance_name Name of the instance.
+     * @param instance_ports Ports assigned to the instance.
+     * @return Ports of the instance firewall rules.
+     */
+    const provision::port_spec get_port_spec(std::string_view instance_name, const ports &instance_ports)
+    {
+        provision::port_spec spec;
+        spec.instance_name = instance_name;
+        spec.peer_port = instance_ports.peer_port;
+        spec.user_port = instance_ports.user_port;
+        spec.gp_tcp_port_start = instance_ports.gp_tcp_port_start;
+        spec.gp_udp_port_start = instance_ports.gp_udp_port_start;
+        return spec;
+    }
+
     /**
      * Create new user and install dependencies and populate id and username.
      * @param user_id Uid of the created user to be populated.
-     * @param username Username of the created user to be populated.
+     * @param username Username of the user to be created. Generated by the install script if empty. Populated with the created username.
      * @param max_cpu_us CPU quota allowed for this user.
      * @param max_mem_kbytes Memory quota allowed for this user.
      * @param max_swap_kbytes Swap memory quota allowed for this user.
      * @param storage_kbytes Disk quota allowed for this user.
      * @param instance_ports Ports assigned to the instance.
+     * @param mode Install mode, whether to install a user for an instance or for the warm pool or to bind a warm pool user.
      */
     int install_user(
         int &user_id, std::string &username, const size_t max_cpu_us, const size_t max_mem_kbytes, const size_t max_swap_kbytes, const size_t storage_kbytes,
-        std::string_view container_name, const ports instance_ports, std::string_view docker_image, std::string_view outbound_ipv6, std::string_view outbound_net_interface)
+        std::string_view container_name, const ports instance_ports, std::string_view docker_image, std::string_view outbound_ipv6, std::string_view outbound_net_interface,
+        std::string_view mode)
     {
-        const std::vector<std::string_view> input_params = {
+        metrics::scoped_timer timer("hp.install_user");
+
+        // The user accounts, the quota, the slice limits and the firewall rules are provisioned natively. The script skips those steps and
+        // sets up the rootless docker daemon.
+        const bool create_user = mode != INSTALL_MODE_BIND;
+        const bool open_ports = mode != INSTALL_MODE_BASE;
+        const provision::user_spec spec{username, max_cpu_us, max_mem_kbytes, max_swap_kbytes, storage_kbytes, contract_ugid, get_max_instance_count()};
+        const provision::port_spec port_spec = get_port_spec(container_name, instance_ports);
+        const std::string registry_address = get_registry_address();
+        // A warm user being bound is left to the caller's rollback, so only the ports opened for the instance are closed here.
+        const auto undo_install = [&]()
+        {
+            if (create_user)
+                uninstall_user(username, instance_ports, container_name);
+            else
+                provision::remove_port_rules(port_spec);
+        };
+
+        // An existing user is not ours to roll back, so it is rejected before anything is provisioned.
+        if (create_user && provision::user_exists(username))
+        {
+            LOG_ERROR << "User creation error : HAS_USER";
+            return -1;
+        }
+
+        std::string native_steps;
+        if (provision::provision_user(native_steps, user_id, spec, port_spec, create_user, open_ports) == -1)
+        {
+            LOG_ERROR << "User provisioning error : " << username;
+            undo_install();
+            return -1;
+        }
+
+        const std::vector<std::string> input_params = {
             std::to_string(max_cpu_us),
             std::to_string(max_mem_kbytes),
             std::to_string(max_swap_kbytes),
             std::to_string(storage_kbytes),
-            container_name,
+            std::string(container_name),
             std::to_string(contract_ugid.uid),
             std::to_string(contract_ugid.gid),
             std::to_string(instance_ports.peer_port),
             std::to_string(instance_ports.user_port),
             std::to_string(instance_ports.gp_tcp_port_start),
             std::to_string(instance_ports.gp_udp_port_start),
-            docker_image,
-            conf::cfg.docker.registry_address,
-            outbound_ipv6,
-            outbound_net_interface};
+            std::string(docker_image),
+            registry_address,
+            std::string(outbound_ipv6),
+            std::string(outbound_net_interface),
+            username,
+            std::string(mode),
+            native_steps};
         std::vector<std::string> output_params;
         if (util::execute_bash_file(conf::ctx.user_install_sh, output_params, input_params) == -1)
+        {
+            undo_install();
+            return -1;
+        }
+
+        if (output_params.empty())
+        {
+            LOG_ERROR << "User creation error : No output from the install script.";
+            undo_install();
             return -1;
+        }
 
         if (strncmp(output_params.at(output_params.size() - 1).data(), "INST_SUC", 8) == 0) // If success.
         {
@@ -959,14 +1877,24 @@ namespace hp
         {
             const std::string error = output_params.at(0);
             LOG_ERROR << "User creation error : " << error;
-            return -1;
         }
         else
         {
             const std::string error = output_params.at(0);
             LOG_ERROR << "Unknown user creation error : " << error;
-            return -1;
         }
+
+        // The script may fail before rolling back the user it was installing, so a created user is removed along with what
+        // was provisioned natively. A bound warm user is still there if the script failed before rolling back, and is then
+        // left to the caller's rollback.
+        util::user_info remaining_user;
+        if (create_user)
+            undo_install();
+        else if (util::get_system_user_info(username, remaining_user) == -1)
+            provision::deprovision_user(username, user_id, port_spec);
+        else
+            provision::remove_port_rules(port_spec);
+        return -1;
     }
 
     /**
@@ -977,16 +1905,44 @@ namespace hp
      */
     int uninstall_user(std::string_view username, const ports assigned_ports, std::string_view instance_name)
     {
-        const std::vector<std::string_view> input_params = {
-            username,
+        metrics::scoped_timer timer("hp.uninstall_user");
+        // The docker daemon of the user goes away with the user.
+        util::user_info user;
+        const bool user_exists = util::get_system_user_info(username, user) == 0;
+        if (user_exists)
+            docker::disconnect(user.user_id);
+
+        // The script removes the users once their processes are gone. The rest is deprovisioned natively afterwards, only
+        // once the user is gone, so a user the script could not remove keeps its limits.
+        std::string native_steps;
+        provision::get_deprovision_steps(native_steps);
+        const provision::port_spec port_spec = get_port_spec(instance_name, assigned_ports);
+
+        const std::vector<std::string> input_params = {
+            std::string(username),
             std::to_string(assigned_ports.peer_port),
             std::to_string(assigned_ports.user_port),
             std::to_string(assigned_ports.gp_tcp_port_start),
             std::to_string(assigned_ports.gp_udp_port_start),
-            instance_name};
+            std::string(instance_name),
+            native_steps};
         std::vector<std::string> output_params;
-        if (util::execute_bash_file(conf::ctx.user_uninstall_sh, output_params, input_params) == -1)
+        const int ret = util::execute_bash_file(conf::ctx.user_uninstall_sh, output_params, input_params);
+        const bool is_removed = ret == 0 && !output_params.empty() && strncmp(output_params.back().data(), "UNINST_SUC", 10) == 0;
+        util::user_info remaining_user;
+        if (is_removed || util::get_system_user_info(username, remaining_user) == -1)
+            provision::deprovision_user(std::string(username), user_exists ? user.user_id : -1, port_spec);
+        else
+            LOG_ERROR << "User " << username << " was not removed. Keeping its quota, limits, cgroups and firewall rules.";
+
+        if (ret == -1)
+            return -1;
+
+        if (output_params.empty())
+        {
+            LOG_ERROR << "User removing error : No output from the uninstall script.";
             return -1;
+        }
 
         // const std::string contract_dir = util::get_user_contract_dir(info.username, container_name);
         if (strncmp(output_params.at(output_params.size() - 1).data(), "UNINST_SUC", 8) == 0) // If success.
@@ -1009,170 +1965,707 @@ namespace hp
     }
 
     /**
-     * Get the instance list except destroyed instances from the database.
-     * @param instances List of instances to be populated.
+     * Loads the instances which are not destroyed from the database into the registry.
      */
-    void get_instance_list(std::vector<hp::instance_info> &instances)
+    void load_registry()
     {
-        sqlite::get_instance_list(db, instances);
+        std::vector<instance_info> instances;
+        sqlite3 *reader = sqlite::acquire_connection(db_readers);
+        sqlite::get_instance_list(reader != NULL ? reader : db, instances);
+        if (reader != NULL)
+            sqlite::release_connection(db_readers, reader);
+
+        {
+            // Removals before the start are not known, so the changes since an earlier sequence are answered with the full list.
+            std::unique_lock lock(registry.mutex);
+            registry.removed_floor = next_change_seq();
+        }
+
+        for (instance_info &info : instances)
+        {
+            info.contract_dir = util::get_user_contract_dir(info.username, info.container_name);
+            register_instance(info);
+        }
     }
 
     /**
-     * Get the leases list from message board database.
-     * @param leases List of leases to be populated.
+     * Adds the instance to the registry or replaces the registered one. Should be called after the database is updated.
+     * @param info Instance to register.
      */
-    void get_lease_list(std::vector<hp::lease_info> &leases)
+    void register_instance(const instance_info &info)
     {
-        const std::string db_mb_path = conf::ctx.data_dir + "/mb-xrpl/mb-xrpl.sqlite";
-        if (sqlite::open_db(db_mb_path, &db_mb, true) == -1)
+        std::unique_lock lock(registry.mutex);
+        const auto [itr, is_new] = registry.instances.try_emplace(info.container_name, info);
+        const uint64_t seq = next_change_seq();
+        if (!is_new)
         {
-            LOG_ERROR << "Error preparing messageboard database in " << db_mb_path;
+            const instance_info &existing = itr->second;
+            remove_from_index(registry.owner_index, existing.owner_pubkey, existing.container_name);
+            remove_from_index(registry.status_index, existing.status, existing.container_name);
+            registry.port_index.erase(existing.assigned_ports.peer_port);
+            itr->second = info;
+        }
+        else
+        {
+            registry.allocated.cpu_us += instance_resources.cpu_us;
+            registry.allocated.mem_kbytes += instance_resources.mem_kbytes;
+            registry.allocated.swap_kbytes += instance_resources.swap_kbytes;
+            registry.allocated.storage_kbytes += instance_resources.storage_kbytes;
+        }
+
+        registry.owner_index[info.owner_pubkey].emplace(info.container_name);
+        registry.status_index[info.status].emplace(info.container_name);
+        registry.port_index[info.assigned_ports.peer_port] = info.container_name;
+        itr->second.change_seq = seq;
+        usage::track_instance(info.container_name, info.username);
+        hpfs::track_trees(info.container_name, info.username.empty() ? std::string() : util::get_user_contract_dir(info.username, info.container_name));
+    }
+
+    /**
+     * Removes the instance from the registry and releases its allocated resources.
+     * @param container_name Name of the instance.
+     */
+    void unregister_instance(std::string_view container_name)
+    {
+        std::unique_lock lock(registry.mutex);
+        const auto itr = registry.instances.find(std::string(container_name));
+        if (itr == registry.instances.end())
             return;
+
+        const instance_info &info = itr->second;
+        remove_from_index(registry.owner_index, info.owner_pubkey, info.container_name);
+        remove_from_index(registry.status_index, info.status, info.container_name);
+        registry.port_index.erase(info.assigned_ports.peer_port);
+
+        registry.allocated.cpu_us -= instance_resources.cpu_us;
+        registry.allocated.mem_kbytes -= instance_resources.mem_kbytes;
+        registry.allocated.swap_kbytes -= instance_resources.swap_kbytes;
+        registry.allocated.storage_kbytes -= instance_resources.storage_kbytes;
+        usage::untrack_instance(container_name);
+        hpfs::untrack_trees(container_name);
+
+        registry.removed.emplace_back(next_change_seq(), info.container_name);
+        if (registry.removed.size() > MAX_REMOVED_INSTANCES)
+        {
+            registry.removed_floor = registry.removed.front().first;
+            registry.removed.pop_front();
         }
-        sqlite::get_lease_list(db_mb, leases);
-        sqlite::close_db(&db_mb);
+        registry.instances.erase(itr);
     }
 
     /**
-     * Get the instance with given name from the database, skip if destroyed.
+     * Removes a container name from a registry index. The bucket is erased once it is empty, so owners and statuses
+     * without instances are not kept. The caller must hold the unique registry lock.
+     * @param index Owner or status index.
+     * @param key Owner pubkey or status of the instance.
+     * @param container_name Name of the instance.
+     */
+    void remove_from_index(std::unordered_map<std::string, std::unordered_set<std::string>> &index, const std::string &key, const std::string &container_name)
+    {
+        const auto itr = index.find(key);
+        if (itr == index.end())
+            return;
+        itr->second.erase(container_name);
+        if (itr->second.empty())
+            index.erase(itr);
+    }
+
+    /**
+     * Updates the status of the registered instance.
+     * @param container_name Name of the instance.
+     * @param status New status.
+     * @param expected_status Only updates if this is the current status. Empty to update regardless.
+     * @return The status before the update. Empty if the instance is not registered.
+     */
+    std::string set_registered_status(std::string_view container_name, std::string_view status, std::string_view expected_status)
+    {
+        std::unique_lock lock(registry.mutex);
+        const auto itr = registry.instances.find(std::string(container_name));
+        if (itr == registry.instances.end())
+            return {};
+
+        std::string previous_status = itr->second.status;
+        if (previous_status == status || (!expected_status.empty() && previous_status != expected_status))
+            return previous_status;
+
+        remove_from_index(registry.status_index, itr->second.status, itr->second.container_name);
+        itr->second.status = status;
+        itr->second.change_seq = next_change_seq();
+        registry.status_index[itr->second.status].emplace(itr->second.container_name);
+        return previous_status;
+    }
+
+    /**
+     * Updates the cached hpfs settings of a registered instance.
+     * @param container_name Name of the instance.
+     * @param hpfs_log_level Hpfs log level of the instance.
+     * @param is_full_history Contract history mode of the instance.
+     */
+    void set_registered_hpfs_settings(std::string_view container_name, std::string_view hpfs_log_level, const bool is_full_history)
+    {
+        std::unique_lock lock(registry.mutex);
+        const auto itr = registry.instances.find(std::string(container_name));
+        if (itr == registry.instances.end())
+            return;
+
+        itr->second.hpfs_log_level = hpfs_log_level;
+        itr->second.is_full_history = is_full_history;
+        itr->second.change_seq = next_change_seq();
+    }
+
+    /**
+     * Updates the cached history shard limits of a registered instance.
+     * @param container_name Name of the instance.
+     * @param history_config Shard limits in the hp config of the instance.
+     */
+    void set_registered_history_config(std::string_view container_name, const msg::history_configuration &history_config)
+    {
+        std::unique_lock lock(registry.mutex);
+        const auto itr = registry.instances.find(std::string(container_name));
+        if (itr == registry.instances.end())
+            return;
+
+        itr->second.history_config = history_config;
+        itr->second.is_history_config_loaded = true;
+        itr->second.change_seq = next_change_seq();
+    }
+
+    /**
+     * Advances the registry change sequence. The caller must hold the unique registry lock.
+     * Sequences are seeded from the clock so the ones handed out before a restart stay below the new ones.
+     * @return The new change sequence.
+     */
+    uint64_t next_change_seq()
+    {
+        registry.change_seq = std::max(registry.change_seq + 1, util::get_epoch_milliseconds() * 1000);
+        return registry.change_seq;
+    }
+
+    /**
+     * Gets the registered instance with the given name.
+     * @param container_name Name of the instance.
+     * @param info Instance info to be populated.
+     * @return 0 if found and -1 if not.
+     */
+    int find_instance(std::string_view container_name, instance_info &info)
+    {
+        std::shared_lock lock(registry.mutex);
+        const auto itr = registry.instances.find(std::string(container_name));
+        if (itr == registry.instances.end())
+            return -1;
+
+        info = itr->second;
+        return 0;
+    }
+
+    /**
+     * Gets the number of allocated instances and the total resources allocated to them.
+     * @param instance_count Allocated instance count.
+     * @param allocated Allocated resources.
+     */
+    void get_allocation(size_t &instance_count, resources &allocated)
+    {
+        std::shared_lock lock(registry.mutex);
+        instance_count = registry.instances.size();
+        allocated = registry.allocated;
+    }
+
+    /**
+     * Divides the host resources of the given config equally among the max number of instances.
+     * @param system System config holding the host resources.
+     * @return Resources of a single instance.
+     */
+    const resources split_resources(const conf::system_config &system)
+    {
+        resources split;
+        split.cpu_us = system.max_cpu_us / system.max_instance_count;
+        split.mem_kbytes = system.max_mem_kbytes / system.max_instance_count;
+        split.swap_kbytes = split.mem_kbytes + (system.max_swap_kbytes / system.max_instance_count);
+        split.storage_kbytes = system.max_storage_kbytes / system.max_instance_count;
+        return split;
+    }
+
+    /**
+     * Gets the resources a new instance is installed with.
+     * @return Resources of a single instance.
+     */
+    const resources get_instance_resources()
+    {
+        std::shared_lock lock(registry.mutex);
+        return instance_resources;
+    }
+
+    /**
+     * Gets the max number of instances, which a config reload can change.
+     * @return Max instance count.
+     */
+    size_t get_max_instance_count()
+    {
+        std::scoped_lock lock(allocation_mutex);
+        return conf::cfg.system.max_instance_count;
+    }
+
+    /**
+     * Gets the private docker registry address the instance users pull from.
+     * @return Registry address. Empty if there's no private registry.
+     */
+    const std::string get_registry_address()
+    {
+        std::scoped_lock lock(allocation_mutex);
+        return conf::cfg.docker.registry_address;
+    }
+
+    /**
+     * Re-reads the config file and applies the log level, the resource limits, the warm pool size and the docker registry address to the
+     * running agent. Other changed fields are only listed, since they take effect after a restart.
+     * Nothing is applied if the config is invalid or the new resource limits do not fit the existing instances.
      * @param error_msg Error message if any.
-     * @param container_name Name of the instance
-     * @param instance Instance info ref to be populated.
+     * @param restart_fields Json paths of the changed fields which need a restart.
      * @return 0 on success and -1 on error.
      */
-    int get_instance(std::string &error_msg, std::string_view container_name, hp::instance_info &instance)
+    int reload_config(std::string &error_msg, std::vector<std::string> &restart_fields)
     {
-        if (sqlite::get_instance(db, container_name, instance) == -1)
+        // The warm pool and the port slots are set up by start(), so the new limits are applied after that.
+        if (wait_for_start() == -1)
         {
-            error_msg = DOCKER_CONTAINER_NOT_FOUND;
-            LOG_ERROR << "No instace with name: " << container_name << ".";
+            error_msg = NOT_STARTED;
+            return -1;
+        }
+
+        metrics::scoped_timer timer("hp.reload_config");
+        std::scoped_lock reload_lock(reload_mutex);
+
+        conf::sa_config next;
+        if (conf::read_config(next) == -1 || conf::validate_config(next) == -1)
+        {
+            error_msg = CONFIG_INVALID;
+            LOG_ERROR << "Config reload failed. Invalid config file " << conf::ctx.config_file;
             return -1;
         }
 
+        if (apply_config(error_msg, next) == -1)
+            return -1;
+
+        // The fields needing a restart are not changed by a reload, so the running config is read without the lock.
+        conf::get_restart_fields(restart_fields, conf::cfg, next);
+        for (const std::string &field : restart_fields)
+            LOG_WARNING << "Config field " << field << " changed. Restart the agent to apply it.";
+
+        LOG_INFO << "Config reloaded. Log level: " << next.log.log_level << ", Max instances: " << next.system.max_instance_count;
         return 0;
     }
+
     /**
-     * Populate the given vector with vacant ports which are not already assigned.
-     * @param vacant_ports Ports vector to hold port pairs from database.
+     * Swaps in the resource limits, the warm pool size, the registry address and the log level of the new config together under the
+     * allocation lock, which the readers of these fields take as well. So an instance creation either sees the old
+     * values or the new ones. As with the reconfig command, the max instance count cannot go below the existing
+     * instances and the resources per instance cannot shrink while there are instances.
+     * The existing instances keep the resources they were installed with. The allocation is counted with the new split,
+     * as it is after a restart.
+     * @param error_msg Error message if any.
+     * @param next Validated config read from the config file.
+     * @return 0 on success and -1 on error.
      */
-    void get_vacant_ports_list(std::vector<hp::ports> &vacant_ports)
+    int apply_config(std::string &error_msg, const conf::sa_config &next)
     {
-        const int gp_tcp_port_count = 2;
-        const int gp_udp_port_count = 2;
+        std::scoped_lock lock(allocation_mutex);
 
-        // get all instances
-        std::vector<hp::instance_info> instances;
-        get_instance_list(instances);
+        size_t instance_count;
+        resources allocated;
+        get_allocation(instance_count, allocated);
 
-        // no instances
-        if (instances.empty())
+        const resources split = split_resources(next.system);
+        if (next.system.max_instance_count < instance_count)
         {
-            return;
+            error_msg = RESOURCES_INVALID;
+            LOG_ERROR << "There are " << instance_count << " active instances, so max instance count cannot be less than that.";
+            return -1;
+        }
+        else if (instance_count > 0 &&
+                 (split.cpu_us < instance_resources.cpu_us ||
+                  split.mem_kbytes < instance_resources.mem_kbytes ||
+                  split.swap_kbytes < instance_resources.swap_kbytes ||
+                  split.storage_kbytes < instance_resources.storage_kbytes))
+        {
+            error_msg = RESOURCES_INVALID;
+            LOG_ERROR << "Resources per instance cannot be reduced while there are active instances.";
+            return -1;
         }
 
-        // Get the max instance
-        const std::vector<hp::instance_info>::iterator element_max_peer_port = std::max_element(instances.begin(), instances.end(),
-                                                                                                [](const hp::instance_info &a, const hp::instance_info &b)
-                                                                                                {
-                                                                                                    return (uint16_t)(a.assigned_ports.user_port) < (uint16_t)(b.assigned_ports.user_port);
-                                                                                                });
-
-        ports init_ports = {(uint16_t)(conf::cfg.hp.init_peer_port), (uint16_t)(conf::cfg.hp.init_user_port), (uint16_t)(conf::cfg.hp.init_gp_tcp_port), (uint16_t)(conf::cfg.hp.init_gp_udp_port)};
-
-        // Keep increasing init port (peer port) until it reaches max port
-        // If init port values did not match with an item in the instances list, add init port values to vacant ports list.
-        while (init_ports.peer_port < element_max_peer_port->assigned_ports.peer_port)
         {
+            std::unique_lock registry_lock(registry.mutex);
+            instance_resources = split;
+            const size_t count = registry.instances.size();
+            registry.allocated = {split.cpu_us * count, split.mem_kbytes * count, split.swap_kbytes * count, split.storage_kbytes * count};
+        }
 
-            bool is_item_available = std::find_if(instances.begin(), instances.end(), [init_ports](const instance_info &instance)
-                                                  { return instance.assigned_ports.peer_port == init_ports.peer_port; }) != instances.end();
+        conf::system_config &system = conf::cfg.system;
+        system.max_instance_count = next.system.max_instance_count;
+        system.max_cpu_us = next.system.max_cpu_us;
+        system.max_mem_kbytes = next.system.max_mem_kbytes;
+        system.max_swap_kbytes = next.system.max_swap_kbytes;
+        system.max_storage_kbytes = next.system.max_storage_kbytes;
+
+        // The registry address is derived from the running host address, since a new host address is only applied on restart.
+        conf::cfg.docker.registry_port = next.docker.registry_port;
+        conf::cfg.docker.registry_address = next.docker.registry_port > 0
+                                                ? conf::cfg.hp.host_address + ":" + std::to_string(next.docker.registry_port)
+                                                : "";
+
+        // The slot count follows the max instance count. Pool users with the previous limits or beyond the new pool size
+        // are retired. The pool thread is started if the pool was disabled until now.
+        init_port_slots();
+        system.warm_pool_size = next.system.warm_pool_size;
+        retire_warm_users();
+        if (system.warm_pool_size > 0 && !warm_pool_thread.joinable() && !is_shutting_down)
+            warm_pool_thread = std::thread(warm_pool_loop);
+        warm_pool_cv.notify_one();
+
+        conf::cfg.log.log_level = next.log.log_level;
+        conf::cfg.log.log_level_type = next.log.log_level_type;
+        salog::set_level(next.log.log_level_type);
+
+        LOG_INFO << "Resources for instance - CPU: " << split.cpu_us << " MicroS, RAM: " << split.mem_kbytes << " KB, Storage: " << split.storage_kbytes << " KB.";
+        return 0;
+    }
 
-            if (!is_item_available)
+    /**
+     * Rebuilds the port slots from the registered instances. There are enough slots for the max instance count, and
+     * for any existing instance beyond it, as long as the port ranges fit in the port numbers.
+     */
+    void init_port_slots()
+    {
+        const conf::hp_config &hp_cfg = conf::cfg.hp;
+        const size_t max_slots = std::min({(size_t)UINT16_MAX - hp_cfg.init_peer_port + 1,
+                                           (size_t)UINT16_MAX - hp_cfg.init_user_port + 1,
+                                           ((size_t)UINT16_MAX - hp_cfg.init_gp_tcp_port) / 2,
+                                           ((size_t)UINT16_MAX - hp_cfg.init_gp_udp_port) / 2});
+
+        std::vector<size_t> used_slots;
+        size_t capacity = conf::cfg.system.max_instance_count;
+        {
+            std::shared_lock lock(registry.mutex);
+            for (const auto &[name, info] : registry.instances)
             {
-                vacant_ports.push_back(init_ports);
+                size_t slot;
+                if (get_port_slot(info.assigned_ports, slot) == -1)
+                {
+                    LOG_WARNING << "Ports of instance " << name << " are outside the configured port ranges.";
+                    continue;
+                }
+                used_slots.push_back(slot);
+                capacity = std::max(capacity, slot + 1);
             }
+        }
 
-            init_ports.peer_port++;
-            init_ports.user_port++;
-            init_ports.gp_tcp_port_start += gp_tcp_port_count;
-            init_ports.gp_udp_port_start += gp_udp_port_count;
+        port_slots.init(std::min(capacity, max_slots));
+        for (const size_t slot : used_slots)
+        {
+            if (port_slots.mark_used(slot) == -1)
+                LOG_WARNING << "Port slot " << slot << " is assigned to more than one instance or is out of the port range.";
         }
     }
+
+    /**
+     * Gets the ports owned by the given slot.
+     * @param slot Port slot.
+     * @return Ports of the slot.
+     */
+    const ports get_slot_ports(const size_t slot)
+    {
+        const conf::hp_config &hp_cfg = conf::cfg.hp;
+        return {(uint16_t)(hp_cfg.init_peer_port + slot), (uint16_t)(hp_cfg.init_user_port + slot),
+                (uint16_t)(hp_cfg.init_gp_tcp_port + slot * 2), (uint16_t)(hp_cfg.init_gp_udp_port + slot * 2)};
+    }
+
+    /**
+     * Gets the slot owning the given ports. Instances created before the general purpose ports were introduced only
+     * have the peer and user ports, so the slot is found by the peer port.
+     * @param assigned_ports Ports of an instance.
+     * @param slot Port slot.
+     * @return 0 on success and -1 if the ports are not in the configured ranges.
+     */
+    int get_port_slot(const ports &assigned_ports, size_t &slot)
+    {
+        if (assigned_ports.peer_port < conf::cfg.hp.init_peer_port)
+            return -1;
+
+        slot = assigned_ports.peer_port - conf::cfg.hp.init_peer_port;
+        return 0;
+    }
+
+    /**
+     * Frees the port slot of the given ports.
+     * @param assigned_ports Ports of an instance.
+     */
+    void release_port_slot(const ports &assigned_ports)
+    {
+        size_t slot;
+        if (get_port_slot(assigned_ports, slot) == -1 || port_slots.release(slot) == -1)
+            LOG_WARNING << "Ports with peer port " << assigned_ports.peer_port << " were not allocated.";
+    }
+
     /**
-     * Check whether there's a pending reboot and cgrules service is running and configured.
-     * @return true if active and configured otherwise false.
+     * Get the instance list except destroyed instances.
+     * @param instances List of instances to be populated.
      */
-    bool system_ready()
+    void get_instance_list(std::vector<hp::instance_info> &instances)
     {
-        char buffer[20];
+        const size_t first = instances.size();
+        {
+            std::shared_lock lock(registry.mutex);
+            instances.reserve(instances.size() + registry.instances.size());
+            for (const auto &[name, info] : registry.instances)
+                instances.push_back(info);
+        }
 
-        if (util::execute_bash_cmd(CGRULE_ACTIVE, buffer, 20) == -1)
-            return false;
+        for (size_t i = first; i < instances.size(); i++)
+            usage::get_latest(instances[i].container_name, instances[i].usage);
+    }
 
-        // Check cgrules service status is active.
-        if (strncmp(buffer, "active", 6) != 0)
+    /**
+     * Get the leases list from message board database.
+     * @param leases List of leases to be populated.
+     */
+    void get_lease_list(std::vector<hp::lease_info> &leases)
+    {
+        // The connection is kept open so the schema is not parsed again on every request.
+        std::scoped_lock lock(db_mb_mutex);
+        if (db_mb == NULL)
         {
-            LOG_ERROR << "Cgrules service is inactive.";
-            return false;
+            const std::string db_mb_path = conf::ctx.data_dir + "/mb-xrpl/mb-xrpl.sqlite";
+            if (sqlite::open_db(db_mb_path, &db_mb) == -1)
+            {
+                LOG_ERROR << "Error preparing messageboard database in " << db_mb_path;
+                return;
+            }
         }
+        sqlite::get_lease_list(db_mb, leases);
+    }
 
-        // Check cgrules cpu and memory mounts exist.
-        if (!util::is_dir_exists(CGRULE_CPU_DIR) || !util::is_dir_exists(CGRULE_MEM_DIR))
+    /**
+     * Selects a page of the registered instances matching the list query, ordered by name.
+     * If the query has a known "since" sequence, only the instances changed after it are listed along with the removed ones.
+     * Otherwise the full list is selected. Lease and usage data are not sequenced and always reflect the latest.
+     * @param page Page to be populated.
+     * @param query List query with the optional filters, cursor and limit.
+     */
+    void query_instances(instance_page &page, const msg::list_msg &query)
+    {
         {
-            LOG_ERROR << "Cgrules cpu or memory mounts does not exist.";
-            return false;
+            std::shared_lock lock(registry.mutex);
+            page.seq = registry.change_seq;
+            page.is_full = query.since == 0 || query.since < registry.removed_floor || query.since > registry.change_seq;
+            const uint64_t since = page.is_full ? 0 : query.since;
+
+            // Start from the narrowest index given by the filters.
+            const std::unordered_set<std::string> *candidates = NULL;
+            bool is_empty = false;
+            if (!query.owner_pubkey.empty())
+            {
+                const auto itr = registry.owner_index.find(query.owner_pubkey);
+                if (itr == registry.owner_index.end())
+                    is_empty = true;
+                else
+                    candidates = &itr->second;
+            }
+            if (!is_empty && !query.status.empty())
+            {
+                const auto itr = registry.status_index.find(query.status);
+                if (itr == registry.status_index.end())
+                    is_empty = true;
+                else if (candidates == NULL || itr->second.size() < candidates->size())
+                    candidates = &itr->second;
+            }
+
+            std::vector<const instance_info *> matches;
+            const auto add_if_match = [&](const instance_info &info)
+            {
+                if ((query.owner_pubkey.empty() || info.owner_pubkey == query.owner_pubkey) &&
+                    (query.status.empty() || info.status == query.status) &&
+                    (query.image.empty() || info.image_name == query.image) &&
+                    info.change_seq > since && (query.after.empty() || info.container_name > query.after))
+                    matches.push_back(&info);
+            };
+
+            if (!is_empty && candidates != NULL)
+            {
+                for (const std::string &name : *candidates)
+                    add_if_match(registry.instances.at(name));
+            }
+            else if (!is_empty)
+            {
+                for (const auto &[name, info] : registry.instances)
+                    add_if_match(info);
+            }
+
+            std::sort(matches.begin(), matches.end(), [](const instance_info *a, const instance_info *b)
+                      { return a->container_name < b->container_name; });
+            if (query.limit > 0 && matches.size() > query.limit)
+            {
+                matches.resize(query.limit);
+                page.next = matches.back()->container_name;
+            }
+
+            page.instances.reserve(matches.size());
+            for (const instance_info *info : matches)
+                page.instances.push_back(*info);
+
+            // Removals are reported once, on the first page of the changes.
+            if (!page.is_full && query.after.empty())
+            {
+                for (const auto &[seq, name] : registry.removed)
+                {
+                    if (seq > since)
+                        page.removed.push_back(name);
+                }
+            }
         }
 
-        // Check cgrules config exist and configured.
-        int fd = open(CGRULE_CONF, O_RDONLY);
-        if (fd == -1)
+        for (instance_info &info : page.instances)
+            usage::get_latest(info.container_name, info.usage);
+    }
+
+    /**
+     * Get the instance with given name from the database, skip if destroyed.
+     * @param error_msg Error message if any.
+     * @param container_name Name of the instance
+     * @param instance Instance info ref to be populated.
+     * @return 0 on success and -1 on error.
+     */
+    int get_instance(std::string &error_msg, std::string_view container_name, hp::instance_info &instance)
+    {
+        if (find_instance(container_name, instance) == -1)
         {
-            LOG_ERROR << errno << ": Error opening the cgrules config file.";
-            return false;
+            error_msg = DOCKER_CONTAINER_NOT_FOUND;
+            LOG_ERROR << "No instace with name: " << container_name << ".";
+            return -1;
         }
 
-        std::string buf;
-        if (util::read_from_fd(fd, buf, 0) == -1)
+        usage::get_latest(container_name, instance.usage);
+        usage::get_history(container_name, instance.usage_history);
+        hpfs::get_fs_usage(container_name, instance.fs_usage);
+
+        // Shard limits are cached after the first read. They are only shown along the usage, so the instance is still
+        // inspected if the config can't be read.
+        if (!instance.is_history_config_loaded && !instance.username.empty())
+            load_history_config(instance);
+        return 0;
+    }
+
+    /**
+     * Reads the history shard limits of an instance from its hp config and caches them.
+     * @param info Instance whose limits should be loaded. Populated with the limits found in the config.
+     * @return 0 on success. -1 on failure.
+     */
+    int load_history_config(instance_info &info)
+    {
+        const std::string config_file_path = util::get_user_contract_dir(info.username, info.container_name) + "/" + HP_CONFIG_PATH;
+        const int config_fd = open(config_file_path.data(), O_RDONLY | O_CLOEXEC);
+        if (config_fd == -1)
         {
-            LOG_ERROR << errno << ": Error reading the cgrules config file.";
-            close(fd);
-            return false;
+            LOG_ERROR << errno << ": Error opening hp config file " << config_file_path;
+            return -1;
         }
 
-        close(fd);
+        jsoncons::ojson d;
+        const int read_ret = util::read_json_file(config_fd, d);
+        close(config_fd);
+        if (read_ret == -1 || read_history_values(d, info.history_config) == -1)
+            return -1;
+
+        set_registered_history_config(info.container_name, info.history_config);
+        return 0;
+    }
 
-        if (!std::regex_search(buf, std::regex(CGRULE_REGEXP)))
+    /**
+     * Reads the history shard limits from a hp config.
+     * @param d Hp config to be read.
+     * @param history_config Populated with the limits found in the config.
+     * @return 0 on success. -1 on failure.
+     */
+    int read_history_values(const jsoncons::ojson &d, msg::history_configuration &history_config)
+    {
+        try
+        {
+            if (!d.contains("node") || !d["node"].contains("history_config"))
+                return 0;
+
+            const jsoncons::ojson &values = d["node"]["history_config"];
+            if (values.contains("max_primary_shards"))
+                history_config.max_primary_shards = values["max_primary_shards"].as<uint64_t>();
+            if (values.contains("max_raw_shards"))
+                history_config.max_raw_shards = values["max_raw_shards"].as<uint64_t>();
+        }
+        catch (const std::exception &e)
         {
-            LOG_ERROR << "Cgrules config entry does not exist.";
-            return false;
+            LOG_ERROR << "Invalid contract config history config. " << e.what();
+            return -1;
         }
+        return 0;
+    }
+
+    /**
+     * Selects the instances targeted by a batch operation.
+     * Listed containers are selected unless they exist and don't match the given filters, so missing ones are reported per container.
+     * If no containers are listed, all the instances matching the filters are selected.
+     * @param selected List of selected container names to be populated.
+     * @param container_names Containers listed in the request. Can be empty.
+     * @param owner_pubkey Owner filter. Empty to match any owner.
+     * @param status Status filter. Empty to match any status.
+     */
+    void select_instances(std::vector<std::string> &selected, const std::vector<std::string> &container_names, std::string_view owner_pubkey, std::string_view status)
+    {
+        std::shared_lock lock(registry.mutex);
+        const auto is_match = [&](const hp::instance_info &instance)
+        {
+            return (owner_pubkey.empty() || instance.owner_pubkey == owner_pubkey) && (status.empty() || instance.status == status);
+        };
 
-        // Check there's a pending reboot.
-        if (util::is_file_exists(REBOOT_FILE))
+        if (container_names.empty())
         {
-            fd = open(REBOOT_FILE, O_RDONLY);
-            if (fd == -1)
+            // Start from the narrowest index given by the filters.
+            const std::unordered_set<std::string> *candidates = NULL;
+            if (!owner_pubkey.empty())
             {
-                LOG_ERROR << errno << ": Error opening the reboot file.";
-                return false;
+                const auto itr = registry.owner_index.find(std::string(owner_pubkey));
+                if (itr == registry.owner_index.end())
+                    return;
+                candidates = &itr->second;
             }
-
-            if (util::read_from_fd(fd, buf, 0) == -1)
+            if (!status.empty())
             {
-                LOG_ERROR << errno << ": Error reading the reboot file.";
-                close(fd);
-                return false;
+                const auto itr = registry.status_index.find(std::string(status));
+                if (itr == registry.status_index.end())
+                    return;
+                if (candidates == NULL || itr->second.size() < candidates->size())
+                    candidates = &itr->second;
             }
 
-            close(fd);
+            if (candidates == NULL)
+            {
+                for (const auto &[name, instance] : registry.instances)
+                    selected.push_back(name);
+                return;
+            }
 
-            if (std::regex_search(buf, std::regex(REBOOT_REGEXP)))
+            for (const std::string &name : *candidates)
             {
-                LOG_ERROR << "There's a pending reboot.";
-                return false;
+                if (is_match(registry.instances.at(name)))
+                    selected.push_back(name);
             }
+            return;
         }
 
-        return true;
+        std::unordered_set<std::string> added;
+        for (const std::string &name : container_names)
+        {
+            if (!added.emplace(name).second)
+                continue;
+
+            const auto itr = registry.instances.find(name);
+            if (itr == registry.instances.end() || is_match(itr->second))
+                selected.push_back(name);
+        }
     }
 } // namespace hp
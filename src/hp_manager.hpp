@@ -3,13 +3,17 @@
 
 #include "pchheader.hpp"
 #include "hpfs_manager.hpp"
+#include "hpfs_usage.hpp"
 #include "conf.hpp"
 #include "conf.hpp"
 #include "msg/msg_common.hpp"
+#include "docker/docker_events.hpp"
+#include "usage.hpp"
+#include "provision.hpp"
 
 namespace hp
 {
-    constexpr const char *CONTAINER_STATES[]{"created", "running", "stopped", "destroyed", "exited"};
+    constexpr const char *CONTAINER_STATES[]{"created", "running", "stopped", "destroyed", "exited", "provisioning"};
 
     enum STATES
     {
@@ -17,9 +21,28 @@ namespace hp
         RUNNING,
         STOPPED,
         DESTROYED,
-        EXITED
+        EXITED,
+        PROVISIONING // Instance is still going through the creation stages.
     };
 
+    // Stages of the instance creation pipeline. The last finished stage is persisted so creation can resume after a restart.
+    constexpr const char *CREATE_STAGES[]{"reserved", "user_installed", "contract_placed", "completed"};
+
+    enum CREATE_STAGE
+    {
+        RESERVED,        // Name and ports are reserved in the database.
+        USER_INSTALLED,  // Instance user and its rootless docker are installed.
+        CONTRACT_PLACED, // Contract directory is in the user home.
+        COMPLETED        // Docker container is created.
+    };
+
+    // Modes of the user install script.
+    constexpr const char *INSTALL_MODE_FULL = "full"; // Installs a user for an instance.
+    constexpr const char *INSTALL_MODE_BASE = "base"; // Installs the instance independent parts of a user to keep in the warm pool.
+    constexpr const char *INSTALL_MODE_BIND = "bind"; // Completes a warm pool user for an instance.
+
+    constexpr size_t MAX_REMOVED_INSTANCES = 1024; // Removed instance names kept to answer the list changes since a sequence.
+
     // Stores ports assigned to a container.
     struct ports
     {
@@ -47,6 +70,27 @@ namespace hp
         std::string status;
         std::string username;
         std::string image_name;
+        std::string create_stage;
+        std::string outbound_ipv6;
+        std::string outbound_net_interface;
+        std::string hpfs_log_level; // Hpfs settings of the instance hp config. Empty if not known yet.
+        bool is_full_history = false;
+        usage::usage_sample usage;                      // Latest sampled resource usage. Not persisted.
+        std::vector<usage::usage_sample> usage_history; // Sampled usage, oldest first. Only populated for inspection.
+        uint64_t change_seq = 0;                        // Registry change sequence of the last update. Not persisted.
+        hpfs::fs_usage fs_usage;                        // Disk usage of the hpfs trees. Only populated for inspection.
+        msg::history_configuration history_config;     // Shard limits of the contract history. Cached from the hp config, not persisted.
+        bool is_history_config_loaded = false;          // Whether history_config has been read from the hp config.
+    };
+
+    // A page of the instance list selected by a list query.
+    struct instance_page
+    {
+        std::vector<instance_info> instances;
+        std::vector<std::string> removed; // Names of the instances removed since the queried sequence.
+        uint64_t seq = 0;                 // Registry change sequence the page is consistent with.
+        bool is_full = true;              // False if only the changes since the queried sequence are listed.
+        std::string next;                 // Name to continue the next page after. Empty if this is the last page.
     };
 
     // Represents a lease data retured from message board database.
@@ -59,20 +103,91 @@ namespace hp
         uint64_t life_moments;
     };
 
+    // Last known state of a container, kept up to date from the docker events.
+    struct container_state
+    {
+        int uid = -1;              // Uid of the instance user owning the docker daemon.
+        std::string status;        // One of the CONTAINER_STATES.
+        bool is_stopping = false;  // Stop is requested by the agent, so the next exit is not a crash.
+    };
+
+    // Status writes committed together in one transaction.
+    struct status_write_batch
+    {
+        std::vector<std::pair<std::string, std::string>> statuses; // Container names and statuses in the order written.
+        std::vector<std::string> previous_statuses;                  // Cached statuses replaced by each write, restored if the commit fails.
+        bool is_done = false;
+        int result = 0;
+    };
+
     struct resources
     {
         size_t cpu_us = 0;         // CPU time an instance can consume.
         size_t mem_kbytes = 0;     // Memory an instance can allocate.
         size_t swap_kbytes = 0;    // Swap memory an instance can allocate.
         size_t storage_kbytes = 0; // Physical storage an instance can allocate.
+
+        bool operator==(const resources &other) const
+        {
+            return cpu_us == other.cpu_us && mem_kbytes == other.mem_kbytes && swap_kbytes == other.swap_kbytes && storage_kbytes == other.storage_kbytes;
+        }
+    };
+
+    // Pre-provisioned user waiting in the warm pool.
+    struct warm_user
+    {
+        std::string username;
+        resources limits; // Limits the user was installed with. Only bound to an instance while they match the instance resources.
+    };
+
+    // In memory view of the instances which are not destroyed. The database is written through only for durability.
+    struct instance_registry
+    {
+        std::unordered_map<std::string, instance_info> instances;                     // Instances keyed by container name.
+        std::unordered_map<std::string, std::unordered_set<std::string>> owner_index;  // Container names keyed by owner pubkey.
+        std::unordered_map<std::string, std::unordered_set<std::string>> status_index; // Container names keyed by status.
+        std::map<uint16_t, std::string> port_index;                                   // Container names keyed by peer port, highest last.
+        resources allocated;                                                          // Resources allocated to the registered instances.
+        uint64_t change_seq = 0;                                                      // Sequence of the last registry change.
+        std::deque<std::pair<uint64_t, std::string>> removed;                         // Recently removed instance names with their sequences, oldest first.
+        uint64_t removed_floor = 0;                                                   // Removals at or before this sequence are not known anymore.
+        std::shared_mutex mutex;
     };
 
     int init();
 
+    int start(const bool restore);
+
+    int wait_for_start();
+
     void deinit();
 
     int create_new_instance(std::string &error_msg, instance_info &info, std::string_view container_name, std::string_view owner_pubkey, const std::string &contract_id, const std::string &image_key, std::string_view outbound_ipv6, std::string_view outbound_net_interface);
 
+    int reserve_instance(std::string &error_msg, instance_info &info);
+
+    int run_create_stages(std::string &error_msg, instance_info &info, const bool is_resume);
+
+    int rollback_instance(const instance_info &info, const bool is_user_installed);
+
+    void resume_pending_instances();
+
+    void restore_running_instances();
+
+    int restore_instance(const instance_info &info);
+
+    void init_warm_pool();
+
+    void warm_pool_loop();
+
+    int provision_warm_user();
+
+    const warm_user acquire_warm_user();
+
+    void release_warm_user(const warm_user &user);
+
+    void retire_warm_users();
+
     int initiate_instance(std::string &error_msg, std::string_view container_name, const msg::initiate_msg &config_msg);
 
     int create_container(std::string_view username, std::string_view image_name, std::string_view container_name, std::string_view contract_dir, const ports &assigned_ports, instance_info &info);
@@ -89,30 +204,97 @@ namespace hp
 
     int destroy_container(std::string &error_msg, std::string_view container_name);
 
-    int create_contract(std::string_view username, std::string_view owner_pubkey, std::string_view contract_id,
-                        std::string_view contract_dir, const ports &assigned_ports, instance_info &info);
+    int prepare_contract(std::string &config, std::string &pubkey_hex, std::string_view owner_pubkey, std::string_view contract_id, const ports &assigned_ports);
+
+    int place_contract(std::string_view username, std::string_view config, std::string_view contract_dir);
 
     int check_instance_status(std::string_view username, std::string_view container_name, std::string &status);
 
+    int watch_container(std::string_view container_name, std::string_view username, std::string_view status);
+
+    void unwatch_container(std::string_view container_name);
+
+    int update_container_status(std::string_view container_name, std::string_view status);
+
+    void revert_statuses(const status_write_batch &batch);
+
+    void set_container_stopping(std::string_view container_name, const bool is_stopping);
+
+    void on_container_event(const docker::container_event &event);
+
+    void reconcile_container_states(const int uid);
+
     int read_json_values(const jsoncons::ojson &d, std::string &hpfs_log_level, bool &is_full_history);
 
+    int load_config_template();
+
+    int load_hpfs_settings(instance_info &info);
+
     int write_json_values(jsoncons::ojson &d, const msg::config_struct &config);
 
+    const std::string generate_username();
+
+    const provision::port_spec get_port_spec(std::string_view instance_name, const ports &instance_ports);
+
     int install_user(int &user_id, std::string &username, const size_t max_cpu_us, const size_t max_mem_kbytes, const size_t max_swap_kbytes,
                      const size_t storage_kbytes, std::string_view container_name, const ports instance_ports, std::string_view docker_image,
-                     std::string_view outbound_ipv6, std::string_view outbound_net_interface);
+                     std::string_view outbound_ipv6, std::string_view outbound_net_interface, std::string_view mode = INSTALL_MODE_FULL);
 
     int uninstall_user(std::string_view username, const ports assigned_ports, std::string_view instance_name);
 
+    void load_registry();
+
+    void register_instance(const instance_info &info);
+
+    void unregister_instance(std::string_view container_name);
+
+    void remove_from_index(std::unordered_map<std::string, std::unordered_set<std::string>> &index, const std::string &key, const std::string &container_name);
+
+    std::string set_registered_status(std::string_view container_name, std::string_view status, std::string_view expected_status = {});
+
+    void set_registered_hpfs_settings(std::string_view container_name, std::string_view hpfs_log_level, const bool is_full_history);
+
+    void set_registered_history_config(std::string_view container_name, const msg::history_configuration &history_config);
+
+    uint64_t next_change_seq();
+
+    int find_instance(std::string_view container_name, instance_info &info);
+
+    void get_allocation(size_t &instance_count, resources &allocated);
+
+    const resources split_resources(const conf::system_config &system);
+
+    const resources get_instance_resources();
+
+    size_t get_max_instance_count();
+
+    const std::string get_registry_address();
+
+    int reload_config(std::string &error_msg, std::vector<std::string> &restart_fields);
+
+    int apply_config(std::string &error_msg, const conf::sa_config &next);
+
+    void init_port_slots();
+
+    const ports get_slot_ports(const size_t slot);
+
+    int get_port_slot(const ports &assigned_ports, size_t &slot);
+
+    void release_port_slot(const ports &assigned_ports);
+
     void get_instance_list(std::vector<hp::instance_info> &instances);
 
     void get_lease_list(std::vector<hp::lease_info> &leases);
 
+    void query_instances(instance_page &page, const msg::list_msg &query);
+
     int get_instance(std::string &error_msg, std::string_view container_name, hp::instance_info &instance);
 
-    bool system_ready();
+    int load_history_config(instance_info &info);
+
+    int read_history_values(const jsoncons::ojson &d, msg::history_configuration &history_config);
 
-    void get_vacant_ports_list(std::vector<hp::ports> &vacant_ports);
+    void select_instances(std::vector<std::string> &selected, const std::vector<std::string> &container_names, std::string_view owner_pubkey, std::string_view status);
 
 } // namespace hp
 #endif
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include "hp_readiness.hpp"
+#include "conf.hpp"
+#include "usage.hpp"
+#include "util/util.hpp"
+#include "util/process.hpp"
+#include "salog.hpp"
+
+namespace hp
+{
+    constexpr int FILE_PERMS = 0644;
+
+    // Cgrules check related constants.
+    constexpr const char *SYSTEMD_UNIT_DIR = "/etc/systemd/system";
+    constexpr const char *CGRULE_EXEC_REGEXP = "ExecStart.*=.*/cgrulesengd$";
+    constexpr const char *CGRULE_CPU_DIR = usage::CGROUP_CPU_DIR;
+    constexpr const char *CGRULE_MEM_DIR = usage::CGROUP_MEM_DIR;
+    constexpr const char *CGRULE_CONF = "/etc/cgrules.conf";
+    constexpr const char *CGRULE_REGEXP = "(^|\n)(\\s*)@sashiuser(\\s+)cpu,memory(\\s+)\%u-cg(\\s*)($|\n)";
+    constexpr const char *REBOOT_FILE = "/run/reboot-required.pkgs";
+    constexpr const char *REBOOT_REGEXP = "(^|\n)(\\s*)sashimono(\\s*)($|\n)";
+    constexpr const char *READINESS_CACHE_FILE = "readiness.json"; // Host checks which passed, inside the data dir.
+
+    /**
+     * Check whether there's a pending reboot and cgrules service is running and configured.
+     * The checks which passed are cached with the modification times of the files they read, and are only done again
+     * once a file changes. The service state is always checked.
+     * @return true if active and configured otherwise false.
+     */
+    bool system_ready()
+    {
+        readiness_cache cache;
+        read_readiness_cache(cache);
+        bool is_updated = false;
+
+        // Locate the cgrules service unit again only if the units changed since it was found.
+        const uint64_t units_dir_mtime = get_mtime(SYSTEMD_UNIT_DIR);
+        if (cache.cgrules_unit.empty() || cache.units_dir_mtime != units_dir_mtime || cache.cgrules_unit_mtime != get_mtime(cache.cgrules_unit))
+        {
+            if (find_cgrules_unit(cache.cgrules_unit) == -1)
+            {
+                LOG_ERROR << "Cgrules service not found.";
+                return false;
+            }
+            cache.units_dir_mtime = units_dir_mtime;
+            cache.cgrules_unit_mtime = get_mtime(cache.cgrules_unit);
+            is_updated = true;
+        }
+
+        // Check cgrules service status is active.
+        const std::string unit_name = cache.cgrules_unit.substr(cache.cgrules_unit.rfind('/') + 1);
+        if (util::run_process({"systemctl", "is-active", "--quiet", unit_name}) == -1)
+        {
+            LOG_ERROR << "Cgrules service is inactive.";
+            return false;
+        }
+
+        // Check cgrules cpu and memory mounts exist.
+        if (!util::is_dir_exists(CGRULE_CPU_DIR) || !util::is_dir_exists(CGRULE_MEM_DIR))
+        {
+            LOG_ERROR << "Cgrules cpu or memory mounts does not exist.";
+            return false;
+        }
+
+        // Check cgrules config exist and configured.
+        const uint64_t cgrules_conf_mtime = get_mtime(CGRULE_CONF);
+        if (cgrules_conf_mtime == 0 || cgrules_conf_mtime != cache.cgrules_conf_mtime)
+        {
+            std::string buf;
+            if (read_host_file(CGRULE_CONF, buf) == -1)
+            {
+                LOG_ERROR << errno << ": Error reading the cgrules config file.";
+                return false;
+            }
+
+            if (!std::regex_search(buf, std::regex(CGRULE_REGEXP)))
+            {
+                LOG_ERROR << "Cgrules config entry does not exist.";
+                return false;
+            }
+            cache.cgrules_conf_mtime = cgrules_conf_mtime;
+            is_updated = true;
+        }
+
+        // Check there's a pending reboot.
+        const uint64_t reboot_file_mtime = get_mtime(REBOOT_FILE);
+        if (reboot_file_mtime != 0 && reboot_file_mtime != cache.reboot_file_mtime)
+        {
+            std::string buf;
+            if (read_host_file(REBOOT_FILE, buf) == -1)
+            {
+                LOG_ERROR << errno << ": Error reading the reboot file.";
+                return false;
+            }
+
+            if (std::regex_search(buf, std::regex(REBOOT_REGEXP)))
+            {
+                LOG_ERROR << "There's a pending reboot.";
+                return false;
+            }
+            cache.reboot_file_mtime = reboot_file_mtime;
+            is_updated = true;
+        }
+
+        if (is_updated)
+            write_readiness_cache(cache);
+
+        return true;
+    }
+
+    /**
+     * Finds the systemd unit file which runs cgrulesengd.
+     * @param unit_path Path of the unit file.
+     * @return 0 on success and -1 if there's no such unit.
+     */
+    int find_cgrules_unit(std::string &unit_path)
+    {
+        DIR *dir = opendir(SYSTEMD_UNIT_DIR);
+        if (dir == NULL)
+        {
+            LOG_ERROR << errno << ": Error opening " << SYSTEMD_UNIT_DIR;
+            return -1;
+        }
+
+        // Same match as grep "ExecStart.*=.*/cgrulesengd$" over the service units.
+        const std::regex exec_start(CGRULE_EXEC_REGEXP);
+        std::vector<std::string> unit_paths;
+        while (const dirent *entry = readdir(dir))
+        {
+            const std::string_view name = entry->d_name;
+            if (name.size() > 8 && name.substr(name.size() - 8) == ".service")
+                unit_paths.push_back(std::string(SYSTEMD_UNIT_DIR) + "/" + entry->d_name);
+        }
+        closedir(dir);
+
+        // The first match in name order is taken as the shell glob would.
+        std::sort(unit_paths.begin(), unit_paths.end());
+        for (const std::string &path : unit_paths)
+        {
+            std::string buf;
+            if (read_host_file(path.c_str(), buf) == -1)
+                continue;
+
+            std::vector<std::string> lines;
+            util::split_string(lines, buf, "\n");
+            for (const std::string &line : lines)
+            {
+                if (std::regex_search(line, exec_start))
+                {
+                    unit_path = path;
+                    return 0;
+                }
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Reads a whole file of the host.
+     * @param path File path.
+     * @param buf Buffer to hold the file contents.
+     * @return 0 on success and -1 on error.
+     */
+    int read_host_file(const char *path, std::string &buf)
+    {
+        const int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return -1;
+
+        const int ret = util::read_from_fd(fd, buf, 0);
+        close(fd);
+        return ret;
+    }
+
+    /**
+     * Gets the modification time of a file.
+     * @param path File path.
+     * @return Modification time in nanoseconds. 0 if the file does not exist.
+     */
+    uint64_t get_mtime(std::string_view path)
+    {
+        struct stat st;
+        if (path.empty() || stat(std::string(path).c_str(), &st) == -1)
+            return 0;
+        return (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    /**
+     * Reads the passed host checks from the readiness cache file. The cache is left empty if there's no valid file.
+     * @param cache Cache to populate.
+     */
+    void read_readiness_cache(readiness_cache &cache)
+    {
+        const std::string path = conf::ctx.data_dir + "/" + READINESS_CACHE_FILE;
+        if (!util::is_file_exists(path))
+            return;
+
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return;
+
+        jsoncons::ojson d;
+        const int ret = util::read_json_file(fd, d);
+        close(fd);
+        if (ret == -1)
+            return;
+
+        try
+        {
+            cache.units_dir_mtime = d["units_dir_mtime"].as<uint64_t>();
+            cache.cgrules_unit = d["cgrules_unit"].as<std::string>();
+            cache.cgrules_unit_mtime = d["cgrules_unit_mtime"].as<uint64_t>();
+            cache.cgrules_conf_mtime = d["cgrules_conf_mtime"].as<uint64_t>();
+            cache.reboot_file_mtime = d["reboot_file_mtime"].as<uint64_t>();
+        }
+        catch (const std::exception &e)
+        {
+            LOG_WARNING << "Invalid readiness cache. " << e.what();
+            cache = {};
+        }
+    }
+
+    /**
+     * Writes the passed host checks into the readiness cache file. The file is replaced through a rename so a failed
+     * write does not leave a partial cache.
+     * @param cache Cache to write.
+     */
+    void write_readiness_cache(const readiness_cache &cache)
+    {
+        jsoncons::ojson d;
+        d.insert_or_assign("units_dir_mtime", cache.units_dir_mtime);
+        d.insert_or_assign("cgrules_unit", cache.cgrules_unit);
+        d.insert_or_assign("cgrules_unit_mtime", cache.cgrules_unit_mtime);
+        d.insert_or_assign("cgrules_conf_mtime", cache.cgrules_conf_mtime);
+        d.insert_or_assign("reboot_file_mtime", cache.reboot_file_mtime);
+        std::string json;
+        if (util::serialize_json(d, json) == -1)
+            return;
+
+        const std::string path = conf::ctx.data_dir + "/" + READINESS_CACHE_FILE;
+        const std::string tmp_path = path + ".tmp";
+        const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, FILE_PERMS);
+        if (fd == -1 || write(fd, json.data(), json.size()) == -1)
+        {
+            LOG_WARNING << errno << ": Error writing readiness cache " << tmp_path;
+            if (fd != -1)
+                close(fd);
+            return;
+        }
+        close(fd);
+
+        if (rename(tmp_path.c_str(), path.c_str()) == -1)
+            LOG_WARNING << errno << ": Error replacing readiness cache.";
+    }
+
+} // namespace hp
@@ -0,0 +1,36 @@
+#ifndef _SA_HP_READINESS_
+#define _SA_HP_READINESS_
+
+#include "pchheader.hpp"
+
+/**
+ * Host checks done before the instances are brought up. Kept apart from the instance management since the mock backend
+ * build replaces them.
+ */
+namespace hp
+{
+    // Host checks which passed, keyed by the modification times of the files they read. A changed file is checked again.
+    struct readiness_cache
+    {
+        uint64_t units_dir_mtime = 0;    // Systemd unit directory, which changes when units are added or removed.
+        std::string cgrules_unit;        // Unit file running cgrulesengd.
+        uint64_t cgrules_unit_mtime = 0;
+        uint64_t cgrules_conf_mtime = 0; // Cgrules config holding the sashiuser entry.
+        uint64_t reboot_file_mtime = 0;  // Pending reboot packages without sashimono. 0 if there was no such file.
+    };
+
+    bool system_ready();
+
+    int find_cgrules_unit(std::string &unit_path);
+
+    int read_host_file(const char *path, std::string &buf);
+
+    uint64_t get_mtime(std::string_view path);
+
+    void read_readiness_cache(readiness_cache &cache);
+
+    void write_readiness_cache(const readiness_cache &cache);
+
+} // namespace hp
+
+#endif
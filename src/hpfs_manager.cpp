@@ -1,10 +1,14 @@
 #include "hpfs_manager.hpp"
 #include "util/util.hpp"
+#include "systemd/systemd_client.hpp"
 #include "conf.hpp"
+#include "metrics.hpp"
 
 namespace hpfs
 {
     constexpr int FILE_PERMS = 0644;
+    const std::vector<std::string> HPFS_UNITS{"contract_fs.service", "ledger_fs.service"};
+
     /**
      * Start hpfs systemd services of the instance.
      * @param username Username of the instance user.
@@ -13,17 +17,13 @@ namespace hpfs
     */
     int start_hpfs_systemd(const std::string &username)
     {
-        const std::string contract_fs_start = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user start contract_fs";
-        const std::string contract_fs_enable = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user enable contract_fs";
-        const std::string ledger_fs_start = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user start ledger_fs";
-        const std::string ledger_fs_enable = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user enable ledger_fs";
-
-        if (system(contract_fs_start.c_str()) == -1 ||
-            system(ledger_fs_start.c_str()) == -1 ||
-            system(contract_fs_enable.c_str()) == -1 ||
-            system(ledger_fs_enable.c_str()) == -1)
+        metrics::scoped_timer timer("hpfs.start");
+        // Both services are enabled and started through the user's systemd manager, waiting for the start jobs.
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1 ||
+            systemd::start_units(user.user_id, HPFS_UNITS) == -1)
         {
-            LOG_ERROR << "Error stopping and disabling hpfs systemd services for user: " << username;
+            LOG_ERROR << "Error starting and enabling hpfs systemd services for user: " << username;
             return -1;
         }
 
@@ -38,15 +38,11 @@ namespace hpfs
     */
     int stop_hpfs_systemd(const std::string &username)
     {
-        const std::string contract_fs_stop = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user stop contract_fs";
-        const std::string contract_fs_disable = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user disable contract_fs";
-        const std::string ledger_fs_stop = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user stop ledger_fs";
-        const std::string ledger_fs_disable = "sudo -u " + username + " XDG_RUNTIME_DIR=/run/user/$(id -u " + username + ") systemctl --user disable ledger_fs";
-
-        if (system(contract_fs_stop.c_str()) == -1 ||
-            system(ledger_fs_stop.c_str()) == -1 ||
-            system(contract_fs_disable.c_str()) == -1 ||
-            system(ledger_fs_disable.c_str()) == -1)
+        metrics::scoped_timer timer("hpfs.stop");
+        // Both services are stopped and disabled through the user's systemd manager, waiting for the stop jobs.
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1 ||
+            systemd::stop_units(user.user_id, HPFS_UNITS) == -1)
         {
             LOG_ERROR << "Error stopping and disabling hpfs systemd services for user: " << username;
             return -1;
@@ -64,6 +60,7 @@ namespace hpfs
     */
     int update_service_conf(const std::string &username, const std::string &log_level, const bool is_full_history)
     {
+        metrics::scoped_timer timer("hpfs.update_service_conf");
         const std::string path = "/home/" + username + "/.serviceconf";
         const int fd = open(path.c_str(), O_CREAT | O_RDWR, 0644);
         if (fd == -1)
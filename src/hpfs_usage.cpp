@@ -0,0 +1,481 @@
+#include "hpfs_usage.hpp"
+#include "conf.hpp"
+#include "util/util.hpp"
+
+namespace hpfs
+{
+    fs_usage_ctx ctx;
+
+    constexpr uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK;
+    constexpr size_t EVENT_BUF_SIZE = 65536;
+    constexpr int POLL_TIMEOUT_MS = 1000;
+    constexpr uint64_t FLUSH_INTERVAL_MS = 1000;   // Changed files are looked at once per interval however many writes they get.
+    constexpr uint64_t RESCAN_INTERVAL_MS = 60000; // Trees which are missing or not fully watched are counted again per interval.
+    constexpr uint64_t STAT_BLOCK_BYTES = 512;     // Unit of st_blocks.
+
+    /**
+     * Returns the steady clock time in milliseconds.
+     */
+    uint64_t get_steady_milliseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * Starts the tree watcher thread if usage sampling is enabled. The agent keeps running without the counts if inotify is not available.
+     * @return 0 on success and -1 on error.
+     */
+    int init_usage()
+    {
+        if (conf::cfg.system.usage_sample_secs == 0)
+            return 0;
+
+        ctx.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (ctx.inotify_fd == -1)
+        {
+            LOG_WARNING << errno << ": Error initializing inotify. Hpfs disk usage is not counted.";
+            return 0;
+        }
+
+        ctx.watcher_thread = std::thread(watcher_loop);
+        return 0;
+    }
+
+    /**
+     * Stops the watcher thread and removes the watches.
+     */
+    void deinit_usage()
+    {
+        ctx.is_shutting_down = true;
+        if (ctx.watcher_thread.joinable())
+            ctx.watcher_thread.join();
+
+        // Closing the inotify instance removes all of its watches.
+        if (ctx.inotify_fd != -1)
+        {
+            close(ctx.inotify_fd);
+            ctx.inotify_fd = -1;
+        }
+        ctx.trees.clear();
+        ctx.watches.clear();
+
+        std::scoped_lock lock(ctx.mutex);
+        ctx.tracked.clear();
+        ctx.usages.clear();
+    }
+
+    /**
+     * Starts counting the trees of an instance. The trees are picked up by the watcher thread, so this doesn't touch the disk.
+     * @param container_name Name of the instance.
+     * @param contract_dir Contract directory holding the trees. Nothing is counted while this is empty.
+     */
+    void track_trees(std::string_view container_name, std::string_view contract_dir)
+    {
+        if (contract_dir.empty())
+        {
+            untrack_trees(container_name);
+            return;
+        }
+
+        std::scoped_lock lock(ctx.mutex);
+        const auto [itr, is_new] = ctx.tracked.try_emplace(std::string(container_name), contract_dir);
+        if (!is_new && itr->second == contract_dir)
+            return;
+
+        itr->second = contract_dir;
+        ctx.usages.erase(itr->first);
+        ctx.is_tracked_changed = true;
+    }
+
+    /**
+     * Stops counting the trees of an instance.
+     * @param container_name Name of the instance.
+     */
+    void untrack_trees(std::string_view container_name)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        const std::string name(container_name);
+        if (ctx.tracked.erase(name) == 0)
+            return;
+
+        ctx.usages.erase(name);
+        ctx.is_tracked_changed = true;
+    }
+
+    /**
+     * Gets the latest counted disk usage of the trees of an instance.
+     * @param container_name Name of the instance.
+     * @param usage Usage to be populated.
+     * @return 0 on success and -1 if the trees are not counted yet.
+     */
+    int get_fs_usage(std::string_view container_name, fs_usage &usage)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        const auto itr = ctx.usages.find(std::string(container_name));
+        if (itr == ctx.usages.end())
+            return -1;
+
+        usage = itr->second;
+        return 0;
+    }
+
+    /**
+     * Picks up the tracked trees, applies their inotify events and publishes the counts once per flush interval.
+     */
+    void watcher_loop()
+    {
+        util::mask_signal();
+
+        alignas(struct inotify_event) char buf[EVENT_BUF_SIZE];
+        struct pollfd pfd{ctx.inotify_fd, POLLIN, 0};
+        uint64_t flush_at = 0;
+        while (!ctx.is_shutting_down)
+        {
+            sync_tracked();
+
+            const int ret = poll(&pfd, 1, POLL_TIMEOUT_MS);
+            if (ret == -1 && errno != EINTR)
+            {
+                LOG_ERROR << errno << ": Error polling the hpfs tree watches.";
+                break;
+            }
+
+            if (ret > 0)
+            {
+                ssize_t size;
+                while ((size = read(ctx.inotify_fd, buf, sizeof(buf))) > 0)
+                    handle_events(buf, size);
+            }
+
+            const uint64_t now = get_steady_milliseconds();
+            if (now >= ctx.rescan_at)
+            {
+                for (auto &[name, trees] : ctx.trees)
+                {
+                    for (size_t i = 0; i < FS_TREE_COUNT; i++)
+                    {
+                        if (!trees[i].is_watched)
+                        {
+                            detach_tree(trees[i]);
+                            attach_tree(name, i);
+                        }
+                    }
+                }
+                ctx.rescan_at = now + RESCAN_INTERVAL_MS;
+            }
+
+            if (now >= flush_at)
+            {
+                for (auto &[name, trees] : ctx.trees)
+                {
+                    for (tree_usage &tree : trees)
+                        flush_dirty(tree);
+                }
+                publish_usage();
+                flush_at = now + FLUSH_INTERVAL_MS;
+            }
+        }
+    }
+
+    /**
+     * Attaches the trees of the newly tracked instances and detaches the ones no longer tracked.
+     */
+    void sync_tracked()
+    {
+        std::unordered_map<std::string, std::string> tracked;
+        {
+            std::scoped_lock lock(ctx.mutex);
+            if (!ctx.is_tracked_changed)
+                return;
+            tracked = ctx.tracked;
+            ctx.is_tracked_changed = false;
+        }
+
+        // Instances tracked again with another contract directory are attached from scratch.
+        for (auto itr = ctx.trees.begin(); itr != ctx.trees.end();)
+        {
+            const auto tracked_itr = tracked.find(itr->first);
+            if (tracked_itr == tracked.end() || itr->second[CONTRACT_FS].root != tracked_itr->second + "/" + FS_TREES[CONTRACT_FS])
+            {
+                for (tree_usage &tree : itr->second)
+                    detach_tree(tree);
+                itr = ctx.trees.erase(itr);
+            }
+            else
+            {
+                itr++;
+            }
+        }
+
+        for (const auto &[name, contract_dir] : tracked)
+        {
+            const auto [itr, is_new] = ctx.trees.try_emplace(name);
+            if (!is_new)
+                continue;
+
+            for (size_t i = 0; i < FS_TREE_COUNT; i++)
+            {
+                itr->second[i].root = contract_dir + "/" + FS_TREES[i];
+                attach_tree(name, i);
+            }
+        }
+    }
+
+    /**
+     * Applies a buffer of inotify events to the counted trees. Changed files are only marked, they are looked at on the next flush.
+     * @param buf Events read from the inotify instance.
+     * @param size Size of the read events.
+     */
+    void handle_events(const char *buf, const ssize_t size)
+    {
+        for (const char *pos = buf; pos < buf + size;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)pos;
+            pos += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // Events were dropped, so every tree is counted again on the next rescan.
+                LOG_WARNING << "Hpfs tree watch events overflowed. Counting the trees again.";
+                for (auto &[name, trees] : ctx.trees)
+                {
+                    for (tree_usage &tree : trees)
+                        tree.is_watched = false;
+                }
+                ctx.rescan_at = 0;
+                continue;
+            }
+
+            const auto watch_itr = ctx.watches.find(event->wd);
+            if (watch_itr == ctx.watches.end())
+                continue;
+
+            const watch_target target = watch_itr->second;
+            const auto trees_itr = ctx.trees.find(target.container_name);
+            if (trees_itr == ctx.trees.end())
+                continue;
+            tree_usage &tree = trees_itr->second[target.tree];
+
+            if (event->mask & IN_IGNORED)
+            {
+                // Watched directory is gone. The tree is attached again by a rescan if its root was removed.
+                ctx.watches.erase(watch_itr);
+                tree.wds.erase(event->wd);
+                if (target.dir.empty())
+                    detach_tree(tree);
+                continue;
+            }
+
+            if (event->len == 0)
+                continue;
+
+            const std::string_view name(event->name);
+            if (target.dir.empty() && name == FS_MOUNT_DIR)
+                continue;
+
+            std::string path(target.dir);
+            if (!path.empty())
+                path.append("/");
+            path.append(name);
+
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                remove_path(tree, path);
+            }
+            else if (event->mask & IN_ISDIR)
+            {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    struct stat st;
+                    if (lstat((tree.root + "/" + path).c_str(), &st) == 0)
+                        set_file(tree, path, st.st_blocks * STAT_BLOCK_BYTES);
+                    if (add_watch(tree, target.container_name, target.tree, path) == -1)
+                        tree.is_watched = false;
+                    scan_dir(tree, target.container_name, target.tree, path);
+                }
+            }
+            else
+            {
+                tree.dirty.emplace(std::move(path));
+            }
+        }
+    }
+
+    /**
+     * Watches and counts a tree if its root exists.
+     * @param container_name Name of the instance.
+     * @param tree_index Tree to attach.
+     */
+    void attach_tree(const std::string &container_name, const size_t tree_index)
+    {
+        tree_usage &tree = ctx.trees.at(container_name)[tree_index];
+        struct stat st;
+        if (lstat(tree.root.c_str(), &st) == -1 || !S_ISDIR(st.st_mode))
+            return;
+
+        // The watch is added before the scan, so the files created meanwhile are either scanned or reported.
+        tree.is_watched = add_watch(tree, container_name, tree_index, "") == 0;
+        tree.is_attached = true;
+        scan_dir(tree, container_name, tree_index, "");
+    }
+
+    /**
+     * Removes the watches and the counts of a tree.
+     * @param tree Tree to detach.
+     */
+    void detach_tree(tree_usage &tree)
+    {
+        for (const int wd : tree.wds)
+        {
+            inotify_rm_watch(ctx.inotify_fd, wd);
+            ctx.watches.erase(wd);
+        }
+        tree.wds.clear();
+        tree.files.clear();
+        tree.dirty.clear();
+        tree.bytes = 0;
+        tree.is_attached = false;
+        tree.is_watched = false;
+    }
+
+    /**
+     * Counts the entries under a directory of a tree and watches its subdirectories.
+     * @param tree Tree of the directory.
+     * @param container_name Name of the instance.
+     * @param tree_index Index of the tree.
+     * @param dir Path of the directory within the tree root. Empty for the root.
+     */
+    void scan_dir(tree_usage &tree, const std::string &container_name, const size_t tree_index, const std::string &dir)
+    {
+        DIR *dir_stream = opendir(dir.empty() ? tree.root.c_str() : (tree.root + "/" + dir).c_str());
+        if (dir_stream == NULL)
+            return;
+
+        const int dir_fd = dirfd(dir_stream);
+        struct dirent *entry;
+        while ((entry = readdir(dir_stream)) != NULL)
+        {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+                (dir.empty() && strcmp(entry->d_name, FS_MOUNT_DIR) == 0))
+                continue;
+
+            struct stat st;
+            if (fstatat(dir_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+                continue;
+
+            const std::string path = dir.empty() ? std::string(entry->d_name) : dir + "/" + entry->d_name;
+            set_file(tree, path, st.st_blocks * STAT_BLOCK_BYTES);
+            if (S_ISDIR(st.st_mode))
+            {
+                if (add_watch(tree, container_name, tree_index, path) == -1)
+                    tree.is_watched = false;
+                scan_dir(tree, container_name, tree_index, path);
+            }
+        }
+        closedir(dir_stream);
+    }
+
+    /**
+     * Watches a directory of a tree.
+     * @param tree Tree of the directory.
+     * @param container_name Name of the instance.
+     * @param tree_index Index of the tree.
+     * @param dir Path of the directory within the tree root. Empty for the root.
+     * @return 0 on success and -1 on error.
+     */
+    int add_watch(tree_usage &tree, const std::string &container_name, const size_t tree_index, const std::string &dir)
+    {
+        const std::string dir_path = dir.empty() ? tree.root : tree.root + "/" + dir;
+        const int wd = inotify_add_watch(ctx.inotify_fd, dir_path.c_str(), WATCH_MASK);
+        if (wd == -1)
+        {
+            // Running out of watches leaves the tree to the periodic rescans.
+            LOG_DEBUG << errno << ": Error watching " << dir_path;
+            return -1;
+        }
+
+        // A directory moved within the tree keeps its watch, which now points to the new path.
+        tree.wds.emplace(wd);
+        ctx.watches[wd] = watch_target{container_name, tree_index, dir};
+        return 0;
+    }
+
+    /**
+     * Sets the counted size of an entry of a tree.
+     * @param tree Tree of the entry.
+     * @param path Path within the tree root.
+     * @param bytes Allocated bytes of the entry.
+     */
+    void set_file(tree_usage &tree, const std::string &path, const uint64_t bytes)
+    {
+        const auto [itr, is_new] = tree.files.try_emplace(path, bytes);
+        if (!is_new)
+        {
+            tree.bytes -= itr->second;
+            itr->second = bytes;
+        }
+        tree.bytes += bytes;
+    }
+
+    /**
+     * Removes an entry and everything under it from the counts of a tree.
+     * @param tree Tree of the entry.
+     * @param path Path within the tree root.
+     */
+    void remove_path(tree_usage &tree, const std::string &path)
+    {
+        const auto itr = tree.files.find(path);
+        if (itr != tree.files.end())
+        {
+            tree.bytes -= itr->second;
+            tree.files.erase(itr);
+        }
+
+        // Siblings like "name.tmp" sort between "name" and "name/", so the children are looked up by their own prefix.
+        const std::string prefix = path + "/";
+        auto child_itr = tree.files.lower_bound(prefix);
+        while (child_itr != tree.files.end() && child_itr->first.compare(0, prefix.size(), prefix) == 0)
+        {
+            tree.bytes -= child_itr->second;
+            child_itr = tree.files.erase(child_itr);
+        }
+    }
+
+    /**
+     * Looks at the changed files of a tree again.
+     * @param tree Tree to flush.
+     */
+    void flush_dirty(tree_usage &tree)
+    {
+        for (const std::string &path : tree.dirty)
+        {
+            struct stat st;
+            if (lstat((tree.root + "/" + path).c_str(), &st) == -1)
+                remove_path(tree, path);
+            else if (!S_ISDIR(st.st_mode))
+                set_file(tree, path, st.st_blocks * STAT_BLOCK_BYTES);
+        }
+        tree.dirty.clear();
+    }
+
+    /**
+     * Publishes the counts of the attached trees to the request threads.
+     */
+    void publish_usage()
+    {
+        const uint64_t timestamp = util::get_epoch_milliseconds();
+        std::scoped_lock lock(ctx.mutex);
+        for (const auto &[name, trees] : ctx.trees)
+        {
+            // Instance might have been untracked after the last sync.
+            if (ctx.tracked.count(name) == 0 || (!trees[CONTRACT_FS].is_attached && !trees[LEDGER_FS].is_attached))
+                continue;
+
+            fs_usage &usage = ctx.usages[name];
+            usage.timestamp = timestamp;
+            for (size_t i = 0; i < FS_TREE_COUNT; i++)
+                usage.kbytes[i] = trees[i].bytes / 1024;
+        }
+    }
+
+} // namespace hpfs
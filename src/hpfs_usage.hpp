@@ -0,0 +1,103 @@
+#ifndef _SA_HPFS_USAGE_
+#define _SA_HPFS_USAGE_
+
+#include "pchheader.hpp"
+
+/**
+ * Counts the disk space used by the contract_fs and ledger_fs trees of the instances without walking them on every request.
+ * Each tree is scanned once and then kept up to date from its inotify events, so only the changed files are looked at again.
+ * The hpfs fuse mounts are skipped, the files behind them are counted in the backing directories.
+ */
+namespace hpfs
+{
+    constexpr const char *FS_TREES[]{"contract_fs", "ledger_fs"};
+
+    enum FS_TREE
+    {
+        CONTRACT_FS,
+        LEDGER_FS
+    };
+
+    constexpr size_t FS_TREE_COUNT = 2;
+    constexpr const char *FS_MOUNT_DIR = "mnt"; // Fuse mount of a tree inside its backing directory.
+
+    // Disk space used by the trees of an instance.
+    struct fs_usage
+    {
+        uint64_t timestamp = 0;                      // Epoch milliseconds of the last update. 0 if not counted yet.
+        std::array<size_t, FS_TREE_COUNT> kbytes{};  // Allocated space per tree in KB, indexed by FS_TREE.
+    };
+
+    // Counted files of a tree. Only accessed by the watcher thread.
+    struct tree_usage
+    {
+        std::string root;                        // Backing directory of the tree.
+        std::map<std::string, uint64_t> files;   // Allocated bytes keyed by the path within the root. Ordered so a directory is a range.
+        std::unordered_set<std::string> dirty;   // Paths to look at again on the next flush.
+        std::unordered_set<int> wds;             // Inotify watches of the directories of the tree.
+        uint64_t bytes = 0;
+        bool is_attached = false;                // Root exists and was scanned.
+        bool is_watched = false;                 // Every directory is watched. Otherwise the tree is rescanned periodically.
+    };
+
+    // Directory an inotify watch belongs to.
+    struct watch_target
+    {
+        std::string container_name;
+        size_t tree = 0;
+        std::string dir; // Path within the tree root. Empty for the root.
+    };
+
+    struct fs_usage_ctx
+    {
+        // Shared with the request threads, guarded by the mutex.
+        std::unordered_map<std::string, std::string> tracked; // Contract directories keyed by container name.
+        std::unordered_map<std::string, fs_usage> usages;     // Published usage keyed by container name.
+        bool is_tracked_changed = false;
+        std::mutex mutex;
+
+        // Only accessed by the watcher thread.
+        std::unordered_map<std::string, std::array<tree_usage, FS_TREE_COUNT>> trees;
+        std::unordered_map<int, watch_target> watches;
+        uint64_t rescan_at = 0; // Steady clock milliseconds of the next rescan of the partially watched trees.
+
+        int inotify_fd = -1;
+        std::thread watcher_thread;
+        std::atomic<bool> is_shutting_down = false;
+    };
+
+    int init_usage();
+
+    void deinit_usage();
+
+    void track_trees(std::string_view container_name, std::string_view contract_dir);
+
+    void untrack_trees(std::string_view container_name);
+
+    int get_fs_usage(std::string_view container_name, fs_usage &usage);
+
+    void watcher_loop();
+
+    void sync_tracked();
+
+    void handle_events(const char *buf, const ssize_t size);
+
+    void attach_tree(const std::string &container_name, const size_t tree_index);
+
+    void detach_tree(tree_usage &tree);
+
+    void scan_dir(tree_usage &tree, const std::string &container_name, const size_t tree_index, const std::string &dir);
+
+    int add_watch(tree_usage &tree, const std::string &container_name, const size_t tree_index, const std::string &dir);
+
+    void set_file(tree_usage &tree, const std::string &path, const uint64_t bytes);
+
+    void remove_path(tree_usage &tree, const std::string &path);
+
+    void flush_dirty(tree_usage &tree);
+
+    void publish_usage();
+
+} // namespace hpfs
+
+#endif
@@ -9,6 +9,8 @@
 #include "hp_manager.hpp"
 #include "crypto.hpp"
 #include "hp_manager.hpp"
+#include "usage.hpp"
+#include "provision.hpp"
 #include "version.hpp"
 #include "util/util.hpp"
 #include "killswitch/killswitch.h"
@@ -75,7 +77,10 @@ int check_config_changes()
 void deinit()
 {
     comm::deinit();
+    usage::deinit();
+    hpfs::deinit_usage();
     hp::deinit();
+    crypto::deinit();
 }
 
 void sig_exit_handler(int signum)
@@ -86,8 +91,30 @@ void sig_exit_handler(int signum)
     exit(signum);
 }
 
+/**
+ * Reloads the config file whenever SIGHUP is received. SIGHUP is blocked in all threads and taken here with sigwait,
+ * so the reload does not run inside a signal handler.
+ */
+void reload_signal_loop()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+
+    int signum;
+    while (sigwait(&mask, &signum) == 0)
+    {
+        LOG_INFO << "Hangup signal received. Reloading config.";
+        std::string error_msg;
+        std::vector<std::string> restart_fields;
+        hp::reload_config(error_msg, restart_fields);
+    }
+}
+
 void segfault_handler(int signum)
 {
+    // The writer thread may not get to run anymore, so the queued lines and the trace are written here.
+    salog::flush();
     LOG_ERROR << boost::stacktrace::stacktrace();
     exit(SIGABRT);
 }
@@ -97,6 +124,7 @@ void segfault_handler(int signum)
  */
 void std_terminate() noexcept
 {
+    salog::flush();
     const std::exception_ptr exptr = std::current_exception();
     if (exptr != 0)
     {
@@ -178,6 +206,14 @@ int main(int argc, char **argv)
     {
         conf::set_dir_paths(argv[0], (argc == 3) ? argv[2] : "");
 
+        // SIGHUP triggers a config reload. It is blocked before any thread is started so only the reload thread takes it.
+        {
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGHUP);
+            pthread_sigmask(SIG_BLOCK, &mask, NULL);
+        }
+
         if (kill_switch(util::get_epoch_milliseconds()))
         {
             std::cerr << "Sashimono Agent usage limit failure.\n";
@@ -195,19 +231,34 @@ int main(int argc, char **argv)
         if (check_config_changes() == -1)
             return 1;
 
+        // Instance keys are pre-generated for as many creations as the warm pool is sized for.
+        if (crypto::init_key_pool(conf::cfg.system.warm_pool_size) == -1)
+            return 1;
+
         LOG_INFO << "Sashimono agent (version " << version::AGENT_VERSION << ")";
         LOG_INFO << "Log level: " << conf::cfg.log.log_level;
         LOG_INFO << "Data dir: " << conf::ctx.data_dir;
 
-        if (comm::init() == -1 || hp::init() == -1)
+        // The socket is opened as soon as the registry is loaded, so the read only requests are answered while the host
+        // checks run and the instances are restored. The requests which change the instances wait for hp::start.
+        // Provisioning is ready before the interrupted creations and the warm pool refill install users.
+        if (provision::init() == -1 || hp::init() == -1 || usage::init() == -1 || hpfs::init_usage() == -1 || comm::init() == -1)
         {
             deinit();
             return 1;
         }
 
-        // After initializing primary subsystems, register the exit handler.
+        // After initializing primary subsystems, register the exit handler. This is done before hp::start, so a stop
+        // or a reload during a long instance restore is handled as well. A reload waits until hp::start is over.
         signal(SIGINT, &sig_exit_handler);
         signal(SIGTERM, &sig_exit_handler);
+        std::thread(reload_signal_loop).detach();
+
+        if (hp::start(true) == -1)
+        {
+            deinit();
+            return 1;
+        }
 
         // Waiting for the websocket sessions.
         comm::wait();
@@ -0,0 +1,209 @@
+#include "metrics.hpp"
+
+namespace metrics
+{
+    // Histograms and counters by name. Entries are never removed, so references to them stay valid.
+    struct metrics_registry
+    {
+        std::shared_mutex mutex;
+        std::map<std::string, std::unique_ptr<histogram>, std::less<>> histograms;
+        std::map<std::string, std::unique_ptr<std::atomic<uint64_t>>, std::less<>> counters;
+    };
+    metrics_registry registry;
+
+    scoped_timer::scoped_timer(histogram &target) : target(target), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    scoped_timer::scoped_timer(std::string_view name) : target(get_histogram(name)), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    scoped_timer::~scoped_timer()
+    {
+        record(target, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    /**
+     * Gets the histogram with the given name, creating it if this is the first use.
+     * @param name Dot separated operation name.
+     * @return The histogram.
+     */
+    histogram &get_histogram(std::string_view name)
+    {
+        {
+            std::shared_lock lock(registry.mutex);
+            const auto itr = registry.histograms.find(name);
+            if (itr != registry.histograms.end())
+                return *itr->second;
+        }
+
+        std::unique_lock lock(registry.mutex);
+        auto &h = registry.histograms[std::string(name)];
+        if (!h)
+            h = std::make_unique<histogram>();
+        return *h;
+    }
+
+    /**
+     * Gets the counter with the given name, creating it if this is the first use.
+     * @param name Dot separated counter name.
+     * @return The counter.
+     */
+    std::atomic<uint64_t> &get_counter(std::string_view name)
+    {
+        {
+            std::shared_lock lock(registry.mutex);
+            const auto itr = registry.counters.find(name);
+            if (itr != registry.counters.end())
+                return *itr->second;
+        }
+
+        std::unique_lock lock(registry.mutex);
+        auto &c = registry.counters[std::string(name)];
+        if (!c)
+            c = std::make_unique<std::atomic<uint64_t>>(0);
+        return *c;
+    }
+
+    /**
+     * Records a duration into a histogram.
+     * @param h Histogram to record into.
+     * @param duration_us Duration in microseconds.
+     */
+    void record(histogram &h, const uint64_t duration_us)
+    {
+        h.buckets[bucket_index(duration_us)].fetch_add(1, std::memory_order_relaxed);
+        h.count.fetch_add(1, std::memory_order_relaxed);
+        h.sum_us.fetch_add(duration_us, std::memory_order_relaxed);
+
+        uint64_t max = h.max_us.load(std::memory_order_relaxed);
+        while (duration_us > max && !h.max_us.compare_exchange_weak(max, duration_us, std::memory_order_relaxed))
+            ;
+    }
+
+    /**
+     * Increments the counter with the given name.
+     * @param name Dot separated counter name.
+     */
+    void increment(std::string_view name)
+    {
+        get_counter(name).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the bucket of a value. Values below the sub bucket count have their own buckets, larger values share
+     * buckets whose width doubles with each power of two.
+     * @param value Value to find the bucket of.
+     * @return Bucket index.
+     */
+    size_t bucket_index(const uint64_t value)
+    {
+        if (value < SUB_BUCKET_COUNT)
+            return value;
+
+        const size_t shift = (63 - __builtin_clzll(value)) - SUB_BUCKET_BITS;
+        const size_t index = (SUB_BUCKET_COUNT * (shift + 1)) + ((value >> shift) - SUB_BUCKET_COUNT);
+        return std::min(index, BUCKET_COUNT - 1);
+    }
+
+    /**
+     * Gets the largest value falling into a bucket.
+     * @param index Bucket index.
+     * @return Upper bound of the bucket.
+     */
+    uint64_t bucket_value(const size_t index)
+    {
+        if (index < SUB_BUCKET_COUNT)
+            return index;
+
+        const size_t shift = (index / SUB_BUCKET_COUNT) - 1;
+        const uint64_t sub_bucket = (index % SUB_BUCKET_COUNT) + SUB_BUCKET_COUNT;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+
+    /**
+     * Summarizes all the histograms and counters. Concurrent recordings might be partially included.
+     * @param histograms Histogram summaries sorted by name.
+     * @param counters Counter values sorted by name.
+     */
+    void get_snapshot(std::vector<histogram_snapshot> &histograms, std::vector<counter_snapshot> &counters)
+    {
+        std::shared_lock lock(registry.mutex);
+        histograms.reserve(registry.histograms.size());
+        for (const auto &[name, h] : registry.histograms)
+        {
+            histogram_snapshot &snapshot = histograms.emplace_back();
+            snapshot.name = name;
+            snapshot.sum_us = h->sum_us.load(std::memory_order_relaxed);
+            snapshot.max_us = h->max_us.load(std::memory_order_relaxed);
+
+            uint64_t counts[BUCKET_COUNT];
+            for (size_t i = 0; i < BUCKET_COUNT; i++)
+            {
+                counts[i] = h->buckets[i].load(std::memory_order_relaxed);
+                snapshot.count += counts[i];
+            }
+
+            // Percentiles are reported as the upper bound of the bucket they fall in, capped at the max.
+            const std::pair<uint64_t, uint64_t *> percentiles[] = {{500, &snapshot.p50_us}, {900, &snapshot.p90_us}, {990, &snapshot.p99_us}}; // Per mille.
+            for (const auto &[per_mille, value] : percentiles)
+            {
+                const uint64_t rank = std::max<uint64_t>(1, ((snapshot.count * per_mille) + 999) / 1000);
+                uint64_t seen = 0;
+                for (size_t i = 0; i < BUCKET_COUNT && snapshot.count > 0; i++)
+                {
+                    seen += counts[i];
+                    if (seen >= rank)
+                    {
+                        *value = std::min(bucket_value(i), snapshot.max_us);
+                        break;
+                    }
+                }
+            }
+        }
+
+        counters.reserve(registry.counters.size());
+        for (const auto &[name, c] : registry.counters)
+            counters.push_back(counter_snapshot{name, c->load(std::memory_order_relaxed)});
+    }
+
+    /**
+     * Builds the Prometheus text exposition of the metrics. Histograms are exposed as summaries in seconds.
+     * @param text String to append the exposition to.
+     */
+    void build_prometheus_text(std::string &text)
+    {
+        std::vector<histogram_snapshot> histograms;
+        std::vector<counter_snapshot> counters;
+        get_snapshot(histograms, counters);
+
+        char line[256];
+        text.reserve(text.size() + (histograms.size() * 512) + (counters.size() * 96) + 256);
+
+        text += "# HELP sashimono_operation_duration_seconds Duration of the agent operations.\n";
+        text += "# TYPE sashimono_operation_duration_seconds summary\n";
+        for (const histogram_snapshot &h : histograms)
+        {
+            const std::pair<const char *, uint64_t> quantiles[] = {{"0.5", h.p50_us}, {"0.9", h.p90_us}, {"0.99", h.p99_us}, {"1", h.max_us}};
+            for (const auto &[quantile, value] : quantiles)
+            {
+                snprintf(line, sizeof(line), "sashimono_operation_duration_seconds{operation=\"%s\",quantile=\"%s\"} %.6f\n", h.name.data(), quantile, value / 1e6);
+                text += line;
+            }
+            snprintf(line, sizeof(line), "sashimono_operation_duration_seconds_sum{operation=\"%s\"} %.6f\n", h.name.data(), h.sum_us / 1e6);
+            text += line;
+            snprintf(line, sizeof(line), "sashimono_operation_duration_seconds_count{operation=\"%s\"} %llu\n", h.name.data(), (unsigned long long)h.count);
+            text += line;
+        }
+
+        text += "# HELP sashimono_events_total Count of the agent events.\n";
+        text += "# TYPE sashimono_events_total counter\n";
+        for (const counter_snapshot &c : counters)
+        {
+            snprintf(line, sizeof(line), "sashimono_events_total{event=\"%s\"} %llu\n", c.name.data(), (unsigned long long)c.value);
+            text += line;
+        }
+    }
+
+} // namespace metrics
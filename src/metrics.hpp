@@ -0,0 +1,74 @@
+#ifndef _SA_METRICS_
+#define _SA_METRICS_
+
+#include "pchheader.hpp"
+
+/**
+ * Latency histograms and counters of the agent operations. Recording is lock free, so the hot paths can be
+ * instrumented freely. Histograms and counters are created on first use and live until the agent exits.
+ */
+namespace metrics
+{
+    constexpr size_t SUB_BUCKET_BITS = 4;                          // 16 linear buckets per power of two, within ~6% of the value.
+    constexpr size_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    constexpr size_t MAGNITUDE_COUNT = 38;                         // Values up to ~2^41 microseconds (~25 days).
+    constexpr size_t BUCKET_COUNT = SUB_BUCKET_COUNT * MAGNITUDE_COUNT;
+
+    // HDR style histogram of durations in microseconds with log-linear buckets.
+    struct histogram
+    {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum_us{0};
+        std::atomic<uint64_t> max_us{0};
+        std::atomic<uint64_t> buckets[BUCKET_COUNT]{};
+    };
+
+    // Point in time summary of a histogram.
+    struct histogram_snapshot
+    {
+        std::string name;
+        uint64_t count = 0;
+        uint64_t sum_us = 0;
+        uint64_t p50_us = 0;
+        uint64_t p90_us = 0;
+        uint64_t p99_us = 0;
+        uint64_t max_us = 0;
+    };
+
+    struct counter_snapshot
+    {
+        std::string name;
+        uint64_t value = 0;
+    };
+
+    // Records the time from its construction to its destruction into a histogram.
+    class scoped_timer
+    {
+        histogram &target;
+        const std::chrono::steady_clock::time_point start;
+
+    public:
+        explicit scoped_timer(histogram &target);
+        explicit scoped_timer(std::string_view name);
+        ~scoped_timer();
+    };
+
+    histogram &get_histogram(std::string_view name);
+
+    std::atomic<uint64_t> &get_counter(std::string_view name);
+
+    void record(histogram &h, const uint64_t duration_us);
+
+    void increment(std::string_view name);
+
+    size_t bucket_index(const uint64_t value);
+
+    uint64_t bucket_value(const size_t index);
+
+    void get_snapshot(std::vector<histogram_snapshot> &histograms, std::vector<counter_snapshot> &counters);
+
+    void build_prometheus_text(std::string &text);
+
+} // namespace metrics
+
+#endif
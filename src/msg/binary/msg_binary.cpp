@@ -0,0 +1,494 @@
+#include "msg_binary.hpp"
+#include "../json/msg_json.hpp"
+
+namespace msg::binary
+{
+    constexpr size_t ENVELOPE_OVERHEAD = 15;       // Magic, version, content kind and the lengths of the type, id and content.
+    constexpr size_t CREATE_OVERHEAD = 24;         // Lengths of the strings and the ports of a create response.
+    constexpr size_t LIST_ENTRY_OVERHEAD = 78;     // Lengths of the strings, the ports, the flags and the usage of a list entry.
+    constexpr size_t LIST_LEASE_OVERHEAD = 28;     // Lease fields of a list entry without the tenant.
+    constexpr size_t INSPECT_OVERHEAD = 67;        // Lengths of the strings, the ports, the storage fields and the usage count.
+    constexpr size_t USAGE_SAMPLE_SIZE = 32;       // Fields of a usage history entry.
+
+    /**
+     * Checks whether a received message is a binary message.
+     * @param message Received message.
+     * @return true if the message starts with the binary magic.
+     */
+    bool is_binary(std::string_view message)
+    {
+        return !message.empty() && (uint8_t)message[0] == MAGIC;
+    }
+
+    /**
+     * Reads the envelope of a binary message. The body is decoded by the extraction of the message type.
+     * @param message The message to scan. Must stay alive while the header is used.
+     * @param header Envelope fields to be populated.
+     * @return 0 on success. -1 if the message is not a valid binary message.
+     */
+    int scan_message(std::string_view message, message_header &header)
+    {
+        reader r{message};
+        uint8_t magic = 0, version = 0;
+        if (read_u8(magic, r) == -1 || magic != MAGIC || read_u8(version, r) == -1)
+        {
+            LOG_ERROR << "Binary message magic missing.";
+            return -1;
+        }
+
+        if (version != VERSION)
+        {
+            LOG_ERROR << "Unsupported binary message version " << (int)version;
+            return -1;
+        }
+
+        if (read_str(header.type, r) == -1 || read_str(header.id, r) == -1)
+        {
+            LOG_ERROR << "Binary message type or id missing.";
+            return -1;
+        }
+
+        if (header.type.empty())
+        {
+            LOG_ERROR << "Binary message type is empty.";
+            return -1;
+        }
+
+        header.body = message.substr(r.pos);
+        return 0;
+    }
+
+    /**
+     * Extracts the json message carried by the message types without a binary layout.
+     * @param json The json message pointing into the message.
+     * @param header Envelope of the message.
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_json_body(std::string_view &json, const message_header &header)
+    {
+        reader r{header.body};
+        if (read_str(json, r) == -1 || r.pos != r.data.size())
+        {
+            LOG_ERROR << "Invalid json body of binary " << header.type << " message.";
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Extracts create message from a binary message.
+     * @param msg Populated msg object.
+     * @param header Envelope of the message.
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_create_message(create_msg &msg, const message_header &header)
+    {
+        std::string_view config;
+        return read_create_body(msg, config, header);
+    }
+
+    /**
+     * Extracts the instance config of a binary create message. The config keeps the json layout of the create message,
+     * since it is only read once per instance and its many optional fields are validated by the json extraction.
+     * @param msg Populated msg object.
+     * @param header Envelope of the message.
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_initiate_message(initiate_msg &msg, const message_header &header)
+    {
+        create_msg create;
+        std::string_view config;
+        if (read_create_body(create, config, header) == -1)
+            return -1;
+
+        // The config must be a single json object, so it is parsed on its own instead of being spliced into the message.
+        jsoncons::json d(jsoncons::json_object_arg);
+        try
+        {
+            d[msg::FLD_TYPE] = msg::MSGTYPE_CREATE;
+            d[msg::FLD_CONFIG] = config.empty() ? jsoncons::json(jsoncons::json_object_arg) : jsoncons::json::parse(config, jsoncons::strict_json_parsing());
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR << "Config of binary create message is not valid json. " << e.what();
+            return -1;
+        }
+
+        if (!d[msg::FLD_CONFIG].is_object())
+        {
+            LOG_ERROR << "Config of binary create message is not a json object.";
+            return -1;
+        }
+
+        msg.container_name = create.container_name;
+        return json::extract_initiate_message(msg, d);
+    }
+
+    /**
+     * Reads the fields of a binary create message.
+     * @param msg Populated msg object.
+     * @param config Json object of the instance config pointing into the message. Empty if not given.
+     * @param header Envelope of the message.
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int read_create_body(create_msg &msg, std::string_view &config, const message_header &header)
+    {
+        msg.type = header.type;
+        reader r{header.body};
+        std::string *fields[] = {&msg.container_name, &msg.pubkey, &msg.contract_id, &msg.image, &msg.outbound_ipv6, &msg.outbound_net_interface};
+        for (std::string *field : fields)
+        {
+            if (read_str(*field, r) == -1)
+            {
+                LOG_ERROR << "Binary create message is truncated.";
+                return -1;
+            }
+        }
+
+        if (read_str(config, r) == -1 || r.pos != r.data.size())
+        {
+            LOG_ERROR << "Invalid config of binary create message.";
+            return -1;
+        }
+
+        // Outbound settings are left out with empty strings, like the missing fields of a json create message.
+        if (msg.outbound_ipv6.empty())
+            msg.outbound_ipv6 = "-";
+        if (msg.outbound_net_interface.empty())
+            msg.outbound_net_interface = "-";
+        return 0;
+    }
+
+    /**
+     * Extracts the messages targeting a single container (destroy, start, stop and inspect) from a binary message.
+     * @param type Message type.
+     * @param container_name Name of the targeted container.
+     * @param header Envelope of the message.
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_container_message(std::string &type, std::string &container_name, const message_header &header)
+    {
+        type = header.type;
+        reader r{header.body};
+        if (read_str(container_name, r) == -1 || r.pos != r.data.size())
+        {
+            LOG_ERROR << "Invalid container_name of binary " << header.type << " message.";
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Extracts list message from a binary message. An empty body lists every instance like a json list message without fields.
+     * @param msg Populated msg object.
+     * @param header Envelope of the message.
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_list_message(list_msg &msg, const message_header &header)
+    {
+        msg.type = header.type;
+        if (header.body.empty())
+            return 0;
+
+        reader r{header.body};
+        uint64_t limit = 0;
+        if (read_str(msg.owner_pubkey, r) == -1 || read_str(msg.status, r) == -1 || read_str(msg.image, r) == -1 ||
+            read_str(msg.after, r) == -1 || read_u64(msg.since, r) == -1 || read_u64(limit, r) == -1 || r.pos != r.data.size())
+        {
+            LOG_ERROR << "Invalid binary list message.";
+            return -1;
+        }
+        msg.limit = limit;
+        msg.is_query = true;
+        return 0;
+    }
+
+    /**
+     * Constructs a generic binary response.
+     * @param msg Buffer to construct the generated message into.
+     * @param response_type Type of the response.
+     * @param content Content inside the response.
+     * @param content_kind Kind of the content as returned by its builder.
+     * @param id Request id to echo back. Empty if the request had none.
+     */
+    void build_response(std::string &msg, std::string_view response_type, std::string_view content, const CONTENT_KIND content_kind, std::string_view id)
+    {
+        msg.reserve(msg.size() + ENVELOPE_OVERHEAD + response_type.size() + id.size() + content.size());
+        append_u8(msg, MAGIC);
+        append_u8(msg, VERSION);
+        append_str(msg, response_type);
+        append_str(msg, id);
+        append_u8(msg, content_kind);
+        append_str(msg, content);
+    }
+
+    /**
+     * Constructs the binary content of a create response.
+     * @param msg Buffer to construct the content into.
+     * @param info Created instance.
+     */
+    void build_create_response(std::string &msg, const hp::instance_info &info)
+    {
+        msg.reserve(msg.size() + CREATE_OVERHEAD + info.container_name.size() + info.ip.size() + info.pubkey.size() + info.contract_id.size());
+        append_str(msg, info.container_name);
+        append_str(msg, info.ip);
+        append_str(msg, info.pubkey);
+        append_str(msg, info.contract_id);
+        append_u16(msg, info.assigned_ports.peer_port);
+        append_u16(msg, info.assigned_ports.user_port);
+        append_u16(msg, info.assigned_ports.gp_tcp_port_start);
+        append_u16(msg, info.assigned_ports.gp_udp_port_start);
+    }
+
+    /**
+     * Constructs the binary content of a list response for a list message without a query.
+     * Laid out like a page holding every instance, with a zero sequence.
+     * @param msg Buffer to construct the content into.
+     * @param instances Instance list.
+     * @param leases Leases of the instances.
+     */
+    void build_list_response(std::string &msg, const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases)
+    {
+        append_u64(msg, 0);
+        append_u8(msg, 1);
+        append_u32(msg, 0);
+        append_instances(msg, instances, leases);
+        append_str(msg, {});
+    }
+
+    /**
+     * Constructs the binary content of a list response for a list query.
+     * @param msg Buffer to construct the content into.
+     * @param page Selected instances.
+     * @param leases Leases of the instances.
+     */
+    void build_list_page_response(std::string &msg, const hp::instance_page &page, const std::vector<hp::lease_info> &leases)
+    {
+        append_u64(msg, page.seq);
+        append_u8(msg, page.is_full ? 1 : 0);
+        append_u32(msg, page.removed.size());
+        for (const std::string &name : page.removed)
+            append_str(msg, name);
+        append_instances(msg, page.instances, leases);
+        append_str(msg, page.next);
+    }
+
+    /**
+     * Appends the count and the entries of an instance list.
+     * @param msg Buffer to append to.
+     * @param instances Instance list.
+     * @param leases Leases of the instances.
+     */
+    void append_instances(std::string &msg, const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases)
+    {
+        std::unordered_map<std::string_view, const hp::lease_info *> instance_leases;
+        instance_leases.reserve(leases.size());
+        for (const hp::lease_info &lease : leases)
+            instance_leases.try_emplace(lease.container_name, &lease);
+
+        size_t message_size = msg.size() + 4;
+        for (const hp::instance_info &instance : instances)
+        {
+            message_size += LIST_ENTRY_OVERHEAD + instance.container_name.size() + instance.username.size() + instance.image_name.size() +
+                            instance.contract_id.size() + instance.status.size();
+            const auto lease = instance_leases.find(instance.container_name);
+            if (lease != instance_leases.end())
+                message_size += LIST_LEASE_OVERHEAD + lease->second->tenant_xrp_address.size();
+        }
+        msg.reserve(message_size);
+
+        append_u32(msg, instances.size());
+        for (const hp::instance_info &instance : instances)
+        {
+            append_str(msg, instance.container_name);
+            append_str(msg, instance.username);
+            append_str(msg, instance.image_name);
+            append_str(msg, instance.contract_id);
+            append_str(msg, instance.status);
+            append_u16(msg, instance.assigned_ports.peer_port);
+            append_u16(msg, instance.assigned_ports.user_port);
+            append_u16(msg, instance.assigned_ports.gp_tcp_port_start);
+            append_u16(msg, instance.assigned_ports.gp_udp_port_start);
+
+            const auto lease_itr = instance_leases.find(instance.container_name);
+            append_u8(msg, lease_itr != instance_leases.end() ? 1 : 0);
+            if (lease_itr != instance_leases.end())
+            {
+                const hp::lease_info *lease = lease_itr->second;
+                append_u64(msg, lease->timestamp);
+                append_u64(msg, lease->created_on_ledger);
+                append_u64(msg, lease->timestamp + (lease->life_moments * MOMENT_SIZE));
+                append_str(msg, lease->tenant_xrp_address);
+            }
+
+            append_u8(msg, instance.usage.timestamp != 0 ? 1 : 0);
+            if (instance.usage.timestamp != 0)
+            {
+                append_u64(msg, instance.usage.cpu_us);
+                append_u64(msg, instance.usage.mem_kbytes);
+                append_u64(msg, instance.usage.disk_kbytes);
+            }
+        }
+    }
+
+    /**
+     * Constructs the binary content of an inspect response.
+     * @param msg Buffer to construct the content into.
+     * @param instance Instance info.
+     */
+    void build_inspect_response(std::string &msg, const hp::instance_info &instance)
+    {
+        msg.reserve(msg.size() + INSPECT_OVERHEAD + instance.container_name.size() + instance.username.size() + instance.image_name.size() +
+                    instance.status.size() + (instance.usage_history.size() * USAGE_SAMPLE_SIZE));
+        append_str(msg, instance.container_name);
+        append_str(msg, instance.username);
+        append_str(msg, instance.image_name);
+        append_str(msg, instance.status);
+        append_u16(msg, instance.assigned_ports.peer_port);
+        append_u16(msg, instance.assigned_ports.user_port);
+
+        append_u64(msg, instance.fs_usage.timestamp);
+        append_u64(msg, instance.fs_usage.kbytes[hpfs::FS_TREE::CONTRACT_FS]);
+        append_u64(msg, instance.fs_usage.kbytes[hpfs::FS_TREE::LEDGER_FS]);
+        append_u8(msg, instance.is_full_history ? 1 : 0);
+        for (const std::optional<uint64_t> &shards : {instance.history_config.max_primary_shards, instance.history_config.max_raw_shards})
+        {
+            append_u8(msg, shards.has_value() ? 1 : 0);
+            if (shards.has_value())
+                append_u64(msg, shards.value());
+        }
+
+        append_u32(msg, instance.usage_history.size());
+        for (const usage::usage_sample &sample : instance.usage_history)
+        {
+            append_u64(msg, sample.timestamp);
+            append_u64(msg, sample.cpu_us);
+            append_u64(msg, sample.mem_kbytes);
+            append_u64(msg, sample.disk_kbytes);
+        }
+    }
+
+    /**
+     * Constructs the binary content of a batch response.
+     * @param msg Buffer to construct the content into.
+     * @param results Results of the batch in the requested order. Structured results are built by the binary builders.
+     */
+    void build_batch_response(std::string &msg, const std::vector<batch_result> &results)
+    {
+        append_u32(msg, results.size());
+        for (const batch_result &result : results)
+        {
+            append_str(msg, result.container_name);
+            append_u8(msg, result.is_success ? 1 : 0);
+            append_u8(msg, result.content_kind);
+            append_str(msg, result.content);
+        }
+    }
+
+    /**
+     * Reads a u8 field.
+     * @param value Read value.
+     * @param r Reader of the message.
+     * @return 0 on success. -1 if the message is truncated.
+     */
+    int read_u8(uint8_t &value, reader &r)
+    {
+        if (r.data.size() - r.pos < 1)
+            return -1;
+        value = (uint8_t)r.data[r.pos++];
+        return 0;
+    }
+
+    /**
+     * Reads a little endian u64 field.
+     * @param value Read value.
+     * @param r Reader of the message.
+     * @return 0 on success. -1 if the message is truncated.
+     */
+    int read_u64(uint64_t &value, reader &r)
+    {
+        if (r.data.size() - r.pos < 8)
+            return -1;
+        value = 0;
+        for (size_t i = 0; i < 8; i++)
+            value |= (uint64_t)(uint8_t)r.data[r.pos + i] << (8 * i);
+        r.pos += 8;
+        return 0;
+    }
+
+    /**
+     * Reads a length prefixed string field in place.
+     * @param value Read string pointing into the message.
+     * @param r Reader of the message.
+     * @return 0 on success. -1 if the message is truncated.
+     */
+    int read_str(std::string_view &value, reader &r)
+    {
+        if (r.data.size() - r.pos < 4)
+            return -1;
+        uint32_t length = 0;
+        for (size_t i = 0; i < 4; i++)
+            length |= (uint32_t)(uint8_t)r.data[r.pos + i] << (8 * i);
+        r.pos += 4;
+
+        if (r.data.size() - r.pos < length)
+            return -1;
+        value = r.data.substr(r.pos, length);
+        r.pos += length;
+        return 0;
+    }
+
+    /**
+     * Reads a length prefixed string field into a string.
+     * @param value Read string.
+     * @param r Reader of the message.
+     * @return 0 on success. -1 if the message is truncated.
+     */
+    int read_str(std::string &value, reader &r)
+    {
+        std::string_view view;
+        if (read_str(view, r) == -1)
+            return -1;
+        value = view;
+        return 0;
+    }
+
+    void append_u8(std::string &msg, const uint8_t value)
+    {
+        msg += (char)value;
+    }
+
+    void append_u16(std::string &msg, const uint16_t value)
+    {
+        const char bytes[2] = {(char)(value & 0xff), (char)((value >> 8) & 0xff)};
+        msg.append(bytes, sizeof(bytes));
+    }
+
+    void append_u32(std::string &msg, const uint32_t value)
+    {
+        char bytes[4];
+        for (size_t i = 0; i < sizeof(bytes); i++)
+            bytes[i] = (char)((value >> (8 * i)) & 0xff);
+        msg.append(bytes, sizeof(bytes));
+    }
+
+    void append_u64(std::string &msg, const uint64_t value)
+    {
+        char bytes[8];
+        for (size_t i = 0; i < sizeof(bytes); i++)
+            bytes[i] = (char)((value >> (8 * i)) & 0xff);
+        msg.append(bytes, sizeof(bytes));
+    }
+
+    /**
+     * Appends a length prefixed string field.
+     * @param msg Buffer to append to.
+     * @param value String to append.
+     */
+    void append_str(std::string &msg, std::string_view value)
+    {
+        append_u32(msg, value.size());
+        msg.append(value.data(), value.size());
+    }
+
+} // namespace msg::binary
@@ -0,0 +1,105 @@
+#ifndef _HP_MSG_MSG_BINARY_
+#define _HP_MSG_MSG_BINARY_
+
+#include "../../pchheader.hpp"
+#include "../msg_common.hpp"
+#include "../../hp_manager.hpp"
+
+/**
+ * Parser helpers for binary messages. Each message type has a fixed field layout, so a message is read field by field
+ * without a parser and the clients can use the strings in place. Integers are little endian. A string is a u32 byte
+ * length followed by the bytes.
+ *
+ * Request:  u8 magic, u8 version, str type, str id, body
+ * Response: u8 magic, u8 version, str type, str id, u8 content kind, str content
+ *
+ * Request bodies:
+ *   create:                        str container_name, str owner_pubkey, str contract_id, str image, str outbound_ipv6,
+ *                                  str outbound_net_interface, str config (json object as in the json create message, can be empty)
+ *   destroy, start, stop, inspect: str container_name
+ *   list:                          empty for all the instances, or str owner_pubkey, str status, str image, str after, u64 since, u64 limit
+ *   other types:                   str json message as sent over a json connection
+ *
+ * Binary response contents:
+ *   create_res:  str name, str ip, str pubkey, str contract_id, u16 peer_port, u16 user_port, u16 gp_tcp_port, u16 gp_udp_port
+ *   list_res:    u64 seq, u8 full, u32 n, n * str removed, u32 n, n * instance, str next
+ *                instance: str name, str user, str image, str contract_id, str status, u16 peer_port, u16 user_port, u16 gp_tcp_port,
+ *                          u16 gp_udp_port, u8 has_lease, [u64 created_timestamp, u64 created_ledger, u64 expiry_timestamp, str tenant],
+ *                          u8 has_usage, [u64 cpu_us, u64 mem_kbytes, u64 disk_kbytes]
+ *   inspect_res: str name, str user, str image, str status, u16 peer_port, u16 user_port, u64 storage_timestamp, u64 contract_fs_kbytes,
+ *                u64 ledger_fs_kbytes, u8 full_history, u8 has_max_primary_shards, [u64 max_primary_shards], u8 has_max_raw_shards,
+ *                [u64 max_raw_shards], u32 n, n * (u64 timestamp, u64 cpu_us, u64 mem_kbytes, u64 disk_kbytes)
+ *   batch_res:   u32 n, n * (str name, u8 is_success, u8 content kind, str content)
+ * Other contents are text or json as in the json responses.
+ */
+namespace msg::binary
+{
+    constexpr uint8_t MAGIC = 0xB5; // Can't be the first byte of a json message or of a length prefix.
+    constexpr uint8_t VERSION = 1;
+
+    // Envelope fields of a binary message, pointing into the message.
+    struct message_header
+    {
+        std::string_view type;
+        std::string_view id;
+        std::string_view body; // Bytes after the id.
+    };
+
+    // Position of the next field of a binary message.
+    struct reader
+    {
+        std::string_view data;
+        size_t pos = 0;
+    };
+
+    bool is_binary(std::string_view message);
+
+    int scan_message(std::string_view message, message_header &header);
+
+    int extract_json_body(std::string_view &json, const message_header &header);
+
+    int extract_create_message(create_msg &msg, const message_header &header);
+
+    int extract_initiate_message(initiate_msg &msg, const message_header &header);
+
+    int read_create_body(create_msg &msg, std::string_view &config, const message_header &header);
+
+    int extract_container_message(std::string &type, std::string &container_name, const message_header &header);
+
+    int extract_list_message(list_msg &msg, const message_header &header);
+
+    void build_response(std::string &msg, std::string_view response_type, std::string_view content, const CONTENT_KIND content_kind = CONTENT_TEXT, std::string_view id = {});
+
+    void build_create_response(std::string &msg, const hp::instance_info &info);
+
+    void build_list_response(std::string &msg, const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases);
+
+    void build_list_page_response(std::string &msg, const hp::instance_page &page, const std::vector<hp::lease_info> &leases);
+
+    void append_instances(std::string &msg, const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases);
+
+    void build_inspect_response(std::string &msg, const hp::instance_info &instance);
+
+    void build_batch_response(std::string &msg, const std::vector<batch_result> &results);
+
+    int read_u8(uint8_t &value, reader &r);
+
+    int read_u64(uint64_t &value, reader &r);
+
+    int read_str(std::string_view &value, reader &r);
+
+    int read_str(std::string &value, reader &r);
+
+    void append_u8(std::string &msg, const uint8_t value);
+
+    void append_u16(std::string &msg, const uint16_t value);
+
+    void append_u32(std::string &msg, const uint32_t value);
+
+    void append_u64(std::string &msg, const uint64_t value);
+
+    void append_str(std::string &msg, std::string_view value);
+
+} // namespace msg::binary
+
+#endif
@@ -9,8 +9,234 @@ namespace msg::json
     constexpr const char *SEP_COMMA_NOQUOTE = ",\"";
     constexpr const char *SEP_COLON_NOQUOTE = "\":";
     constexpr const char *DOUBLE_QUOTE = "\"";
-    constexpr uint16_t MOMENT_SIZE = 3600;       // Seconds per Moment.
-    constexpr uint16_t INSTANCE_INFO_SIZE = 495; // Size of a single instance info
+    constexpr size_t MAX_SCAN_DEPTH = 64;         // Max nesting of the values skipped when scanning a message.
+    constexpr size_t LIST_ENTRY_OVERHEAD = 138;   // Keys, separators and the max digits of the ports of a list entry.
+    constexpr size_t LIST_LEASE_OVERHEAD = 131;   // Keys, separators and the max digits of the lease fields of a list entry.
+    constexpr size_t INSPECT_OVERHEAD = 80;       // Keys, separators and the max digits of the ports of an inspect response.
+    constexpr size_t CREATE_OVERHEAD = 130;       // Keys, separators and the max digits of the ports of a create response.
+    constexpr size_t USAGE_FIELDS_OVERHEAD = 99;  // Keys, separators and the max digits of the usage fields.
+    constexpr size_t USAGE_SAMPLE_OVERHEAD = 134; // Keys, separators and the max digits of a usage history entry.
+    constexpr size_t STORAGE_OVERHEAD = 220;      // Keys, separators and the max digits of the storage fields of an inspect response.
+
+    /**
+     * Scans the top level of a json message for the type, the id and the list fields without parsing the message body.
+     * Nested values are only checked for balanced brackets and terminated strings. The body is validated
+     * when it is parsed into a document for extracting a request.
+     * @param message The message to scan.
+     * @param header Populated with the found type, id and list fields.
+     * @return 0 on success. -1 if the message is not a json object or the type or the id are not strings.
+     */
+    int scan_message(std::string_view message, message_header &header)
+    {
+        header = message_header();
+        size_t pos = 0;
+        skip_whitespace(message, pos);
+        if (pos == message.size() || message[pos] != '{')
+        {
+            LOG_ERROR << "JSON message scanning failed. Object expected.";
+            return -1;
+        }
+        pos++;
+        skip_whitespace(message, pos);
+
+        bool is_ended = pos < message.size() && message[pos] == '}';
+        while (!is_ended)
+        {
+            bool is_key_escaped = false;
+            const size_t key_start = pos + 1;
+            if (pos == message.size() || message[pos] != '"' || scan_string(message, pos, is_key_escaped) == -1)
+            {
+                LOG_ERROR << "JSON message scanning failed. Invalid key.";
+                return -1;
+            }
+            const std::string_view key = message.substr(key_start, pos - key_start - 1);
+
+            skip_whitespace(message, pos);
+            if (pos == message.size() || message[pos] != ':')
+            {
+                LOG_ERROR << "JSON message scanning failed. Colon expected.";
+                return -1;
+            }
+            pos++;
+            skip_whitespace(message, pos);
+
+            const size_t value_start = pos;
+            if (scan_value(message, pos) == -1)
+            {
+                LOG_ERROR << "JSON message scanning failed. Invalid value.";
+                return -1;
+            }
+
+            header.is_escaped |= is_key_escaped;
+            if (!is_key_escaped && (key == msg::FLD_TYPE || key == msg::FLD_ID))
+            {
+                if (message[value_start] != '"')
+                {
+                    LOG_ERROR << (key == msg::FLD_TYPE ? "JSON message 'type' missing or invalid." : "Invalid id value.");
+                    return -1;
+                }
+
+                const std::string_view value = message.substr(value_start + 1, pos - value_start - 2);
+                header.is_escaped |= value.find('\\') != std::string_view::npos;
+                if (key == msg::FLD_TYPE)
+                {
+                    header.type = value;
+                }
+                else
+                {
+                    header.id = value;
+                    header.has_id = true;
+                }
+            }
+            else if (!is_key_escaped)
+            {
+                std::string_view *list_field = key == msg::FLD_PUBKEY ? &header.owner_pubkey
+                                               : key == msg::FLD_STATUS ? &header.status
+                                               : key == msg::FLD_IMAGE  ? &header.image
+                                               : key == msg::FLD_AFTER  ? &header.after
+                                               : key == msg::FLD_SINCE  ? &header.since
+                                               : key == msg::FLD_LIMIT  ? &header.limit
+                                                                        : NULL;
+                if (list_field != NULL)
+                {
+                    *list_field = message.substr(value_start, pos - value_start);
+                    header.is_escaped |= message[value_start] == '"' && list_field->find('\\') != std::string_view::npos;
+                }
+            }
+
+            skip_whitespace(message, pos);
+            if (pos < message.size() && message[pos] == ',')
+            {
+                pos++;
+                skip_whitespace(message, pos);
+            }
+            else if (pos < message.size() && message[pos] == '}')
+            {
+                is_ended = true;
+            }
+            else
+            {
+                LOG_ERROR << "JSON message scanning failed. Comma or end of object expected.";
+                return -1;
+            }
+        }
+
+        pos++;
+        skip_whitespace(message, pos);
+        if (pos != message.size())
+        {
+            LOG_ERROR << "JSON message scanning failed. Unexpected data after the object.";
+            return -1;
+        }
+
+        if (header.type.empty() && !header.is_escaped)
+        {
+            LOG_ERROR << "JSON message 'type' missing or invalid.";
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Moves past a json string.
+     * @param message Message holding the string.
+     * @param pos Position of the opening quote. Set to the position after the closing quote.
+     * @param is_escaped Set to true if the string has escape sequences.
+     * @return 0 on success. -1 if the string is not terminated or has control characters.
+     */
+    int scan_string(std::string_view message, size_t &pos, bool &is_escaped)
+    {
+        for (pos++; pos < message.size(); pos++)
+        {
+            const char c = message[pos];
+            if (c == '"')
+            {
+                pos++;
+                return 0;
+            }
+            else if (c == '\\')
+            {
+                is_escaped = true;
+                pos++; // Escaped character can't end the string.
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                return -1;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Moves past a json value. Containers are skipped by matching their brackets.
+     * @param message Message holding the value.
+     * @param pos Position of the value. Set to the position after the value.
+     * @return 0 on success. -1 if the value is invalid.
+     */
+    int scan_value(std::string_view message, size_t &pos)
+    {
+        if (pos == message.size())
+            return -1;
+
+        bool is_escaped = false;
+        const char first = message[pos];
+        if (first == '"')
+            return scan_string(message, pos, is_escaped);
+
+        if (first != '{' && first != '[')
+        {
+            // Number, true, false or null.
+            const size_t start = pos;
+            while (pos < message.size() && (isalnum(message[pos]) || message[pos] == '-' || message[pos] == '+' || message[pos] == '.'))
+                pos++;
+            return pos == start ? -1 : 0;
+        }
+
+        char closing[MAX_SCAN_DEPTH];
+        size_t depth = 0;
+        while (pos < message.size())
+        {
+            const char c = message[pos];
+            if (c == '"')
+            {
+                if (scan_string(message, pos, is_escaped) == -1)
+                    return -1;
+                continue;
+            }
+
+            if (c == '{' || c == '[')
+            {
+                if (depth == MAX_SCAN_DEPTH)
+                    return -1;
+                closing[depth++] = c == '{' ? '}' : ']';
+            }
+            else if (c == '}' || c == ']')
+            {
+                if (closing[--depth] != c)
+                    return -1;
+                if (depth == 0)
+                {
+                    pos++;
+                    return 0;
+                }
+            }
+            pos++;
+        }
+        return -1;
+    }
+
+    /**
+     * Moves past the json whitespace.
+     * @param message Message to scan.
+     * @param pos Position to start at. Set to the first non whitespace position.
+     */
+    void skip_whitespace(std::string_view message, size_t &pos)
+    {
+        while (pos < message.size() && (message[pos] == ' ' || message[pos] == '\t' || message[pos] == '\n' || message[pos] == '\r'))
+            pos++;
+    }
+
     /**
      * Parses a json message sent by the message board.
      * @param d Jsoncons document to which the parsed json should be loaded.
@@ -65,6 +291,48 @@ namespace msg::json
         return 0;
     }
 
+    /**
+     * Extracts the optional request 'id' value from the json document.
+     * Clients supplying an id keep the connection open and match responses by the id.
+     * @param extracted_id Extracted id. Empty if the message does not have an id.
+     * @param d The json document holding the read request message.
+     * @return 0 on successful extraction or if there's no id. -1 if the id is invalid.
+     */
+    int extract_id(std::string &extracted_id, const jsoncons::json &d)
+    {
+        extracted_id.clear();
+        if (!d.contains(msg::FLD_ID))
+            return 0;
+
+        if (!d[msg::FLD_ID].is<std::string>())
+        {
+            LOG_ERROR << "Invalid id value.";
+            return -1;
+        }
+
+        const std::string id = d[msg::FLD_ID].as<std::string>();
+        if (!is_valid_id(id))
+        {
+            LOG_ERROR << "Invalid id value.";
+            return -1;
+        }
+        extracted_id = id;
+
+        return 0;
+    }
+
+    /**
+     * Checks whether a request id can be echoed back. The id is echoed without escaping, so only a safe character set is allowed.
+     * @param id Request id.
+     * @return true if the id is valid.
+     */
+    bool is_valid_id(std::string_view id)
+    {
+        return !id.empty() && id.length() <= msg::MAX_ID_LENGTH &&
+               std::find_if(id.begin(), id.end(), [](const char c)
+                            { return !isalnum(c) && c != '-' && c != '_' && c != '.'; }) == id.end();
+    }
+
     /**
      * Extracts create message from msg.
      * @param msg Populated msg object.
@@ -635,23 +903,267 @@ namespace msg::json
         return 0;
     }
 
+    /**
+     * Extracts batch message from msg. At least one of the container names, owner or status should be given.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "batch_start | batch_stop | batch_destroy | batch_inspect",
+     *            "container_names": ["<container_name>", ...],
+     *            "owner_pubkey": "<pubkey of the owner>",
+     *            "status": "<instance status>"
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_batch_message(batch_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        if (d.contains(msg::FLD_CONTAINER_NAMES))
+        {
+            if (!d[msg::FLD_CONTAINER_NAMES].is_array())
+            {
+                LOG_ERROR << "Invalid container_names value.";
+                return -1;
+            }
+
+            for (const auto &name : d[msg::FLD_CONTAINER_NAMES].array_range())
+            {
+                if (!name.is<std::string>())
+                {
+                    LOG_ERROR << "Invalid container_names value.";
+                    return -1;
+                }
+                msg.container_names.push_back(name.as<std::string>());
+            }
+        }
+
+        if (d.contains(msg::FLD_PUBKEY))
+        {
+            if (!d[msg::FLD_PUBKEY].is<std::string>())
+            {
+                LOG_ERROR << "Invalid owner_pubkey value.";
+                return -1;
+            }
+            msg.owner_pubkey = d[msg::FLD_PUBKEY].as<std::string>();
+        }
+
+        if (d.contains(msg::FLD_STATUS))
+        {
+            if (!d[msg::FLD_STATUS].is<std::string>())
+            {
+                LOG_ERROR << "Invalid status value.";
+                return -1;
+            }
+            msg.status = d[msg::FLD_STATUS].as<std::string>();
+        }
+
+        // Empty selection is rejected so a malformed request never targets every instance.
+        if (msg.container_names.empty() && msg.owner_pubkey.empty() && msg.status.empty())
+        {
+            LOG_ERROR << "Batch message does not select any containers.";
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Extracts list message from msg. Without any of the optional fields, every instance is listed.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "list",
+     *            "owner_pubkey": "<pubkey of the owner>",
+     *            "status": "<instance status>",
+     *            "image": "<docker image name>",
+     *            "since": <change sequence of a previous response>,
+     *            "after": "<last instance name of the previous page>",
+     *            "limit": <max instances in the page>
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_list_message(list_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        const std::pair<const char *, std::string *> string_fields[] = {
+            {msg::FLD_PUBKEY, &msg.owner_pubkey}, {msg::FLD_STATUS, &msg.status}, {msg::FLD_IMAGE, &msg.image}, {msg::FLD_AFTER, &msg.after}};
+        for (const auto &[field, value] : string_fields)
+        {
+            if (!d.contains(field))
+                continue;
+
+            if (!d[field].is<std::string>())
+            {
+                LOG_ERROR << "Invalid " << field << " value.";
+                return -1;
+            }
+            *value = d[field].as<std::string>();
+            msg.is_query = true;
+        }
+
+        const std::pair<const char *, uint64_t *> number_fields[] = {{msg::FLD_SINCE, &msg.since}, {msg::FLD_LIMIT, &msg.limit}};
+        for (const auto &[field, value] : number_fields)
+        {
+            if (!d.contains(field))
+                continue;
+
+            if (!d[field].is<uint64_t>())
+            {
+                LOG_ERROR << "Invalid " << field << " value.";
+                return -1;
+            }
+            *value = d[field].as<uint64_t>();
+            msg.is_query = true;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Extracts list message from the top level fields found by scanning the message, so a list request is served
+     * without parsing the message into a document. Escaped values are left to the document based extraction.
+     * @param msg Populated msg object.
+     * @param header Scanned header of the message.
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_list_message(list_msg &msg, const message_header &header)
+    {
+        msg.type = header.type;
+
+        const std::tuple<const char *, std::string_view, std::string *> string_fields[] = {
+            {msg::FLD_PUBKEY, header.owner_pubkey, &msg.owner_pubkey}, {msg::FLD_STATUS, header.status, &msg.status}, {msg::FLD_IMAGE, header.image, &msg.image}, {msg::FLD_AFTER, header.after, &msg.after}};
+        for (const auto &[field, raw, value] : string_fields)
+        {
+            if (raw.empty())
+                continue;
+
+            if (raw.front() != '"')
+            {
+                LOG_ERROR << "Invalid " << field << " value.";
+                return -1;
+            }
+            *value = raw.substr(1, raw.size() - 2);
+            msg.is_query = true;
+        }
+
+        const std::tuple<const char *, std::string_view, uint64_t *> number_fields[] = {{msg::FLD_SINCE, header.since, &msg.since}, {msg::FLD_LIMIT, header.limit, &msg.limit}};
+        for (const auto &[field, raw, value] : number_fields)
+        {
+            if (raw.empty())
+                continue;
+
+            const auto [end, ec] = std::from_chars(raw.data(), raw.data() + raw.size(), *value);
+            if (ec != std::errc() || end != raw.data() + raw.size())
+            {
+                LOG_ERROR << "Invalid " << field << " value.";
+                return -1;
+            }
+            msg.is_query = true;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Extracts metrics message from msg.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "metrics",
+     *            "format": "json | prometheus" (optional, defaults to json)
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_metrics_message(metrics_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        msg.format = msg::METRICS_FORMAT_JSON;
+        if (d.contains(msg::FLD_FORMAT))
+        {
+            if (!d[msg::FLD_FORMAT].is<std::string>() ||
+                (d[msg::FLD_FORMAT].as<std::string>() != msg::METRICS_FORMAT_JSON && d[msg::FLD_FORMAT].as<std::string>() != msg::METRICS_FORMAT_PROMETHEUS))
+            {
+                LOG_ERROR << "Invalid format value.";
+                return -1;
+            }
+            msg.format = d[msg::FLD_FORMAT].as<std::string>();
+        }
+
+        return 0;
+    }
+
+    /**
+     * Extracts encoding message from msg.
+     * @param msg Populated msg object.
+     * @param d The json document holding the message.
+     *          Accepted signed input container format:
+     *          {
+     *            "type": "encoding",
+     *            "encoding": "json | binary"
+     *          }
+     * @return 0 on successful extraction. -1 for failure.
+     */
+    int extract_encoding_message(encoding_msg &msg, const jsoncons::json &d)
+    {
+        if (extract_type(msg.type, d) == -1)
+            return -1;
+
+        if (!d.contains(msg::FLD_ENCODING) || !d[msg::FLD_ENCODING].is<std::string>())
+        {
+            LOG_ERROR << "Field encoding is missing or invalid.";
+            return -1;
+        }
+
+        const std::string encoding = d[msg::FLD_ENCODING].as<std::string>();
+        if (encoding == msg::MSG_ENCODINGS[msg::ENCODING_JSON])
+            msg.encoding = msg::ENCODING_JSON;
+        else if (encoding == msg::MSG_ENCODINGS[msg::ENCODING_BINARY])
+            msg.encoding = msg::ENCODING_BINARY;
+        else
+        {
+            LOG_ERROR << "Invalid encoding value.";
+            return -1;
+        }
+
+        return 0;
+    }
+
     /**
      * Constructs a generic json response.
      * @param msg Buffer to construct the generated json message string into.
      *            Message format:
      *            {
+     *              "id": "<request id if the request had one>",
      *              'type': '<message type>',
      *              "content": "<any string>"
      *            }
      * @param response_type Type of the response.
      * @param content Content inside the response.
-     * @param json_content Whether content is a json string.
+     * @param content_kind Kind of the content as returned by its builder. Text contents are put in a json string.
+     * @param id Request id to echo back. Omitted if empty.
      */
-    void build_response(std::string &msg, std::string_view response_type, std::string_view content, const bool json_content)
+    void build_response(std::string &msg, std::string_view response_type, std::string_view content, const CONTENT_KIND content_kind, std::string_view id)
     {
+        const bool json_content = content_kind != CONTENT_TEXT;
         // Extra 40 bytes added for the other data included, in addition to the content here
-        msg.reserve(content.length() + 40);
+        msg.reserve(msg.size() + content.length() + id.length() + 48);
         msg += "{\"";
+        if (!id.empty())
+        {
+            msg += msg::FLD_ID;
+            msg += SEP_COLON;
+            msg += id;
+            msg += SEP_COMMA;
+        }
         msg += msg::FLD_TYPE;
         msg += SEP_COLON;
         msg += response_type;
@@ -680,7 +1192,7 @@ namespace msg::json
      */
     void build_create_response(std::string &msg, const hp::instance_info &info)
     {
-        msg.reserve(1024);
+        msg.reserve(msg.size() + CREATE_OVERHEAD + info.container_name.size() + info.ip.size() + info.pubkey.size() + info.contract_id.size());
         msg += "{\"";
         msg += "name";
         msg += SEP_COLON;
@@ -704,19 +1216,19 @@ namespace msg::json
         msg += SEP_COMMA;
         msg += "peer_port";
         msg += SEP_COLON;
-        msg += std::to_string(info.assigned_ports.peer_port);
+        append_number(msg, info.assigned_ports.peer_port);
         msg += SEP_COMMA;
         msg += "user_port";
         msg += SEP_COLON;
-        msg += std::to_string(info.assigned_ports.user_port);
+        append_number(msg, info.assigned_ports.user_port);
         msg += SEP_COMMA;
         msg += "gp_tcp_port";
         msg += SEP_COLON;
-        msg += std::to_string(info.assigned_ports.gp_tcp_port_start);
+        append_number(msg, info.assigned_ports.gp_tcp_port_start);
         msg += SEP_COMMA;
         msg += "gp_udp_port";
         msg += SEP_COLON;
-        msg += std::to_string(info.assigned_ports.gp_udp_port_start);
+        append_number(msg, info.assigned_ports.gp_udp_port_start);
         msg += "\"}";
     }
 
@@ -738,14 +1250,33 @@ namespace msg::json
      *              "created_ledger": <created on xrpl ledger>,
      *              "expiry_timestamp": <expires at the mentioned UNIX time>,
      *              "tenant": "<tenant xrp account address>",
+     *              "cpu_us": <cpu time used per second out of 1000000 microsec>,
+     *              "mem_kbytes": <memory used in KB>,
+     *              "disk_kbytes": <disk space used in KB>
      *             }
      *           ]
+     *           Usage fields are only included once the instance is sampled.
      * @param instances Instance list.
+     * @param leases Leases of the instances.
      *
      */
     void build_list_response(std::string &msg, const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases)
     {
-        const uint32_t message_size = (INSTANCE_INFO_SIZE * instances.size()) + 3;
+        std::unordered_map<std::string_view, const hp::lease_info *> instance_leases;
+        instance_leases.reserve(leases.size());
+        for (const hp::lease_info &lease : leases)
+            instance_leases.try_emplace(lease.container_name, &lease);
+
+        // Whole response is sized up front so it is written without reallocating.
+        size_t message_size = msg.size() + 2;
+        for (const hp::instance_info &instance : instances)
+        {
+            message_size += LIST_ENTRY_OVERHEAD + USAGE_FIELDS_OVERHEAD + instance.container_name.size() + instance.username.size() +
+                            instance.image_name.size() + instance.contract_id.size() + instance.status.size();
+            const auto lease = instance_leases.find(instance.container_name);
+            if (lease != instance_leases.end())
+                message_size += LIST_LEASE_OVERHEAD + lease->second->tenant_xrp_address.size();
+        }
         msg.reserve(message_size);
 
         msg += "[";
@@ -776,37 +1307,37 @@ namespace msg::json
             msg += SEP_COMMA;
             msg += "peer_port";
             msg += SEP_COLON_NOQUOTE;
-            msg += std::to_string(instance.assigned_ports.peer_port);
+            append_number(msg, instance.assigned_ports.peer_port);
             msg += SEP_COMMA_NOQUOTE;
             msg += "user_port";
             msg += SEP_COLON_NOQUOTE;
-            msg += std::to_string(instance.assigned_ports.user_port);
+            append_number(msg, instance.assigned_ports.user_port);
             msg += SEP_COMMA_NOQUOTE;
             msg += "gp_tcp_port";
             msg += SEP_COLON_NOQUOTE;
-            msg += std::to_string(instance.assigned_ports.gp_tcp_port_start);
+            append_number(msg, instance.assigned_ports.gp_tcp_port_start);
             msg += SEP_COMMA_NOQUOTE;
             msg += "gp_udp_port";
             msg += SEP_COLON_NOQUOTE;
-            msg += std::to_string(instance.assigned_ports.gp_udp_port_start);
+            append_number(msg, instance.assigned_ports.gp_udp_port_start);
 
             // Include matching lease information.
-            const auto lease = std::find_if(leases.begin(), leases.end(), [&](const hp::lease_info &l)
-                                            { return l.container_name == instance.container_name; });
-            if (lease != leases.end())
+            const auto lease_itr = instance_leases.find(instance.container_name);
+            if (lease_itr != instance_leases.end())
             {
+                const hp::lease_info *lease = lease_itr->second;
                 msg += SEP_COMMA_NOQUOTE;
                 msg += "created_timestamp";
                 msg += SEP_COLON_NOQUOTE;
-                msg += std::to_string(lease->timestamp);
+                append_number(msg, lease->timestamp);
                 msg += SEP_COMMA_NOQUOTE;
                 msg += "created_ledger";
                 msg += SEP_COLON_NOQUOTE;
-                msg += std::to_string(lease->created_on_ledger);
+                append_number(msg, lease->created_on_ledger);
                 msg += SEP_COMMA_NOQUOTE;
                 msg += "expiry_timestamp";
                 msg += SEP_COLON_NOQUOTE;
-                msg += std::to_string(lease->timestamp + (lease->life_moments * MOMENT_SIZE));
+                append_number(msg, lease->timestamp + (lease->life_moments * MOMENT_SIZE));
                 msg += SEP_COMMA_NOQUOTE;
                 msg += "tenant";
                 msg += SEP_COLON;
@@ -814,13 +1345,66 @@ namespace msg::json
                 msg += "\"";
             }
 
+            if (instance.usage.timestamp != 0)
+                append_usage_fields(msg, instance.usage);
+
             msg += "}";
             if (i < instances.size() - 1)
                 msg += ",";
         }
         msg += "]";
+    }
 
-        std::cout << msg << "\n";
+    /**
+     * Constructs the response message for a list message with filters, a cursor or a page limit.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             {
+     *               "seq": <change sequence to ask the next changes since>,
+     *               "full": <whether the instances are not limited to the changes since the requested sequence>,
+     *               "removed": ["<name of an instance removed since the requested sequence>", ...],
+     *               "instances": [<list entries as in the plain list response>],
+     *               "next": "<name to ask the next page after, only if there are more instances>"
+     *             }
+     * @param page Selected instances.
+     * @param leases Leases of the instances.
+     */
+    void build_list_page_response(std::string &msg, const hp::instance_page &page, const std::vector<hp::lease_info> &leases)
+    {
+        msg += "{\"";
+        msg += "seq";
+        msg += SEP_COLON_NOQUOTE;
+        append_number(msg, page.seq);
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "full";
+        msg += SEP_COLON_NOQUOTE;
+        msg += page.is_full ? "true" : "false";
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "removed";
+        msg += SEP_COLON_NOQUOTE;
+        msg += "[";
+        for (size_t i = 0; i < page.removed.size(); i++)
+        {
+            msg += DOUBLE_QUOTE;
+            msg += page.removed[i];
+            msg += DOUBLE_QUOTE;
+            if (i < page.removed.size() - 1)
+                msg += ",";
+        }
+        msg += "]";
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "instances";
+        msg += SEP_COLON_NOQUOTE;
+        build_list_response(msg, page.instances, leases);
+        if (!page.next.empty())
+        {
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "next";
+            msg += SEP_COLON;
+            msg += page.next;
+            msg += DOUBLE_QUOTE;
+        }
+        msg += "}";
     }
 
     /**
@@ -833,14 +1417,27 @@ namespace msg::json
      *              "image": "<docker image name>",
      *              "status": "<status of the instance>",
      *              "peer_port": "<peer port of the instance>",
-     *              "user_port": "<user port of the instance>"
+     *              "user_port": "<user port of the instance>",
+     *              "storage": {
+     *                "timestamp": <UNIX timestamp in milliseconds of the counts, 0 if not counted yet>,
+     *                "contract_fs_kbytes": <n>,
+     *                "ledger_fs_kbytes": <n>,
+     *                "full_history": <whether the ledger history is kept in full>,
+     *                "max_primary_shards": <n, only if configured>,
+     *                "max_raw_shards": <n, only if configured>
+     *              },
+     *              "usage": [
+     *                { "timestamp": <sample UNIX timestamp in milliseconds>, "cpu_us": <n>, "mem_kbytes": <n>, "disk_kbytes": <n> },
+     *                ...
+     *              ]
      *             }
      * @param instance Instance info.
      *
      */
     void build_inspect_response(std::string &msg, const hp::instance_info &instance)
     {
-        msg.reserve(1024);
+        msg.reserve(msg.size() + INSPECT_OVERHEAD + STORAGE_OVERHEAD + instance.container_name.size() + instance.username.size() + instance.image_name.size() + instance.status.size() +
+                    (instance.usage_history.size() * USAGE_SAMPLE_OVERHEAD));
         msg += "{\"";
         msg += "name";
         msg += SEP_COLON;
@@ -860,12 +1457,62 @@ namespace msg::json
         msg += SEP_COMMA;
         msg += "peer_port";
         msg += SEP_COLON_NOQUOTE;
-        msg += std::to_string(instance.assigned_ports.peer_port);
+        append_number(msg, instance.assigned_ports.peer_port);
         msg += SEP_COMMA_NOQUOTE;
         msg += "user_port";
         msg += SEP_COLON_NOQUOTE;
-        msg += std::to_string(instance.assigned_ports.user_port);
+        append_number(msg, instance.assigned_ports.user_port);
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "storage";
+        msg += SEP_COLON_NOQUOTE;
+        msg += "{\"";
+        msg += "timestamp";
+        msg += SEP_COLON_NOQUOTE;
+        append_number(msg, instance.fs_usage.timestamp);
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "contract_fs_kbytes";
+        msg += SEP_COLON_NOQUOTE;
+        append_number(msg, instance.fs_usage.kbytes[hpfs::FS_TREE::CONTRACT_FS]);
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "ledger_fs_kbytes";
+        msg += SEP_COLON_NOQUOTE;
+        append_number(msg, instance.fs_usage.kbytes[hpfs::FS_TREE::LEDGER_FS]);
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "full_history";
+        msg += SEP_COLON_NOQUOTE;
+        msg += instance.is_full_history ? "true" : "false";
+        if (instance.history_config.max_primary_shards.has_value())
+        {
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "max_primary_shards";
+            msg += SEP_COLON_NOQUOTE;
+            append_number(msg, instance.history_config.max_primary_shards.value());
+        }
+        if (instance.history_config.max_raw_shards.has_value())
+        {
+            msg += SEP_COMMA_NOQUOTE;
+            msg += "max_raw_shards";
+            msg += SEP_COLON_NOQUOTE;
+            append_number(msg, instance.history_config.max_raw_shards.value());
+        }
         msg += "}";
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "usage";
+        msg += SEP_COLON_NOQUOTE;
+        msg += "[";
+        for (size_t i = 0; i < instance.usage_history.size(); i++)
+        {
+            const usage::usage_sample &sample = instance.usage_history[i];
+            msg += "{\"";
+            msg += "timestamp";
+            msg += SEP_COLON_NOQUOTE;
+            append_number(msg, sample.timestamp);
+            append_usage_fields(msg, sample);
+            msg += "}";
+            if (i < instance.usage_history.size() - 1)
+                msg += ",";
+        }
+        msg += "]}";
     }
 
     /**
@@ -894,4 +1541,195 @@ namespace msg::json
         msg += DOUBLE_QUOTE;
         msg += "}";
     }
+
+    /**
+     * Constructs the response content for batch messages.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             [
+     *               { "name": "<instance name>", "result": "<result or inspect response>" },
+     *               { "name": "<instance name>", "error": "<error>" },
+     *               ...
+     *             ]
+     * @param results Results of the batch in the requested order.
+     */
+    void build_batch_response(std::string &msg, const std::vector<batch_result> &results)
+    {
+        msg += "[";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const batch_result &result = results[i];
+            msg += "{\"";
+            msg += "name";
+            msg += SEP_COLON;
+            msg += result.container_name;
+            msg += SEP_COMMA;
+            msg += result.is_success ? "result" : "error";
+            if (result.content_kind != CONTENT_TEXT)
+            {
+                msg += SEP_COLON_NOQUOTE;
+                msg += result.content;
+            }
+            else
+            {
+                msg += SEP_COLON;
+                msg += result.content;
+                msg += DOUBLE_QUOTE;
+            }
+            msg += "}";
+            if (i < results.size() - 1)
+                msg += ",";
+        }
+        msg += "]";
+    }
+
+    /**
+     * Constructs the response content for metrics message.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             {
+     *               "histograms": [
+     *                 { "name": "<operation>", "count": <n>, "sum_us": <n>, "p50_us": <n>, "p90_us": <n>, "p99_us": <n>, "max_us": <n> },
+     *                 ...
+     *               ],
+     *               "counters": [ { "name": "<event>", "value": <n> }, ... ]
+     *             }
+     * @param histograms Histogram summaries.
+     * @param counters Counter values.
+     */
+    void build_metrics_response(std::string &msg, const std::vector<metrics::histogram_snapshot> &histograms, const std::vector<metrics::counter_snapshot> &counters)
+    {
+        msg.reserve(msg.size() + (histograms.size() * 200) + (counters.size() * 80) + 32);
+        msg += "{\"histograms\":[";
+        for (size_t i = 0; i < histograms.size(); i++)
+        {
+            const metrics::histogram_snapshot &h = histograms[i];
+            const std::pair<const char *, uint64_t> values[] = {
+                {"count", h.count}, {"sum_us", h.sum_us}, {"p50_us", h.p50_us}, {"p90_us", h.p90_us}, {"p99_us", h.p99_us}, {"max_us", h.max_us}};
+
+            msg += "{\"";
+            msg += "name";
+            msg += SEP_COLON;
+            msg += h.name;
+            msg += DOUBLE_QUOTE;
+            for (const auto &[key, value] : values)
+            {
+                msg += SEP_COMMA_NOQUOTE;
+                msg += key;
+                msg += SEP_COLON_NOQUOTE;
+                append_number(msg, value);
+            }
+            msg += "}";
+            if (i < histograms.size() - 1)
+                msg += ",";
+        }
+        msg += "],\"counters\":[";
+        for (size_t i = 0; i < counters.size(); i++)
+        {
+            msg += "{\"";
+            msg += "name";
+            msg += SEP_COLON;
+            msg += counters[i].name;
+            msg += SEP_COMMA;
+            msg += "value";
+            msg += SEP_COLON_NOQUOTE;
+            append_number(msg, counters[i].value);
+            msg += "}";
+            if (i < counters.size() - 1)
+                msg += ",";
+        }
+        msg += "]}";
+    }
+
+    /**
+     * Constructs the response content for reload message.
+     * @param msg Buffer to construct the generated json message string into.
+     *           Message format:
+     *             {
+     *               "restart_required": ["<config field>", ...]
+     *             }
+     * @param restart_fields Changed config fields which were not applied since they need a restart.
+     */
+    void build_reload_response(std::string &msg, const std::vector<std::string> &restart_fields)
+    {
+        msg += "{\"";
+        msg += FLD_RESTART_REQUIRED;
+        msg += "\":[";
+        for (size_t i = 0; i < restart_fields.size(); i++)
+        {
+            msg += DOUBLE_QUOTE;
+            msg += restart_fields[i];
+            msg += DOUBLE_QUOTE;
+            if (i < restart_fields.size() - 1)
+                msg += ",";
+        }
+        msg += "]}";
+    }
+
+    /**
+     * Constructs a json string holding the given text, escaping the characters json does not allow in strings.
+     * @param msg Buffer to construct the json string into.
+     * @param text Text to be held by the string.
+     */
+    void build_text_content(std::string &msg, std::string_view text)
+    {
+        msg.reserve(msg.size() + text.size() + (text.size() / 16) + 2);
+        msg += DOUBLE_QUOTE;
+        for (const char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                msg += '\\';
+                msg += c;
+            }
+            else if (c == '\n')
+            {
+                msg += "\\n";
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                msg += escaped;
+            }
+            else
+            {
+                msg += c;
+            }
+        }
+        msg += DOUBLE_QUOTE;
+    }
+
+    /**
+     * Appends the decimal digits of a number without going through a temporary string.
+     * @param msg Buffer to append to.
+     * @param value Number to append.
+     */
+    void append_number(std::string &msg, const uint64_t value)
+    {
+        char digits[20];
+        const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+        msg.append(digits, end - digits);
+    }
+
+    /**
+     * Appends the cpu, memory and disk usage fields of a sample to the json object being built.
+     * @param msg Buffer to append to.
+     * @param sample Usage sample.
+     */
+    void append_usage_fields(std::string &msg, const usage::usage_sample &sample)
+    {
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "cpu_us";
+        msg += SEP_COLON_NOQUOTE;
+        append_number(msg, sample.cpu_us);
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "mem_kbytes";
+        msg += SEP_COLON_NOQUOTE;
+        append_number(msg, sample.mem_kbytes);
+        msg += SEP_COMMA_NOQUOTE;
+        msg += "disk_kbytes";
+        msg += SEP_COLON_NOQUOTE;
+        append_number(msg, sample.disk_kbytes);
+    }
 } // namespace msg::json
@@ -10,10 +10,39 @@
  */
 namespace msg::json
 {
+    // Top level fields of a message found without parsing the message body.
+    struct message_header
+    {
+        std::string_view type;   // Raw string value of the type field. Empty if not given.
+        std::string_view id;     // Raw string value of the id field.
+        bool has_id = false;
+        bool is_escaped = false; // An escaped key, or a type, id or list field value with escape sequences, which only the full parsing decodes.
+
+        // Raw values of the list fields, string values with their quotes. Empty if not given.
+        std::string_view owner_pubkey;
+        std::string_view status;
+        std::string_view image;
+        std::string_view after;
+        std::string_view since;
+        std::string_view limit;
+    };
+
+    int scan_message(std::string_view message, message_header &header);
+
+    int scan_string(std::string_view message, size_t &pos, bool &is_escaped);
+
+    int scan_value(std::string_view message, size_t &pos);
+
+    void skip_whitespace(std::string_view message, size_t &pos);
+
     int parse_message(jsoncons::json &d, std::string_view message);
 
     int extract_type(std::string &extracted_type, const jsoncons::json &d);
 
+    int extract_id(std::string &extracted_id, const jsoncons::json &d);
+
+    bool is_valid_id(std::string_view id);
+
     int extract_create_message(create_msg &msg, const jsoncons::json &d);
 
     int extract_initiate_message(initiate_msg &msg, const jsoncons::json &d);
@@ -26,16 +55,40 @@ namespace msg::json
 
     int extract_inspect_message(inspect_msg &msg, const jsoncons::json &d);
 
-    void build_response(std::string &msg, std::string_view response_type, std::string_view content, const bool json_content = false);
+    int extract_batch_message(batch_msg &msg, const jsoncons::json &d);
+
+    int extract_list_message(list_msg &msg, const jsoncons::json &d);
+
+    int extract_list_message(list_msg &msg, const message_header &header);
+
+    int extract_metrics_message(metrics_msg &msg, const jsoncons::json &d);
+
+    int extract_encoding_message(encoding_msg &msg, const jsoncons::json &d);
+
+    void build_response(std::string &msg, std::string_view response_type, std::string_view content, const CONTENT_KIND content_kind = CONTENT_TEXT, std::string_view id = {});
 
     void build_create_response(std::string &msg, const hp::instance_info &info);
 
     void build_list_response(std::string &msg, const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases);
 
+    void build_list_page_response(std::string &msg, const hp::instance_page &page, const std::vector<hp::lease_info> &leases);
+
     void build_inspect_response(std::string &msg, const hp::instance_info &instance);
 
     void build_error_response(std::string &msg, std::string_view container_name, std::string_view error);
 
+    void build_batch_response(std::string &msg, const std::vector<batch_result> &results);
+
+    void build_metrics_response(std::string &msg, const std::vector<metrics::histogram_snapshot> &histograms, const std::vector<metrics::counter_snapshot> &counters);
+
+    void build_reload_response(std::string &msg, const std::vector<std::string> &restart_fields);
+
+    void build_text_content(std::string &msg, std::string_view text);
+
+    void append_number(std::string &msg, const uint64_t value);
+
+    void append_usage_fields(std::string &msg, const usage::usage_sample &sample);
+
 } // namespace msg::json
 
 #endif
\ No newline at end of file
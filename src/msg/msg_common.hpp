@@ -3,9 +3,27 @@
 
 #include "../pchheader.hpp"
 #include "../conf.hpp"
+#include "../metrics.hpp"
 
 namespace msg
 {
+    // Encodings of the messages of a connection. Negotiated with the encoding message.
+    enum MSG_ENCODING
+    {
+        ENCODING_JSON,
+        ENCODING_BINARY
+    };
+
+    constexpr const char *MSG_ENCODINGS[]{"json", "binary"};
+
+    // Kinds of the response contents. Binary contents only occur on binary connections.
+    enum CONTENT_KIND
+    {
+        CONTENT_TEXT,
+        CONTENT_JSON,
+        CONTENT_BINARY
+    };
+
     struct create_msg
     {
         std::string type;
@@ -167,11 +185,57 @@ namespace msg
         std::string container_name;
     };
 
+    // Targets the listed containers and/or the containers matching the owner and status filters.
+    struct batch_msg
+    {
+        std::string type;
+        std::vector<std::string> container_names;
+        std::string owner_pubkey;
+        std::string status;
+    };
+
+    // Instances matching all the given filters, changed after the since sequence, in name order.
+    struct list_msg
+    {
+        std::string type;
+        std::string owner_pubkey;
+        std::string status;
+        std::string image;
+        uint64_t since = 0; // Change sequence of a previous response. 0 to list all the instances.
+        std::string after;  // Name of the last instance of the previous page.
+        size_t limit = 0;   // Max instances in the page. 0 for no limit.
+        bool is_query = false; // Whether any of the above is given. Otherwise the response is the plain instance array.
+    };
+
+    struct encoding_msg
+    {
+        std::string type;
+        MSG_ENCODING encoding = ENCODING_JSON;
+    };
+
+    struct metrics_msg
+    {
+        std::string type;
+        std::string format; // METRICS_FORMAT_JSON or METRICS_FORMAT_PROMETHEUS.
+    };
+
+    // Outcome of the operation on a single container of a batch.
+    struct batch_result
+    {
+        std::string container_name;
+        bool is_success = false;
+        std::string content;       // Result or the error code.
+        CONTENT_KIND content_kind = CONTENT_TEXT; // Kind returned by the builder of the content.
+    };
+
     // Message field names
     constexpr const char *FLD_TYPE = "type";
+    constexpr const char *FLD_ID = "id";
     constexpr const char *FLD_CONTENT = "content";
     constexpr const char *FLD_PUBKEY = "owner_pubkey";
     constexpr const char *FLD_CONTAINER_NAME = "container_name";
+    constexpr const char *FLD_CONTAINER_NAMES = "container_names";
+    constexpr const char *FLD_STATUS = "status";
     constexpr const char *FLD_CONTRACT_ID = "contract_id";
     constexpr const char *FLD_IMAGE = "image";
     constexpr const char *FLD_OUTBOUND_IPV6 = "outbound_ipv6";
@@ -214,6 +278,12 @@ namespace msg
     constexpr const char *FLD_HISTORY_CONFIG = "history_config";
     constexpr const char *FLD_MAX_R_SHARDS = "max_raw_shards";
     constexpr const char *FLD_LOGGERS = "loggers";
+    constexpr const char *FLD_FORMAT = "format";
+    constexpr const char *FLD_RESTART_REQUIRED = "restart_required";
+    constexpr const char *FLD_SINCE = "since";
+    constexpr const char *FLD_AFTER = "after";
+    constexpr const char *FLD_LIMIT = "limit";
+    constexpr const char *FLD_ENCODING = "encoding";
 
     constexpr const char *FLD_IDLE_TIMEOUT = "idle_timeout";
     constexpr const char *FLD_MSG_FORWARDING = "msg_forwarding";
@@ -228,6 +298,11 @@ namespace msg
     constexpr const char *FLD_PEER_DISCOVERY = "peer_discovery";
     constexpr const char *FLD_CON_READ_REQ = "concurrent_read_requests";
 
+    constexpr const size_t MAX_ID_LENGTH = 64; // Max length of a client supplied request id.
+    constexpr const uint16_t MOMENT_SIZE = 3600; // Seconds per Moment.
+    constexpr const char *METRICS_FORMAT_JSON = "json";
+    constexpr const char *METRICS_FORMAT_PROMETHEUS = "prometheus";
+
     // Message types
     constexpr const char *MSGTYPE_INIT = "init";
     constexpr const char *MSGTYPE_CREATE = "create";
@@ -237,6 +312,13 @@ namespace msg
     constexpr const char *MSGTYPE_STOP = "stop";
     constexpr const char *MSGTYPE_LIST = "list";
     constexpr const char *MSGTYPE_INSPECT = "inspect";
+    constexpr const char *MSGTYPE_BATCH_START = "batch_start";
+    constexpr const char *MSGTYPE_BATCH_STOP = "batch_stop";
+    constexpr const char *MSGTYPE_BATCH_DESTROY = "batch_destroy";
+    constexpr const char *MSGTYPE_BATCH_INSPECT = "batch_inspect";
+    constexpr const char *MSGTYPE_METRICS = "metrics";
+    constexpr const char *MSGTYPE_RELOAD = "reload";
+    constexpr const char *MSGTYPE_ENCODING = "encoding";
 
     // Message res types
     constexpr const char *MSGTYPE_ERROR = "error";
@@ -251,8 +333,17 @@ namespace msg
     constexpr const char *MSGTYPE_STOP_RES = "stop_res";
     constexpr const char *MSGTYPE_STOP_ERROR = "stop_error";
     constexpr const char *MSGTYPE_LIST_RES = "list_res";
+    constexpr const char *MSGTYPE_LIST_ERROR = "list_error";
     constexpr const char *MSGTYPE_INSPECT_RES = "inspect_res";
     constexpr const char *MSGTYPE_INSPECT_ERROR = "inspect_error";
+    constexpr const char *MSGTYPE_BATCH_RES = "batch_res";
+    constexpr const char *MSGTYPE_BATCH_ERROR = "batch_error";
+    constexpr const char *MSGTYPE_METRICS_RES = "metrics_res";
+    constexpr const char *MSGTYPE_METRICS_ERROR = "metrics_error";
+    constexpr const char *MSGTYPE_RELOAD_RES = "reload_res";
+    constexpr const char *MSGTYPE_RELOAD_ERROR = "reload_error";
+    constexpr const char *MSGTYPE_ENCODING_RES = "encoding_res";
+    constexpr const char *MSGTYPE_ENCODING_ERROR = "encoding_error";
 
 } // namespace msg
 
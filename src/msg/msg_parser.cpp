@@ -1,73 +1,231 @@
 #include "msg_parser.hpp"
-#include "json/msg_json.hpp"
 
 namespace msg
 {
+    msg_parser::msg_parser(const MSG_ENCODING encoding) : encoding(encoding)
+    {
+    }
+
     int msg_parser::parse(std::string_view message)
     {
-        return json::parse_message(jdoc, message);
+        this->message = message;
+        is_doc_parsed = false;
+        if (encoding == ENCODING_BINARY)
+            return binary::scan_message(message, binary_header);
+
+        if (json::scan_message(message, header) == -1)
+            return -1;
+
+        // Escaped type or id values are decoded by the full parsing.
+        return header.is_escaped ? parse_document() : 0;
+    }
+
+    int msg_parser::parse_document() const
+    {
+        if (is_doc_parsed)
+            return 0;
+
+        std::string_view json_message = message;
+        if (encoding == ENCODING_BINARY && binary::extract_json_body(json_message, binary_header) == -1)
+            return -1;
+        if (json::parse_message(jdoc, json_message) == -1)
+            return -1;
+        is_doc_parsed = true;
+        return 0;
     }
 
     int msg_parser::extract_type(std::string &extracted_type) const
     {
-        return json::extract_type(extracted_type, jdoc);
+        if (encoding == ENCODING_BINARY)
+        {
+            extracted_type = binary_header.type;
+            return 0;
+        }
+
+        if (is_doc_parsed)
+            return json::extract_type(extracted_type, jdoc);
+
+        extracted_type = header.type;
+        return 0;
+    }
+
+    int msg_parser::extract_id(std::string &extracted_id) const
+    {
+        if (encoding != ENCODING_BINARY && is_doc_parsed)
+            return json::extract_id(extracted_id, jdoc);
+
+        // Binary messages without an id have an empty one.
+        extracted_id.clear();
+        const bool has_id = encoding == ENCODING_BINARY ? !binary_header.id.empty() : header.has_id;
+        if (!has_id)
+            return 0;
+
+        const std::string_view id = encoding == ENCODING_BINARY ? binary_header.id : header.id;
+
+        if (!json::is_valid_id(id))
+        {
+            LOG_ERROR << "Invalid id value.";
+            return -1;
+        }
+        extracted_id = id;
+        return 0;
     }
 
     int msg_parser::extract_create_message(create_msg &msg) const
     {
-        return json::extract_create_message(msg, jdoc);
+        if (encoding == ENCODING_BINARY)
+            return binary::extract_create_message(msg, binary_header);
+        return parse_document() == -1 ? -1 : json::extract_create_message(msg, jdoc);
     }
 
     int msg_parser::extract_initiate_message(initiate_msg &msg) const
     {
-        return json::extract_initiate_message(msg, jdoc);
+        if (encoding == ENCODING_BINARY)
+            return binary::extract_initiate_message(msg, binary_header);
+        return parse_document() == -1 ? -1 : json::extract_initiate_message(msg, jdoc);
     }
 
     int msg_parser::extract_destroy_message(destroy_msg &msg) const
     {
-        return json::extract_destroy_message(msg, jdoc);
+        if (encoding == ENCODING_BINARY)
+            return binary::extract_container_message(msg.type, msg.container_name, binary_header);
+        return parse_document() == -1 ? -1 : json::extract_destroy_message(msg, jdoc);
     }
 
     int msg_parser::extract_start_message(start_msg &msg) const
     {
-        return json::extract_start_message(msg, jdoc);
+        if (encoding == ENCODING_BINARY)
+            return binary::extract_container_message(msg.type, msg.container_name, binary_header);
+        return parse_document() == -1 ? -1 : json::extract_start_message(msg, jdoc);
     }
 
     int msg_parser::extract_stop_message(stop_msg &msg) const
     {
-        return json::extract_stop_message(msg, jdoc);
+        if (encoding == ENCODING_BINARY)
+            return binary::extract_container_message(msg.type, msg.container_name, binary_header);
+        return parse_document() == -1 ? -1 : json::extract_stop_message(msg, jdoc);
     }
 
     int msg_parser::extract_inspect_message(inspect_msg &msg) const
     {
-        return json::extract_inspect_message(msg, jdoc);
+        if (encoding == ENCODING_BINARY)
+            return binary::extract_container_message(msg.type, msg.container_name, binary_header);
+        return parse_document() == -1 ? -1 : json::extract_inspect_message(msg, jdoc);
     }
 
-    void msg_parser::build_response(std::string &msg, std::string_view response_type, std::string_view content, const bool json_content) const
+    int msg_parser::extract_batch_message(batch_msg &msg) const
     {
-        json::build_response(msg, response_type, content, json_content);
+        return parse_document() == -1 ? -1 : json::extract_batch_message(msg, jdoc);
     }
 
-    void msg_parser::build_create_response(std::string &msg, const hp::instance_info &info) const
+    int msg_parser::extract_list_message(list_msg &msg) const
     {
+        if (encoding == ENCODING_BINARY)
+            return binary::extract_list_message(msg, binary_header);
+
+        // List fields are found by the scan. Only the messages with escaped values are parsed into a document.
+        if (is_doc_parsed)
+            return json::extract_list_message(msg, jdoc);
+        return json::extract_list_message(msg, header);
+    }
+
+    int msg_parser::extract_metrics_message(metrics_msg &msg) const
+    {
+        return parse_document() == -1 ? -1 : json::extract_metrics_message(msg, jdoc);
+    }
+
+    int msg_parser::extract_encoding_message(encoding_msg &msg) const
+    {
+        return parse_document() == -1 ? -1 : json::extract_encoding_message(msg, jdoc);
+    }
+
+    void msg_parser::build_response(std::string &msg, std::string_view response_type, std::string_view content, const CONTENT_KIND content_kind, std::string_view id) const
+    {
+        if (encoding == ENCODING_BINARY)
+            binary::build_response(msg, response_type, content, content_kind, id);
+        else
+            json::build_response(msg, response_type, content, content_kind, id);
+    }
+
+    CONTENT_KIND msg_parser::build_create_response(std::string &msg, const hp::instance_info &info) const
+    {
+        if (encoding == ENCODING_BINARY)
+        {
+            binary::build_create_response(msg, info);
+            return CONTENT_BINARY;
+        }
         json::build_create_response(msg, info);
+        return CONTENT_JSON;
     }
 
-    void msg_parser::build_list_response(std::string &msg,
+    CONTENT_KIND msg_parser::build_list_response(std::string &msg,
                                          const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases) const
     {
+        if (encoding == ENCODING_BINARY)
+        {
+            binary::build_list_response(msg, instances, leases);
+            return CONTENT_BINARY;
+        }
         json::build_list_response(msg, instances, leases);
+        return CONTENT_JSON;
     }
 
-    void msg_parser::build_inspect_response(std::string &msg, const hp::instance_info &instance) const
+    CONTENT_KIND msg_parser::build_inspect_response(std::string &msg, const hp::instance_info &instance) const
     {
+        if (encoding == ENCODING_BINARY)
+        {
+            binary::build_inspect_response(msg, instance);
+            return CONTENT_BINARY;
+        }
         json::build_inspect_response(msg, instance);
+        return CONTENT_JSON;
     }
 
-    void msg_parser::build_error_response(std::string &msg,
+    CONTENT_KIND msg_parser::build_list_page_response(std::string &msg, const hp::instance_page &page, const std::vector<hp::lease_info> &leases) const
+    {
+        if (encoding == ENCODING_BINARY)
+        {
+            binary::build_list_page_response(msg, page, leases);
+            return CONTENT_BINARY;
+        }
+        json::build_list_page_response(msg, page, leases);
+        return CONTENT_JSON;
+    }
+
+    CONTENT_KIND msg_parser::build_error_response(std::string &msg,
                                          std::string_view container_name, std::string_view error) const
     {
         json::build_error_response(msg, container_name, error);
+        return CONTENT_JSON;
+    }
+
+    CONTENT_KIND msg_parser::build_batch_response(std::string &msg, const std::vector<batch_result> &results) const
+    {
+        if (encoding == ENCODING_BINARY)
+        {
+            binary::build_batch_response(msg, results);
+            return CONTENT_BINARY;
+        }
+        json::build_batch_response(msg, results);
+        return CONTENT_JSON;
+    }
+
+    CONTENT_KIND msg_parser::build_metrics_response(std::string &msg, const std::vector<metrics::histogram_snapshot> &histograms, const std::vector<metrics::counter_snapshot> &counters) const
+    {
+        json::build_metrics_response(msg, histograms, counters);
+        return CONTENT_JSON;
+    }
+
+    CONTENT_KIND msg_parser::build_reload_response(std::string &msg, const std::vector<std::string> &restart_fields) const
+    {
+        json::build_reload_response(msg, restart_fields);
+        return CONTENT_JSON;
+    }
+
+    CONTENT_KIND msg_parser::build_text_content(std::string &msg, std::string_view text) const
+    {
+        json::build_text_content(msg, text);
+        return CONTENT_JSON;
     }
 
 } // namespace msg
\ No newline at end of file
@@ -4,29 +4,53 @@
 #include "../pchheader.hpp"
 #include "msg_common.hpp"
 #include "../hp_manager.hpp"
+#include "json/msg_json.hpp"
+#include "binary/msg_binary.hpp"
 
 namespace msg
 {
+    // Message type and id are found when parsing. The message body is only parsed into a document when a
+    // request is extracted, so the message must stay alive until then.
+    // Binary messages are decoded field by field. Only the message types without a binary layout carry a json document.
+    // Response builders return the kind of the content they built, which the response envelope is labelled with.
     class msg_parser
     {
-        jsoncons::json jdoc;
+        MSG_ENCODING encoding;
+        std::string_view message;
+        json::message_header header;
+        binary::message_header binary_header;
+        mutable jsoncons::json jdoc;
+        mutable bool is_doc_parsed = false;
+
+        int parse_document() const;
 
     public:
+        msg_parser(const MSG_ENCODING encoding = ENCODING_JSON);
         int parse(std::string_view message);
         int extract_type(std::string &extracted_type) const;
+        int extract_id(std::string &extracted_id) const;
         int extract_create_message(create_msg &msg) const;
         int extract_initiate_message(initiate_msg &msg) const;
         int extract_destroy_message(destroy_msg &msg) const;
         int extract_start_message(start_msg &msg) const;
         int extract_stop_message(stop_msg &msg) const;
         int extract_inspect_message(inspect_msg &msg) const;
-        void build_response(std::string &msg, std::string_view response_type, std::string_view content, const bool json_content = false) const;
-        void build_create_response(std::string &msg, const hp::instance_info &info) const;
-        void build_list_response(std::string &msg,
+        int extract_batch_message(batch_msg &msg) const;
+        int extract_list_message(list_msg &msg) const;
+        int extract_metrics_message(metrics_msg &msg) const;
+        int extract_encoding_message(encoding_msg &msg) const;
+        void build_response(std::string &msg, std::string_view response_type, std::string_view content, const CONTENT_KIND content_kind = CONTENT_TEXT, std::string_view id = {}) const;
+        CONTENT_KIND build_create_response(std::string &msg, const hp::instance_info &info) const;
+        CONTENT_KIND build_list_response(std::string &msg,
                                              const std::vector<hp::instance_info> &instances, const std::vector<hp::lease_info> &leases) const;
-        void build_inspect_response(std::string &msg, const hp::instance_info &instance) const;
-        void build_error_response(std::string &msg,
+        CONTENT_KIND build_list_page_response(std::string &msg, const hp::instance_page &page, const std::vector<hp::lease_info> &leases) const;
+        CONTENT_KIND build_inspect_response(std::string &msg, const hp::instance_info &instance) const;
+        CONTENT_KIND build_error_response(std::string &msg,
                                          std::string_view container_name, std::string_view error) const;
+        CONTENT_KIND build_batch_response(std::string &msg, const std::vector<batch_result> &results) const;
+        CONTENT_KIND build_metrics_response(std::string &msg, const std::vector<metrics::histogram_snapshot> &histograms, const std::vector<metrics::counter_snapshot> &counters) const;
+        CONTENT_KIND build_reload_response(std::string &msg, const std::vector<std::string> &restart_fields) const;
+        CONTENT_KIND build_text_content(std::string &msg, std::string_view text) const;
     };
 
 } // namespace msg
@@ -2,29 +2,56 @@
 #define _SA_PCHHEADER_
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <boost/stacktrace.hpp>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
 #include <concurrentqueue.h>
 #include <csignal>
+#include <deque>
+#include <dirent.h>
 #include <fcntl.h>
 #include <ftw.h>
+#include <functional>
+#include <future>
+#include <grp.h>
 #include <iostream>
 #include <jsoncons/json.hpp>
 #include <libgen.h>
+#include <linux/fs.h>
+#include <map>
+#include <mntent.h>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <set>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
 #include <sqlite3.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
+#include <sys/quota.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/un.h>
 #include <sodium.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <thread>
@@ -0,0 +1,613 @@
+#include "provision.hpp"
+#include "usage.hpp"
+#include "util/util.hpp"
+#include "util/process.hpp"
+
+namespace provision
+{
+    provision_ctx ctx;
+
+    constexpr const char *SUBUID_FILE = "/etc/subuid";
+    constexpr const char *SUBGID_FILE = "/etc/subgid";
+    constexpr const char *LIMITS_CONF = "/etc/security/limits.conf";
+    constexpr const char *LIMITS_CONF_TMP = "/etc/security/limits.conf.sashi";
+    constexpr const char *SLICE_CONF_DIR = "/etc/systemd/system";
+    constexpr const char *SLICE_CONF_FILE = "override.conf";
+    constexpr mode_t FILE_PERMS = 0644;
+    constexpr rlim_t MIN_NOFILE_LIMIT = 250000;     // Host file descriptor limit shared among the instance users.
+    constexpr rlim_t DEFAULT_NOFILE_LIMIT = 55000;  // Per user file descriptor limit if the instance count is not configured.
+
+    /**
+     * Locates the user quotas. Disk quotas are left to the install script if the user quotas are not enabled,
+     * since the script enables them.
+     * @return 0 on success and -1 on error.
+     */
+    int init()
+    {
+        const long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        ctx.cpu_count = cpu_count > 0 ? cpu_count : 1;
+
+        std::string device;
+        struct if_dqinfo info{};
+        if (usage::find_quota_device(device) == 0 && quotactl(QCMD(Q_GETINFO, USRQUOTA), device.c_str(), 0, (caddr_t)&info) == 0)
+            ctx.quota_device = device;
+        else
+            LOG_INFO << "User quotas are not enabled. Disk quotas are set by the user install script.";
+
+        return 0;
+    }
+
+    /**
+     * Provisions the given user. The quota, the slice limits and the firewall rules are independent so they are set up in parallel.
+     * @param steps Comma separated names of the steps done to be populated.
+     * @param user_id Uid of the user to be populated.
+     * @param spec Limits of the user.
+     * @param ports Instance ports to be opened.
+     * @param create_user Whether to create the user. An existing user only gets the firewall rules.
+     * @param open_ports Whether to open the instance ports in the firewall.
+     * @return 0 on success and -1 on error.
+     */
+    int provision_user(std::string &steps, int &user_id, const user_spec &spec, const port_spec &ports, const bool create_user, const bool open_ports)
+    {
+        if (create_user)
+        {
+            int group_id;
+            if (add_user_limits(spec.username, spec.max_user_count) == -1 ||
+                add_user(spec.username, user_id, group_id) == -1 ||
+                add_contract_user(spec.username, user_id, group_id, spec.contract_ugid) == -1)
+                return -1;
+            append_step(steps, STEP_USER);
+        }
+        else
+        {
+            util::user_info user;
+            if (util::get_system_user_info(spec.username, user) == -1)
+                return -1;
+            user_id = user.user_id;
+        }
+
+        std::future<int> quota_set, slice_set, ports_allowed;
+        if (create_user && !ctx.quota_device.empty())
+            quota_set = std::async(std::launch::async, set_disk_quota, user_id, spec.storage_kbytes);
+        if (create_user)
+            slice_set = std::async(std::launch::async, set_slice_limits, std::cref(spec), user_id);
+        if (open_ports)
+            ports_allowed = std::async(std::launch::async, allow_ports, std::cref(ports));
+
+        int ret = 0;
+        const auto collect = [&](std::future<int> &step_done, const char *step)
+        {
+            if (!step_done.valid())
+                return;
+            if (step_done.get() == 0)
+                append_step(steps, step);
+            else
+                ret = -1;
+        };
+        collect(quota_set, STEP_QUOTA);
+        collect(slice_set, STEP_CGROUP);
+        collect(ports_allowed, STEP_FIREWALL);
+        return ret;
+    }
+
+    /**
+     * Populates the steps removed by deprovision_user, so the uninstall script skips them.
+     * @param steps Comma separated names of the steps to be populated.
+     */
+    void get_deprovision_steps(std::string &steps)
+    {
+        append_step(steps, STEP_USER);
+        if (!ctx.quota_device.empty())
+            append_step(steps, STEP_QUOTA);
+        append_step(steps, STEP_CGROUP);
+        append_step(steps, STEP_FIREWALL);
+    }
+
+    /**
+     * Removes what was provisioned for the given user apart from the user accounts. Errors are only logged
+     * since a removed user is not restored.
+     * @param username Username of the user.
+     * @param user_id Uid of the user. -1 if the user does not exist anymore.
+     * @param ports Instance ports to be closed.
+     */
+    void deprovision_user(const std::string &username, const int user_id, const port_spec &ports)
+    {
+        std::future<int> cgroups_removed = std::async(std::launch::async, remove_cgroups, std::string_view(username), user_id);
+        std::future<int> rules_removed = std::async(std::launch::async, remove_port_rules, std::cref(ports));
+
+        // The quota record outlives the user and would apply to a new user getting the same uid.
+        if (user_id >= 0 && !ctx.quota_device.empty())
+            set_disk_quota(user_id, 0);
+        remove_user_limits(username);
+
+        cgroups_removed.get();
+        rules_removed.get();
+    }
+
+    /**
+     * Checks whether a system user exists.
+     * @param username Username of the user.
+     * @return Whether the user exists.
+     */
+    bool user_exists(const std::string &username)
+    {
+        struct passwd pwd, *result = NULL;
+        char buf[1024];
+        return getpwnam_r(username.c_str(), &pwd, buf, sizeof(buf), &result) == 0 && result != NULL;
+    }
+
+    /**
+     * Checks whether a system group exists.
+     * @param group_name Name of the group.
+     * @return Whether the group exists.
+     */
+    bool group_exists(const std::string &group_name)
+    {
+        struct group grp, *result = NULL;
+        char buf[1024];
+        return getgrnam_r(group_name.c_str(), &grp, buf, sizeof(buf), &result) == 0 && result != NULL;
+    }
+
+    /**
+     * Creates the login disabled instance user in the sashimono user group. An existing user is not taken over.
+     * @param username Username of the user.
+     * @param user_id Uid of the user to be populated.
+     * @param group_id Primary gid of the user to be populated.
+     * @return 0 on success and -1 on error.
+     */
+    int add_user(const std::string &username, int &user_id, int &group_id)
+    {
+        if (user_exists(username))
+        {
+            LOG_ERROR << "User " << username << " already exists.";
+            return -1;
+        }
+
+        if (util::run_process({"useradd", "--shell", USER_SHELL, "-m", username}) == -1)
+        {
+            LOG_ERROR << "Error creating user " << username;
+            return -1;
+        }
+
+        // Lingering lets the rootless dockerd service of the user run without a login.
+        if (util::run_process({"usermod", "--lock", "-a", "-G", USER_GROUP, username}) == -1 ||
+            util::run_process({"loginctl", "enable-linger", username}) == -1)
+        {
+            LOG_ERROR << "Error configuring user " << username;
+            return -1;
+        }
+
+        util::user_info user;
+        if (util::get_system_user_info(username, user) == -1)
+            return -1;
+
+        struct stat st;
+        if (stat(user.home_dir.c_str(), &st) == -1 || chmod(user.home_dir.c_str(), st.st_mode & ~S_IRWXO) == -1)
+        {
+            LOG_ERROR << errno << ": Error restricting the home dir of user " << username;
+            return -1;
+        }
+
+        user_id = user.user_id;
+        group_id = user.group_id;
+        return 0;
+    }
+
+    /**
+     * Creates the host user of the contract user inside the container if it does not exist. Its ids are the
+     * contract ids mapped into the subordinate id range of the instance user.
+     * @param username Username of the instance user.
+     * @param user_id Uid of the instance user.
+     * @param group_id Primary gid of the instance user.
+     * @param contract_ugid Ids of the contract user inside the container.
+     * @return 0 on success and -1 on error.
+     */
+    int add_contract_user(const std::string &username, const int user_id, const int group_id, const conf::ugid &contract_ugid)
+    {
+        const std::string contract_user = username + CONTRACT_USER_SUFFIX;
+        if (!user_exists(contract_user))
+        {
+            int uid_offset;
+            if (get_subid_offset(SUBUID_FILE, username, uid_offset) == -1)
+                return -1;
+            const std::string host_uid = std::to_string(uid_offset + contract_ugid.uid - 1);
+
+            std::vector<std::string> argv{"useradd", "--shell", USER_SHELL, "-M", "-u", host_uid};
+            if (contract_ugid.gid == 0)
+            {
+                argv.insert(argv.end(), {"-g", std::to_string(group_id)});
+            }
+            else
+            {
+                int gid_offset;
+                if (get_subid_offset(SUBGID_FILE, username, gid_offset) == -1)
+                    return -1;
+                const std::string host_gid = std::to_string(gid_offset + contract_ugid.gid - 1);
+                if (!group_exists(contract_user) && util::run_process({"groupadd", "-g", host_gid, contract_user}) == -1)
+                {
+                    LOG_ERROR << "Error creating group " << contract_user;
+                    return -1;
+                }
+                argv.insert(argv.end(), {"-g", host_gid, "-G", username});
+            }
+            argv.push_back(contract_user);
+
+            if (util::run_process(argv) == -1)
+            {
+                LOG_ERROR << "Error creating contract user " << contract_user;
+                return -1;
+            }
+        }
+
+        if (util::run_process({"usermod", "--lock", contract_user}) == -1)
+        {
+            LOG_ERROR << "Error locking contract user " << contract_user;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Finds the start of the subordinate id range of a user.
+     * @param file_path Subordinate uid or gid file.
+     * @param username Username of the user.
+     * @param offset First subordinate id to be populated.
+     * @return 0 on success and -1 on error.
+     */
+    int get_subid_offset(const char *file_path, std::string_view username, int &offset)
+    {
+        const int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+        std::string buf;
+        if (fd == -1 || util::read_from_fd(fd, buf) == -1)
+        {
+            LOG_ERROR << errno << ": Error reading " << file_path;
+            if (fd != -1)
+                close(fd);
+            return -1;
+        }
+        close(fd);
+
+        // Lines are in <username>:<first id>:<id count> format.
+        std::vector<std::string> lines;
+        util::split_string(lines, buf, "\n");
+        for (const std::string &line : lines)
+        {
+            std::vector<std::string> fields;
+            util::split_string(fields, line, ":");
+            if (fields.size() == 3 && fields[0] == username)
+                return util::stoi(fields[1], offset);
+        }
+
+        LOG_ERROR << "No subordinate ids for user " << username << " in " << file_path;
+        return -1;
+    }
+
+    /**
+     * Adds the process and file descriptor limits of the user. The host file descriptor limit is shared among the instance users.
+     * @param username Username of the user.
+     * @param max_user_count Max instance users sharing the host limit.
+     * @return 0 on success and -1 on error.
+     */
+    int add_user_limits(std::string_view username, const size_t max_user_count)
+    {
+        struct rlimit nofile{}, nproc{};
+        getrlimit(RLIMIT_NOFILE, &nofile);
+        getrlimit(RLIMIT_NPROC, &nproc);
+
+        const rlim_t host_nofile = std::max(nofile.rlim_cur, MIN_NOFILE_LIMIT);
+        const rlim_t user_nofile = max_user_count > 0 ? host_nofile / (max_user_count + 1) : DEFAULT_NOFILE_LIMIT;
+        const std::string user_nproc = nproc.rlim_cur == RLIM_INFINITY ? "unlimited" : std::to_string(nproc.rlim_cur);
+
+        const std::string user(username);
+        const std::string limits = user + " hard nofile " + std::to_string(user_nofile) + "\n" +
+                                   user + " soft nofile " + std::to_string(user_nofile) + "\n" +
+                                   user + " hard nproc " + user_nproc + "\n";
+
+        std::scoped_lock lock(ctx.limits_mutex);
+        const int fd = open(LIMITS_CONF, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, FILE_PERMS);
+        std::string buf;
+        if (fd == -1 || util::read_from_fd(fd, buf) == -1)
+        {
+            LOG_ERROR << errno << ": Error reading " << LIMITS_CONF;
+            if (fd != -1)
+                close(fd);
+            return -1;
+        }
+
+        // Limits of a partially provisioned user are already there.
+        const std::string line_start = user + " ";
+        if (buf.compare(0, line_start.size(), line_start) == 0 || buf.find("\n" + line_start) != std::string::npos)
+        {
+            close(fd);
+            return 0;
+        }
+
+        if (!buf.empty() && buf.back() != '\n')
+            buf = "\n" + limits;
+        else
+            buf = limits;
+
+        if (write(fd, buf.data(), buf.size()) == -1)
+        {
+            LOG_ERROR << errno << ": Error writing " << LIMITS_CONF;
+            close(fd);
+            return -1;
+        }
+        close(fd);
+        return 0;
+    }
+
+    /**
+     * Removes the process and file descriptor limits of the user.
+     * @param username Username of the user.
+     * @return 0 on success and -1 on error.
+     */
+    int remove_user_limits(std::string_view username)
+    {
+        std::scoped_lock lock(ctx.limits_mutex);
+        const int fd = open(LIMITS_CONF, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return errno == ENOENT ? 0 : -1;
+
+        std::string buf;
+        if (util::read_from_fd(fd, buf) == -1)
+        {
+            LOG_ERROR << errno << ": Error reading " << LIMITS_CONF;
+            close(fd);
+            return -1;
+        }
+        close(fd);
+
+        const std::string line_start = std::string(username) + " ";
+        std::string kept;
+        kept.reserve(buf.size());
+        bool removed = false;
+        size_t pos = 0;
+        while (pos < buf.size())
+        {
+            size_t end = buf.find('\n', pos);
+            end = end == std::string::npos ? buf.size() : end + 1;
+            if (buf.compare(pos, line_start.size(), line_start) == 0)
+                removed = true;
+            else
+                kept.append(buf, pos, end - pos);
+            pos = end;
+        }
+        if (!removed)
+            return 0;
+
+        // Replaced through a rename so a failed write doesn't leave the limits of the other users truncated.
+        if (write_value(LIMITS_CONF_TMP, kept) == -1 || rename(LIMITS_CONF_TMP, LIMITS_CONF) == -1)
+        {
+            LOG_ERROR << errno << ": Error writing " << LIMITS_CONF;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Sets the disk quota of a user on the root filesystem.
+     * @param user_id Uid of the user.
+     * @param kbytes Disk space allowed in KB. 0 removes the limit.
+     * @return 0 on success and -1 on error.
+     */
+    int set_disk_quota(const int user_id, const size_t kbytes)
+    {
+        // Quota blocks are 1KB like with the setquota command. Inode limits are left unlimited.
+        struct dqblk quota{};
+        quota.dqb_bsoftlimit = kbytes;
+        quota.dqb_bhardlimit = kbytes;
+        quota.dqb_valid = QIF_LIMITS;
+        if (quotactl(QCMD(Q_SETQUOTA, USRQUOTA), ctx.quota_device.c_str(), user_id, (caddr_t)&quota) == -1)
+        {
+            LOG_ERROR << errno << ": Error setting the disk quota of uid " << user_id;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Applies the cpu and memory limits of a user to its systemd user slice. The slice is picked up on the next
+     * systemd reload by the install script. The user cgroups are left to user-cgcreate.sh as before.
+     * @param spec Limits of the user.
+     * @param user_id Uid of the user.
+     * @return 0 on success and -1 on error.
+     */
+    int set_slice_limits(const user_spec &spec, const int user_id)
+    {
+        // Slice cpu quota is a percentage of one core.
+        const size_t cpu_quota_percent = ctx.cpu_count * spec.cpu_us * 100 / usage::CPU_SCALE;
+        const std::string slice_dir = std::string(SLICE_CONF_DIR) + "/user-" + std::to_string(user_id) + ".slice.d";
+        const std::string slice_conf = "[Slice]\n"
+                                       "MemoryAccounting=true\n"
+                                       "CPUAccounting=true\n"
+                                       "MemoryMax=" + std::to_string(spec.mem_kbytes) + "K\n"
+                                       "CPUQuota=" + std::to_string(cpu_quota_percent) + "%\n"
+                                       "MemorySwapMax=" + std::to_string(spec.swap_kbytes) + "K\n";
+        if (util::create_dir_tree_recursive(slice_dir) == -1 || write_value(slice_dir + "/" + SLICE_CONF_FILE, slice_conf) == -1)
+        {
+            LOG_ERROR << "Error configuring the user slice of " << spec.username;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Removes the cgroups and the slice limits of a user. The user processes must have exited.
+     * @param username Username of the user.
+     * @param user_id Uid of the user. -1 if the user does not exist anymore.
+     * @return 0 on success and -1 on error.
+     */
+    int remove_cgroups(std::string_view username, const int user_id)
+    {
+        int ret = 0;
+        const std::string cgroup_name = "/" + std::string(username) + usage::CGROUP_SUFFIX;
+        for (const std::string &dir : {usage::CGROUP_CPU_DIR + cgroup_name, usage::CGROUP_MEM_DIR + cgroup_name})
+        {
+            if (rmdir(dir.c_str()) == -1 && errno != ENOENT)
+            {
+                LOG_ERROR << errno << ": Error removing cgroup " << dir;
+                ret = -1;
+            }
+        }
+
+        if (user_id >= 0)
+        {
+            const std::string slice_dir = std::string(SLICE_CONF_DIR) + "/user-" + std::to_string(user_id) + ".slice.d";
+            if (util::is_dir_exists(slice_dir) && util::remove_directory_recursively(slice_dir) == -1)
+            {
+                LOG_ERROR << "Error removing the user slice config " << slice_dir;
+                ret = -1;
+            }
+        }
+        return ret;
+    }
+
+    /**
+     * Replaces the content of a file.
+     * @param file_path Path of the file.
+     * @param value Content to be written.
+     * @return 0 on success and -1 on error.
+     */
+    int write_value(const std::string &file_path, std::string_view value)
+    {
+        const int fd = open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, FILE_PERMS);
+        if (fd == -1 || write(fd, value.data(), value.size()) == -1)
+        {
+            LOG_ERROR << errno << ": Error writing " << file_path;
+            if (fd != -1)
+                close(fd);
+            return -1;
+        }
+        close(fd);
+        return 0;
+    }
+
+    /**
+     * Opens the instance ports in the firewall. Ports which are already allowed are skipped, so the rules added by
+     * someone else are not tagged as the instance's own.
+     * @param ports Instance ports.
+     * @return 0 on success and -1 on error.
+     */
+    int allow_ports(const port_spec &ports)
+    {
+        std::vector<std::pair<std::string, std::string>> existing_rules;
+        if (get_firewall_rules(existing_rules, ports.instance_name) == -1)
+            return -1;
+
+        std::vector<std::pair<std::string, std::string>> rules;
+        get_port_rules(rules, ports);
+        for (const auto &[rule, comment] : rules)
+        {
+            const bool is_allowed = std::any_of(existing_rules.begin(), existing_rules.end(), [&rule = rule](const auto &existing)
+                                                { return existing.first == rule; });
+            if (is_allowed)
+                LOG_DEBUG << rule << " is already allowed in the firewall. Skipping.";
+            else if (util::run_process({"ufw", "allow", rule, "comment", comment}) == -1)
+            {
+                LOG_ERROR << "Error allowing " << rule << " in the firewall for " << ports.instance_name;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * Closes the instance ports in the firewall. Rules which were not added for the instance are kept.
+     * @param ports Instance ports.
+     * @return 0 on success and -1 on error.
+     */
+    int remove_port_rules(const port_spec &ports)
+    {
+        if (ports.peer_port == 0) // Warm pool users don't have ports.
+            return 0;
+
+        std::vector<std::pair<std::string, std::string>> existing_rules;
+        if (get_firewall_rules(existing_rules, ports.instance_name) == -1)
+            return -1;
+
+        int ret = 0;
+        std::vector<std::pair<std::string, std::string>> rules;
+        get_port_rules(rules, ports);
+        for (const auto &[rule, comment] : rules)
+        {
+            // Comments are compared whole so the rules of sa10 are not taken as the rules of sa1.
+            const bool is_own = std::any_of(existing_rules.begin(), existing_rules.end(), [&comment = comment](const auto &existing)
+                                            { return existing.second == comment; });
+            if (is_own && util::run_process({"ufw", "delete", "allow", rule}) == -1)
+            {
+                LOG_ERROR << "Error removing " << rule << " from the firewall for " << ports.instance_name;
+                ret = -1;
+            }
+        }
+        return ret;
+    }
+
+    /**
+     * Populates the firewall rules of the instance ports with the comments identifying them.
+     * @param rules Rule and comment pairs to be populated.
+     * @param ports Instance ports.
+     */
+    void get_port_rules(std::vector<std::pair<std::string, std::string>> &rules, const port_spec &ports)
+    {
+        const std::string comment = FIREWALL_COMMENT_PREFIX + ports.instance_name;
+        rules.emplace_back(std::to_string(ports.user_port) + "/tcp", comment + "-user");
+        rules.emplace_back(std::to_string(ports.peer_port), comment + "-peer");
+        for (size_t i = 0; i < GP_UDP_PORT_COUNT; i++)
+            rules.emplace_back(std::to_string(ports.gp_udp_port_start + i), comment + "-gp-udp-" + std::to_string(i));
+        for (size_t i = 0; i < GP_TCP_PORT_COUNT; i++)
+            rules.emplace_back(std::to_string(ports.gp_tcp_port_start + i), comment + "-gp-tcp-" + std::to_string(i));
+    }
+
+    /**
+     * Reads the allow rules of the firewall.
+     * @param rules Destination and comment pairs to be populated. The comment is empty for rules without one.
+     * @param instance_name Name of the instance the rules are read for.
+     * @return 0 on success and -1 on error.
+     */
+    int get_firewall_rules(std::vector<std::pair<std::string, std::string>> &rules, std::string_view instance_name)
+    {
+        util::process_result status;
+        if (util::run_process({"ufw", "status"}, status) == -1 || status.exit_code != 0)
+        {
+            LOG_ERROR << "Error reading the firewall rules for " << instance_name;
+            return -1;
+        }
+
+        // Rule lines look like "22861/tcp (v6)   ALLOW   Anywhere (v6)   # sashimono-sa1-user".
+        std::vector<std::string> lines;
+        util::split_string(lines, status.output, "\n");
+        for (const std::string &line : lines)
+        {
+            const size_t comment_pos = line.find(" # ");
+            std::vector<std::string> fields;
+            util::split_string(fields, std::string_view(line).substr(0, comment_pos), " ");
+
+            const size_t action_index = (fields.size() > 1 && fields[1] == "(v6)") ? 2 : 1;
+            if (fields.size() <= action_index || fields[action_index] != "ALLOW")
+                continue;
+
+            std::string comment;
+            if (comment_pos != std::string::npos)
+            {
+                comment = line.substr(comment_pos + 3);
+                comment.erase(comment.find_last_not_of(" \t\r") + 1);
+            }
+            rules.emplace_back(fields[0], std::move(comment));
+        }
+        return 0;
+    }
+
+    /**
+     * Adds a step name to a comma separated step list.
+     * @param steps Step list.
+     * @param step Step name.
+     */
+    void append_step(std::string &steps, const char *step)
+    {
+        if (!steps.empty())
+            steps.append(",");
+        steps.append(step);
+    }
+
+} // namespace provision
@@ -0,0 +1,98 @@
+#ifndef _SA_PROVISION_
+#define _SA_PROVISION_
+
+#include "pchheader.hpp"
+#include "conf.hpp"
+
+/**
+ * Provisions the instance users natively instead of through the user install and uninstall scripts.
+ * Covers the user accounts, the disk quota, the user slice limits and the firewall rules of the instance ports.
+ * Every step can be run again on a partially provisioned user. The scripts are told which steps were done here so they skip them.
+ */
+namespace provision
+{
+    // Names of the provisioning steps as passed to the scripts.
+    constexpr const char *STEP_USER = "user";
+    constexpr const char *STEP_QUOTA = "quota";
+    constexpr const char *STEP_CGROUP = "cgroup";
+    constexpr const char *STEP_FIREWALL = "firewall";
+
+    constexpr const char *USER_GROUP = "sashiuser";
+    constexpr const char *USER_SHELL = "/usr/sbin/nologin";
+    constexpr const char *CONTRACT_USER_SUFFIX = "-secuser"; // Host user of the contract user inside the container.
+    constexpr const char *FIREWALL_COMMENT_PREFIX = "sashi-";
+    constexpr size_t GP_TCP_PORT_COUNT = 2;
+    constexpr size_t GP_UDP_PORT_COUNT = 2;
+
+    // Resource limits and ids of a user to be provisioned.
+    struct user_spec
+    {
+        std::string username;
+        size_t cpu_us = 0;                  // CPU time out of 1000000 microsec.
+        size_t mem_kbytes = 0;
+        size_t swap_kbytes = 0;
+        size_t storage_kbytes = 0;
+        conf::ugid contract_ugid;           // Ids of the contract user inside the container.
+        size_t max_user_count = 0;          // Max instance users sharing the host file descriptor limit.
+    };
+
+    // Instance ports to be opened in the firewall.
+    struct port_spec
+    {
+        std::string instance_name;
+        uint16_t peer_port = 0;
+        uint16_t user_port = 0;
+        uint16_t gp_tcp_port_start = 0;
+        uint16_t gp_udp_port_start = 0;
+    };
+
+    struct provision_ctx
+    {
+        std::string quota_device; // Block device holding the user quotas. Empty if the user quotas are not enabled.
+        size_t cpu_count = 1;
+        std::mutex limits_mutex;  // Serializes the rewrites of the limits config.
+    };
+
+    int init();
+
+    int provision_user(std::string &steps, int &user_id, const user_spec &spec, const port_spec &ports, const bool create_user, const bool open_ports);
+
+    void get_deprovision_steps(std::string &steps);
+
+    void deprovision_user(const std::string &username, const int user_id, const port_spec &ports);
+
+    bool user_exists(const std::string &username);
+
+    bool group_exists(const std::string &group_name);
+
+    int add_user(const std::string &username, int &user_id, int &group_id);
+
+    int add_contract_user(const std::string &username, const int user_id, const int group_id, const conf::ugid &contract_ugid);
+
+    int get_subid_offset(const char *file_path, std::string_view username, int &offset);
+
+    int add_user_limits(std::string_view username, const size_t max_user_count);
+
+    int remove_user_limits(std::string_view username);
+
+    int set_disk_quota(const int user_id, const size_t kbytes);
+
+    int set_slice_limits(const user_spec &spec, const int user_id);
+
+    int remove_cgroups(std::string_view username, const int user_id);
+
+    int write_value(const std::string &file_path, std::string_view value);
+
+    int allow_ports(const port_spec &ports);
+
+    int remove_port_rules(const port_spec &ports);
+
+    void get_port_rules(std::vector<std::pair<std::string, std::string>> &rules, const port_spec &ports);
+
+    int get_firewall_rules(std::vector<std::pair<std::string, std::string>> &rules, std::string_view instance_name);
+
+    void append_step(std::string &steps, const char *step);
+
+} // namespace provision
+
+#endif
@@ -4,87 +4,389 @@
 
 namespace salog
 {
-    class plog_formatter;
+    constexpr size_t WRITE_BATCH_SIZE = 256;    // Max log lines taken off the queue for a single write.
+    constexpr int WRITER_IDLE_WAIT_MS = 20;     // Wait of the writer thread when there's nothing to write.
+    constexpr uint64_t REORDER_WINDOW_MS = 100; // Lines are held back this long so lines of other threads can be sorted in.
+    constexpr int FLUSH_WAIT_MS = 500;          // Max wait for the writer thread to write the queued lines on a crash.
+    constexpr mode_t LOG_FILE_PERMS = 0644;
 
-    // Custom formatter adopted from:
-    // https://github.com/SergiusTheBest/plog/blob/master/include/plog/Formatters/TxtFormatter.h
-    class plog_formatter
+    // Date and time prefix of the second the last log line of a thread was formatted in.
+    struct time_prefix
+    {
+        time_t second = -1;
+        char text[32];
+        size_t length = 0;
+    };
+    thread_local time_prefix cached_prefix;
+
+    // Log file rolled over to numbered files once it reaches the max size, as the plog rolling file appender does.
+    struct log_file
+    {
+        std::string path;
+        int fd = -1;
+        size_t size = 0;
+        size_t max_bytes = 0; // 0 to never roll.
+        size_t max_files = 0; // Files kept including the current one.
+    };
+
+    // Formatted line with the epoch milliseconds of its record, which the writer orders the lines by.
+    struct queued_line
+    {
+        uint64_t time_ms = 0;
+        std::string text;
+    };
+
+    struct log_ctx
+    {
+        moodycamel::ConcurrentQueue<queued_line> queue; // Each logging thread has its own sub-queue.
+        std::thread writer_thread;
+        bool is_shutting_down = false;
+        std::atomic<bool> is_writer_done = false;
+        std::atomic<bool> is_sync = false; // Set on the crash paths. Lines are then written by the logging thread.
+        std::mutex writer_mutex;
+        std::condition_variable writer_cv; // Notified on shutdown.
+        bool is_console = false;
+        log_file file;
+        std::atomic<plog::Severity> max_severity = plog::Severity::info; // Changed by config reloads while logging.
+    };
+    log_ctx logs;
+
+    plog::Severity to_plog_severity(const conf::LOG_SEVERITY level_type);
+
+    const char *severity_to_string(const plog::Severity severity);
+
+    void format_line(std::string &line, const plog::Record &record);
+
+    void writer_loop();
+
+    void write_pending(std::vector<queued_line> &pending, std::string &batch, const uint64_t written_until_ms);
+
+    void write_batch(std::string_view batch);
+
+    void write_direct(std::string_view batch);
+
+    int open_log_file();
+
+    void roll_log_files();
+
+    // Formats the records on the logging thread and hands them to the writer thread without locking.
+    class async_appender : public plog::IAppender
     {
     public:
-        static plog::util::nstring header()
+        void write(const plog::Record &record) override
         {
-            return plog::util::nstring();
-        }
+            if (record.getSeverity() > logs.max_severity.load(std::memory_order_relaxed))
+                return;
 
-        static inline const char *severity_to_string(plog::Severity severity)
-        {
-            switch (severity)
+            queued_line line;
+            format_line(line.text, record);
+            if (logs.is_sync.load(std::memory_order_acquire))
             {
-            case plog::Severity::fatal:
-                return "fat";
-            case plog::Severity::error:
-                return "err";
-            case plog::Severity::warning:
-                return "wrn";
-            case plog::Severity::info:
-                return "inf";
-            case plog::Severity::debug:
-                return "dbg";
-            case plog::Severity::verbose:
-                return "ver";
-            default:
-                return "def";
+                write_direct(line.text);
+                return;
             }
+
+            thread_local moodycamel::ProducerToken token(logs.queue);
+            line.time_ms = record.getTime().time * 1000ULL + record.getTime().millitm;
+            logs.queue.enqueue(token, std::move(line));
         }
+    };
 
-        static plog::util::nstring format(const plog::Record &record)
+    void init()
+    {
+        const plog::Severity level = to_plog_severity(conf::cfg.log.log_level_type);
+
+        // Take decision to append logger for file / console or both.
+        logs.is_console = conf::cfg.log.loggers.count("console") == 1;
+        if (conf::cfg.log.loggers.count("file") == 1)
         {
-            tm t;
-            plog::util::localtime_s(&t, &record.getTime().time); // local time
+            logs.file.path = conf::ctx.log_dir + "/sa.log";
+            logs.file.max_bytes = conf::cfg.log.max_mbytes_per_file * 1024 * 1024;
+            logs.file.max_files = conf::cfg.log.max_file_count;
+            if (open_log_file() == -1)
+                std::cerr << errno << ": Error opening log file " << logs.file.path << "\n";
+        }
 
-            plog::util::nostringstream ss;
-            ss << t.tm_year + 1900 << std::setfill(PLOG_NSTR('0')) << std::setw(2) << t.tm_mon + 1 << std::setfill(PLOG_NSTR('0')) << std::setw(2) << t.tm_mday << PLOG_NSTR(" ");
-            ss << std::setfill(PLOG_NSTR('0')) << std::setw(2) << t.tm_hour << PLOG_NSTR(":")
-               << std::setfill(PLOG_NSTR('0')) << std::setw(2) << t.tm_min << PLOG_NSTR(":")
-               << std::setfill(PLOG_NSTR('0')) << std::setw(2) << t.tm_sec << PLOG_NSTR(" ");
-            // Uncomment for millseconds.
-            // << std::setfill(PLOG_NSTR('0')) << std::setw(3) << record.getTime().millitm << PLOG_NSTR(" ");
+        // Plog reads its max severity without synchronization, so it is left at verbose and the lines are filtered
+        // by the appender against a level which a reload can change.
+        logs.max_severity = level;
+        static async_appender appender;
+        plog::init(plog::Severity::verbose).addAppender(&appender);
 
-            ss << PLOG_NSTR("[") << severity_to_string(record.getSeverity()) << PLOG_NSTR("][sa] ");
-            ss << record.getMessage() << PLOG_NSTR("\n");
+        // Exit paths which do not call deinit still get the queued lines written.
+        logs.writer_thread = std::thread(writer_loop);
+        std::atexit(deinit);
+    }
 
-            return ss.str();
+    /**
+     * Changes the severity of the lines logged from now on.
+     * @param level_type New log severity level.
+     */
+    void set_level(const conf::LOG_SEVERITY level_type)
+    {
+        logs.max_severity = to_plog_severity(level_type);
+    }
+
+    plog::Severity to_plog_severity(const conf::LOG_SEVERITY level_type)
+    {
+        if (level_type == conf::LOG_SEVERITY::DEBUG)
+            return plog::Severity::debug;
+        else if (level_type == conf::LOG_SEVERITY::INFO)
+            return plog::Severity::info;
+        else if (level_type == conf::LOG_SEVERITY::WARN)
+            return plog::Severity::warning;
+        else
+            return plog::Severity::error;
+    }
+
+    /**
+     * Writes the queued log lines on the calling thread and makes the later lines skip the queue. Used on the crash paths,
+     * where the writer thread might not get to write them or might be the crashed thread. Best effort, since lines
+     * queued by other threads meanwhile might be missed.
+     */
+    void flush()
+    {
+        if (!logs.writer_thread.joinable() || logs.is_sync.load())
+            return;
+
+        {
+            std::scoped_lock lock(logs.writer_mutex);
+            logs.is_shutting_down = true;
         }
-    };
+        logs.writer_cv.notify_one();
 
-    void init()
+        if (std::this_thread::get_id() != logs.writer_thread.get_id())
+        {
+            for (int waited_ms = 0; !logs.is_writer_done && waited_ms < FLUSH_WAIT_MS; waited_ms++)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        logs.is_sync = true;
+
+        // Lines the writer thread did not take.
+        queued_line lines[WRITE_BATCH_SIZE];
+        std::vector<queued_line> pending;
+        size_t count;
+        while ((count = logs.queue.try_dequeue_bulk(lines, WRITE_BATCH_SIZE)) > 0)
+            std::move(lines, lines + count, std::back_inserter(pending));
+        std::stable_sort(pending.begin(), pending.end(), [](const queued_line &a, const queued_line &b)
+                         { return a.time_ms < b.time_ms; });
+        for (const queued_line &line : pending)
+            write_direct(line.text);
+    }
+
+    /**
+     * Writes the queued log lines and stops the writer thread.
+     */
+    void deinit()
     {
-        plog::Severity level;
+        if (logs.writer_thread.joinable())
+        {
+            {
+                std::scoped_lock lock(logs.writer_mutex);
+                logs.is_shutting_down = true;
+            }
+            logs.writer_cv.notify_one();
 
-        if (conf::cfg.log.log_level_type == conf::LOG_SEVERITY::DEBUG)
-            level = plog::Severity::debug;
-        else if (conf::cfg.log.log_level_type == conf::LOG_SEVERITY::INFO)
-            level = plog::Severity::info;
-        else if (conf::cfg.log.log_level_type == conf::LOG_SEVERITY::WARN)
-            level = plog::Severity::warning;
-        else
-            level = plog::Severity::error;
+            // A writer thread which did not finish on a crash path is left behind, since it might be the calling thread.
+            if (logs.is_sync && !logs.is_writer_done)
+                logs.writer_thread.detach();
+            else
+                logs.writer_thread.join();
+        }
 
-        const std::string trace_file = conf::ctx.log_dir + "/sa.log";
-        static plog::RollingFileAppender<plog_formatter> fileAppender(trace_file.c_str(), conf::cfg.log.max_mbytes_per_file * 1024 * 1024, conf::cfg.log.max_file_count);
-        static plog::ConsoleAppender<plog_formatter> consoleAppender;
+        if (logs.file.fd != -1)
+        {
+            close(logs.file.fd);
+            logs.file.fd = -1;
+        }
+    }
 
-        plog::Logger<0> &logger = plog::init(level);
+    const char *severity_to_string(const plog::Severity severity)
+    {
+        switch (severity)
+        {
+        case plog::Severity::fatal:
+            return "fat";
+        case plog::Severity::error:
+            return "err";
+        case plog::Severity::warning:
+            return "wrn";
+        case plog::Severity::info:
+            return "inf";
+        case plog::Severity::debug:
+            return "dbg";
+        case plog::Severity::verbose:
+            return "ver";
+        default:
+            return "def";
+        }
+    }
 
-        // Take decision to append logger for file / console or both.
-        if (conf::cfg.log.loggers.count("console") == 1)
+    /**
+     * Formats a log record as "YYYYMMDD HH:MM:SS.mmm [sev][sa] message".
+     * The date and time part is only formatted once per second on each thread.
+     * @param line String to hold the formatted line.
+     * @param record Log record.
+     */
+    void format_line(std::string &line, const plog::Record &record)
+    {
+        const plog::util::Time &time = record.getTime();
+        time_prefix &prefix = cached_prefix;
+        if (prefix.second != time.time)
         {
-            logger.addAppender(&consoleAppender);
+            tm t;
+            plog::util::localtime_s(&t, &time.time); // local time
+            prefix.length = strftime(prefix.text, sizeof(prefix.text), "%Y%m%d %H:%M:%S.", &t);
+            prefix.second = time.time;
         }
 
-        if (conf::cfg.log.loggers.count("file") == 1)
+        const char *message = record.getMessage();
+        const size_t message_length = strlen(message);
+        line.reserve(prefix.length + message_length + 16);
+        line.append(prefix.text, prefix.length);
+
+        const unsigned int millis = time.millitm % 1000;
+        line += static_cast<char>('0' + millis / 100);
+        line += static_cast<char>('0' + (millis / 10) % 10);
+        line += static_cast<char>('0' + millis % 10);
+        line += " [";
+        line += severity_to_string(record.getSeverity());
+        line += "][sa] ";
+        line.append(message, message_length);
+        line += '\n';
+    }
+
+    /**
+     * Writes the queued log lines in batches until shutdown. Lines queued before the shutdown are all written.
+     * The sub-queues of the logging threads are drained one after the other, so the lines are held back for the reorder
+     * window and written in the order of their timestamps.
+     */
+    void writer_loop()
+    {
+        queued_line lines[WRITE_BATCH_SIZE];
+        std::vector<queued_line> pending;
+        std::string batch;
+        while (true)
+        {
+            bool is_stopping;
+            {
+                std::scoped_lock lock(logs.writer_mutex);
+                is_stopping = logs.is_shutting_down;
+            }
+
+            const size_t count = logs.queue.try_dequeue_bulk(lines, WRITE_BATCH_SIZE);
+            std::move(lines, lines + count, std::back_inserter(pending));
+            if (count == WRITE_BATCH_SIZE)
+                continue;
+
+            const uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                        std::chrono::system_clock::now().time_since_epoch())
+                                        .count();
+            write_pending(pending, batch, is_stopping ? UINT64_MAX : now_ms - REORDER_WINDOW_MS);
+            if (is_stopping)
+                break;
+
+            std::unique_lock lock(logs.writer_mutex);
+            if (!logs.is_shutting_down)
+                logs.writer_cv.wait_for(lock, std::chrono::milliseconds(WRITER_IDLE_WAIT_MS));
+        }
+        logs.is_writer_done = true;
+    }
+
+    /**
+     * Writes the pending lines up to the given time in the order of their timestamps. Lines of a thread keep their order.
+     * @param pending Lines taken off the queue. The written lines are removed.
+     * @param batch Buffer to concatenate the lines into.
+     * @param written_until_ms Epoch milliseconds of the last lines to write.
+     */
+    void write_pending(std::vector<queued_line> &pending, std::string &batch, const uint64_t written_until_ms)
+    {
+        std::stable_sort(pending.begin(), pending.end(), [](const queued_line &a, const queued_line &b)
+                         { return a.time_ms < b.time_ms; });
+        const auto end = std::partition_point(pending.begin(), pending.end(), [&](const queued_line &line)
+                                              { return line.time_ms <= written_until_ms; });
+        if (end == pending.begin())
+            return;
+
+        batch.clear();
+        for (auto itr = pending.begin(); itr != end; itr++)
+            batch += itr->text;
+        write_batch(batch);
+        pending.erase(pending.begin(), end);
+    }
+
+    /**
+     * Writes a batch of formatted lines to the enabled outputs.
+     * @param batch Formatted lines.
+     */
+    void write_batch(std::string_view batch)
+    {
+        if (logs.is_console)
         {
-            logger.addAppender(&fileAppender);
+            fwrite(batch.data(), 1, batch.size(), stdout);
+            fflush(stdout);
         }
+
+        if (logs.file.fd == -1)
+            return;
+
+        if (logs.file.max_bytes > 0 && logs.file.size > 0 && logs.file.size + batch.size() > logs.file.max_bytes)
+            roll_log_files();
+
+        if (logs.file.fd != -1 && ::write(logs.file.fd, batch.data(), batch.size()) > 0)
+            logs.file.size += batch.size();
+    }
+
+    /**
+     * Writes lines to the enabled outputs from any thread, without rolling the log file.
+     * @param batch Formatted lines.
+     */
+    void write_direct(std::string_view batch)
+    {
+        if (logs.is_console)
+            ::write(STDOUT_FILENO, batch.data(), batch.size());
+        if (logs.file.fd != -1)
+            ::write(logs.file.fd, batch.data(), batch.size());
+    }
+
+    /**
+     * Opens the log file for appending.
+     * @return 0 on success and -1 on error.
+     */
+    int open_log_file()
+    {
+        logs.file.fd = open(logs.file.path.data(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, LOG_FILE_PERMS);
+        if (logs.file.fd == -1)
+            return -1;
+
+        struct stat st;
+        logs.file.size = fstat(logs.file.fd, &st) == 0 ? st.st_size : 0;
+        return 0;
+    }
+
+    /**
+     * Renames sa.log to sa.1.log, sa.1.log to sa.2.log and so on, dropping the oldest file, and opens a new sa.log.
+     * With a single file, sa.log is started over.
+     */
+    void roll_log_files()
+    {
+        close(logs.file.fd);
+        logs.file.fd = -1;
+
+        const auto file_name = [](const size_t number)
+        {
+            if (number == 0)
+                return logs.file.path;
+            const size_t ext_pos = logs.file.path.rfind('.');
+            return logs.file.path.substr(0, ext_pos) + "." + std::to_string(number) + logs.file.path.substr(ext_pos);
+        };
+
+        // The rename onto the last kept number drops the oldest file.
+        if (logs.file.max_files <= 1)
+            unlink(logs.file.path.data());
+        for (size_t number = logs.file.max_files > 1 ? logs.file.max_files - 1 : 0; number > 0; number--)
+            rename(file_name(number - 1).data(), file_name(number).data());
+
+        open_log_file();
     }
 } // namespace salog
@@ -1,9 +1,17 @@
 #ifndef _SA_SALOG_
 #define _SA_SALOG_
 
+#include "conf.hpp"
+
 namespace salog
 {
     void init();
+
+    void set_level(const conf::LOG_SEVERITY level_type);
+
+    void flush();
+
+    void deinit();
 } // namespace salog
 
-#endif
\ No newline at end of file
+#endif
@@ -12,41 +12,57 @@ namespace sqlite
     constexpr const char *CREATE_UNIQUE_INDEX = "CREATE UNIQUE INDEX ";
     constexpr const char *JOURNAL_MODE_OFF = "PRAGMA journal_mode=OFF";
     constexpr const char *BEGIN_TRANSACTION = "BEGIN TRANSACTION;";
+    constexpr const char *BEGIN_IMMEDIATE_TRANSACTION = "BEGIN IMMEDIATE;";
     constexpr const char *COMMIT_TRANSACTION = "COMMIT;";
     constexpr const char *ROLLBACK_TRANSACTION = "ROLLBACK;";
-    constexpr const char *INSERT_INTO = "INSERT INTO ";
     constexpr const char *PRIMARY_KEY = "PRIMARY KEY";
     constexpr const char *NOT_NULL = "NOT NULL";
-    constexpr const char *VALUES = "VALUES";
 
     constexpr const char *INSTANCE_TABLE = "instances";
 
     constexpr const char *INSERT_INTO_HP_INSTANCE = "INSERT INTO instances("
                                                     "owner_pubkey, time, username, status, name, ip,"
-                                                    "peer_port, user_port, init_gp_tcp_port, init_gp_udp_port, pubkey, contract_id, image_name"
-                                                    ") VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?)";
+                                                    "peer_port, user_port, init_gp_tcp_port, init_gp_udp_port, pubkey, contract_id, image_name,"
+                                                    "create_stage, outbound_ipv6, outbound_net_interface, hpfs_log_level, full_history"
+                                                    ") VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)";
 
-    constexpr const char *GET_VACANT_PORTS_FROM_HP = "SELECT DISTINCT peer_port, user_port, init_gp_tcp_port, init_gp_udp_port FROM "
-                                                     "instances WHERE status == ? AND user_port NOT IN"
-                                                     "(SELECT user_port FROM instances WHERE status != ?)";
+    constexpr const char *UPDATE_INSTANCE_STAGE = "UPDATE instances SET status = ?, pubkey = ?, image_name = ?, create_stage = ? WHERE name = ?";
 
-    constexpr const char *GET_MAX_PORTS_FROM_HP = "SELECT peer_port, user_port, init_gp_tcp_port, init_gp_udp_port FROM instances WHERE status != ? ORDER BY peer_port DESC LIMIT 1";
+    constexpr const char *UPDATE_HPFS_SETTINGS = "UPDATE instances SET hpfs_log_level = ?, full_history = ? WHERE name = ?";
+
+    // Instances created before the creation stages were introduced have a null stage, those are considered completed.
+    constexpr const char *GET_PENDING_INSTANCES = "SELECT name, owner_pubkey, username, status, ip, peer_port, user_port, init_gp_tcp_port, init_gp_udp_port,"
+                                                  "pubkey, contract_id, image_name, create_stage, outbound_ipv6, outbound_net_interface, hpfs_log_level, full_history FROM instances "
+                                                  "WHERE create_stage IS NOT NULL AND create_stage != ?";
 
     constexpr const char *UPDATE_STATUS_IN_HP = "UPDATE instances SET status = ? WHERE name = ?";
 
-    constexpr const char *IS_CONTAINER_EXISTS = "SELECT username, status, peer_port, user_port, init_gp_tcp_port, init_gp_udp_port FROM instances WHERE name = ?";
+    constexpr const char *GET_INSTANCE_LIST = "SELECT name, username, user_port, peer_port, init_gp_tcp_port, init_gp_udp_port, status, image_name, contract_id, owner_pubkey,"
+                                              "ip, pubkey, create_stage, outbound_ipv6, outbound_net_interface, hpfs_log_level, full_history FROM instances WHERE status != ?";
 
-    constexpr const char *GET_ALOCATED_INSTANCE_COUNT = "SELECT COUNT(name) FROM instances WHERE status != ?";
+    constexpr const char *IS_TABLE_EXISTS = "SELECT * FROM sqlite_master WHERE type='table' AND name = ?";
 
-    constexpr const char *GET_RUNNING_INSTANCE_NAMES = "SELECT name FROM instances WHERE status = ?";
+    constexpr const char *DELETE_HP_INSTANCE = "DELETE FROM instances WHERE name = ?";
 
-    constexpr const char *GET_INSTANCE_LIST = "SELECT name, username, user_port, peer_port, init_gp_tcp_port, init_gp_udp_port, status, image_name, contract_id FROM instances WHERE status != ?";
+    constexpr const char *WARM_USER_TABLE = "warm_users";
 
-    constexpr const char *GET_INSTANCE = "SELECT name, username, user_port, peer_port, init_gp_tcp_port, init_gp_udp_port, status, image_name FROM instances WHERE name == ? AND status != ?";
+    // A warm user is inserted before its installation starts and marked ready once the installation is finished.
+    constexpr const char *INSERT_INTO_WARM_USER = "INSERT INTO warm_users(username, time, ready, cpu_us, mem_kbytes, swap_kbytes, storage_kbytes) "
+                                                  "VALUES(?,?,0,?,?,?,?)";
 
-    constexpr const char *IS_TABLE_EXISTS = "SELECT * FROM sqlite_master WHERE type='table' AND name = ?";
+    constexpr const char *UPDATE_WARM_USER_READY = "UPDATE warm_users SET ready = 1 WHERE username = ?";
 
-    constexpr const char *DELETE_HP_INSTANCE = "DELETE FROM instances WHERE name = ?";
+    constexpr const char *GET_WARM_USERS = "SELECT username, cpu_us, mem_kbytes, swap_kbytes, storage_kbytes FROM warm_users WHERE ready = ? ORDER BY time";
+
+    constexpr const char *DELETE_WARM_USER = "DELETE FROM warm_users WHERE username = ?";
+
+    // Warm users which got bound to an instance are owned by the instance record.
+    constexpr const char *DELETE_ALLOCATED_WARM_USERS = "DELETE FROM warm_users WHERE username IN (SELECT username FROM instances)";
+
+    // Prepared statements of each connection keyed by the address of their constexpr sql string.
+    // A statement is checked out while in use, so a connection shared by threads never steps the same statement twice.
+    std::unordered_map<sqlite3 *, std::unordered_map<const char *, std::vector<sqlite3_stmt *>>> statement_cache;
+    std::mutex statement_cache_mutex;
 
     // Message boad database queries
     constexpr const char *GET_LEASES_LIST = "SELECT timestamp, tx_hash, tenant_xrp_address, life_moments, container_name, created_on_ledger, status FROM leases WHERE status = 'Acquired' OR status = 'Extended'";
@@ -79,6 +95,105 @@ namespace sqlite
         return 0;
     }
 
+    /**
+     * Applies the configured pragmas to a connection. The journal mode and synchronous settings are only applied to
+     * writable connections since they are set by the writer.
+     * @param db Pointer to the db.
+     * @param config Database configuration.
+     * @param writable Whether the connection is writable.
+     * @returns returns 0 on success, or -1 on error.
+     */
+    int configure_db(sqlite3 *db, const conf::db_config &config, const bool writable)
+    {
+        if (sqlite3_busy_timeout(db, config.busy_timeout_ms) != SQLITE_OK ||
+            exec_sql(db, "PRAGMA mmap_size=" + std::to_string(config.mmap_bytes)) == -1)
+        {
+            LOG_ERROR << "Error configuring database. " << sqlite3_errmsg(db);
+            return -1;
+        }
+
+        if (writable &&
+            (exec_sql(db, "PRAGMA journal_mode=" + config.journal_mode) == -1 ||
+             exec_sql(db, "PRAGMA synchronous=" + config.synchronous) == -1))
+        {
+            LOG_ERROR << "Error configuring database journal.";
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Opens the given number of read only connections to a database.
+     * @param pool Pool to populate.
+     * @param db_name Database name to be connected.
+     * @param count Number of connections.
+     * @param config Database configuration.
+     * @returns returns 0 on success, or -1 on error.
+     */
+    int open_pool(connection_pool &pool, std::string_view db_name, const size_t count, const conf::db_config &config)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            sqlite3 *db = NULL;
+            if (open_db(db_name, &db) == -1 || configure_db(db, config, false) == -1)
+            {
+                close_db(&db);
+                close_pool(pool);
+                return -1;
+            }
+            pool.connections.push_back(db);
+        }
+
+        pool.free_connections = pool.connections;
+        return 0;
+    }
+
+    /**
+     * Takes a connection from the pool, waiting until one is free.
+     * @param pool Connection pool.
+     * @returns returns the connection, or NULL if the pool is empty.
+     */
+    sqlite3 *acquire_connection(connection_pool &pool)
+    {
+        std::unique_lock lock(pool.mutex);
+        if (pool.connections.empty())
+            return NULL;
+
+        pool.cv.wait(lock, [&pool]
+                     { return !pool.free_connections.empty(); });
+        sqlite3 *db = pool.free_connections.back();
+        pool.free_connections.pop_back();
+        return db;
+    }
+
+    /**
+     * Gives a connection back to the pool.
+     * @param pool Connection pool.
+     * @param db Connection taken by acquire_connection.
+     */
+    void release_connection(connection_pool &pool, sqlite3 *db)
+    {
+        {
+            std::scoped_lock lock(pool.mutex);
+            pool.free_connections.push_back(db);
+        }
+        pool.cv.notify_one();
+    }
+
+    /**
+     * Closes all the connections of the pool. Connections must not be in use.
+     * @param pool Connection pool.
+     */
+    void close_pool(connection_pool &pool)
+    {
+        std::scoped_lock lock(pool.mutex);
+        for (sqlite3 *db : pool.connections)
+            close_db(&db);
+        pool.connections.clear();
+        pool.free_connections.clear();
+    }
+
     /**
      * Executes given sql query.
      * @param db Pointer to the db.
@@ -99,6 +214,74 @@ namespace sqlite
         return 0;
     }
 
+    /**
+     * Gets a prepared statement for the given sql from the connection's statement cache, preparing it if there's no free one.
+     * The statement must be given back with release_statement once done.
+     * @param db Pointer to the db.
+     * @param sql Constexpr sql string. The cache is keyed by its address.
+     * @param stmt Prepared statement. NULL on error.
+     * @returns returns 0 on success, or -1 on error.
+     */
+    int prepare_statement(sqlite3 *db, const char *sql, sqlite3_stmt **stmt)
+    {
+        {
+            std::scoped_lock lock(statement_cache_mutex);
+            std::vector<sqlite3_stmt *> &free_stmts = statement_cache[db][sql];
+            if (!free_stmts.empty())
+            {
+                *stmt = free_stmts.back();
+                free_stmts.pop_back();
+                return 0;
+            }
+        }
+
+        if (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, 0) != SQLITE_OK || *stmt == NULL)
+        {
+            LOG_ERROR << "Error preparing sql statement. " << sqlite3_errmsg(db);
+            sqlite3_finalize(*stmt);
+            *stmt = NULL;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Resets the statement and returns it to the connection's statement cache.
+     * @param db Pointer to the db.
+     * @param sql Sql string the statement was prepared with.
+     * @param stmt Statement to release. Ignored if NULL.
+     */
+    void release_statement(sqlite3 *db, const char *sql, sqlite3_stmt *stmt)
+    {
+        if (stmt == NULL)
+            return;
+
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+
+        std::scoped_lock lock(statement_cache_mutex);
+        statement_cache[db][sql].push_back(stmt);
+    }
+
+    /**
+     * Finalizes all the cached statements of the connection.
+     * @param db Pointer to the db.
+     */
+    void clear_statement_cache(sqlite3 *db)
+    {
+        std::scoped_lock lock(statement_cache_mutex);
+        const auto itr = statement_cache.find(db);
+        if (itr == statement_cache.end())
+            return;
+
+        for (auto &[sql, stmts] : itr->second)
+        {
+            for (sqlite3_stmt *stmt : stmts)
+                sqlite3_finalize(stmt);
+        }
+        statement_cache.erase(itr);
+    }
+
     int begin_transaction(sqlite3 *db)
     {
         return sqlite::exec_sql(db, BEGIN_TRANSACTION);
@@ -223,67 +406,6 @@ namespace sqlite
         return ret;
     }
 
-    /**
-     * Inserts mulitple rows to a table.
-     * @param db Pointer to the db.
-     * @param table_name Table name to be populated.
-     * @param column_names_string Comma seperated string of colums (eg: "col_1,col_2,...").
-     * @param value_strings Vector of comma seperated values (wrap in single quotes for TEXT type) (eg: ["r1val1,'r1val2',...", "r2val1,'r2val2',..."]).
-     * @returns returns 0 on success, or -1 on error.
-     */
-    int insert_rows(sqlite3 *db, std::string_view table_name, std::string_view column_names_string, const std::vector<std::string> &value_strings)
-    {
-        std::string sql;
-
-        sql.append(INSERT_INTO);
-        sql.append(table_name);
-        sql.append("(");
-        sql.append(column_names_string);
-        sql.append(") ");
-        sql.append(VALUES);
-
-        for (auto itr = value_strings.begin(); itr != value_strings.end(); ++itr)
-        {
-            sql.append("(");
-            sql.append(*itr);
-            sql.append(")");
-
-            if (itr != value_strings.end() - 1)
-                sql.append(",");
-        }
-
-        /* Execute SQL statement */
-        return exec_sql(db, sql);
-    }
-
-    /**
-     * Inserts a row to a table.
-     * @param db Pointer to the db.
-     * @param table_name Table name to be populated.
-     * @param column_names_string Comma seperated string of colums (eg: "col_1,col_2,...").
-     * @param value_string comma seperated values as per column order (wrap in single quotes for TEXT type) (eg: "r1val1,'r1val2',...").
-     * @returns returns 0 on success, or -1 on error.
-     */
-    int insert_row(sqlite3 *db, std::string_view table_name, std::string_view column_names_string, std::string_view value_string)
-    {
-        std::string sql;
-        // Reserving the space for the query before construction.
-        sql.reserve(sizeof(INSERT_INTO) + table_name.size() + column_names_string.size() + sizeof(VALUES) + value_string.size() + 5);
-
-        sql.append(INSERT_INTO);
-        sql.append(table_name);
-        sql.append("(");
-        sql.append(column_names_string);
-        sql.append(") ");
-        sql.append(VALUES);
-        sql.append("(");
-        sql.append(value_string);
-        sql.append(")");
-
-        /* Execute SQL statement */
-        return exec_sql(db, sql);
-    }
-
     /**
      * Checks whether table exist in the database.
      * @param db Pointer to the db.
@@ -294,17 +416,17 @@ namespace sqlite
     {
         sqlite3_stmt *stmt;
 
-        if (sqlite3_prepare_v2(db, IS_TABLE_EXISTS, -1, &stmt, 0) == SQLITE_OK &&
+        if (prepare_statement(db, IS_TABLE_EXISTS, &stmt) == 0 &&
             stmt != NULL && sqlite3_bind_text(stmt, 1, table_name.data(), table_name.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_ROW)
         {
-            // Finalize and distroys the statement.
-            sqlite3_finalize(stmt);
+            // Reset the statement and return it to the cache.
+            release_statement(db, IS_TABLE_EXISTS, stmt);
             return true;
         }
 
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
+        // Reset the statement and return it to the cache.
+        release_statement(db, IS_TABLE_EXISTS, stmt);
         return false;
     }
 
@@ -340,6 +462,9 @@ namespace sqlite
         if (*db == NULL)
             return 0;
 
+        // Connection cannot be closed while it has unfinalized statements.
+        clear_statement_cache(*db);
+
         if (sqlite3_close(*db) != SQLITE_OK)
         {
             LOG_ERROR << "Can't close database: " << sqlite3_errmsg(*db);
@@ -372,20 +497,75 @@ namespace sqlite
                 table_column_info("init_gp_udp_port", COLUMN_DATA_TYPE::INT),
                 table_column_info("pubkey", COLUMN_DATA_TYPE::TEXT),
                 table_column_info("contract_id", COLUMN_DATA_TYPE::TEXT),
-                table_column_info("image_name", COLUMN_DATA_TYPE::TEXT)};
+                table_column_info("image_name", COLUMN_DATA_TYPE::TEXT),
+                table_column_info("create_stage", COLUMN_DATA_TYPE::TEXT),
+                table_column_info("outbound_ipv6", COLUMN_DATA_TYPE::TEXT),
+                table_column_info("outbound_net_interface", COLUMN_DATA_TYPE::TEXT),
+                table_column_info("hpfs_log_level", COLUMN_DATA_TYPE::TEXT),
+                table_column_info("full_history", COLUMN_DATA_TYPE::INT)};
 
             if (create_table(db, INSTANCE_TABLE, columns) == -1 ||
                 create_index(db, INSTANCE_TABLE, "name", true) == -1 ||
                 create_index(db, INSTANCE_TABLE, "owner_pubkey", false) == -1) // one user can have multiple instances running.
                 return -1;
         }
-        else if (!is_column_exists(db, INSTANCE_TABLE, "init_gp_tcp_port")) // TODO: Added because v0.8.4 does not have gp ports.
+        else
+        {
+            if (!is_column_exists(db, INSTANCE_TABLE, "init_gp_tcp_port")) // TODO: Added because v0.8.4 does not have gp ports.
+            {
+                const std::vector<table_column_info> columns{
+                    table_column_info("init_gp_tcp_port", COLUMN_DATA_TYPE::INT),
+                    table_column_info("init_gp_udp_port", COLUMN_DATA_TYPE::INT)};
+
+                if (alter_table(db, INSTANCE_TABLE, columns) == -1)
+                    return -1;
+            }
+
+            if (!is_column_exists(db, INSTANCE_TABLE, "create_stage")) // Added with the staged instance creation.
+            {
+                const std::vector<table_column_info> columns{
+                    table_column_info("create_stage", COLUMN_DATA_TYPE::TEXT),
+                    table_column_info("outbound_ipv6", COLUMN_DATA_TYPE::TEXT),
+                    table_column_info("outbound_net_interface", COLUMN_DATA_TYPE::TEXT)};
+
+                if (alter_table(db, INSTANCE_TABLE, columns) == -1)
+                    return -1;
+            }
+
+            if (!is_column_exists(db, INSTANCE_TABLE, "hpfs_log_level")) // Added with the cached hpfs settings. Null until read from the instance config.
+            {
+                const std::vector<table_column_info> columns{
+                    table_column_info("hpfs_log_level", COLUMN_DATA_TYPE::TEXT),
+                    table_column_info("full_history", COLUMN_DATA_TYPE::INT)};
+
+                if (alter_table(db, INSTANCE_TABLE, columns) == -1)
+                    return -1;
+            }
+        }
+
+        if (!is_table_exists(db, WARM_USER_TABLE))
+        {
+            const std::vector<table_column_info> columns{
+                table_column_info("username", COLUMN_DATA_TYPE::TEXT, true),
+                table_column_info("time", COLUMN_DATA_TYPE::INT),
+                table_column_info("ready", COLUMN_DATA_TYPE::INT),
+                table_column_info("cpu_us", COLUMN_DATA_TYPE::INT),
+                table_column_info("mem_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("swap_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("storage_kbytes", COLUMN_DATA_TYPE::INT)};
+
+            if (create_table(db, WARM_USER_TABLE, columns) == -1)
+                return -1;
+        }
+        else if (!is_column_exists(db, WARM_USER_TABLE, "cpu_us")) // Added with the warm user limits. Null limits never match, so those users are replaced.
         {
             const std::vector<table_column_info> columns{
-                table_column_info("init_gp_tcp_port", COLUMN_DATA_TYPE::INT),
-                table_column_info("init_gp_udp_port", COLUMN_DATA_TYPE::INT)};
+                table_column_info("cpu_us", COLUMN_DATA_TYPE::INT),
+                table_column_info("mem_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("swap_kbytes", COLUMN_DATA_TYPE::INT),
+                table_column_info("storage_kbytes", COLUMN_DATA_TYPE::INT)};
 
-            if (alter_table(db, INSTANCE_TABLE, columns) == -1)
+            if (alter_table(db, WARM_USER_TABLE, columns) == -1)
                 return -1;
         }
         return 0;
@@ -400,7 +580,7 @@ namespace sqlite
     int insert_hp_instance_row(sqlite3 *db, const hp::instance_info &info)
     {
         sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(db, INSERT_INTO_HP_INSTANCE, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        if (prepare_statement(db, INSERT_INTO_HP_INSTANCE, &stmt) == 0 &&
             sqlite3_bind_text(stmt, 1, info.owner_pubkey.data(), info.owner_pubkey.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_bind_int64(stmt, 2, util::get_epoch_milliseconds()) == SQLITE_OK &&
             sqlite3_bind_text(stmt, 3, info.username.data(), info.username.length(), SQLITE_STATIC) == SQLITE_OK &&
@@ -414,161 +594,176 @@ namespace sqlite
             sqlite3_bind_text(stmt, 11, info.pubkey.data(), info.pubkey.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_bind_text(stmt, 12, info.contract_id.data(), info.contract_id.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_bind_text(stmt, 13, info.image_name.data(), info.image_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 14, info.create_stage.data(), info.create_stage.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 15, info.outbound_ipv6.data(), info.outbound_ipv6.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 16, info.outbound_net_interface.data(), info.outbound_net_interface.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 17, info.hpfs_log_level.data(), info.hpfs_log_level.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_int(stmt, 18, info.is_full_history ? 1 : 0) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_DONE)
         {
-            sqlite3_finalize(stmt);
+            release_statement(db, INSERT_INTO_HP_INSTANCE, stmt);
             return 0;
         }
 
         LOG_ERROR << errno << ": Error inserting hp instance record. " << sqlite3_errmsg(db);
+        release_statement(db, INSERT_INTO_HP_INSTANCE, stmt);
         return -1;
     }
 
     /**
-     * Checks whether the container exist in the database and populate the instance information.
+     * Persists the creation stage of an instance along with the fields populated during the creation.
      * @param db Pointer to the db.
-     * @param container_name Name of the container to be checked.
      * @param info HP instance information.
-     * @returns 0 if not found, 1 if container exists .
+     * @returns returns 0 on success, or -1 on error.
      */
-    int is_container_exists(sqlite3 *db, std::string_view container_name, hp::instance_info &info)
+    int update_instance_stage(sqlite3 *db, const hp::instance_info &info)
     {
         sqlite3_stmt *stmt;
-
-        if (sqlite3_prepare_v2(db, IS_CONTAINER_EXISTS, -1, &stmt, 0) == SQLITE_OK &&
-            stmt != NULL && sqlite3_bind_text(stmt, 1, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
-            sqlite3_step(stmt) == SQLITE_ROW)
+        if (prepare_statement(db, UPDATE_INSTANCE_STAGE, &stmt) == 0 &&
+            sqlite3_bind_text(stmt, 1, info.status.data(), info.status.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 2, info.pubkey.data(), info.pubkey.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 3, info.image_name.data(), info.image_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 4, info.create_stage.data(), info.create_stage.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 5, info.container_name.data(), info.container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_DONE)
         {
-            // Populate only the necessary fields.
-            info.username = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
-            info.status = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
-            info.assigned_ports.peer_port = sqlite3_column_int64(stmt, 2);
-            info.assigned_ports.user_port = sqlite3_column_int64(stmt, 3);
-            info.assigned_ports.gp_tcp_port_start = sqlite3_column_int64(stmt, 4);
-            info.assigned_ports.gp_udp_port_start = sqlite3_column_int64(stmt, 5);
-
-            // Finalize and distroys the statement.
-            sqlite3_finalize(stmt);
-            return 1;
+            release_statement(db, UPDATE_INSTANCE_STAGE, stmt);
+            return 0;
         }
 
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
-        return 0; // Not found
+        LOG_ERROR << "Error updating creation stage of " << info.container_name << ". " << sqlite3_errmsg(db);
+        release_statement(db, UPDATE_INSTANCE_STAGE, stmt);
+        return -1;
     }
 
     /**
-     * Update the status of the given container to the new value.
-     * @param db Database connection.
-     * @param container_name Name of the container whose status should be updated.
-     * @param status The new status of the container.
-     * @return 0 on success and -1 on error.
+     * Persists the hpfs settings of the instance hp config.
+     * @param db Pointer to the db.
+     * @param container_name Name of the instance.
+     * @param hpfs_log_level Hpfs log level.
+     * @param is_full_history Contract history mode.
+     * @returns returns 0 on success, or -1 on error.
      */
-    int update_status_in_container(sqlite3 *db, std::string_view container_name, std::string_view status)
+    int update_hpfs_settings(sqlite3 *db, std::string_view container_name, std::string_view hpfs_log_level, const bool is_full_history)
     {
         sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(db, UPDATE_STATUS_IN_HP, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
-            sqlite3_bind_text(stmt, 1, status.data(), status.length(), SQLITE_STATIC) == SQLITE_OK &&
-            sqlite3_bind_text(stmt, 2, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+        if (prepare_statement(db, UPDATE_HPFS_SETTINGS, &stmt) == 0 &&
+            sqlite3_bind_text(stmt, 1, hpfs_log_level.data(), hpfs_log_level.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_int(stmt, 2, is_full_history ? 1 : 0) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 3, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_DONE)
         {
-            sqlite3_finalize(stmt);
+            release_statement(db, UPDATE_HPFS_SETTINGS, stmt);
             return 0;
         }
-        LOG_ERROR << "Error updating container status for " << container_name;
+
+        LOG_ERROR << "Error updating hpfs settings of " << container_name << ". " << sqlite3_errmsg(db);
+        release_statement(db, UPDATE_HPFS_SETTINGS, stmt);
         return -1;
     }
 
     /**
-     * Get the max peer and user ports assigned for instances excluding destroyed instances.
+     * Populate the given vector with the instances whose creation is not completed.
      * @param db Database connection.
-     * @param max_ports Container holding max peer and user ports.
+     * @param instances Vector to hold instance details.
      */
-    void get_max_ports(sqlite3 *db, hp::ports &max_ports)
+    void get_pending_instances(sqlite3 *db, std::vector<hp::instance_info> &instances)
     {
         sqlite3_stmt *stmt;
+        std::string_view completed_stage(hp::CREATE_STAGES[hp::CREATE_STAGE::COMPLETED]);
 
-        if (sqlite3_prepare_v2(db, GET_MAX_PORTS_FROM_HP, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
-            sqlite3_bind_text(stmt, 1, hp::CONTAINER_STATES[hp::STATES::DESTROYED], sizeof(hp::CONTAINER_STATES[hp::STATES::DESTROYED]), SQLITE_STATIC) == SQLITE_OK &&
-            sqlite3_step(stmt) == SQLITE_ROW)
+        if (prepare_statement(db, GET_PENDING_INSTANCES, &stmt) == 0 &&
+            sqlite3_bind_text(stmt, 1, completed_stage.data(), completed_stage.length(), SQLITE_STATIC) == SQLITE_OK)
         {
-            const uint16_t peer_port = sqlite3_column_int64(stmt, 0);
-            const uint16_t user_port = sqlite3_column_int64(stmt, 1);
-            const uint16_t gp_tcp_port_start = sqlite3_column_int64(stmt, 2);
-            const uint16_t gp_udp_port_start = sqlite3_column_int64(stmt, 3);
-
-            max_ports = {peer_port, user_port, gp_tcp_port_start, gp_udp_port_start};
-        }
-        // Initialize with default config values if either of the ports are zero.
-        if (max_ports.peer_port == 0 || max_ports.user_port == 0)
-        {
-            max_ports = {(uint16_t)(conf::cfg.hp.init_peer_port - 1), (uint16_t)(conf::cfg.hp.init_user_port - 1), (uint16_t)(conf::cfg.hp.init_gp_tcp_port - 2), (uint16_t)(conf::cfg.hp.init_gp_udp_port - 2)};
-        }
-        else if (max_ports.gp_tcp_port_start == 0 || max_ports.gp_udp_port_start == 0)
-        {
-            const uint16_t increment = ((max_ports.peer_port - conf::cfg.hp.init_peer_port) * 2);
-            const uint16_t gp_tcp_port_start = conf::cfg.hp.init_gp_tcp_port + increment;
-            const uint16_t gp_udp_port_start = conf::cfg.hp.init_gp_udp_port + increment;
-            max_ports = {max_ports.user_port, max_ports.peer_port, gp_tcp_port_start, gp_udp_port_start};
+            while (stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                hp::instance_info info;
+                info.container_name = column_text(stmt, 0);
+                info.owner_pubkey = column_text(stmt, 1);
+                info.username = column_text(stmt, 2);
+                info.status = column_text(stmt, 3);
+                info.ip = column_text(stmt, 4);
+                info.assigned_ports.peer_port = sqlite3_column_int64(stmt, 5);
+                info.assigned_ports.user_port = sqlite3_column_int64(stmt, 6);
+                info.assigned_ports.gp_tcp_port_start = sqlite3_column_int64(stmt, 7);
+                info.assigned_ports.gp_udp_port_start = sqlite3_column_int64(stmt, 8);
+                info.pubkey = column_text(stmt, 9);
+                info.contract_id = column_text(stmt, 10);
+                info.image_name = column_text(stmt, 11);
+                info.create_stage = column_text(stmt, 12);
+                info.outbound_ipv6 = column_text(stmt, 13);
+                info.outbound_net_interface = column_text(stmt, 14);
+                info.hpfs_log_level = column_text(stmt, 15);
+                info.is_full_history = sqlite3_column_int(stmt, 16) == 1;
+                instances.push_back(info);
+            }
         }
 
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
+        // Reset the statement and return it to the cache.
+        release_statement(db, GET_PENDING_INSTANCES, stmt);
     }
 
     /**
-     * Populate the given vector with vacant ports of destroyed instances which are not already assigned.
-     * @param db Database connection.
-     * @param vacant_ports Ports vector to hold port pairs from database.
+     * Reads a text column treating null values as empty strings.
+     * @param stmt Statement positioned at a row.
+     * @param column Column index.
+     * @return Column value.
      */
-    void get_vacant_ports(sqlite3 *db, std::vector<hp::ports> &vacant_ports)
+    const std::string column_text(sqlite3_stmt *stmt, const int column)
     {
+        const unsigned char *text = sqlite3_column_text(stmt, column);
+        return text == NULL ? std::string() : std::string(reinterpret_cast<const char *>(text));
+    }
 
+    /**
+     * Update the status of the given container to the new value.
+     * @param db Database connection.
+     * @param container_name Name of the container whose status should be updated.
+     * @param status The new status of the container.
+     * @return 0 on success and -1 on error.
+     */
+    int update_status_in_container(sqlite3 *db, std::string_view container_name, std::string_view status)
+    {
         sqlite3_stmt *stmt;
-        std::string_view destroy_status(hp::CONTAINER_STATES[hp::STATES::DESTROYED]);
-
-        if (sqlite3_prepare_v2(db, GET_VACANT_PORTS_FROM_HP, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
-            sqlite3_bind_text(stmt, 1, destroy_status.data(), destroy_status.length(), SQLITE_STATIC) == SQLITE_OK &&
-            sqlite3_bind_text(stmt, 2, destroy_status.data(), destroy_status.length(), SQLITE_STATIC) == SQLITE_OK)
+        if (prepare_statement(db, UPDATE_STATUS_IN_HP, &stmt) == 0 &&
+            sqlite3_bind_text(stmt, 1, status.data(), status.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_text(stmt, 2, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_DONE)
         {
-            while (stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW)
-            {
-                const uint16_t peer_port = sqlite3_column_int64(stmt, 0);
-                const uint16_t user_port = sqlite3_column_int64(stmt, 1);
-                const uint16_t gp_tcp_port = sqlite3_column_int64(stmt, 2);
-                const uint16_t gp_udp_port = sqlite3_column_int64(stmt, 3);
-                vacant_ports.push_back({peer_port, user_port, gp_tcp_port, gp_udp_port});
-            }
+            release_statement(db, UPDATE_STATUS_IN_HP, stmt);
+            return 0;
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
+        LOG_ERROR << "Error updating container status for " << container_name;
+        release_statement(db, UPDATE_STATUS_IN_HP, stmt);
+        return -1;
     }
 
     /**
-     * Populate the given vector with names of running hp instances.
+     * Updates the statuses of many containers in a single transaction.
      * @param db Database connection.
-     * @param running_instance_names Vector to hold name of instances from database.
+     * @param statuses Container names and their new statuses, applied in order.
+     * @return 0 on success and -1 on error.
      */
-    void get_running_instance_names(sqlite3 *db, std::vector<std::string> &running_instance_names)
+    int update_statuses_in_containers(sqlite3 *db, const std::vector<std::pair<std::string, std::string>> &statuses)
     {
-        running_instance_names.clear();
-
-        sqlite3_stmt *stmt;
-        std::string_view running_status(hp::CONTAINER_STATES[hp::STATES::RUNNING]);
+        if (exec_sql(db, BEGIN_IMMEDIATE_TRANSACTION) == -1)
+            return -1;
 
-        if (sqlite3_prepare_v2(db, GET_RUNNING_INSTANCE_NAMES, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
-            sqlite3_bind_text(stmt, 1, running_status.data(), running_status.length(), SQLITE_STATIC) == SQLITE_OK)
+        for (const auto &[container_name, status] : statuses)
         {
-            while (stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW)
+            if (update_status_in_container(db, container_name, status) == -1)
             {
-                const std::string name(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
-                running_instance_names.push_back(name);
+                rollback_transaction(db);
+                return -1;
             }
         }
 
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
+        if (commit_transaction(db) == -1)
+        {
+            rollback_transaction(db);
+            return -1;
+        }
+        return 0;
     }
 
     /**
@@ -581,7 +776,7 @@ namespace sqlite
         sqlite3_stmt *stmt;
         std::string_view destroy_status(hp::CONTAINER_STATES[hp::STATES::DESTROYED]);
 
-        if (sqlite3_prepare_v2(db, GET_INSTANCE_LIST, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        if (prepare_statement(db, GET_INSTANCE_LIST, &stmt) == 0 &&
             sqlite3_bind_text(stmt, 1, destroy_status.data(), destroy_status.length(), SQLITE_STATIC) == SQLITE_OK)
         {
             while (stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW)
@@ -596,12 +791,20 @@ namespace sqlite
                 info.status = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 6));
                 info.image_name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 7));
                 info.contract_id = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 8));
+                info.owner_pubkey = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 9));
+                info.ip = column_text(stmt, 10);
+                info.pubkey = column_text(stmt, 11);
+                info.create_stage = column_text(stmt, 12);
+                info.outbound_ipv6 = column_text(stmt, 13);
+                info.outbound_net_interface = column_text(stmt, 14);
+                info.hpfs_log_level = column_text(stmt, 15);
+                info.is_full_history = sqlite3_column_int(stmt, 16) == 1;
                 instances.push_back(info);
             }
         }
 
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
+        // Reset the statement and return it to the cache.
+        release_statement(db, GET_INSTANCE_LIST, stmt);
     }
 
     /**
@@ -612,7 +815,7 @@ namespace sqlite
     void get_lease_list(sqlite3 *db, std::vector<hp::lease_info> &leases)
     {
         sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(db, GET_LEASES_LIST, -1, &stmt, 0) == SQLITE_OK && stmt != NULL)
+        if (prepare_statement(db, GET_LEASES_LIST, &stmt) == 0)
         {
             while (sqlite3_step(stmt) == SQLITE_ROW)
             {
@@ -626,88 +829,134 @@ namespace sqlite
             }
         }
 
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
+        // Reset the statement and return it to the cache.
+        release_statement(db, GET_LEASES_LIST, stmt);
     }
 
     /**
-     * Populate the given instace ref with the container info of given name only if not destroyed.
+     * Delete an instance record based on the provided container name.
      * @param db Database connection.
-     * @param container_name Container name.
-     * @param instance Instance details.
-     * @return 0 on if exist otherwise -1.
+     * @param container_name Name of the container which should be deleted.
+     * @return 0 on success and -1 on error.
      */
-    int get_instance(sqlite3 *db, std::string_view container_name, hp::instance_info &instance)
+    int delete_hp_instance(sqlite3 *db, std::string_view container_name)
     {
         sqlite3_stmt *stmt;
-        std::string_view destroy_status(hp::CONTAINER_STATES[hp::STATES::DESTROYED]);
-
-        if (sqlite3_prepare_v2(db, GET_INSTANCE, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
+        if (prepare_statement(db, DELETE_HP_INSTANCE, &stmt) == 0 &&
             sqlite3_bind_text(stmt, 1, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
-            sqlite3_bind_text(stmt, 2, destroy_status.data(), destroy_status.length(), SQLITE_STATIC) == SQLITE_OK &&
-            (stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW))
-        {
-            instance.container_name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-            instance.username = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
-            instance.assigned_ports.user_port = sqlite3_column_int64(stmt, 2);
-            instance.assigned_ports.peer_port = sqlite3_column_int64(stmt, 3);
-            instance.assigned_ports.gp_tcp_port_start = sqlite3_column_int64(stmt, 4);
-            instance.assigned_ports.gp_udp_port_start = sqlite3_column_int64(stmt, 5);
-            instance.status = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 6));
-            instance.image_name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 7));
-
-            // Finalize and distroys the statement.
-            sqlite3_finalize(stmt);
+            sqlite3_step(stmt) == SQLITE_DONE)
+        {
+            release_statement(db, DELETE_HP_INSTANCE, stmt);
             return 0;
         }
-
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
+        LOG_ERROR << "Error deleting container " << container_name;
+        release_statement(db, DELETE_HP_INSTANCE, stmt);
         return -1;
     }
 
     /**
-     * Get count of running instances
+     * Inserts a warm pool user record which is not ready yet.
      * @param db Database connection.
-     * @return Count on success -1 on error.
+     * @param user The user being provisioned and the limits it is installed with.
+     * @return 0 on success and -1 on error.
      */
-    int get_allocated_instance_count(sqlite3 *db)
+    int insert_warm_user(sqlite3 *db, const hp::warm_user &user)
     {
         sqlite3_stmt *stmt;
-        std::string_view destroyed_status(hp::CONTAINER_STATES[hp::STATES::DESTROYED]);
+        if (prepare_statement(db, INSERT_INTO_WARM_USER, &stmt) == 0 &&
+            sqlite3_bind_text(stmt, 1, user.username.data(), user.username.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 2, util::get_epoch_milliseconds()) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 3, user.limits.cpu_us) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 4, user.limits.mem_kbytes) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 5, user.limits.swap_kbytes) == SQLITE_OK &&
+            sqlite3_bind_int64(stmt, 6, user.limits.storage_kbytes) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_DONE)
+        {
+            release_statement(db, INSERT_INTO_WARM_USER, stmt);
+            return 0;
+        }
 
-        if (sqlite3_prepare_v2(db, GET_ALOCATED_INSTANCE_COUNT, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
-            sqlite3_bind_text(stmt, 1, destroyed_status.data(), destroyed_status.length(), SQLITE_STATIC) == SQLITE_OK &&
-            sqlite3_step(stmt) == SQLITE_ROW)
+        LOG_ERROR << "Error inserting warm user " << user.username << ". " << sqlite3_errmsg(db);
+        release_statement(db, INSERT_INTO_WARM_USER, stmt);
+        return -1;
+    }
+
+    /**
+     * Marks a warm pool user as ready to be bound to an instance.
+     * @param db Database connection.
+     * @param username Name of the provisioned user.
+     * @return 0 on success and -1 on error.
+     */
+    int update_warm_user_ready(sqlite3 *db, std::string_view username)
+    {
+        sqlite3_stmt *stmt;
+        if (prepare_statement(db, UPDATE_WARM_USER_READY, &stmt) == 0 &&
+            sqlite3_bind_text(stmt, 1, username.data(), username.length(), SQLITE_STATIC) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_DONE)
         {
-            const uint64_t count = sqlite3_column_int64(stmt, 0);
-            // Finalize and distroys the statement.
-            sqlite3_finalize(stmt);
-            return count;
+            release_statement(db, UPDATE_WARM_USER_READY, stmt);
+            return 0;
         }
 
-        // Finalize and distroys the statement.
-        sqlite3_finalize(stmt);
+        LOG_ERROR << "Error updating warm user " << username << ". " << sqlite3_errmsg(db);
+        release_statement(db, UPDATE_WARM_USER_READY, stmt);
         return -1;
     }
 
     /**
-     * Delete an instance record based on the provided container name.
+     * Populate the given vector with the warm pool users in the order they were provisioned.
      * @param db Database connection.
-     * @param container_name Name of the container which should be deleted.
+     * @param users Vector to hold the users.
+     * @param ready Whether to get the ready users or the users whose provisioning did not finish.
+     */
+    void get_warm_users(sqlite3 *db, std::vector<hp::warm_user> &users, const bool ready)
+    {
+        sqlite3_stmt *stmt;
+        if (prepare_statement(db, GET_WARM_USERS, &stmt) == 0 &&
+            sqlite3_bind_int(stmt, 1, ready ? 1 : 0) == SQLITE_OK)
+        {
+            while (stmt != NULL && sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                hp::warm_user &user = users.emplace_back();
+                user.username = column_text(stmt, 0);
+                user.limits = {(size_t)sqlite3_column_int64(stmt, 1), (size_t)sqlite3_column_int64(stmt, 2),
+                               (size_t)sqlite3_column_int64(stmt, 3), (size_t)sqlite3_column_int64(stmt, 4)};
+            }
+        }
+
+        // Reset the statement and return it to the cache.
+        release_statement(db, GET_WARM_USERS, stmt);
+    }
+
+    /**
+     * Deletes a warm pool user record.
+     * @param db Database connection.
+     * @param username Name of the user.
      * @return 0 on success and -1 on error.
      */
-    int delete_hp_instance(sqlite3 *db, std::string_view container_name)
+    int delete_warm_user(sqlite3 *db, std::string_view username)
     {
         sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(db, DELETE_HP_INSTANCE, -1, &stmt, 0) == SQLITE_OK && stmt != NULL &&
-            sqlite3_bind_text(stmt, 1, container_name.data(), container_name.length(), SQLITE_STATIC) == SQLITE_OK &&
+        if (prepare_statement(db, DELETE_WARM_USER, &stmt) == 0 &&
+            sqlite3_bind_text(stmt, 1, username.data(), username.length(), SQLITE_STATIC) == SQLITE_OK &&
             sqlite3_step(stmt) == SQLITE_DONE)
         {
-            sqlite3_finalize(stmt);
+            release_statement(db, DELETE_WARM_USER, stmt);
             return 0;
         }
-        LOG_ERROR << "Error deleting container " << container_name;
+
+        LOG_ERROR << "Error deleting warm user " << username;
+        release_statement(db, DELETE_WARM_USER, stmt);
         return -1;
     }
+
+    /**
+     * Deletes the warm pool user records of the users which are already bound to an instance.
+     * @param db Database connection.
+     * @return 0 on success and -1 on error.
+     */
+    int delete_allocated_warm_users(sqlite3 *db)
+    {
+        return exec_sql(db, DELETE_ALLOCATED_WARM_USERS);
+    }
 }
@@ -39,10 +39,35 @@ namespace sqlite
         }
     };
 
+    // Read only connections shared by concurrent queries.
+    struct connection_pool
+    {
+        std::vector<sqlite3 *> connections;
+        std::vector<sqlite3 *> free_connections;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
     int open_db(std::string_view db_name, sqlite3 **db, const bool writable = false, const bool journal = true);
 
+    int configure_db(sqlite3 *db, const conf::db_config &config, const bool writable);
+
+    int open_pool(connection_pool &pool, std::string_view db_name, const size_t count, const conf::db_config &config);
+
+    sqlite3 *acquire_connection(connection_pool &pool);
+
+    void release_connection(connection_pool &pool, sqlite3 *db);
+
+    void close_pool(connection_pool &pool);
+
     int exec_sql(sqlite3 *db, std::string_view sql, int (*callback)(void *, int, char **, char **) = NULL, void *callback_first_arg = NULL);
 
+    int prepare_statement(sqlite3 *db, const char *sql, sqlite3_stmt **stmt);
+
+    void release_statement(sqlite3 *db, const char *sql, sqlite3_stmt *stmt);
+
+    void clear_statement_cache(sqlite3 *db);
+
     int begin_transaction(sqlite3 *db);
 
     int commit_transaction(sqlite3 *db);
@@ -55,10 +80,6 @@ namespace sqlite
 
     int create_index(sqlite3 *db, std::string_view table_name, std::string_view column_names, const bool is_unique);
 
-    int insert_rows(sqlite3 *db, std::string_view table_name, std::string_view column_names_string, const std::vector<std::string> &value_strings);
-
-    int insert_row(sqlite3 *db, std::string_view table_name, std::string_view column_names_string, std::string_view value_string);
-
     bool is_table_exists(sqlite3 *db, std::string_view table_name);
 
     bool is_column_exists(sqlite3 *db, std::string_view table_name, std::string_view column_name);
@@ -69,24 +90,32 @@ namespace sqlite
 
     int insert_hp_instance_row(sqlite3 *db, const hp::instance_info &info);
 
-    int is_container_exists(sqlite3 *db, std::string_view container_name, hp::instance_info &info);
+    int update_instance_stage(sqlite3 *db, const hp::instance_info &info);
 
-    int update_status_in_container(sqlite3 *db, std::string_view container_name, std::string_view status);
+    int update_hpfs_settings(sqlite3 *db, std::string_view container_name, std::string_view hpfs_log_level, const bool is_full_history);
 
-    void get_max_ports(sqlite3 *db, hp::ports &max_ports);
+    void get_pending_instances(sqlite3 *db, std::vector<hp::instance_info> &instances);
 
-    void get_vacant_ports(sqlite3 *db, std::vector<hp::ports> &vacant_ports);
+    const std::string column_text(sqlite3_stmt *stmt, const int column);
+
+    int update_status_in_container(sqlite3 *db, std::string_view container_name, std::string_view status);
 
-    void get_running_instance_names(sqlite3 *db, std::vector<std::string> &running_instance_names);
+    int update_statuses_in_containers(sqlite3 *db, const std::vector<std::pair<std::string, std::string>> &statuses);
 
     void get_instance_list(sqlite3 *db, std::vector<hp::instance_info> &instances);
 
     void get_lease_list(sqlite3 *db, std::vector<hp::lease_info> &leases);
 
-    int get_instance(sqlite3 *db, std::string_view container_name, hp::instance_info &instance);
+    int delete_hp_instance(sqlite3 *db, std::string_view container_name);
 
-    int get_allocated_instance_count(sqlite3 *db);
+    int insert_warm_user(sqlite3 *db, const hp::warm_user &user);
 
-    int delete_hp_instance(sqlite3 *db, std::string_view container_name);
+    int update_warm_user_ready(sqlite3 *db, std::string_view username);
+
+    void get_warm_users(sqlite3 *db, std::vector<hp::warm_user> &users, const bool ready);
+
+    int delete_warm_user(sqlite3 *db, std::string_view username);
+
+    int delete_allocated_warm_users(sqlite3 *db);
 }
 #endif
@@ -0,0 +1,513 @@
+#include "systemd_client.hpp"
+#include "../util/util.hpp"
+#include "../metrics.hpp"
+
+namespace systemd
+{
+    constexpr const char *MANAGER_SOCKET_PATH = "/run/user/%d/systemd/private";
+    constexpr const char *MANAGER_PATH = "/org/freedesktop/systemd1";
+    constexpr const char *MANAGER_INTERFACE = "org.freedesktop.systemd1.Manager";
+    constexpr const char *JOB_MODE = "replace";
+    constexpr const char *JOB_DONE = "done";
+    constexpr const char *NO_SUCH_UNIT_ERROR = "org.freedesktop.systemd1.NoSuchUnit";
+
+    constexpr uint8_t MESSAGE_METHOD_CALL = 1;
+    constexpr uint8_t MESSAGE_METHOD_RETURN = 2;
+    constexpr uint8_t MESSAGE_ERROR = 3;
+    constexpr uint8_t MESSAGE_SIGNAL = 4;
+
+    constexpr uint8_t FIELD_PATH = 1;
+    constexpr uint8_t FIELD_INTERFACE = 2;
+    constexpr uint8_t FIELD_MEMBER = 3;
+    constexpr uint8_t FIELD_ERROR_NAME = 4;
+    constexpr uint8_t FIELD_REPLY_SERIAL = 5;
+    constexpr uint8_t FIELD_SIGNATURE = 8;
+
+    constexpr size_t HEADER_SIZE = 16; // Fixed header part including the header fields array length.
+    constexpr size_t MAX_MESSAGE_SIZE = 1024 * 1024;
+    constexpr size_t READ_CHUNK_SIZE = 4096;
+
+    /**
+     * Enables and starts the given units and waits for the start jobs to finish.
+     * @param uid Uid of the user owning the systemd manager.
+     * @param units Unit names.
+     * @return 0 on success and -1 on error.
+     */
+    int start_units(const int uid, const std::vector<std::string> &units)
+    {
+        metrics::scoped_timer timer("systemd.start_units");
+        return run_unit_jobs(uid, units, true);
+    }
+
+    /**
+     * Stops and disables the given units and waits for the stop jobs to finish. Units which don't exist are ignored.
+     * @param uid Uid of the user owning the systemd manager.
+     * @param units Unit names.
+     * @return 0 on success and -1 on error.
+     */
+    int stop_units(const int uid, const std::vector<std::string> &units)
+    {
+        metrics::scoped_timer timer("systemd.stop_units");
+        return run_unit_jobs(uid, units, false);
+    }
+
+    /**
+     * Sends the unit file, reload and job calls for all the units in one write and waits until every call is answered and
+     * every job is reported as removed.
+     * @param uid Uid of the user owning the systemd manager.
+     * @param units Unit names.
+     * @param is_start Whether to enable and start, or to stop and disable the units.
+     * @return 0 on success and -1 on error.
+     */
+    int run_unit_jobs(const int uid, const std::vector<std::string> &units, const bool is_start)
+    {
+        manager_connection conn;
+        if (connect_manager(uid, conn) == -1)
+            return -1;
+
+        // Job removed signals are only sent to subscribed connections.
+        std::string out;
+        std::unordered_map<uint32_t, std::string> pending_calls; // Unit names keyed by the call serial. Empty for the unit file calls.
+        pending_calls.emplace(append_call(conn, out, "Subscribe", "", ""), "");
+
+        std::string files_body;
+        append_string_array(files_body, units);
+        append_uint32(files_body, 0); // runtime
+        if (is_start)
+        {
+            append_uint32(files_body, 1); // force
+            pending_calls.emplace(append_call(conn, out, "EnableUnitFiles", "asbb", files_body), "");
+        }
+        else
+        {
+            pending_calls.emplace(append_call(conn, out, "DisableUnitFiles", "asb", files_body), "");
+        }
+
+        // The manager handles the calls in order, so the jobs run after the reload picks up the changed unit files,
+        // as with systemctl enable and disable.
+        pending_calls.emplace(append_call(conn, out, "Reload", "", ""), "");
+
+        for (const std::string &unit : units)
+        {
+            std::string body;
+            append_string(body, unit);
+            append_string(body, JOB_MODE);
+            pending_calls.emplace(append_call(conn, out, is_start ? "StartUnit" : "StopUnit", "ss", body), unit);
+        }
+
+        size_t sent = 0;
+        while (sent < out.size())
+        {
+            const ssize_t ret = send(conn.fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if (ret == -1 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+            {
+                LOG_ERROR << errno << ": Error sending to the systemd manager of uid " << uid;
+                disconnect_manager(conn);
+                return -1;
+            }
+            sent += ret;
+        }
+
+        // Jobs might be removed before their call is answered, so the results are kept until the job is known.
+        std::unordered_map<std::string, std::string> pending_jobs;  // Unit names keyed by the job path.
+        std::unordered_map<std::string, std::string> finished_jobs; // Job results keyed by the job path.
+        int ret = 0;
+        const uint64_t timeout_at = util::get_epoch_milliseconds() + (JOB_TIMEOUT_SECS * 1000);
+        while (!pending_calls.empty() || !pending_jobs.empty())
+        {
+            bus_message msg;
+            if (read_message(conn, msg, timeout_at) == -1)
+            {
+                LOG_ERROR << "Error waiting for the systemd jobs of uid " << uid;
+                ret = -1;
+                break;
+            }
+
+            if (msg.type == MESSAGE_SIGNAL && msg.member == "JobRemoved" && msg.signature == "uoss")
+            {
+                size_t pos = 0;
+                uint32_t id;
+                std::string job, unit, result;
+                if (read_uint32(msg.body, pos, id) == -1 || read_string(msg.body, pos, job) == -1 ||
+                    read_string(msg.body, pos, unit) == -1 || read_string(msg.body, pos, result) == -1)
+                    continue;
+
+                const auto itr = pending_jobs.find(job);
+                if (itr == pending_jobs.end())
+                {
+                    finished_jobs.emplace(job, result);
+                    continue;
+                }
+                if (result != JOB_DONE)
+                {
+                    LOG_ERROR << "Systemd job of " << unit << " for uid " << uid << " finished with " << result;
+                    ret = -1;
+                }
+                pending_jobs.erase(itr);
+                continue;
+            }
+
+            if (msg.type != MESSAGE_METHOD_RETURN && msg.type != MESSAGE_ERROR)
+                continue;
+
+            const auto itr = pending_calls.find(msg.reply_serial);
+            if (itr == pending_calls.end())
+                continue;
+            const std::string unit = itr->second;
+            pending_calls.erase(itr);
+
+            if (msg.type == MESSAGE_ERROR)
+            {
+                // Stopping a unit which does not exist is not an error.
+                if (!is_start && msg.error_name == NO_SUCH_UNIT_ERROR)
+                    continue;
+
+                size_t pos = 0;
+                std::string message;
+                if (msg.signature.rfind("s", 0) == 0)
+                    read_string(msg.body, pos, message);
+                LOG_ERROR << "Systemd call failed for uid " << uid << ". " << msg.error_name << " " << message;
+                ret = -1;
+                continue;
+            }
+
+            // Job calls return the job path.
+            if (!unit.empty() && msg.signature == "o")
+            {
+                size_t pos = 0;
+                std::string job;
+                if (read_string(msg.body, pos, job) == -1)
+                    continue;
+
+                const auto finished_itr = finished_jobs.find(job);
+                if (finished_itr == finished_jobs.end())
+                {
+                    pending_jobs.emplace(job, unit);
+                }
+                else if (finished_itr->second != JOB_DONE)
+                {
+                    LOG_ERROR << "Systemd job of " << unit << " for uid " << uid << " finished with " << finished_itr->second;
+                    ret = -1;
+                }
+            }
+        }
+
+        disconnect_manager(conn);
+        return ret;
+    }
+
+    /**
+     * Connects to the systemd manager of the user and authenticates with the peer credentials.
+     * @param uid Uid of the user owning the systemd manager.
+     * @param conn Connection to be populated.
+     * @return 0 on success and -1 on error.
+     */
+    int connect_manager(const int uid, manager_connection &conn)
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), MANAGER_SOCKET_PATH, uid);
+
+        conn.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (conn.fd == -1)
+        {
+            LOG_ERROR << errno << ": Error creating systemd manager socket.";
+            return -1;
+        }
+
+        const timeval timeout{JOB_TIMEOUT_SECS, 0};
+        if (setsockopt(conn.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1 ||
+            connect(conn.fd, (const sockaddr *)&addr, sizeof(addr)) == -1)
+        {
+            LOG_ERROR << errno << ": Error connecting to systemd manager " << addr.sun_path;
+            disconnect_manager(conn);
+            return -1;
+        }
+
+        // The external auth mechanism takes the hex encoded uid of this process.
+        const std::string auth = std::string(1, '\0') + "AUTH EXTERNAL " + util::to_hex(std::to_string(geteuid())) + "\r\n";
+        if (send(conn.fd, auth.data(), auth.size(), MSG_NOSIGNAL) != (ssize_t)auth.size())
+        {
+            LOG_ERROR << errno << ": Error authenticating to systemd manager " << addr.sun_path;
+            disconnect_manager(conn);
+            return -1;
+        }
+
+        pollfd pfd{conn.fd, POLLIN, 0};
+        const uint64_t timeout_at = util::get_epoch_milliseconds() + (JOB_TIMEOUT_SECS * 1000);
+        while (conn.buffer.find("\r\n") == std::string::npos)
+        {
+            const uint64_t now = util::get_epoch_milliseconds();
+            const int ready = now >= timeout_at ? 0 : poll(&pfd, 1, timeout_at - now);
+            if (ready == -1 && errno == EINTR)
+                continue;
+
+            char chunk[256];
+            const ssize_t ret = ready > 0 ? recv(conn.fd, chunk, sizeof(chunk), 0) : -1;
+            if (ret <= 0)
+            {
+                LOG_ERROR << errno << ": Error authenticating to systemd manager " << addr.sun_path;
+                disconnect_manager(conn);
+                return -1;
+            }
+            conn.buffer.append(chunk, ret);
+        }
+
+        const std::string begin = "BEGIN\r\n";
+        if (conn.buffer.rfind("OK ", 0) != 0 || send(conn.fd, begin.data(), begin.size(), MSG_NOSIGNAL) != (ssize_t)begin.size())
+        {
+            LOG_ERROR << "Systemd manager " << addr.sun_path << " rejected the authentication.";
+            disconnect_manager(conn);
+            return -1;
+        }
+        conn.buffer.erase(0, conn.buffer.find("\r\n") + 2);
+        return 0;
+    }
+
+    /**
+     * Closes the manager connection.
+     * @param conn Connection to close.
+     */
+    void disconnect_manager(manager_connection &conn)
+    {
+        if (conn.fd != -1)
+        {
+            close(conn.fd);
+            conn.fd = -1;
+        }
+        conn.buffer.clear();
+    }
+
+    /**
+     * Appends a method call on the systemd manager to the output buffer.
+     * @param conn Connection giving the call serial.
+     * @param out Buffer to append to.
+     * @param member Method name.
+     * @param signature Signature of the arguments.
+     * @param body Marshalled arguments.
+     * @return Serial of the call.
+     */
+    uint32_t append_call(manager_connection &conn, std::string &out, std::string_view member, std::string_view signature, std::string_view body)
+    {
+        const uint32_t serial = conn.next_serial++;
+
+        // Alignment is relative to the message start.
+        std::string msg;
+        msg.push_back('l'); // Little endian.
+        msg.push_back(MESSAGE_METHOD_CALL);
+        msg.push_back(0); // Flags.
+        msg.push_back(1); // Protocol version.
+        append_uint32(msg, body.size());
+        append_uint32(msg, serial);
+        append_uint32(msg, 0); // Header fields length, set below.
+
+        const auto append_field = [&msg](const uint8_t code, std::string_view type, std::string_view value)
+        {
+            align(msg, 8);
+            msg.push_back(code);
+            append_signature(msg, type);
+            if (type == "g")
+                append_signature(msg, value);
+            else
+                append_string(msg, value);
+        };
+
+        append_field(FIELD_PATH, "o", MANAGER_PATH);
+        append_field(FIELD_INTERFACE, "s", MANAGER_INTERFACE);
+        append_field(FIELD_MEMBER, "s", member);
+        if (!signature.empty())
+            append_field(FIELD_SIGNATURE, "g", signature);
+
+        const uint32_t fields_len = msg.size() - HEADER_SIZE;
+        memcpy(msg.data() + 12, &fields_len, sizeof(fields_len));
+        align(msg, 8);
+
+        out.append(msg).append(body);
+        return serial;
+    }
+
+    /**
+     * Reads the next complete message from the connection.
+     * @param conn Manager connection.
+     * @param msg Message to be populated.
+     * @param timeout_at Time to give up waiting at.
+     * @return 0 on success and -1 on error or timeout.
+     */
+    int read_message(manager_connection &conn, bus_message &msg, const uint64_t timeout_at)
+    {
+        pollfd pfd{conn.fd, POLLIN, 0};
+        while (true)
+        {
+            if (conn.buffer.size() >= HEADER_SIZE)
+            {
+                uint32_t body_len, fields_len;
+                memcpy(&body_len, conn.buffer.data() + 4, sizeof(body_len));
+                memcpy(&fields_len, conn.buffer.data() + 12, sizeof(fields_len));
+                const size_t header_len = ((HEADER_SIZE + fields_len + 7) / 8) * 8;
+                if (conn.buffer[0] != 'l' || (size_t)body_len + header_len > MAX_MESSAGE_SIZE)
+                {
+                    LOG_ERROR << "Unsupported message from the systemd manager.";
+                    return -1;
+                }
+
+                const size_t total = header_len + body_len;
+                if (conn.buffer.size() >= total)
+                {
+                    const int ret = parse_message(std::string_view(conn.buffer.data(), total), msg);
+                    conn.buffer.erase(0, total);
+                    return ret;
+                }
+            }
+
+            const uint64_t now = util::get_epoch_milliseconds();
+            if (now >= timeout_at)
+                return -1;
+
+            const int ready = poll(&pfd, 1, timeout_at - now);
+            if (ready == -1 && errno == EINTR)
+                continue;
+            if (ready <= 0)
+                return -1;
+
+            char chunk[READ_CHUNK_SIZE];
+            const ssize_t ret = recv(conn.fd, chunk, sizeof(chunk), 0);
+            if (ret == -1 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                return -1;
+            conn.buffer.append(chunk, ret);
+        }
+    }
+
+    /**
+     * Parses the header fields of a complete little endian message.
+     * @param data Message bytes.
+     * @param msg Message to be populated.
+     * @return 0 on success and -1 on error.
+     */
+    int parse_message(std::string_view data, bus_message &msg)
+    {
+        msg.type = data[1];
+        uint32_t body_len, fields_len;
+        memcpy(&body_len, data.data() + 4, sizeof(body_len));
+        memcpy(&fields_len, data.data() + 12, sizeof(fields_len));
+
+        const std::string_view fields = data.substr(0, HEADER_SIZE + fields_len);
+        size_t pos = HEADER_SIZE;
+        while (pos < fields.size())
+        {
+            pos = ((pos + 7) / 8) * 8;
+            if (pos >= fields.size())
+                break;
+
+            const uint8_t code = fields[pos++];
+            std::string type, value;
+            if (read_signature(fields, pos, type) == -1)
+                return -1;
+
+            if (type == "u")
+            {
+                uint32_t number;
+                if (read_uint32(fields, pos, number) == -1)
+                    return -1;
+                if (code == FIELD_REPLY_SERIAL)
+                    msg.reply_serial = number;
+            }
+            else if (type == "g")
+            {
+                if (read_signature(fields, pos, value) == -1)
+                    return -1;
+                if (code == FIELD_SIGNATURE)
+                    msg.signature = value;
+            }
+            else if (type == "s" || type == "o")
+            {
+                if (read_string(fields, pos, value) == -1)
+                    return -1;
+                if (code == FIELD_MEMBER)
+                    msg.member = value;
+                else if (code == FIELD_ERROR_NAME)
+                    msg.error_name = value;
+            }
+            else
+            {
+                return -1; // Standard header fields only use the above types.
+            }
+        }
+
+        msg.body = data.substr(data.size() - body_len);
+        return 0;
+    }
+
+    /**
+     * Pads the buffer with zeros to the given alignment.
+     */
+    void align(std::string &buf, const size_t alignment)
+    {
+        buf.resize(((buf.size() + alignment - 1) / alignment) * alignment, '\0');
+    }
+
+    void append_uint32(std::string &buf, const uint32_t value)
+    {
+        align(buf, 4);
+        buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void append_string(std::string &buf, std::string_view value)
+    {
+        append_uint32(buf, value.size());
+        buf.append(value).push_back('\0');
+    }
+
+    void append_signature(std::string &buf, std::string_view value)
+    {
+        buf.push_back((char)value.size());
+        buf.append(value).push_back('\0');
+    }
+
+    void append_string_array(std::string &buf, const std::vector<std::string> &values)
+    {
+        append_uint32(buf, 0);
+        const size_t len_pos = buf.size() - 4;
+        for (const std::string &value : values)
+            append_string(buf, value);
+
+        const uint32_t len = buf.size() - len_pos - 4;
+        memcpy(buf.data() + len_pos, &len, sizeof(len));
+    }
+
+    int read_uint32(std::string_view data, size_t &pos, uint32_t &value)
+    {
+        pos = ((pos + 3) / 4) * 4;
+        if (pos + 4 > data.size())
+            return -1;
+        memcpy(&value, data.data() + pos, sizeof(value));
+        pos += 4;
+        return 0;
+    }
+
+    int read_string(std::string_view data, size_t &pos, std::string &value)
+    {
+        uint32_t len;
+        if (read_uint32(data, pos, len) == -1 || pos + len + 1 > data.size())
+            return -1;
+        value = data.substr(pos, len);
+        pos += len + 1;
+        return 0;
+    }
+
+    int read_signature(std::string_view data, size_t &pos, std::string &value)
+    {
+        if (pos >= data.size())
+            return -1;
+        const uint8_t len = data[pos++];
+        if (pos + len + 1 > data.size())
+            return -1;
+        value = data.substr(pos, len);
+        pos += len + 1;
+        return 0;
+    }
+
+} // namespace systemd
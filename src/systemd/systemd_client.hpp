@@ -0,0 +1,66 @@
+#ifndef _SA_SYSTEMD_SYSTEMD_CLIENT_
+#define _SA_SYSTEMD_SYSTEMD_CLIENT_
+
+#include "../pchheader.hpp"
+
+/**
+ * Minimal D-Bus client talking to the systemd user manager of each instance user over its private socket.
+ */
+namespace systemd
+{
+    constexpr int JOB_TIMEOUT_SECS = 60; // Max time to wait for the unit jobs to finish.
+
+    // A D-Bus message received from the manager.
+    struct bus_message
+    {
+        uint8_t type = 0;
+        uint32_t reply_serial = 0;
+        std::string member;
+        std::string error_name;
+        std::string signature;
+        std::string body;
+    };
+
+    // Connection to a user's systemd manager. The private socket is peer to peer, so no bus registration is needed.
+    struct manager_connection
+    {
+        int fd = -1;
+        uint32_t next_serial = 1;
+        std::string buffer; // Received bytes not parsed yet.
+    };
+
+    int start_units(const int uid, const std::vector<std::string> &units);
+
+    int stop_units(const int uid, const std::vector<std::string> &units);
+
+    int run_unit_jobs(const int uid, const std::vector<std::string> &units, const bool is_start);
+
+    int connect_manager(const int uid, manager_connection &conn);
+
+    void disconnect_manager(manager_connection &conn);
+
+    uint32_t append_call(manager_connection &conn, std::string &out, std::string_view member, std::string_view signature, std::string_view body);
+
+    int read_message(manager_connection &conn, bus_message &msg, const uint64_t timeout_at);
+
+    int parse_message(std::string_view data, bus_message &msg);
+
+    void align(std::string &buf, const size_t alignment);
+
+    void append_uint32(std::string &buf, const uint32_t value);
+
+    void append_string(std::string &buf, std::string_view value);
+
+    void append_signature(std::string &buf, std::string_view value);
+
+    void append_string_array(std::string &buf, const std::vector<std::string> &values);
+
+    int read_uint32(std::string_view data, size_t &pos, uint32_t &value);
+
+    int read_string(std::string_view data, size_t &pos, std::string &value);
+
+    int read_signature(std::string_view data, size_t &pos, std::string &value);
+
+} // namespace systemd
+
+#endif
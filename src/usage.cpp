@@ -0,0 +1,413 @@
+#include "usage.hpp"
+#include "conf.hpp"
+#include "util/util.hpp"
+
+namespace usage
+{
+    usage_ctx ctx;
+
+    constexpr const char *PROC_STAT = "/proc/stat";
+    constexpr const char *PROC_MEMINFO = "/proc/meminfo";
+    constexpr const char *PROC_MOUNTS = "/proc/self/mounts";
+    constexpr const char *CPU_USAGE_FILE = "cpuacct.usage";      // Cumulative cpu time of the cgroup in nanoseconds.
+    constexpr const char *MEM_USAGE_FILE = "memory.usage_in_bytes";
+    constexpr const char *DISK_ROOT = "/";
+    constexpr size_t PROC_READ_SIZE = 4096; // First line of /proc/stat and the head of /proc/meminfo fit in this.
+    constexpr size_t HOST_CPU_SMOOTHING = 4; // Host cpu usage is a moving average so a short spike doesn't refuse creates.
+
+    /**
+     * Starts the usage sampler thread if sampling is enabled.
+     * @return 0 on success and -1 on error.
+     */
+    int init()
+    {
+        if (conf::cfg.system.usage_sample_secs == 0)
+            return 0;
+
+        const long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        ctx.cpu_count = cpu_count > 0 ? cpu_count : 1;
+
+        // Disk usage is not reported if the user quotas can't be located. Cpu and memory are still sampled.
+        if (find_quota_device(ctx.quota_device) == -1)
+            LOG_WARNING << "Root filesystem device not found. Instance disk usage is not sampled.";
+
+        ctx.sampler_thread = std::thread(sampler_loop);
+        return 0;
+    }
+
+    /**
+     * Stops the sampler thread and closes the cgroup files.
+     */
+    void deinit()
+    {
+        {
+            std::scoped_lock lock(ctx.mutex);
+            ctx.is_shutting_down = true;
+        }
+        ctx.sampler_cv.notify_all();
+
+        if (ctx.sampler_thread.joinable())
+            ctx.sampler_thread.join();
+
+        std::scoped_lock lock(ctx.mutex);
+        for (auto &[name, instance] : ctx.instances)
+            close_files(instance);
+        ctx.instances.clear();
+    }
+
+    /**
+     * Starts sampling the usage of an instance. Tracking an instance again with another user restarts its history.
+     * @param container_name Name of the instance.
+     * @param username Instance user owning the cgroups and the disk quota. Nothing is sampled while this is empty.
+     */
+    void track_instance(std::string_view container_name, std::string_view username)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        const auto [itr, is_new] = ctx.instances.try_emplace(std::string(container_name));
+        instance_usage &instance = itr->second;
+        if (!is_new && instance.username == username)
+            return;
+
+        close_files(instance);
+        instance = instance_usage{};
+        instance.username = username;
+    }
+
+    /**
+     * Stops sampling the usage of an instance and drops its history.
+     * @param container_name Name of the instance.
+     */
+    void untrack_instance(std::string_view container_name)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end())
+            return;
+
+        close_files(itr->second);
+        ctx.instances.erase(itr);
+    }
+
+    /**
+     * Samples the host and the tracked instances every configured interval.
+     * A sample is a few small reads of already open files, so it is taken while holding the lock.
+     */
+    void sampler_loop()
+    {
+        util::mask_signal();
+
+        const std::chrono::seconds interval(conf::cfg.system.usage_sample_secs);
+        std::unique_lock lock(ctx.mutex);
+        while (!ctx.is_shutting_down)
+        {
+            sample_instances();
+            ctx.sampler_cv.wait_for(lock, interval, []
+                                    { return ctx.is_shutting_down; });
+        }
+    }
+
+    /**
+     * Takes a sample of the host and of every tracked instance. Must be called while holding the lock.
+     */
+    void sample_instances()
+    {
+        const uint64_t timestamp = util::get_epoch_milliseconds();
+        const uint64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        sample_host(timestamp);
+        for (auto &[name, instance] : ctx.instances)
+        {
+            if (!instance.username.empty())
+                sample_instance(instance, timestamp, now_us);
+        }
+    }
+
+    /**
+     * Reads the cgroup counters and the disk quota of an instance and appends a sample to its history.
+     * Nothing is recorded until the cgroups of the user exist.
+     * @param instance Instance to sample.
+     * @param timestamp Epoch milliseconds of the sample.
+     * @param now_us Steady clock microseconds used to measure the cpu interval.
+     */
+    void sample_instance(instance_usage &instance, const uint64_t timestamp, const uint64_t now_us)
+    {
+        uint64_t cpu_ns = 0, mem_bytes = 0;
+        const bool has_cpu = read_cgroup_value(instance.cpu_fd, CGROUP_CPU_DIR, instance.username, CPU_USAGE_FILE, cpu_ns) == 0;
+        const bool has_mem = read_cgroup_value(instance.mem_fd, CGROUP_MEM_DIR, instance.username, MEM_USAGE_FILE, mem_bytes) == 0;
+        if (!has_cpu && !has_mem)
+            return;
+
+        usage_sample sample;
+        sample.timestamp = timestamp;
+        sample.mem_kbytes = mem_bytes / 1024;
+
+        if (has_cpu)
+        {
+            // Cpu time is cumulative, so the first sample only sets the baseline.
+            if (instance.sampled_at != 0 && now_us > instance.sampled_at && cpu_ns >= instance.cpu_ns)
+                sample.cpu_us = ((cpu_ns - instance.cpu_ns) / 1000) * CPU_SCALE / ((now_us - instance.sampled_at) * ctx.cpu_count);
+            instance.cpu_ns = cpu_ns;
+            instance.sampled_at = now_us;
+        }
+
+        if (instance.uid == -1)
+            instance.uid = resolve_uid(instance.username);
+        if (instance.uid != -1)
+            read_disk_usage(instance.uid, sample.disk_kbytes);
+
+        instance.history[instance.next] = sample;
+        instance.next = (instance.next + 1) % HISTORY_SIZE;
+        if (instance.count < HISTORY_SIZE)
+            instance.count++;
+    }
+
+    /**
+     * Samples the cpu, memory and disk availability of the host.
+     * @param timestamp Epoch milliseconds of the sample.
+     */
+    void sample_host(const uint64_t timestamp)
+    {
+        char buf[PROC_READ_SIZE];
+
+        // First line holds the cumulative ticks of all the cores: cpu user nice system idle iowait irq softirq steal.
+        if (read_proc_file(PROC_STAT, buf, sizeof(buf)) != -1 && strncmp(buf, "cpu ", 4) == 0)
+        {
+            uint64_t ticks[8] = {};
+            char *pos = buf + 4;
+            for (uint64_t &tick : ticks)
+                tick = strtoull(pos, &pos, 10);
+
+            const uint64_t idle = ticks[3] + ticks[4];
+            uint64_t total = 0;
+            for (const uint64_t tick : ticks)
+                total += tick;
+            const uint64_t busy = total - idle;
+
+            if (ctx.host_total_ticks != 0 && total > ctx.host_total_ticks && busy >= ctx.host_busy_ticks)
+            {
+                const size_t cpu_us = (busy - ctx.host_busy_ticks) * CPU_SCALE / (total - ctx.host_total_ticks);
+                ctx.host.cpu_us = ctx.host.timestamp == 0 ? cpu_us : (ctx.host.cpu_us * (HOST_CPU_SMOOTHING - 1) + cpu_us) / HOST_CPU_SMOOTHING;
+                ctx.host.timestamp = timestamp;
+            }
+            ctx.host_busy_ticks = busy;
+            ctx.host_total_ticks = total;
+        }
+
+        if (read_proc_file(PROC_MEMINFO, buf, sizeof(buf)) != -1)
+        {
+            const char *pos = strstr(buf, "MemAvailable:");
+            if (pos != NULL)
+                ctx.host.mem_available_kbytes = strtoull(pos + 13, NULL, 10);
+        }
+
+        struct statvfs st;
+        if (statvfs(DISK_ROOT, &st) == 0)
+            ctx.host.disk_available_kbytes = (uint64_t)st.f_bavail * st.f_frsize / 1024;
+    }
+
+    /**
+     * Looks up the uid of an instance user without logging, since the user might not be installed yet.
+     * @param username Instance user name.
+     * @return Uid of the user or -1 if not found.
+     */
+    int resolve_uid(std::string_view username)
+    {
+        struct passwd pwd, *result = NULL;
+        char buf[1024];
+        if (getpwnam_r(std::string(username).c_str(), &pwd, buf, sizeof(buf), &result) != 0 || result == NULL)
+            return -1;
+        return pwd.pw_uid;
+    }
+
+    /**
+     * Closes the cgroup files of an instance.
+     * @param instance Instance of the files.
+     */
+    void close_files(instance_usage &instance)
+    {
+        if (instance.cpu_fd != -1)
+        {
+            close(instance.cpu_fd);
+            instance.cpu_fd = -1;
+        }
+        if (instance.mem_fd != -1)
+        {
+            close(instance.mem_fd);
+            instance.mem_fd = -1;
+        }
+    }
+
+    /**
+     * Reads a numeric value of a user cgroup. The file is opened on first use and kept open for the next reads.
+     * @param fd Open file descriptor of the value or -1. Closed again if the read fails.
+     * @param controller_dir Cgroup controller hierarchy.
+     * @param username Instance user of the cgroup.
+     * @param file Value file name within the cgroup.
+     * @param value Read value.
+     * @return 0 on success and -1 on error.
+     */
+    int read_cgroup_value(int &fd, const char *controller_dir, std::string_view username, const char *file, uint64_t &value)
+    {
+        if (fd == -1)
+        {
+            const std::string path = std::string(controller_dir) + "/" + std::string(username) + CGROUP_SUFFIX + "/" + file;
+            fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+                return -1;
+        }
+
+        char buf[32];
+        const ssize_t size = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (size <= 0)
+        {
+            // Cgroup might have been removed and created again, so it is reopened next time.
+            close(fd);
+            fd = -1;
+            return -1;
+        }
+
+        buf[size] = '\0';
+        value = strtoull(buf, NULL, 10);
+        return 0;
+    }
+
+    /**
+     * Reads the beginning of a proc file. Proc files report no size, so they are read into a fixed buffer.
+     * @param path File path.
+     * @param buf Buffer to read into. Null terminated after the read.
+     * @param size Buffer size.
+     * @return Number of bytes read or -1 on error.
+     */
+    int read_proc_file(const char *path, char *buf, const size_t size)
+    {
+        const int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return -1;
+
+        const ssize_t read_size = read(fd, buf, size - 1);
+        close(fd);
+        if (read_size < 0)
+            return -1;
+
+        buf[read_size] = '\0';
+        return read_size;
+    }
+
+    /**
+     * Reads the disk space charged to a user by the root filesystem quota.
+     * @param uid Uid of the user.
+     * @param kbytes Used disk space in KB.
+     * @return 0 on success and -1 on error.
+     */
+    int read_disk_usage(const int uid, size_t &kbytes)
+    {
+        if (ctx.quota_device.empty())
+            return -1;
+
+        struct dqblk quota{};
+        if (quotactl(QCMD(Q_GETQUOTA, USRQUOTA), ctx.quota_device.c_str(), uid, (caddr_t)&quota) == -1)
+            return -1;
+
+        kbytes = quota.dqb_curspace / 1024;
+        return 0;
+    }
+
+    /**
+     * Finds the block device mounted as the root filesystem, which holds the instance user quotas.
+     * @param device Path of the device.
+     * @return 0 on success and -1 on error.
+     */
+    int find_quota_device(std::string &device)
+    {
+        FILE *mounts = setmntent(PROC_MOUNTS, "r");
+        if (mounts == NULL)
+            return -1;
+
+        // Last mount of the root wins since it hides the earlier ones.
+        struct mntent *entry;
+        while ((entry = getmntent(mounts)) != NULL)
+        {
+            if (strcmp(entry->mnt_dir, DISK_ROOT) == 0 && strncmp(entry->mnt_fsname, "/dev/", 5) == 0)
+                device = entry->mnt_fsname;
+        }
+        endmntent(mounts);
+
+        return device.empty() ? -1 : 0;
+    }
+
+    /**
+     * Gets the latest usage sample of an instance.
+     * @param container_name Name of the instance.
+     * @param sample Latest sample.
+     * @return 0 on success and -1 if the instance has not been sampled yet.
+     */
+    int get_latest(std::string_view container_name, usage_sample &sample)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end() || itr->second.count == 0)
+            return -1;
+
+        const instance_usage &instance = itr->second;
+        sample = instance.history[(instance.next + HISTORY_SIZE - 1) % HISTORY_SIZE];
+        return 0;
+    }
+
+    /**
+     * Gets the usage history of an instance.
+     * @param container_name Name of the instance.
+     * @param history List of samples to be populated, oldest first.
+     */
+    void get_history(std::string_view container_name, std::vector<usage_sample> &history)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        const auto itr = ctx.instances.find(std::string(container_name));
+        if (itr == ctx.instances.end())
+            return;
+
+        const instance_usage &instance = itr->second;
+        history.reserve(history.size() + instance.count);
+        for (size_t i = 0; i < instance.count; i++)
+            history.push_back(instance.history[(instance.next + HISTORY_SIZE - instance.count + i) % HISTORY_SIZE]);
+    }
+
+    /**
+     * Gets the latest usage of the host.
+     * @param host Host usage to be populated.
+     */
+    void get_host_usage(host_usage &host)
+    {
+        std::scoped_lock lock(ctx.mutex);
+        host = ctx.host;
+    }
+
+    /**
+     * Checks whether the host has the headroom to take a new instance. Allocation limits are checked separately,
+     * this only refuses creates when the host is actually saturated. All the creates are admitted until the first sample.
+     * @param reason Saturated resource if refused.
+     * @param mem_kbytes Memory allocated to the new instance.
+     * @param storage_kbytes Disk space allocated to the new instance.
+     * @return 0 if admitted and -1 if refused.
+     */
+    int check_admission(std::string &reason, const size_t mem_kbytes, const size_t storage_kbytes)
+    {
+        host_usage host;
+        get_host_usage(host);
+        if (host.timestamp == 0)
+            return 0;
+
+        if (host.cpu_us > CPU_SCALE * conf::cfg.system.max_host_cpu_percent / 100)
+            reason = "cpu";
+        else if (host.mem_available_kbytes < mem_kbytes)
+            reason = "memory";
+        else if (host.disk_available_kbytes < storage_kbytes)
+            reason = "disk";
+        else
+            return 0;
+
+        LOG_WARNING << "Host " << reason << " is saturated. Cpu: " << host.cpu_us << " MicroS, available RAM: " << host.mem_available_kbytes
+                    << " KB, available storage: " << host.disk_available_kbytes << " KB.";
+        return -1;
+    }
+
+} // namespace usage
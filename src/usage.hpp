@@ -0,0 +1,101 @@
+#ifndef _SA_USAGE_
+#define _SA_USAGE_
+
+#include "pchheader.hpp"
+
+/**
+ * Samples the actual resource usage of the instances from their cgroups and disk quotas, and of the host.
+ * Recent samples are kept in memory so the instance listings and the create admission don't touch the files.
+ */
+namespace usage
+{
+    constexpr const char *CGROUP_CPU_DIR = "/sys/fs/cgroup/cpu";
+    constexpr const char *CGROUP_MEM_DIR = "/sys/fs/cgroup/memory";
+    constexpr const char *CGROUP_SUFFIX = "-cg"; // Cgroups of an instance user are named <username>-cg by the cgrules.
+    constexpr size_t HISTORY_SIZE = 60;          // Samples kept per instance.
+    constexpr size_t CPU_SCALE = 1000000;        // Cpu usage is given out of 1000000 microsec like max_cpu_us.
+
+    // Resource usage at a sample time.
+    struct usage_sample
+    {
+        uint64_t timestamp = 0;  // Epoch milliseconds of the sample. 0 if not sampled yet.
+        size_t cpu_us = 0;       // CPU time used per second over all the cores (out of 1000000 microsec).
+        size_t mem_kbytes = 0;   // Memory charged to the instance cgroup in KB.
+        size_t disk_kbytes = 0;  // Disk space charged to the instance user quota in KB.
+    };
+
+    // Usage of the host as a whole.
+    struct host_usage
+    {
+        uint64_t timestamp = 0;            // Epoch milliseconds of the sample. 0 if not sampled yet.
+        size_t cpu_us = 0;                 // Busy CPU time per second averaged over the recent samples (out of 1000000 microsec).
+        size_t mem_available_kbytes = 0;   // Memory available for new allocations in KB.
+        size_t disk_available_kbytes = 0;  // Free disk space of the root filesystem in KB.
+    };
+
+    struct instance_usage
+    {
+        std::string username;
+        int uid = -1;              // Resolved on the first sample after the user is installed.
+        int cpu_fd = -1;           // Cpu accounting file of the user cgroup, kept open between the samples.
+        int mem_fd = -1;           // Memory usage file of the user cgroup, kept open between the samples.
+        uint64_t cpu_ns = 0;       // Cumulative cpu time at the last sample.
+        uint64_t sampled_at = 0;   // Steady clock microseconds of the last sample.
+        std::array<usage_sample, HISTORY_SIZE> history; // Ring buffer of the samples.
+        size_t next = 0;           // History slot of the next sample.
+        size_t count = 0;          // Number of samples in the history.
+    };
+
+    struct usage_ctx
+    {
+        std::unordered_map<std::string, instance_usage> instances; // Tracked instances keyed by container name.
+        host_usage host;
+        uint64_t host_busy_ticks = 0;  // Cumulative busy and total cpu ticks of the host at the last sample.
+        uint64_t host_total_ticks = 0;
+        std::string quota_device;      // Block device of the root filesystem holding the user quotas.
+        size_t cpu_count = 1;
+        std::thread sampler_thread;
+        bool is_shutting_down = false;
+        std::mutex mutex;
+        std::condition_variable sampler_cv;
+    };
+
+    int init();
+
+    void deinit();
+
+    void track_instance(std::string_view container_name, std::string_view username);
+
+    void untrack_instance(std::string_view container_name);
+
+    void sampler_loop();
+
+    void sample_instances();
+
+    void sample_instance(instance_usage &instance, const uint64_t timestamp, const uint64_t now_us);
+
+    void sample_host(const uint64_t timestamp);
+
+    int resolve_uid(std::string_view username);
+
+    void close_files(instance_usage &instance);
+
+    int read_cgroup_value(int &fd, const char *controller_dir, std::string_view username, const char *file, uint64_t &value);
+
+    int read_proc_file(const char *path, char *buf, const size_t size);
+
+    int read_disk_usage(const int uid, size_t &kbytes);
+
+    int find_quota_device(std::string &device);
+
+    int get_latest(std::string_view container_name, usage_sample &sample);
+
+    void get_history(std::string_view container_name, std::vector<usage_sample> &history);
+
+    void get_host_usage(host_usage &host);
+
+    int check_admission(std::string &reason, const size_t mem_kbytes, const size_t storage_kbytes);
+
+} // namespace usage
+
+#endif
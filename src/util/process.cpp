@@ -0,0 +1,240 @@
+#include "process.hpp"
+#include "util.hpp"
+#include "../metrics.hpp"
+
+extern char **environ;
+
+namespace util
+{
+    constexpr size_t MAX_PROCESS_OUTPUT_BYTES = 1024 * 1024; // Captured standard output beyond this is only logged.
+    constexpr int PROCESS_POLL_INTERVAL_MS = 100;            // Max wait between the checks for the process exit without a pidfd.
+    constexpr size_t PROCESS_READ_SIZE = 4096;
+
+    /**
+     * Runs the given program without a shell and waits for it to finish. Standard output is captured and both standard
+     * output and error are logged line by line while the process runs. The process runs in its own process group, which
+     * is killed if it exceeds the timeout. Safe to call from multiple threads.
+     * @param argv Program and its arguments. The program is looked up in PATH.
+     * @param result Exit status and the captured output.
+     * @param timeout_secs Max time to wait for the process.
+     * @return 0 if the process ran to completion and -1 if it could not be started or waited for, or timed out.
+     */
+    int run_process(const std::vector<std::string> &argv, process_result &result, const int timeout_secs)
+    {
+        if (argv.empty())
+            return -1;
+
+        // Timed by the program name, looking through sudo.
+        const std::string &program = (argv[0] == "sudo" && argv.size() > 1) ? argv[1] : argv[0];
+        metrics::scoped_timer timer("process." + program.substr(program.find_last_of('/') + 1));
+
+        // Pipes are closed on exec so processes spawned by other threads don't hold them open.
+        int out_pipe[2], err_pipe[2];
+        if (pipe2(out_pipe, O_CLOEXEC) == -1)
+        {
+            LOG_ERROR << errno << ": Error creating output pipe for " << argv[0];
+            return -1;
+        }
+        if (pipe2(err_pipe, O_CLOEXEC) == -1)
+        {
+            LOG_ERROR << errno << ": Error creating error pipe for " << argv[0];
+            close(out_pipe[0]);
+            close(out_pipe[1]);
+            return -1;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+
+        // Worker threads mask the signals, the child should start with the defaults.
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        sigset_t signals;
+        sigemptyset(&signals);
+        posix_spawnattr_setsigmask(&attr, &signals);
+        sigfillset(&signals);
+        posix_spawnattr_setsigdefault(&attr, &signals);
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+        std::vector<char *> args;
+        args.reserve(argv.size() + 1);
+        for (const std::string &arg : argv)
+            args.push_back(const_cast<char *>(arg.c_str()));
+        args.push_back(NULL);
+
+        pid_t pid;
+        const int ret = posix_spawnp(&pid, args[0], &actions, &attr, args.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        close(out_pipe[1]);
+        close(err_pipe[1]);
+
+        if (ret != 0)
+        {
+            LOG_ERROR << ret << ": Error starting " << argv[0];
+            close(out_pipe[0]);
+            close(err_pipe[0]);
+            return -1;
+        }
+
+        fcntl(out_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(err_pipe[0], F_SETFL, O_NONBLOCK);
+
+        // The pidfd becomes readable when the process exits, so the exit is seen without polling waitpid. Kernels without
+        // pidfds fall back to checking the exit every poll interval.
+        int pid_fd = -1;
+#ifdef SYS_pidfd_open
+        pid_fd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+        pollfd fds[3] = {{out_pipe[0], POLLIN, 0}, {err_pipe[0], POLLIN, 0}, {pid_fd, POLLIN, 0}};
+        std::string pending[2];
+
+        // Reads whatever is available on the pipes. Pipes are closed once they reach the end.
+        const auto read_pipes = [&]()
+        {
+            char buf[PROCESS_READ_SIZE];
+            for (int i = 0; i < 2; i++)
+            {
+                while (fds[i].fd != -1)
+                {
+                    const ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+                    if (n > 0)
+                    {
+                        if (i == 0 && result.output.size() < MAX_PROCESS_OUTPUT_BYTES)
+                            result.output.append(buf, std::min((size_t)n, MAX_PROCESS_OUTPUT_BYTES - result.output.size()));
+                        pending[i].append(buf, n);
+                        log_process_lines(pending[i], i == 1, false);
+                        continue;
+                    }
+                    if (n == -1 && errno == EINTR)
+                        continue;
+                    if (n == -1 && errno == EAGAIN)
+                        break;
+
+                    close(fds[i].fd);
+                    fds[i].fd = -1;
+                }
+            }
+        };
+
+        // Stop reading once the process exits, since processes it started in background might keep the pipes open.
+        const uint64_t timeout_at = get_epoch_milliseconds() + (timeout_secs * 1000);
+        int status = 0;
+        int wait_error = 0;
+        while (true)
+        {
+            const pid_t waited = waitpid(pid, &status, WNOHANG);
+            if (waited == -1 && errno != EINTR)
+                wait_error = errno;
+            if (waited == pid || wait_error != 0)
+            {
+                read_pipes();
+                break;
+            }
+
+            const uint64_t now = get_epoch_milliseconds();
+            if (now >= timeout_at)
+            {
+                result.is_timed_out = true;
+                kill(-pid, SIGKILL);
+                while (waitpid(pid, &status, 0) == -1)
+                {
+                    if (errno != EINTR)
+                    {
+                        wait_error = errno;
+                        break;
+                    }
+                }
+                read_pipes();
+                break;
+            }
+
+            // Closed pipes are skipped by poll. Once both are closed, this only waits for the exit.
+            const int wait_ms = pid_fd != -1 ? (int)(timeout_at - now) : std::min((int)(timeout_at - now), PROCESS_POLL_INTERVAL_MS);
+            if (poll(fds, 3, wait_ms) > 0)
+                read_pipes();
+        }
+
+        if (pid_fd != -1)
+            close(pid_fd);
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (fds[i].fd != -1)
+                close(fds[i].fd);
+            log_process_lines(pending[i], i == 1, true);
+        }
+
+        // Without the wait status the exit of the process is unknown.
+        if (wait_error != 0)
+        {
+            LOG_ERROR << wait_error << ": Error waiting for " << argv[0];
+            result.exit_code = -1;
+            return -1;
+        }
+
+        if (WIFEXITED(status))
+            result.exit_code = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            result.signal = WTERMSIG(status);
+
+        if (result.is_timed_out)
+        {
+            LOG_ERROR << argv[0] << " did not finish within " << timeout_secs << "s and was killed.";
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Runs the given program without a shell and waits for it to finish.
+     * @param argv Program and its arguments. The program is looked up in PATH.
+     * @param timeout_secs Max time to wait for the process.
+     * @return 0 if the process exited with code 0 and -1 otherwise.
+     */
+    int run_process(const std::vector<std::string> &argv, const int timeout_secs)
+    {
+        process_result result;
+        if (run_process(argv, result, timeout_secs) == -1)
+            return -1;
+
+        if (result.exit_code != 0)
+        {
+            LOG_ERROR << argv[0] << " exited with " << (result.signal != 0 ? "signal " : "code ") << (result.signal != 0 ? result.signal : result.exit_code);
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Logs the complete lines of a child process output and keeps the incomplete last line.
+     * @param pending Output not logged yet.
+     * @param is_stderr Whether the output is from the standard error.
+     * @param flush Whether to log the incomplete last line too.
+     */
+    void log_process_lines(std::string &pending, const bool is_stderr, const bool flush)
+    {
+        size_t start = 0, end;
+        while ((end = pending.find('\n', start)) != std::string::npos || (flush && start < pending.size()))
+        {
+            if (end == std::string::npos)
+                end = pending.size();
+
+            if (end > start)
+            {
+                const std::string_view line(pending.data() + start, end - start);
+                if (is_stderr)
+                    LOG_WARNING << line;
+                else
+                    LOG_INFO << line;
+            }
+            start = end + 1;
+        }
+        pending.erase(0, std::min(start, pending.size()));
+    }
+
+} // namespace util
@@ -0,0 +1,27 @@
+#ifndef _SA_UTIL_PROCESS_
+#define _SA_UTIL_PROCESS_
+
+#include "../pchheader.hpp"
+
+namespace util
+{
+    constexpr int DEFAULT_PROCESS_TIMEOUT_SECS = 300; // Max time a child process is allowed to run.
+
+    // Outcome of a child process run.
+    struct process_result
+    {
+        int exit_code = -1;        // Exit code if the process exited normally, -1 otherwise.
+        int signal = 0;            // Signal which terminated the process if any.
+        bool is_timed_out = false; // Process was killed because it exceeded the timeout.
+        std::string output;        // Captured standard output.
+    };
+
+    int run_process(const std::vector<std::string> &argv, process_result &result, const int timeout_secs = DEFAULT_PROCESS_TIMEOUT_SECS);
+
+    int run_process(const std::vector<std::string> &argv, const int timeout_secs = DEFAULT_PROCESS_TIMEOUT_SECS);
+
+    void log_process_lines(std::string &pending, const bool is_stderr, const bool flush);
+
+} // namespace util
+
+#endif
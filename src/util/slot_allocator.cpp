@@ -0,0 +1,105 @@
+#include "slot_allocator.hpp"
+
+namespace util
+{
+    constexpr size_t BITS_PER_WORD = 64;
+
+    /**
+     * Resets the allocator with all the slots free.
+     * @param capacity Number of slots.
+     */
+    void slot_allocator::init(const size_t capacity)
+    {
+        std::scoped_lock lock(slots_mutex);
+        slot_count = capacity;
+        used_count = 0;
+        used_bits.assign((capacity + BITS_PER_WORD - 1) / BITS_PER_WORD, 0);
+        free_slots.clear();
+        free_slots.reserve(capacity);
+        for (size_t slot = capacity; slot > 0; slot--)
+            free_slots.push_back(slot - 1);
+    }
+
+    /**
+     * Marks the given slot as used. Used when rebuilding the allocator from the existing allocations.
+     * @param slot Slot to mark.
+     * @return 0 on success -1 if the slot is out of range or already used.
+     */
+    int slot_allocator::mark_used(const size_t slot)
+    {
+        std::scoped_lock lock(slots_mutex);
+        if (slot >= slot_count || is_set(slot))
+            return -1;
+
+        // The free list entry of the slot is skipped when it reaches the top.
+        used_bits[slot / BITS_PER_WORD] |= (1ULL << (slot % BITS_PER_WORD));
+        used_count++;
+        return 0;
+    }
+
+    /**
+     * Takes the most recently released slot, or the lowest never used one. The slot is held until it is released.
+     * @param slot Reserved slot.
+     * @return 0 on success -1 if there are no free slots.
+     */
+    int slot_allocator::reserve(size_t &slot)
+    {
+        std::scoped_lock lock(slots_mutex);
+        while (!free_slots.empty())
+        {
+            const size_t candidate = free_slots.back();
+            free_slots.pop_back();
+            if (is_set(candidate))
+                continue;
+
+            used_bits[candidate / BITS_PER_WORD] |= (1ULL << (candidate % BITS_PER_WORD));
+            used_count++;
+            slot = candidate;
+            return 0;
+        }
+        return -1;
+    }
+
+    /**
+     * Gives back a reserved or used slot.
+     * @param slot Slot to release.
+     * @return 0 on success -1 if the slot is not in use.
+     */
+    int slot_allocator::release(const size_t slot)
+    {
+        std::scoped_lock lock(slots_mutex);
+        if (slot >= slot_count || !is_set(slot))
+            return -1;
+
+        used_bits[slot / BITS_PER_WORD] &= ~(1ULL << (slot % BITS_PER_WORD));
+        used_count--;
+
+        // Released slots are reused first.
+        free_slots.push_back(slot);
+        return 0;
+    }
+
+    /**
+     * @return Number of slots.
+     */
+    size_t slot_allocator::capacity()
+    {
+        std::scoped_lock lock(slots_mutex);
+        return slot_count;
+    }
+
+    /**
+     * @return Number of slots in use.
+     */
+    size_t slot_allocator::count()
+    {
+        std::scoped_lock lock(slots_mutex);
+        return used_count;
+    }
+
+    bool slot_allocator::is_set(const size_t slot) const
+    {
+        return used_bits[slot / BITS_PER_WORD] & (1ULL << (slot % BITS_PER_WORD));
+    }
+
+} // namespace util
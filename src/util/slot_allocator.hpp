@@ -0,0 +1,39 @@
+#ifndef _SA_UTIL_SLOT_ALLOCATOR_
+#define _SA_UTIL_SLOT_ALLOCATOR_
+
+#include "../pchheader.hpp"
+
+namespace util
+{
+    /**
+     * Allocates numbered slots in constant time. A bitmap keeps the slots in use and a free list keeps the slots
+     * available for allocation. Stale free list entries left by mark_used are skipped on allocation.
+     */
+    class slot_allocator
+    {
+    private:
+        std::vector<uint64_t> used_bits;
+        std::vector<size_t> free_slots; // Stack of free slots. Initially the lowest slot is at the top.
+        size_t slot_count = 0;
+        size_t used_count = 0;
+        std::mutex slots_mutex;
+
+        bool is_set(const size_t slot) const;
+
+    public:
+        void init(const size_t capacity);
+
+        int mark_used(const size_t slot);
+
+        int reserve(size_t &slot);
+
+        int release(const size_t slot);
+
+        size_t capacity();
+
+        size_t count();
+    };
+
+} // namespace util
+
+#endif
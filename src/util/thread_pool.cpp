@@ -0,0 +1,86 @@
+#include "thread_pool.hpp"
+#include "util.hpp"
+
+namespace util
+{
+    /**
+     * Starts the worker threads.
+     * @param worker_count Number of worker threads.
+     * @param max_pending Maximum number of tasks allowed to wait in the queue.
+     * @return 0 on success -1 on error.
+     */
+    int thread_pool::init(const size_t worker_count, const size_t max_pending)
+    {
+        if (worker_count == 0)
+        {
+            LOG_ERROR << "Thread pool worker count cannot be zero.";
+            return -1;
+        }
+
+        max_pending_tasks = max_pending;
+        is_shutting_down = false;
+        workers.reserve(worker_count);
+        for (size_t i = 0; i < worker_count; i++)
+            workers.emplace_back(&thread_pool::worker_loop, this);
+
+        return 0;
+    }
+
+    /**
+     * Queues the given task to be executed by a worker.
+     * @param task Task to execute.
+     * @return 0 on success -1 if the pool is stopped or the queue is full.
+     */
+    int thread_pool::submit(std::function<void()> task)
+    {
+        {
+            std::scoped_lock lock(tasks_mutex);
+            if (is_shutting_down || workers.empty() || tasks.size() >= max_pending_tasks)
+                return -1;
+            tasks.push(std::move(task));
+        }
+        tasks_cv.notify_one();
+        return 0;
+    }
+
+    /**
+     * Stops accepting tasks, drops the queued ones and waits for the running tasks to complete.
+     */
+    void thread_pool::deinit()
+    {
+        {
+            std::scoped_lock lock(tasks_mutex);
+            is_shutting_down = true;
+            tasks = {};
+        }
+        tasks_cv.notify_all();
+
+        for (std::thread &worker : workers)
+        {
+            if (worker.joinable())
+                worker.join();
+        }
+        workers.clear();
+    }
+
+    void thread_pool::worker_loop()
+    {
+        util::mask_signal();
+
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock lock(tasks_mutex);
+                tasks_cv.wait(lock, [this]
+                              { return is_shutting_down || !tasks.empty(); });
+                if (is_shutting_down)
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+} // namespace util
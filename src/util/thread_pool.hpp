@@ -0,0 +1,33 @@
+#ifndef _SA_UTIL_THREAD_POOL_
+#define _SA_UTIL_THREAD_POOL_
+
+#include "../pchheader.hpp"
+
+namespace util
+{
+    /**
+     * Fixed size pool of worker threads executing tasks from a bounded queue.
+     */
+    class thread_pool
+    {
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks; // Tasks waiting for a free worker.
+        std::mutex tasks_mutex;
+        std::condition_variable tasks_cv;
+        size_t max_pending_tasks = 0;
+        bool is_shutting_down = false;
+
+        void worker_loop();
+
+    public:
+        int init(const size_t worker_count, const size_t max_pending);
+
+        int submit(std::function<void()> task);
+
+        void deinit();
+    };
+
+} // namespace util
+
+#endif
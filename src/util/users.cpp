@@ -0,0 +1,41 @@
+#include "../pchheader.hpp"
+#include "util.hpp"
+
+namespace util
+{
+    /**
+     * Construct the user contract directory path when username is given.
+     * @param username Username of the user.
+     * @return Contract directory path.
+     */
+    const std::string get_user_contract_dir(const std::string &username, std::string_view container_name)
+    {
+        return "/home/" + username + "/" + container_name.data();
+    }
+
+    /**
+     * Get system user info by given user name.
+     * @param username Username of the user.
+     * @param user_info User info struct to be populated.
+     * @return -1 of error, 0 on success.
+     */
+    int get_system_user_info(std::string_view username, user_info &user_info)
+    {
+        struct passwd pwd, *result = NULL;
+        char buf[1024];
+        const int ret = getpwnam_r(std::string(username).c_str(), &pwd, buf, sizeof(buf), &result);
+
+        if (ret != 0 || result == NULL)
+        {
+            LOG_ERROR << ret << ": Error in getpwnam_r " << username;
+            return -1;
+        }
+
+        user_info.username = username;
+        user_info.user_id = pwd.pw_uid;
+        user_info.group_id = pwd.pw_gid;
+        user_info.home_dir = pwd.pw_dir;
+        return 0;
+    }
+
+} // namespace util
@@ -1,9 +1,10 @@
 #include "../pchheader.hpp"
 #include "util.hpp"
+#include "process.hpp"
+#include "../metrics.hpp"
 
 namespace util
 {
-    constexpr const char *RUN_SH = "chmod +x %s && sudo bash %s %s"; // Enable execute permission before running in case bash script does not have the permission.
 
     const std::string to_hex(const std::string_view bin)
     {
@@ -195,6 +196,194 @@ namespace util
             1, FTW_DEPTH | FTW_PHYS);
     }
 
+    /**
+     * Creates a copy of a directory tree in one pass, with every entry owned by the given user and having the given mode.
+     * File contents are reflinked where the filesystem supports it so the data is shared until modified.
+     * @param source Directory to copy.
+     * @param destination Directory to create. Must not exist.
+     * @param uid Owner user of the copy.
+     * @param gid Owner group of the copy.
+     * @param mode Mode of the copied directories and files.
+     * @param skip Paths relative to the source which are not copied.
+     * @return 0 on success and -1 on error.
+     */
+    int clone_tree(std::string_view source, std::string_view destination, const uid_t uid, const gid_t gid, const mode_t mode, const std::unordered_set<std::string> &skip)
+    {
+        const int source_fd = open(source.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (source_fd == -1)
+        {
+            LOG_ERROR << errno << ": Error opening directory " << source;
+            return -1;
+        }
+
+        int destination_fd = -1;
+        if (mkdir(destination.data(), mode) == -1 ||
+            (destination_fd = open(destination.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+            fchown(destination_fd, uid, gid) == -1 || fchmod(destination_fd, mode) == -1)
+        {
+            LOG_ERROR << errno << ": Error creating directory " << destination;
+            if (destination_fd != -1)
+                close(destination_fd);
+            close(source_fd);
+            return -1;
+        }
+
+        const int ret = clone_dir(source_fd, destination_fd, "", uid, gid, mode, skip);
+        close(destination_fd);
+        close(source_fd);
+        return ret;
+    }
+
+    /**
+     * Copies the entries of a directory into another directory, recursing into the sub directories.
+     * @param source_fd Fd of the directory to copy. Ownership is kept by the caller.
+     * @param destination_fd Fd of the directory to copy into.
+     * @param relative_path Path of the directory relative to the tree root, to match the skipped paths.
+     * @param uid Owner user of the copy.
+     * @param gid Owner group of the copy.
+     * @param mode Mode of the copied directories and files.
+     * @param skip Paths relative to the tree root which are not copied.
+     * @return 0 on success and -1 on error.
+     */
+    int clone_dir(const int source_fd, const int destination_fd, std::string_view relative_path, const uid_t uid, const gid_t gid, const mode_t mode, const std::unordered_set<std::string> &skip)
+    {
+        // The directory stream takes over the fd, so it is given a duplicate.
+        const int dir_fd = fcntl(source_fd, F_DUPFD_CLOEXEC, 0);
+        DIR *dir = dir_fd == -1 ? NULL : fdopendir(dir_fd);
+        if (dir == NULL)
+        {
+            LOG_ERROR << errno << ": Error reading directory " << relative_path;
+            if (dir_fd != -1)
+                close(dir_fd);
+            return -1;
+        }
+
+        int ret = 0;
+        dirent *entry;
+        while (ret == 0 && (entry = readdir(dir)) != NULL)
+        {
+            const std::string_view name(entry->d_name);
+            if (name == "." || name == "..")
+                continue;
+
+            const std::string path = relative_path.empty() ? std::string(name) : std::string(relative_path) + "/" + entry->d_name;
+            if (skip.count(path) != 0)
+                continue;
+
+            struct stat st;
+            if (fstatat(source_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+            {
+                LOG_ERROR << errno << ": Error reading " << path;
+                ret = -1;
+                break;
+            }
+
+            if (S_ISDIR(st.st_mode))
+            {
+                int src_fd = -1, dst_fd = -1;
+                if ((src_fd = openat(source_fd, entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+                    mkdirat(destination_fd, entry->d_name, mode) == -1 ||
+                    (dst_fd = openat(destination_fd, entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+                    fchown(dst_fd, uid, gid) == -1 || fchmod(dst_fd, mode) == -1)
+                {
+                    LOG_ERROR << errno << ": Error creating directory " << path;
+                    ret = -1;
+                }
+                else
+                {
+                    ret = clone_dir(src_fd, dst_fd, path, uid, gid, mode, skip);
+                }
+
+                if (src_fd != -1)
+                    close(src_fd);
+                if (dst_fd != -1)
+                    close(dst_fd);
+            }
+            else if (S_ISLNK(st.st_mode))
+            {
+                char target[PATH_MAX];
+                const ssize_t len = readlinkat(source_fd, entry->d_name, target, sizeof(target) - 1);
+                if (len == -1 || (target[len] = '\0', symlinkat(target, destination_fd, entry->d_name)) == -1 ||
+                    fchownat(destination_fd, entry->d_name, uid, gid, AT_SYMLINK_NOFOLLOW) == -1)
+                {
+                    LOG_ERROR << errno << ": Error copying link " << path;
+                    ret = -1;
+                }
+            }
+            else if (S_ISREG(st.st_mode))
+            {
+                int src_fd = -1, dst_fd = -1;
+                if ((src_fd = openat(source_fd, entry->d_name, O_RDONLY | O_CLOEXEC)) == -1 ||
+                    (dst_fd = openat(destination_fd, entry->d_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode)) == -1 ||
+                    clone_file(src_fd, dst_fd) == -1 ||
+                    fchown(dst_fd, uid, gid) == -1 || fchmod(dst_fd, mode) == -1)
+                {
+                    LOG_ERROR << errno << ": Error copying file " << path;
+                    ret = -1;
+                }
+
+                if (src_fd != -1)
+                    close(src_fd);
+                if (dst_fd != -1)
+                    close(dst_fd);
+            }
+        }
+
+        closedir(dir);
+        return ret;
+    }
+
+    /**
+     * Copies the contents of a file. The data is reflinked if the filesystem supports it, otherwise copied in kernel.
+     * @param source_fd Fd of the file to copy.
+     * @param destination_fd Fd of the empty file to copy into.
+     * @return 0 on success and -1 on error.
+     */
+    int clone_file(const int source_fd, const int destination_fd)
+    {
+        if (ioctl(destination_fd, FICLONE, source_fd) == 0)
+            return 0;
+
+        // Filesystems without reflinks, or source and destination on different filesystems.
+        while (true)
+        {
+            const ssize_t ret = copy_file_range(source_fd, NULL, destination_fd, NULL, SSIZE_MAX, 0);
+            if (ret == 0)
+                return 0;
+            if (ret > 0 || errno == EINTR)
+                continue;
+            if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+                return -1;
+            break;
+        }
+
+        // Kernels which can't copy across filesystems in kernel.
+        char buf[65536];
+        while (true)
+        {
+            const ssize_t len = read(source_fd, buf, sizeof(buf));
+            if (len == 0)
+                return 0;
+            if (len == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+
+            ssize_t written = 0;
+            while (written < len)
+            {
+                const ssize_t ret = write(destination_fd, buf + written, len - written);
+                if (ret == -1 && errno == EINTR)
+                    continue;
+                if (ret == -1)
+                    return -1;
+                written += ret;
+            }
+        }
+    }
+
     // Kill a process with a signal and if specified, wait until it stops running.
     int kill_process(const pid_t pid, const bool wait, const int signal)
     {
@@ -301,39 +490,6 @@ namespace util
         return 0;
     }
 
-    /**
-     * Construct the user contract directory path when username is given.
-     * @param username Username of the user.
-     * @return Contract directory path.
-     */
-    const std::string get_user_contract_dir(const std::string &username, std::string_view container_name)
-    {
-        return "/home/" + username + "/" + container_name.data();
-    }
-
-    /**
-     * Get system user info by given user name.
-     * @param username Username of the user.
-     * @param user_info User info struct to be populated.
-     * @return -1 of error, 0 on success.
-     */
-    int get_system_user_info(std::string_view username, user_info &user_info)
-    {
-        const struct passwd *pwd = getpwnam(username.data());
-
-        if (pwd == NULL)
-        {
-            LOG_ERROR << errno << ": Error in getpwnam " << username;
-            return -1;
-        }
-
-        user_info.username = username;
-        user_info.user_id = pwd->pw_uid;
-        user_info.group_id = pwd->pw_gid;
-        user_info.home_dir = pwd->pw_dir;
-        return 0;
-    }
-
     /**
      * Find and replace given substring inside a string.
      * @param str String to be modified.
@@ -359,7 +515,25 @@ namespace util
     int write_json_file(const int fd, const jsoncons::ojson &d)
     {
         std::string json;
-        // Convert json object to a string.
+        if (serialize_json(d, json) == -1)
+            return -1;
+
+        if (ftruncate(fd, 0) == -1 || write(fd, json.data(), json.size()) == -1)
+        {
+            LOG_ERROR << "Writing modified hp config file failed. ";
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Converts the given json doc to a pretty printed string.
+     * @param d A valid JSON document.
+     * @param json String to be populated.
+     * @return 0 on success. -1 on failure.
+     */
+    int serialize_json(const jsoncons::ojson &d, std::string &json)
+    {
         try
         {
             jsoncons::json_options options;
@@ -368,19 +542,12 @@ namespace util
             std::ostringstream os;
             os << jsoncons::pretty_print(d, options);
             json = os.str();
-            os.clear();
         }
         catch (const std::exception &e)
         {
             LOG_ERROR << "Converting modified hp config json to string failed. ";
             return -1;
         }
-
-        if (ftruncate(fd, 0) == -1 || write(fd, json.data(), json.size()) == -1)
-        {
-            LOG_ERROR << "Writing modified hp config file failed. ";
-            return -1;
-        }
         return 0;
     }
 
@@ -418,52 +585,37 @@ namespace util
      * @param file_name Name of the bash script.
      * @param output_params Final output of the bash script.
      * @param input_params Input parameters to the bash script (Optional).
+     * @param timeout_secs Max time to wait for the script.
+     * @return 0 on success and -1 on error.
      */
-    int execute_bash_file(std::string_view file_name, std::vector<std::string> &output_params, const std::vector<std::string_view> &input_params)
+    int execute_bash_file(std::string_view file_name, std::vector<std::string> &output_params, const std::vector<std::string> &input_params, const int timeout_secs)
     {
-        std::string params = "";
-        for (auto itr = input_params.begin(); itr != input_params.end(); itr++)
+        metrics::scoped_timer timer("script." + std::string(file_name.substr(file_name.find_last_of('/') + 1)));
+        std::vector<std::string> argv{"sudo", "bash", std::string(file_name)};
+        for (const std::string &param : input_params)
         {
-            // Empty params are appended as '-' to preserve param order.
-            params.append(itr->empty() ? "-" : *itr);
-
-            if (std::next(itr) != input_params.end())
-                params.append(" ");
+            // Empty params are passed as '-' to preserve param order.
+            argv.emplace_back(param.empty() ? "-" : param);
         }
-        const int len = 23 + (file_name.length() * 2) + params.length();
-        char command[len];
-        sprintf(command, RUN_SH, file_name.data(), file_name.data(), params.empty() ? "\0" : params.data());
 
-        FILE *fpipe = popen(command, "r");
-        if (fpipe == NULL)
-        {
-            LOG_ERROR << "Error on popen for command " << std::string(command);
+        process_result result;
+        if (run_process(argv, result, timeout_secs) == -1)
             return -1;
-        }
 
-        char buffer[200];
-        std::string output;
+        // Only take the last output line. It contains the output of the execution.
+        std::string_view output(result.output);
+        while (!output.empty() && output.back() == '\n')
+            output.remove_suffix(1);
+        const size_t line_start = output.find_last_of('\n');
+        if (line_start != std::string_view::npos)
+            output.remove_prefix(line_start + 1);
 
-        // Only take the last cout string It contains the output of the execution.
-        while (fgets(buffer, sizeof(buffer), fpipe) != NULL)
-        {
-            output = buffer;
-            // Replace ending new line character at the end of the log line.
-            if (!output.empty())
-            {
-                if (output.back() == '\n')
-                    output.pop_back();
-                LOG_INFO << output;
-            }
-        }
-
-        pclose(fpipe);
         util::split_string(output_params, output, ",");
         return 0;
     }
 
     /**
-     * Execute bash command and take the output.
+     * Execute bash command and take the first line of the output.
      * @param command Command to execute.
      * @param output Pointer to populate output.
      * @param output_len Length of the output.
@@ -471,26 +623,22 @@ namespace util
      */
     int execute_bash_cmd(const char *command, char *output, const int output_len)
     {
-        FILE *fpipe = popen(command, "r");
-
-        if (!fpipe)
-        {
-            LOG_ERROR << "Error on popen for command " << std::string(command);
-            return -1;
-        }
-
-        if (!fgets(output, output_len, fpipe))
-        {
-            LOG_ERROR << "Error on fgets for command " << std::string(command);
+        process_result result;
+        if (run_process({"/bin/sh", "-c", command}, result) == -1)
             return -1;
-        }
 
-        if (pclose(fpipe) < 0)
+        if (result.output.empty())
         {
-            LOG_ERROR << "Error on pclose for command " << std::string(command);
+            LOG_ERROR << "No output for command " << std::string(command);
             return -1;
         }
 
+        // Keep the line end as fgets would.
+        const size_t line_end = result.output.find('\n');
+        const size_t line_len = line_end == std::string::npos ? result.output.size() : line_end + 1;
+        const size_t len = std::min(line_len, (size_t)output_len - 1);
+        memcpy(output, result.output.data(), len);
+        output[len] = '\0';
         return 0;
     }
 
@@ -9,6 +9,7 @@
 namespace util
 {
     constexpr const mode_t DIR_PERMS = 0755;
+    constexpr int SCRIPT_TIMEOUT_SECS = 1800; // Max time a bash script is allowed to run.
     struct user_info
     {
         std::string username;
@@ -41,6 +42,12 @@ namespace util
 
     int remove_directory_recursively(std::string_view dir_path);
 
+    int clone_tree(std::string_view source, std::string_view destination, const uid_t uid, const gid_t gid, const mode_t mode, const std::unordered_set<std::string> &skip = {});
+
+    int clone_dir(const int source_fd, const int destination_fd, std::string_view relative_path, const uid_t uid, const gid_t gid, const mode_t mode, const std::unordered_set<std::string> &skip);
+
+    int clone_file(const int source_fd, const int destination_fd);
+
     int kill_process(const pid_t pid, const bool wait, const int signal = SIGINT);
 
     void split_string(std::vector<std::string> &collection, std::string_view str, std::string_view delimeter);
@@ -51,6 +58,7 @@ namespace util
 
     int stoull(const std::string &str, uint64_t &result);
 
+    // Instance user lookups are defined in users.cpp, which the mock backend build replaces.
     const std::string get_user_contract_dir(const std::string &username, std::string_view container_name);
 
     int get_system_user_info(std::string_view username, user_info &user_info);
@@ -59,9 +67,11 @@ namespace util
 
     int write_json_file(const int fd, const jsoncons::ojson &d);
 
+    int serialize_json(const jsoncons::ojson &d, std::string &json);
+
     int read_json_file(const int fd, jsoncons::ojson &d);
 
-    int execute_bash_file(std::string_view file_name, std::vector<std::string> &output_params, const std::vector<std::string_view> &input_params = {});
+    int execute_bash_file(std::string_view file_name, std::vector<std::string> &output_params, const std::vector<std::string> &input_params = {}, const int timeout_secs = SCRIPT_TIMEOUT_SECS);
 
     int execute_bash_cmd(const char *command, char *output, const int output_len);
 
@@ -0,0 +1,258 @@
+/**
+    Mock backend of the benchmark agent build (sagent_mock).
+    Replaces the docker client, the systemd client, the user provisioning and the child processes, so creating and destroying
+    instances only exercises the socket, message and database paths of the agent.
+**/
+#include "../../src/pchheader.hpp"
+#include "../../src/conf.hpp"
+#include "../../src/hp_manager.hpp"
+#include "../../src/hp_readiness.hpp"
+#include "../../src/provision.hpp"
+#include "../../src/docker/docker_client.hpp"
+#include "../../src/docker/docker_events.hpp"
+#include "../../src/docker/image_cache.hpp"
+#include "../../src/systemd/systemd_client.hpp"
+#include "../../src/util/util.hpp"
+#include "../../src/util/process.hpp"
+
+namespace mock
+{
+    constexpr const char *HOME_DIR = "mock-home"; // Home directories of the mock users, relative to the data dir.
+    constexpr const char *INSTALL_SCRIPT = "user-install.sh";
+    constexpr const char *UNINSTALL_SCRIPT = "user-uninstall.sh";
+    constexpr size_t INSTALL_USERNAME_ARG = 18; // Argument positions after "sudo bash <script>".
+    constexpr size_t UNINSTALL_USERNAME_ARG = 3;
+
+    // Container statuses keyed by container name. All the mock users share the agent uid, so names are the keys.
+    std::unordered_map<std::string, std::string> containers;
+    std::mutex containers_mutex;
+
+    const std::string get_home_dir(std::string_view username)
+    {
+        return conf::ctx.data_dir + "/" + HOME_DIR + "/" + std::string(username);
+    }
+
+    /**
+     * Simulates the user install script. A mock user is a home directory, so it survives agent restarts.
+     * @param argv Script command line.
+     * @param output Script output to be populated.
+     */
+    void install_user(const std::vector<std::string> &argv, std::string &output)
+    {
+        static std::atomic<uint32_t> user_seq{0};
+        std::string username = argv.size() > INSTALL_USERNAME_ARG ? argv[INSTALL_USERNAME_ARG] : "-";
+        if (username == "-")
+            username = "sashimock" + std::to_string(getpid()) + "x" + std::to_string(user_seq++);
+
+        const std::string home_dir = get_home_dir(username);
+        if (util::create_dir_tree_recursive(home_dir) == -1)
+        {
+            output = "mock_home_error,INST_ERR\n";
+            return;
+        }
+        output = std::to_string(getuid()) + "," + username + ",INST_SUC\n";
+    }
+
+    /**
+     * Simulates the user uninstall script.
+     * @param argv Script command line.
+     * @param output Script output to be populated.
+     */
+    void uninstall_user(const std::vector<std::string> &argv, std::string &output)
+    {
+        if (argv.size() > UNINSTALL_USERNAME_ARG)
+            util::remove_directory_recursively(get_home_dir(argv[UNINSTALL_USERNAME_ARG]));
+        output = "UNINST_SUC\n";
+    }
+
+    int set_status(std::string_view name, std::string_view status, const bool must_exist)
+    {
+        std::scoped_lock lock(containers_mutex);
+        const auto itr = containers.find(std::string(name));
+        if (itr == containers.end())
+        {
+            if (must_exist)
+                return -1;
+            containers.emplace(name, status);
+            return 0;
+        }
+        itr->second = status;
+        return 0;
+    }
+} // namespace mock
+
+namespace util
+{
+    int run_process(const std::vector<std::string> &argv, process_result &result, const int timeout_secs)
+    {
+        result.exit_code = 0;
+        result.output.clear();
+
+        const std::string_view script = argv.size() > 2 ? std::string_view(argv[2]) : std::string_view();
+        if (script.size() >= strlen(mock::INSTALL_SCRIPT) && script.substr(script.size() - strlen(mock::INSTALL_SCRIPT)) == mock::INSTALL_SCRIPT)
+            mock::install_user(argv, result.output);
+        else if (script.size() >= strlen(mock::UNINSTALL_SCRIPT) && script.substr(script.size() - strlen(mock::UNINSTALL_SCRIPT)) == mock::UNINSTALL_SCRIPT)
+            mock::uninstall_user(argv, result.output);
+        return 0;
+    }
+
+    int run_process(const std::vector<std::string> &argv, const int timeout_secs)
+    {
+        process_result result;
+        return run_process(argv, result, timeout_secs);
+    }
+
+    const std::string get_user_contract_dir(const std::string &username, std::string_view container_name)
+    {
+        return mock::get_home_dir(username) + "/" + std::string(container_name);
+    }
+
+    int get_system_user_info(std::string_view username, user_info &user_info)
+    {
+        const std::string home_dir = mock::get_home_dir(username);
+        if (!is_dir_exists(home_dir))
+            return -1;
+
+        user_info.username = username;
+        user_info.user_id = getuid();
+        user_info.group_id = getgid();
+        user_info.home_dir = home_dir;
+        return 0;
+    }
+} // namespace util
+
+namespace hp
+{
+    bool system_ready()
+    {
+        return true;
+    }
+} // namespace hp
+
+namespace provision
+{
+    int init()
+    {
+        return 0;
+    }
+
+    int provision_user(std::string &steps, int &user_id, const user_spec &spec, const port_spec &ports, const bool create_user, const bool open_ports)
+    {
+        user_id = getuid();
+        return 0;
+    }
+
+    bool user_exists(const std::string &username)
+    {
+        return util::is_dir_exists(mock::get_home_dir(username));
+    }
+
+    void get_deprovision_steps(std::string &steps)
+    {
+    }
+
+    void deprovision_user(const std::string &username, const int user_id, const port_spec &ports)
+    {
+    }
+
+    int remove_port_rules(const port_spec &ports)
+    {
+        return 0;
+    }
+} // namespace provision
+
+namespace docker
+{
+    void deinit()
+    {
+    }
+
+    int create_container(const int uid, const container_config &config, const int timeout_secs)
+    {
+        return mock::set_status(config.name, "created", false);
+    }
+
+    int pull_image(const int uid, std::string_view image, const int timeout_secs)
+    {
+        return 0;
+    }
+
+    int start_container(const int uid, std::string_view name)
+    {
+        return mock::set_status(name, "running", true);
+    }
+
+    int stop_container(const int uid, std::string_view name)
+    {
+        return mock::set_status(name, "exited", true);
+    }
+
+    int remove_container(const int uid, std::string_view name)
+    {
+        std::scoped_lock lock(mock::containers_mutex);
+        mock::containers.erase(std::string(name));
+        return 0;
+    }
+
+    int get_container_status(const int uid, std::string_view name, std::string &status)
+    {
+        std::scoped_lock lock(mock::containers_mutex);
+        const auto itr = mock::containers.find(std::string(name));
+        if (itr == mock::containers.end())
+            return -1;
+        status = itr->second;
+        return 0;
+    }
+
+    int ping(const int uid)
+    {
+        return 0;
+    }
+
+    void disconnect(const int uid)
+    {
+    }
+
+    int init_events(const std::function<void(const container_event &)> &handler)
+    {
+        return 0;
+    }
+
+    void deinit_events()
+    {
+    }
+
+    int init_image_cache()
+    {
+        return 0;
+    }
+
+    void deinit_image_cache()
+    {
+    }
+
+    void prefetch_images(const int uid, const int timeout_secs)
+    {
+    }
+
+    void watch_events(const int uid)
+    {
+    }
+
+    void unwatch_events(const int uid)
+    {
+    }
+} // namespace docker
+
+namespace systemd
+{
+    int start_units(const int uid, const std::vector<std::string> &units)
+    {
+        return 0;
+    }
+
+    int stop_units(const int uid, const std::vector<std::string> &units)
+    {
+        return 0;
+    }
+} // namespace systemd
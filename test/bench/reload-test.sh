@@ -0,0 +1,52 @@
+#!/bin/bash
+# Config reload test against the mock backend agent.
+# Reloads the config with a zero max_instance_count through both 'sashi reload' and SIGHUP, and checks that the
+# reload is rejected and the agent keeps running with its previous limits.
+
+# Usage (after 'make bench' and 'sagent_mock new'):
+# sudo ./test/bench/reload-test.sh
+# sudo ./test/bench/reload-test.sh ./build
+
+build_dir=$(realpath ${1:-./build})
+cfg="$build_dir/sa.cfg"
+[ ! -f "$cfg" ] && echo "$cfg not found. Run 'sagent_mock new' first." && exit 1
+
+backup=$(mktemp)
+cp "$cfg" "$backup"
+
+"$build_dir/sagent_mock" run "$build_dir" >/dev/null 2>&1 &
+agent_pid=$!
+
+function cleanup() {
+    kill $agent_pid 2>/dev/null && wait $agent_pid 2>/dev/null
+    cp "$backup" "$cfg" && rm "$backup"
+}
+trap cleanup EXIT
+
+function fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# Wait for the agent socket.
+for i in {1..50}; do
+    "$build_dir/sashi" status >/dev/null 2>&1 && break
+    sleep 0.1
+done
+"$build_dir/sashi" status >/dev/null 2>&1 || fail "agent socket did not open"
+
+old_count=$(jq '.system.max_instance_count' "$backup")
+jq '.system.max_instance_count = 0 | .system.warm_pool_size = 0' "$backup" >"$cfg"
+
+"$build_dir/sashi" reload >/dev/null 2>&1 && fail "sashi reload accepted a zero max_instance_count"
+kill -0 $agent_pid 2>/dev/null || fail "agent exited on sashi reload"
+
+kill -HUP $agent_pid
+sleep 0.5
+kill -0 $agent_pid 2>/dev/null || fail "agent exited on SIGHUP"
+
+# The previous limits still apply, so a reload of the original config succeeds.
+cp "$backup" "$cfg"
+"$build_dir/sashi" reload >/dev/null 2>&1 || fail "reload of the original config (max_instance_count $old_count) failed"
+
+echo "PASS"
@@ -0,0 +1,369 @@
+/**
+    Load generator for the Sashimono agent socket.
+    Runs a mix of list, inspect, create and destroy requests over concurrent connections and reports the
+    throughput and the latency percentiles of each request type.
+**/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <CLI/CLI.hpp>
+
+namespace bench
+{
+    constexpr const char *DEFAULT_SOCKET_PATH = "/etc/sashimono/sa.sock";
+    constexpr const char *DEFAULT_MIX = "list=80,inspect=20";
+    constexpr const char *DEFAULT_OWNER = "ed0000000000000000000000000000000000000000000000000000000000000000";
+    constexpr const char *DEFAULT_IMAGE = "evernode/sashimono:hp.latest-ubt.20.04";
+    constexpr size_t HEADER_SIZE = 8;         // Length prefix sent ahead of a message.
+    constexpr size_t MAX_PACKET_SIZE = 65536; // Large messages are sent as several packets of this size.
+
+    constexpr const char *OPERATIONS[]{"list", "inspect", "create", "destroy"};
+
+    enum OPERATION
+    {
+        LIST,
+        INSPECT,
+        CREATE,
+        DESTROY,
+        OPERATION_COUNT
+    };
+
+    struct bench_config
+    {
+        std::string socket_path = DEFAULT_SOCKET_PATH;
+        size_t concurrency = 8;   // Connections sending requests in parallel.
+        size_t request_count = 10000;
+        std::string mix = DEFAULT_MIX;
+        size_t weights[OPERATION_COUNT] = {};
+        std::string owner_pubkey = DEFAULT_OWNER;
+        std::string image = DEFAULT_IMAGE;
+        std::string inspect_name; // Instance inspected when the connection hasn't created any.
+        bool keep_instances = false;
+    };
+
+    // Latencies and errors recorded by a connection. Merged after all the connections finish.
+    struct worker_stats
+    {
+        std::vector<uint64_t> latencies_us[OPERATION_COUNT];
+        size_t errors[OPERATION_COUNT] = {};
+    };
+
+    bench_config cfg;
+    std::atomic<size_t> issued{0}; // Requests taken by the connections so far.
+
+    /**
+     * Parses a request mix given as comma separated type=weight pairs.
+     * @param mix Mix string, e.g. list=80,inspect=15,create=3,destroy=2.
+     * @param weights Weights of the request types to be populated.
+     * @return 0 on success and -1 on error.
+     */
+    int parse_mix(std::string_view mix, size_t (&weights)[OPERATION_COUNT])
+    {
+        size_t total = 0;
+        while (!mix.empty())
+        {
+            const size_t end = std::min(mix.find(','), mix.size());
+            const std::string_view entry = mix.substr(0, end);
+            mix.remove_prefix(std::min(end + 1, mix.size()));
+
+            const size_t sep = entry.find('=');
+            if (sep == std::string_view::npos)
+                return -1;
+
+            const auto op = std::find(std::begin(OPERATIONS), std::end(OPERATIONS), entry.substr(0, sep));
+            if (op == std::end(OPERATIONS))
+                return -1;
+
+            const size_t weight = strtoul(std::string(entry.substr(sep + 1)).c_str(), NULL, 10);
+            weights[op - std::begin(OPERATIONS)] = weight;
+            total += weight;
+        }
+        return total == 0 ? -1 : 0;
+    }
+
+    int connect_socket(std::string_view path)
+    {
+        const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            return -1;
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.data(), sizeof(addr.sun_path) - 1);
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /**
+     * Sends a length prefixed message the same way as the sashi cli.
+     * @return 0 on success and -1 on error.
+     */
+    int send_message(const int fd, std::string_view message)
+    {
+        uint8_t header[HEADER_SIZE] = {};
+        const uint32_t size = message.size();
+        header[0] = size >> 24;
+        header[1] = size >> 16;
+        header[2] = size >> 8;
+        header[3] = size;
+        if (write(fd, header, HEADER_SIZE) != HEADER_SIZE)
+            return -1;
+
+        for (size_t offset = 0; offset < message.size(); offset += MAX_PACKET_SIZE)
+        {
+            const size_t packet_size = std::min(MAX_PACKET_SIZE, message.size() - offset);
+            if (write(fd, message.data() + offset, packet_size) != (ssize_t)packet_size)
+                return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * Reads a length prefixed message.
+     * @return 0 on success and -1 on error.
+     */
+    int read_message(const int fd, std::string &message)
+    {
+        uint8_t header[HEADER_SIZE];
+        if (read(fd, header, HEADER_SIZE) != HEADER_SIZE)
+            return -1;
+
+        const uint32_t size = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | header[3];
+        message.resize(size);
+        size_t received = 0;
+        while (received < size)
+        {
+            const ssize_t res = read(fd, message.data() + received, size - received);
+            if (res <= 0)
+                return -1;
+            received += res;
+        }
+        return 0;
+    }
+
+    /**
+     * Checks whether the response type reports a success. Error types of the agent end with "error".
+     */
+    bool is_success(std::string_view response)
+    {
+        constexpr std::string_view type_key = "\"type\":\"";
+        const size_t start = response.find(type_key);
+        if (start == std::string_view::npos)
+            return false;
+
+        const size_t type_start = start + type_key.size();
+        const size_t type_end = response.find('"', type_start);
+        if (type_end == std::string_view::npos)
+            return false;
+
+        const std::string_view type = response.substr(type_start, type_end - type_start);
+        return type.size() < 5 || type.substr(type.size() - 5) != "error";
+    }
+
+    const std::string generate_contract_id(std::mt19937_64 &rng)
+    {
+        char id[37];
+        const uint64_t high = rng(), low = rng();
+        snprintf(id, sizeof(id), "%08x-%04x-4%03x-%04x-%012llx", (uint32_t)(high >> 32), (uint32_t)(high >> 16) & 0xffff, (uint32_t)high & 0xfff,
+                 (uint32_t)(0x8000 | ((low >> 48) & 0x3fff)), (unsigned long long)(low & 0xffffffffffffULL));
+        return id;
+    }
+
+    /**
+     * Sends the requests of one connection until all the requests are issued.
+     * Destroys target the instances created by the same connection, so the mix keeps the instance count bounded.
+     * @param index Connection index.
+     * @param stats Stats to be populated.
+     */
+    void run_worker(const size_t index, worker_stats &stats)
+    {
+        const int fd = connect_socket(cfg.socket_path);
+        if (fd == -1)
+        {
+            std::cerr << errno << ": Error connecting to " << cfg.socket_path << std::endl;
+            return;
+        }
+
+        std::mt19937_64 rng(index + 1);
+        size_t total_weight = 0;
+        for (const size_t weight : cfg.weights)
+            total_weight += weight;
+
+        std::vector<std::string> created;
+        std::string message, response;
+        size_t seq = 0;
+
+        const auto execute = [&](const OPERATION op, std::string_view name, const bool is_measured = true)
+        {
+            // An id keeps the connection open for the next request.
+            message = "{\"type\":\"";
+            message += OPERATIONS[op];
+            message += "\",\"id\":\"";
+            message += std::to_string(index) + "-" + std::to_string(seq++);
+            message += "\"";
+            if (op == CREATE)
+            {
+                message += ",\"container_name\":\"" + std::string(name) + "\",\"owner_pubkey\":\"" + cfg.owner_pubkey +
+                           "\",\"contract_id\":\"" + generate_contract_id(rng) + "\",\"image\":\"" + cfg.image + "\",\"config\":{}";
+            }
+            else if (op != LIST)
+            {
+                message += ",\"container_name\":\"" + std::string(name) + "\"";
+            }
+            message += "}";
+
+            const auto start = std::chrono::steady_clock::now();
+            const bool is_sent = send_message(fd, message) == 0 && read_message(fd, response) == 0;
+            const uint64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+            const bool success = is_sent && is_success(response);
+            if (is_measured)
+            {
+                stats.latencies_us[op].push_back(latency_us);
+                if (!success)
+                    stats.errors[op]++;
+            }
+            return is_sent ? (success ? 0 : 1) : -1;
+        };
+
+        while (issued.fetch_add(1) < cfg.request_count)
+        {
+            size_t pick = rng() % total_weight;
+            size_t op_index = 0;
+            while (pick >= cfg.weights[op_index])
+                pick -= cfg.weights[op_index++];
+            OPERATION op = (OPERATION)op_index;
+
+            // Fall back to the closest request when there's no instance to target.
+            if (op == DESTROY && created.empty())
+                op = CREATE;
+            if (op == INSPECT && created.empty() && cfg.inspect_name.empty())
+                op = LIST;
+
+            int ret = 0;
+            if (op == CREATE)
+            {
+                const std::string name = "sabench" + std::to_string(getpid()) + "x" + std::to_string(index) + "x" + std::to_string(seq);
+                ret = execute(op, name);
+                if (ret == 0)
+                    created.push_back(name);
+            }
+            else if (op == DESTROY)
+            {
+                ret = execute(op, created.back());
+                created.pop_back();
+            }
+            else if (op == INSPECT)
+            {
+                ret = execute(op, created.empty() ? cfg.inspect_name : created[rng() % created.size()]);
+            }
+            else
+            {
+                ret = execute(op, {});
+            }
+
+            if (ret == -1)
+            {
+                std::cerr << "Connection " << index << " lost." << std::endl;
+                break;
+            }
+        }
+
+        // Cleanup is not measured.
+        if (!cfg.keep_instances)
+        {
+            for (const std::string &name : created)
+                execute(DESTROY, name, false);
+        }
+
+        close(fd);
+    }
+
+    uint64_t percentile(const std::vector<uint64_t> &sorted, const size_t per_mille)
+    {
+        if (sorted.empty())
+            return 0;
+        const size_t rank = (sorted.size() * per_mille + 999) / 1000;
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+
+    /**
+     * Prints the throughput and the latency percentiles of each request type.
+     * @param stats Merged stats of all the connections.
+     * @param elapsed_us Wall time of the run.
+     */
+    void print_report(worker_stats &stats, const uint64_t elapsed_us)
+    {
+        size_t total = 0;
+        printf("%-8s %10s %8s %12s %10s %10s %10s %10s\n", "type", "requests", "errors", "req/s", "p50_us", "p99_us", "p999_us", "max_us");
+        for (size_t op = 0; op < OPERATION_COUNT; op++)
+        {
+            std::vector<uint64_t> &latencies = stats.latencies_us[op];
+            if (latencies.empty())
+                continue;
+
+            std::sort(latencies.begin(), latencies.end());
+            total += latencies.size();
+            printf("%-8s %10zu %8zu %12.1f %10llu %10llu %10llu %10llu\n", OPERATIONS[op], latencies.size(), stats.errors[op],
+                   latencies.size() * 1000000.0 / elapsed_us, (unsigned long long)percentile(latencies, 500), (unsigned long long)percentile(latencies, 990),
+                   (unsigned long long)percentile(latencies, 999), (unsigned long long)latencies.back());
+        }
+        printf("total %zu requests in %.3f s, %.1f req/s over %zu connections\n", total, elapsed_us / 1000000.0, total * 1000000.0 / elapsed_us, cfg.concurrency);
+    }
+
+} // namespace bench
+
+int main(int argc, char **argv)
+{
+    CLI::App app("Sashimono agent load generator.");
+    app.add_option("-s,--socket", bench::cfg.socket_path, "Agent socket path");
+    app.add_option("-c,--concurrency", bench::cfg.concurrency, "Number of concurrent connections");
+    app.add_option("-n,--requests", bench::cfg.request_count, "Total number of requests");
+    app.add_option("-m,--mix", bench::cfg.mix, "Request mix as type=weight pairs of list, inspect, create and destroy");
+    app.add_option("-o,--owner", bench::cfg.owner_pubkey, "Owner public key of the created instances");
+    app.add_option("-i,--image", bench::cfg.image, "Container image of the created instances");
+    app.add_option("--inspect-name", bench::cfg.inspect_name, "Instance to inspect when a connection hasn't created any");
+    app.add_flag("-k,--keep", bench::cfg.keep_instances, "Keep the created instances instead of destroying them at the end");
+    CLI11_PARSE(app, argc, argv);
+
+    if (bench::cfg.concurrency == 0 || bench::parse_mix(bench::cfg.mix, bench::cfg.weights) == -1)
+    {
+        std::cerr << "Invalid concurrency or request mix.\n";
+        return 1;
+    }
+
+    std::vector<bench::worker_stats> stats(bench::cfg.concurrency);
+    std::vector<std::thread> workers;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < bench::cfg.concurrency; i++)
+        workers.emplace_back(bench::run_worker, i, std::ref(stats[i]));
+    for (std::thread &worker : workers)
+        worker.join();
+    const uint64_t elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    bench::worker_stats merged;
+    for (bench::worker_stats &worker : stats)
+    {
+        for (size_t op = 0; op < bench::OPERATION_COUNT; op++)
+        {
+            merged.latencies_us[op].insert(merged.latencies_us[op].end(), worker.latencies_us[op].begin(), worker.latencies_us[op].end());
+            merged.errors[op] += worker.errors[op];
+        }
+    }
+
+    bench::print_report(merged, std::max<uint64_t>(elapsed_us, 1));
+    return 0;
+}